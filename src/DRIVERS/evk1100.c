@@ -27,6 +27,8 @@
 #include "intc.h"
 #include "power_clocks_lib.h"
 
+#include <string.h>
+
 
 
 #define EXAMPLE_USART               (&AVR32_USART1)
@@ -39,11 +41,59 @@
 #define MACB_EXAMPLE_PBA_HZ			24000000
 
 #define MS_TIMER_CHANNEL	0
-#define MAC_STATUS_CHANNEL	1
+
+/*
+ * The MACB works through rings of descriptors in RAM.
+ *
+ * Receive buffers are a fixed 128 bytes, so a frame takes
+ * several.  They sit one after another in rx_buffers, so
+ * unless a frame runs off the end of the ring the stack is
+ * handed it where the MACB put it, and the buffers go back
+ * once the stack returns.
+ *
+ * The UC3A has no data cache, so nothing needs flushing.
+ */
+#define MACB_RX_BUFFER_SIZE		128
+#ifndef MACB_RX_BUFFERS
+#define MACB_RX_BUFFERS			48
+#endif
+
+#ifndef MACB_TX_BUFFERS
+#define MACB_TX_BUFFERS			4
+#endif
+#define MACB_TX_BUFFER_SIZE		1536
+
+/* Receive descriptor */
+#define RX_OWNED				0x00000001		/* Software has it */
+#define RX_WRAP					0x00000002
+#define RX_ADDR_MASK			0xFFFFFFFC
+#define RX_LEN_MASK				0x00000FFF
+#define RX_SOF					0x00004000
+#define RX_EOF					0x00008000
+
+/* Transmit descriptor */
+#define TX_LEN_MASK				0x000007FF
+#define TX_LAST					0x00008000
+#define TX_WRAP					0x40000000
+#define TX_USED					0x80000000		/* Software has it */
+
+/* Gives up waiting for the MACB to send a frame (loops) */
+#define MACB_TX_TIMEOUT			100000
+
+struct macb_desc
+{
+	volatile uint32_t addr;
+	volatile uint32_t status;
+};
 
 /* 'Private' functions */
 __attribute__((__interrupt__)) void tc_irq(void);
-__attribute__((__interrupt__)) void mac_irq(void);
+__attribute__((__interrupt__)) void macb_irq(void);
+static void macb_rings_init(void);
+static bool mac_read_frame(void);
+static bool mac_frame_waiting(void);
+static void rx_release(uint16_t index, uint16_t count);
+static RETURN_STATUS tx_wait(const uint16_t index);
 
 /* 'Private' variables */
 
@@ -57,6 +107,19 @@ static void (*cb_frame_complete)(uint8_t *buffer, const uint16_t buffer_len) = N
 // Timer callback.
 static void(*cb_timer)(void) = NULL;
 
+// Descriptor rings, and the buffers they point to
+static struct macb_desc rx_ring[MACB_RX_BUFFERS] __attribute__((aligned(8)));
+static struct macb_desc tx_ring[MACB_TX_BUFFERS] __attribute__((aligned(8)));
+static uint8_t rx_buffers[MACB_RX_BUFFERS][MACB_RX_BUFFER_SIZE] __attribute__((aligned(4)));
+static uint8_t tx_buffers[MACB_TX_BUFFERS][MACB_TX_BUFFER_SIZE] __attribute__((aligned(4)));
+
+// Next receive descriptor to look at, and next transmit one to use
+static uint16_t rx_tail = 0;
+static uint16_t tx_head = 0;
+
+// For frames that run off the end of the receive ring
+static uint8_t rx_bounce[MACB_TX_BUFFER_SIZE];
+
 /**
  * Timer Counter Interrupt #1
  *
@@ -75,48 +138,202 @@ __attribute__((__interrupt__)) void tc_irq(void)
 }
 
 /**
- * Timer Counter Interrupt #2
+ * MACB Interrupt
  *
- * Checks the MAC for new data, as 
- * the MAC interface we are using doesn't
- * interrupt on received packet, so we
- * emulate it instead.
+ * RCOMP says at least one frame has come in.
+ * Read all of them, not just that one.
+ *
+ * In poll mode (MAC_POLL) it only tells
+ * the stack, which then reads them with
+ * poll_mac.
  */
-__attribute__((__interrupt__)) void mac_irq(void)
+__attribute__((__interrupt__)) void macb_irq(void)
 {
-	// Read bit to clear it
-	tc_read_sr(&AVR32_TC, MAC_STATUS_CHANNEL);
+	// Both clear when read/written back
+	const uint32_t isr = AVR32_MACB.isr;
+	AVR32_MACB.rsr = AVR32_MACB.rsr;
 
-	if(cb_frame_complete == NULL)
+	if(!(isr & AVR32_MACB_ISR_RCOMP_MASK) || cb_frame_complete == NULL)
 	{
 		return;
 	}
 
-	// Test MAC status
-	const unsigned long rx_len = ulMACBInputLength();
-	if(rx_len > 0)
+#ifdef MAC_POLL
+	ether_rx_schedule();
+#else
+	while(mac_read_frame());
+#endif
+}
+
+/**
+ * Set up both rings.  Every receive buffer
+ * belongs to the MACB, and every transmit
+ * one to us.
+ */
+static void macb_rings_init(void)
+{
+	uint16_t i = 0;
+
+	for(i = 0; i < MACB_RX_BUFFERS; i++)
 	{
-		uint8_t rx_buffer[200];
-		vMACBRead(rx_buffer, 200, rx_len);
-	/*	
-		usart_write_line(EXAMPLE_USART, "RX did good (");
-		
-		char temp[10] = {0};
-		int i = 9;
-		unsigned long temp_rx_len = rx_len;
-		do 
+		rx_ring[i].addr = ((uint32_t)rx_buffers[i]) & RX_ADDR_MASK;
+		rx_ring[i].status = 0;
+	}
+	rx_ring[MACB_RX_BUFFERS - 1].addr |= RX_WRAP;
+
+	for(i = 0; i < MACB_TX_BUFFERS; i++)
+	{
+		tx_ring[i].addr = (uint32_t)tx_buffers[i];
+		tx_ring[i].status = TX_USED;
+	}
+	tx_ring[MACB_TX_BUFFERS - 1].status |= TX_WRAP;
+
+	rx_tail = 0;
+	tx_head = 0;
+}
+
+/**
+ * Is there a whole frame waiting?
+ */
+static bool mac_frame_waiting(void)
+{
+	uint16_t index = rx_tail;
+	uint16_t i = 0;
+
+	for(i = 0; i < MACB_RX_BUFFERS; i++)
+	{
+		if(!(rx_ring[index].addr & RX_OWNED))
 		{
-			temp[--i] = (temp_rx_len % 10)+'0';
-			temp_rx_len /= 10;
-		}while(temp_rx_len > 0);
-		
-		usart_write_line(EXAMPLE_USART, &temp[i]);
-		usart_write_line(EXAMPLE_USART, ")\r\n");		
-*/
-		(cb_frame_complete)(rx_buffer, rx_len);
+			return false;
+		}
+		if(rx_ring[index].status & RX_EOF)
+		{
+			return true;
+		}
+		index = (index + 1) % MACB_RX_BUFFERS;
 	}
+
+	return false;
 }
 
+/**
+ * Give count receive buffers, from index,
+ * back to the MACB.
+ */
+static void rx_release(uint16_t index, uint16_t count)
+{
+	while(count-- > 0)
+	{
+		rx_ring[index].addr &= ~RX_OWNED;
+		index = (index + 1) % MACB_RX_BUFFERS;
+	}
+}
+
+/**
+ * Pass the next frame up, if there is one.
+ */
+static bool mac_read_frame(void)
+{
+	// Drop anything left without a start (after running out of buffers)
+	while((rx_ring[rx_tail].addr & RX_OWNED) && !(rx_ring[rx_tail].status & RX_SOF))
+	{
+		rx_release(rx_tail, 1);
+		rx_tail = (rx_tail + 1) % MACB_RX_BUFFERS;
+	}
+
+	if(!mac_frame_waiting())
+	{
+		return false;
+	}
+
+	// Find the end.  A second start means the first frame was cut short.
+	uint16_t start = rx_tail;
+	uint16_t count = 1;
+	uint16_t index = start;
+
+	while(!(rx_ring[index].status & RX_EOF))
+	{
+		index = (index + 1) % MACB_RX_BUFFERS;
+
+		if(rx_ring[index].status & RX_SOF)
+		{
+			rx_release(start, count);
+			rx_tail = index;
+			return true;
+		}
+		count++;
+	}
+
+	const uint16_t rx_len = rx_ring[index].status & RX_LEN_MASK;
+	uint8_t *frame = rx_buffers[start];
+
+	// Only copy if it wrapped round the end of the ring
+	if(start + count > MACB_RX_BUFFERS)
+	{
+		const uint16_t first = (MACB_RX_BUFFERS - start) * MACB_RX_BUFFER_SIZE;
+
+		if(rx_len <= sizeof(rx_bounce))
+		{
+			memcpy(rx_bounce, rx_buffers[start], first);
+			memcpy(&rx_bounce[first], rx_buffers[0], rx_len - first);
+			frame = rx_bounce;
+		}
+		else
+		{
+			frame = NULL;
+		}
+	}
+
+	if(frame != NULL && cb_frame_complete != NULL)
+	{
+		(cb_frame_complete)(frame, rx_len);
+	}
+
+	// The stack is done with it
+	rx_release(start, count);
+	rx_tail = (index + 1) % MACB_RX_BUFFERS;
+
+	return true;
+}
+
+#ifdef MAC_POLL
+/**
+ * Read up to budget frames.
+ */
+uint16_t poll_mac(const uint16_t budget)
+{
+	uint16_t done = 0;
+	while(done < budget && cb_frame_complete != NULL && mac_read_frame())
+	{
+		done++;
+	}
+
+	return done;
+}
+
+/**
+ * Turn RCOMP on or off.  It only fires for
+ * new frames, so if some are already waiting
+ * tell the stack straight away.
+ */
+void mac_rx_irq(const bool enable)
+{
+	if(enable)
+	{
+		AVR32_MACB.ier = AVR32_MACB_IER_RCOMP_MASK;
+
+		if(mac_frame_waiting())
+		{
+			ether_rx_schedule();
+		}
+	}
+	else
+	{
+		AVR32_MACB.idr = AVR32_MACB_IDR_RCOMP_MASK;
+	}
+}
+#endif
+
 
 RETURN_STATUS register_ms_callback(void(*handler)(void))
 {
@@ -178,31 +395,6 @@ RETURN_STATUS init_uc()
 	    .clki     = FALSE,                             // Clock inversion.
 	    .tcclks   = TC_CLOCK_SOURCE_TC2                // Internal source clock 2 - connected to PBA/4
 	  };
-	  static const tc_waveform_opt_t WAVEFORM_OPT_MAC =
-	  {
-	    .channel  = MAC_STATUS_CHANNEL,                        // Channel selection.
-
-	    .bswtrg   = TC_EVT_EFFECT_NOOP,                // Software trigger effect on TIOB.
-	    .beevt    = TC_EVT_EFFECT_NOOP,                // External event effect on TIOB.
-	    .bcpc     = TC_EVT_EFFECT_NOOP,                // RC compare effect on TIOB.
-	    .bcpb     = TC_EVT_EFFECT_NOOP,                // RB compare effect on TIOB.
-
-	    .aswtrg   = TC_EVT_EFFECT_NOOP,                // Software trigger effect on TIOA.
-	    .aeevt    = TC_EVT_EFFECT_NOOP,                // External event effect on TIOA.
-	    .acpc     = TC_EVT_EFFECT_NOOP,                // RC compare effect on TIOA: toggle.
-	    .acpa     = TC_EVT_EFFECT_NOOP,                // RA compare effect on TIOA: toggle (other possibilities are none, set and clear).
-
-	    .wavsel   = TC_WAVEFORM_SEL_UP_MODE_RC_TRIGGER,// Waveform selection: Up mode with automatic trigger(reset) on RC compare.
-	    .enetrg   = FALSE,                             // External event trigger enable.
-	    .eevt     = 0,                                 // External event selection.
-	    .eevtedg  = TC_SEL_NO_EDGE,                    // External event edge selection.
-	    .cpcdis   = FALSE,                             // Counter disable when RC compare.
-	    .cpcstop  = FALSE,                             // Counter clock stopped with RC compare.
-
-	    .burst    = FALSE,                             // Burst signal selection.
-	    .clki     = FALSE,                             // Clock inversion.
-	    .tcclks   = TC_CLOCK_SOURCE_TC2                // Internal source clock 2 - connected to PBA/4
-	  };
 	  static const tc_interrupt_t TC_INTERRUPT =
 	  {
 	    .etrgs = 0,
@@ -249,27 +441,20 @@ RETURN_STATUS init_uc()
 
 	  // Register the RTC interrupt handler to the interrupt controller.
 	  INTC_register_interrupt(&tc_irq, AVR32_TC_IRQ0, AVR32_INTC_INT0);
-	  INTC_register_interrupt(&mac_irq, AVR32_TC_IRQ1, AVR32_INTC_INT0);
 
 	  Enable_global_interrupt();
 
 	  // Initialize the timer/counters.
 	  tc_init_waveform(tc, &WAVEFORM_OPT_MS);
-	  tc_init_waveform(tc, &WAVEFORM_OPT_MAC);
 
 	  // Set the compare triggers to count ms.
 	  // We want: (1/(FPBA/4)) * RC = 1000 Hz => RC = (FPBA/4) / 1000 = 3000 to get an interrupt every 1ms
 	  tc_write_rc(tc, MS_TIMER_CHANNEL, (MACB_EXAMPLE_PBA_HZ/4)/1000);  // Set RC value.
-	  
-	  // Can afford to check the mac a little slower
-	  tc_write_rc(tc, MAC_STATUS_CHANNEL, (MACB_EXAMPLE_PBA_HZ/4)/500);
 
 	  tc_configure_interrupts(tc, MS_TIMER_CHANNEL, &TC_INTERRUPT);
-	  tc_configure_interrupts(tc, MAC_STATUS_CHANNEL, &TC_INTERRUPT);
 
 	  // Start the timer/counter.
 	  tc_start(tc, MS_TIMER_CHANNEL);                    // And start the timer/counter.
-	  tc_start(tc, MAC_STATUS_CHANNEL);
 
 //	LED_On(LED0);
 
@@ -312,29 +497,161 @@ RETURN_STATUS init_mac()
   // Assign GPIO to MACB
   gpio_enable_module(MACB_GPIO_MAP, sizeof(MACB_GPIO_MAP) / sizeof(MACB_GPIO_MAP[0]));
 		
-	if (xMACBInit(&AVR32_MACB))
+	// Let the framework do the clocks, address and PHY
+	if (!xMACBInit(&AVR32_MACB))
 	{
-		bMACInitialised = true;
-		return SUCCESS;
+		bMACInitialised = false;
+		return FAILURE;
 	}
-	
-	bMACInitialised = false;
-	return FAILURE;		
+
+	// Then take it back, and use our own rings
+	volatile avr32_macb_t *macb = &AVR32_MACB;
+
+	macb->ncr &= ~(AVR32_MACB_NCR_RE_MASK | AVR32_MACB_NCR_TE_MASK);
+	macb->idr = 0xFFFFFFFF;
+
+	macb_rings_init();
+	macb->rbqp = (uint32_t)rx_ring;
+	macb->tbqp = (uint32_t)tx_ring;
+
+	// Full size (1536 byte) frames
+	macb->ncfgr |= AVR32_MACB_NCFGR_BIG_MASK;
+
+	macb->rsr = macb->rsr;
+	macb->tsr = macb->tsr;
+	(void)macb->isr;
+
+	Disable_global_interrupt();
+	INTC_register_interrupt(&macb_irq, AVR32_MACB_IRQ, AVR32_INTC_INT1);
+	Enable_global_interrupt();
+
+	macb->ncr |= AVR32_MACB_NCR_RE_MASK | AVR32_MACB_NCR_TE_MASK;
+	macb->ier = AVR32_MACB_IER_RCOMP_MASK;
+
+	bMACInitialised = true;
+	return SUCCESS;
+}
+
+
+uint8_t get_mac_offload(void)
+{
+	// The MACB doesn't do checksums
+	return MAC_OFFLOAD_NONE;
+}
+
+
+/**
+ * Wait for the MACB to hand a transmit
+ * descriptor back.
+ */
+static RETURN_STATUS tx_wait(const uint16_t index)
+{
+	uint32_t timeout = MACB_TX_TIMEOUT;
+
+	while(!(tx_ring[index].status & TX_USED))
+	{
+		if(--timeout == 0)
+		{
+			return TIMEOUT;
+		}
+	}
+
+	return SUCCESS;
 }
 
 
+/**
+ * Copy into the next transmit buffer and
+ * start it.  Returns without waiting, so
+ * the next frame can be built while this
+ * one goes.
+ */
 RETURN_STATUS send_frame(const uint8_t *buffer, const uint16_t buffer_len)
 {
-	usart_write_line(EXAMPLE_USART, "Sending Packet\r\n");
-	
-	lMACBSend(&AVR32_MACB, buffer, buffer_len, TRUE);
+	// The MACB adds the FCS
+	const uint16_t frame_len = buffer_len - ETH_CRCLEN;
+
+	if(buffer_len < ETH_CRCLEN || frame_len > MACB_TX_BUFFER_SIZE)
+	{
+		return FAILURE;
+	}
+
+	// Ring full
+	if(tx_wait(tx_head) != SUCCESS)
+	{
+		return TIMEOUT;
+	}
+
+	memcpy(tx_buffers[tx_head], buffer, frame_len);
+	tx_ring[tx_head].addr = (uint32_t)tx_buffers[tx_head];
+	tx_ring[tx_head].status = (frame_len & TX_LEN_MASK) | TX_LAST
+		| (tx_ring[tx_head].status & TX_WRAP);
+
+	tx_head = (tx_head + 1) % MACB_TX_BUFFERS;
+
+	AVR32_MACB.ncr |= AVR32_MACB_NCR_TSTART_MASK;
 	return SUCCESS;
 }
 
 
+#ifdef MAC_GATHER
+/**
+ * Send header and payload as one frame
+ * without copying either.  The MACB reads
+ * them from where they are, so this waits
+ * until it has.
+ */
+RETURN_STATUS send_frame_gather(const uint8_t *header, const uint16_t header_len, const uint8_t *payload, const uint16_t payload_len)
+{
+	const uint16_t first = tx_head;
+	const uint16_t second = (tx_head + 1) % MACB_TX_BUFFERS;
+
+	if(header_len + payload_len > MACB_TX_BUFFER_SIZE)
+	{
+		return FAILURE;
+	}
+
+	if(tx_wait(first) != SUCCESS || tx_wait(second) != SUCCESS)
+	{
+		return TIMEOUT;
+	}
+
+	// Second first, so the MACB never finds half a frame
+	tx_ring[second].addr = (uint32_t)payload;
+	tx_ring[second].status = (payload_len & TX_LEN_MASK) | TX_LAST
+		| (tx_ring[second].status & TX_WRAP);
+
+	tx_ring[first].addr = (uint32_t)header;
+	tx_ring[first].status = (header_len & TX_LEN_MASK)
+		| (tx_ring[first].status & TX_WRAP);
+
+	tx_head = (second + 1) % MACB_TX_BUFFERS;
+
+	AVR32_MACB.ncr |= AVR32_MACB_NCR_TSTART_MASK;
+
+	// Only the first gets marked used when it has gone
+	RETURN_STATUS status = tx_wait(first);
+
+	tx_ring[first].addr = (uint32_t)tx_buffers[first];
+	tx_ring[second].addr = (uint32_t)tx_buffers[second];
+	tx_ring[second].status |= TX_USED;
+
+	return status;
+}
+#endif
+
+
 
 RETURN_STATUS set_frame_complete(void (*frame_complete_callback)(uint8_t *buffer, const uint16_t buffer_len))
 {
 	cb_frame_complete = frame_complete_callback;
 	return SUCCESS;
 }
+
+#ifdef MAC_RX_VECTOR
+/* No batches, every frame goes to frame_complete */
+RETURN_STATUS set_frames_complete(void (*frames_complete_callback)(struct mac_frame *frames, const uint16_t count))
+{
+	return FAILURE;
+}
+#endif
@@ -0,0 +1,274 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: linux_hugepage.c
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Huge page, NUMA local packet memory (see
+ *				 linux_hugepage.h).
+ *
+ *				 1 GB pages are tried for anything that big,
+ *				 then 2 MB pages, then ordinary pages with a
+ *				 hint to the kernel to make them huge when it
+ *				 can (transparent huge pages).  Reserved huge
+ *				 pages have to be set up first, eg:
+ *				   echo 512 > /proc/sys/vm/nr_hugepages
+ *
+ *				 The memory is bound to the NIC's node before
+ *				 it is touched, so it is allocated there.
+ *				 No libnuma is needed, mbind is called
+ *				 directly.
+ *
+ *				 Options (define at compile time):
+ *				  HUGEPAGE_NO_1G	Never try 1 GB pages
+ *
+ *  History
+ *	DB/19 Oct 2026	hugepage_free unmaps whole pages
+ *	DB/19 Oct 2026	Started
+ ****************************************************************************/
+
+#include "linux_hugepage.h"
+#include "../pool.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB			0x40000
+#endif
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT		26
+#endif
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE		14
+#endif
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED		1
+#endif
+
+
+/* Page sizes to try, as log2 */
+#define HUGEPAGE_1G_BITS	30
+#define HUGEPAGE_2M_BITS	21
+
+/* Most NUMA nodes mbind is told about */
+#define HUGEPAGE_MAX_NODES	64
+
+
+/* 'Private' functions */
+static void *hugepage_map(const size_t len, const int page_bits);
+static size_t hugepage_round(const size_t len, const size_t page_size);
+
+
+/****************************************************
+ *    Function: hugepage_alloc
+ * Description: Get memory for packets, on the same
+ * 				NUMA node as the NIC, in the biggest
+ * 				pages the system will give us.
+ *
+ *	Input:
+ *		len			Bytes needed
+ *		ifname		NIC it is for, or NULL for any node
+ *		page_size	Set to the page size used (can
+ *					be NULL)
+ *
+ *	Return:
+ * 		The memory (page aligned, zeroed)
+ * 		NULL		Out of memory
+ ***************************************************/
+void *hugepage_alloc(const size_t len, const char *ifname, size_t *page_size)
+{
+	if(len == 0)
+		return NULL;
+
+	size_t used = (size_t)1 << HUGEPAGE_2M_BITS;
+	void *mem = NULL;
+
+#ifndef HUGEPAGE_NO_1G
+	/* Only worth it if it fills most of a page */
+	if(len >= ((size_t)1 << HUGEPAGE_1G_BITS) / 2)
+	{
+		mem = hugepage_map(len, HUGEPAGE_1G_BITS);
+		used = (size_t)1 << HUGEPAGE_1G_BITS;
+	}
+#endif
+
+	if(mem == NULL)
+	{
+		mem = hugepage_map(len, HUGEPAGE_2M_BITS);
+		used = (size_t)1 << HUGEPAGE_2M_BITS;
+	}
+
+	if(mem == NULL)
+	{
+		/* No reserved huge pages, ask for transparent ones */
+		used = (size_t)sysconf(_SC_PAGESIZE);
+		mem = mmap(NULL, hugepage_round(len, used), PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(mem == MAP_FAILED)
+			return NULL;
+
+		madvise(mem, hugepage_round(len, used), MADV_HUGEPAGE);
+	}
+
+	/* Before anything is touched, so pages come from the right node */
+	int node = (ifname != NULL) ? get_nic_numa_node(ifname) : -1;
+	if(node >= 0 && node < HUGEPAGE_MAX_NODES)
+	{
+		unsigned long nodemask = 1UL << node;
+		syscall(SYS_mbind, mem, hugepage_round(len, used), MPOL_PREFERRED,
+				&nodemask, (unsigned long)HUGEPAGE_MAX_NODES, 0);
+	}
+
+	/* Fault it all in now rather than on the first frames */
+	size_t offset = 0;
+	for(offset = 0; offset < len; offset += used)
+	{
+		((volatile uint8_t *)mem)[offset] = 0;
+	}
+
+	if(page_size != NULL)
+		*page_size = used;
+
+	return mem;
+}
+
+
+/****************************************************
+ *    Function: hugepage_free
+ * Description: Give back memory from hugepage_alloc.
+ *
+ *	Input:
+ *		mem			From hugepage_alloc
+ *		len			Length asked for
+ *		page_size	Page size hugepage_alloc used
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		Not unmapped
+ ***************************************************/
+RETURN_STATUS hugepage_free(void *mem, const size_t len, const size_t page_size)
+{
+	if(mem == NULL)
+		return SUCCESS;
+
+	/* A huge page mapping only unmaps in whole pages */
+	if(page_size == 0 || munmap(mem, hugepage_round(len, page_size)) != 0)
+		return FAILURE;
+
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: get_nic_numa_node
+ * Description: Find which NUMA node a NIC hangs off.
+ *
+ *	Input:
+ *		ifname		Interface, eg "eth0"
+ *
+ *	Return:
+ * 		The node
+ * 		-1			Not known (virtual NIC, or a
+ * 					single node machine)
+ ***************************************************/
+int get_nic_numa_node(const char *ifname)
+{
+	char path[96];
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", ifname);
+
+	FILE *file = fopen(path, "r");
+	if(file == NULL)
+		return -1;
+
+	int node = -1;
+	if(fscanf(file, "%d", &node) != 1)
+		node = -1;
+
+	fclose(file);
+	return node;
+}
+
+
+/****************************************************
+ *    Function: init_hugepage_pool
+ * Description: Set up the current context's buffer
+ * 				pool in memory from hugepage_alloc.
+ * 				Call it from each context that should
+ * 				have a pool, so each has its own.
+ *
+ *		  NOTE:	The arena is never given back.
+ *
+ *	Input:
+ *		ifname		NIC the buffers are for
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		Out of memory
+ ***************************************************/
+RETURN_STATUS init_hugepage_pool(const char *ifname)
+{
+	size_t page_size = 0;
+	uint8_t *arena = hugepage_alloc(POOL_ARENA_SIZE, ifname, &page_size);
+	if(arena == NULL)
+		return FAILURE;
+
+	if(init_pool(arena, POOL_ARENA_SIZE) != SUCCESS)
+	{
+		hugepage_free(arena, POOL_ARENA_SIZE, page_size);
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: hugepage_map
+ * Description: Map reserved huge pages of one size.
+ *
+ *	Input:
+ *		len			Bytes needed
+ *		page_bits	log2 of the page size
+ *
+ *	Return:
+ * 		The memory
+ * 		NULL		None of that size free
+ ***************************************************/
+static void *hugepage_map(const size_t len, const int page_bits)
+{
+	void *mem = mmap(NULL, hugepage_round(len, (size_t)1 << page_bits), PROT_READ | PROT_WRITE,
+						MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (page_bits << MAP_HUGE_SHIFT), -1, 0);
+
+	return (mem == MAP_FAILED) ? NULL : mem;
+}
+
+
+/****************************************************
+ *    Function: hugepage_round
+ * Description: Round len up to a whole number of
+ * 				pages.
+ ***************************************************/
+static size_t hugepage_round(const size_t len, const size_t page_size)
+{
+	return (len + page_size - 1) & ~(page_size - 1);
+}
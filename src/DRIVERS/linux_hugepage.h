@@ -0,0 +1,60 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: linux_hugepage.h
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Packet memory for the Linux drivers, from
+ *				 huge pages on the NIC's NUMA node.
+ *
+ *				 Big rings on 4 KB pages spend a lot of time
+ *				 in TLB misses, and memory on the far node
+ *				 costs every frame a trip across the
+ *				 interconnect.  The AF_XDP UMEM comes from
+ *				 here, and so can the buffer pool (pool.h).
+ *
+ *				 Usage (per stack context, so each core gets
+ *				 its own pool):
+ *				   init_hugepage_pool("eth0");
+ *
+ *  History
+ *	DB/19 Oct 2026	hugepage_free takes the page size
+ *	DB/19 Oct 2026	Started
+ ****************************************************/
+#ifndef LINUX_HUGEPAGE_H_
+#define LINUX_HUGEPAGE_H_
+
+#include "../global.h"
+
+#include <stddef.h>
+
+
+/** Get len bytes (zeroed) on ifname's NUMA node, from the biggest pages there are **/
+void *hugepage_alloc(const size_t len, const char *ifname, size_t *page_size);
+
+/** Give it back (len as it was asked for, page_size as hugepage_alloc said) **/
+RETURN_STATUS hugepage_free(void *mem, const size_t len, const size_t page_size);
+
+/** NUMA node the NIC is on, -1 if there's only one or it can't tell **/
+int get_nic_numa_node(const char *ifname);
+
+/** init_pool for this context with an arena from hugepage_alloc **/
+RETURN_STATUS init_hugepage_pool(const char *ifname);
+
+#endif /* LINUX_HUGEPAGE_H_ */
@@ -0,0 +1,748 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: linux_packet.c
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Linux packet socket (AF_PACKET) on a real
+ *				 interface as the MAC, optionally sharded
+ *				 across cores (see linux_packet.h).
+ *
+ *				 With more than one shard every socket joins
+ *				 the same fanout group, and the kernel picks
+ *				 a shard for each frame:
+ *				  - by flow hash (default), so a UDP flow
+ *				    always goes to the same shard
+ *				  - or, with PACKET_BY_QUEUE, by the NIC
+ *				    queue it came in on.  Set the NIC's RSS
+ *				    and IRQ affinity so queue N is handled on
+ *				    shard N's core, and a frame never leaves
+ *				    that core.
+ *
+ *				 Receiving is batched (recvmmsg).  A receive
+ *				 thread and a 1ms timer thread stand in for
+ *				 the interrupts of a real MAC.  In poll mode
+ *				 (MAC_POLL) there is no receive thread; the
+ *				 program busy polls with ether_poll instead.
+ *
+ *				 Options (define at compile time):
+ *				  PACKET_IFNAME		Interface (default eth0)
+ *				  PACKET_BY_QUEUE	Shard by NIC queue
+ *
+ *  History
+ *	DB/19 Oct 2026	Whole batches handed up at once (MAC_RX_VECTOR)
+ *	DB/19 Oct 2026	Added poll mode (MAC_POLL)
+ *	DB/19 Oct 2026	Threads run in the stack context of init_mac
+ *	DB/19 Oct 2026	Started
+ ****************************************************************************/
+
+#define _GNU_SOURCE
+
+#include "linux_packet.h"
+#include "../link_uc_mac.h"
+#include "../stack_defines.h"
+#include "../ethernet.h"
+#include "../sip_ctx.h"
+#include "../arp.h"
+
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING	23
+#endif
+
+
+/* Interface to use */
+#ifndef PACKET_IFNAME
+#define PACKET_IFNAME	"eth0"
+#endif
+
+/* Frames to read per system call */
+#define PACKET_RX_BATCH	32
+
+/* Biggest frame the stack can take */
+#define PACKET_MAX_FRAME	(ETH_MAXDATA + ETH_HEADERLEN + ETH_CRCLEN)
+
+/* Longest the receive thread sleeps (ms) before checking the mailbox */
+#define PACKET_POLL_MS	10
+
+/* Messages waiting from one shard to another */
+#define SHARD_MAILBOX_SIZE	64
+
+
+/** Mailbox message, one ARP entry **/
+struct shard_msg
+{
+	uint8_t ip_addr[4];
+	uint8_t hw_addr[6];
+};
+
+/** One way from one shard to another.  Only the sender
+ *  writes head, only the receiver writes tail. **/
+struct shard_mailbox
+{
+	uint32_t head;
+	uint32_t tail;
+	struct shard_msg msg[SHARD_MAILBOX_SIZE];
+} __attribute__((aligned(64)));
+
+
+/* 'Private' variables */
+
+// Don't keep initialising
+static bool bUCInitialised = false;
+static bool bMACInitialised = false;
+
+static int packet_fd = -1;
+static int if_index = 0;
+
+// Shards (1 = not sharded)
+static uint8_t shard = 0;
+static uint8_t shard_count = 1;
+static uint16_t fanout_id = 0;
+
+// Mailboxes, shared by all the shards.  [to][from]
+static struct shard_mailbox *mailboxes = NULL;
+
+// Receive buffers
+static uint8_t rx_frames[PACKET_RX_BATCH][PACKET_MAX_FRAME];
+static struct mmsghdr rx_msgs[PACKET_RX_BATCH];
+static struct iovec rx_iovs[PACKET_RX_BATCH];
+
+// Frame complete callback
+static void (*cb_frame_complete)(uint8_t *buffer, const uint16_t buffer_len) = NULL;
+#ifdef MAC_RX_VECTOR
+static void (*cb_frames_complete)(struct mac_frame *frames, const uint16_t count) = NULL;
+#endif
+
+// Timer callback
+static void (*cb_timer)(void) = NULL;
+
+#ifndef MAC_POLL
+static pthread_t rx_thread;
+#endif
+static pthread_t timer_thread;
+
+
+/* 'Private' functions */
+static void shard_arp_learnt(const uint8_t *ip4_addr, const uint8_t *hw_addr);
+static void shard_read_mail(void);
+static int packet_rx_batch(const unsigned int budget);
+#ifndef MAC_POLL
+static void *packet_rx(void *arg);
+#endif
+static void *packet_timer(void *arg);
+
+
+/****************************************************
+ *    Function: start_shards
+ * Description: Fork into count copies of this
+ * 				process, each pinned to its own core
+ * 				(first_cpu, first_cpu + 1, ...).
+ *
+ * 				Returns in every shard, like fork().
+ * 				Use get_shard to tell them apart.
+ * 				Shards exit when the first one does.
+ *
+ *		  NOTE:	Call before init_ethernet.  Anything
+ *		  		set up before is copied into each
+ *		  		shard.
+ *
+ *	Input:
+ *		count		Number of shards (1 - SHARD_MAX)
+ *		first_cpu	Core for shard 0, or -1 to not pin
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		Already started, or fork failed
+ ***************************************************/
+RETURN_STATUS start_shards(const uint8_t count, const int first_cpu)
+{
+	if(bUCInitialised || shard_count > 1 || count == 0 || count > SHARD_MAX)
+		return FAILURE;
+
+	/* Everyone needs to see the mailboxes, so map them before forking */
+	if(count > 1)
+	{
+		mailboxes = mmap(NULL, sizeof(struct shard_mailbox) * count * count, PROT_READ | PROT_WRITE,
+							MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if(mailboxes == MAP_FAILED)
+		{
+			mailboxes = NULL;
+			return FAILURE;
+		}
+		memset(mailboxes, 0, sizeof(struct shard_mailbox) * count * count);
+	}
+
+	pid_t parent = getpid();
+	fanout_id = (uint16_t)parent;
+	shard_count = count;
+
+	uint8_t i = 0;
+	for(i = 1; i < count; i++)
+	{
+		pid_t pid = fork();
+		if(pid < 0)
+		{
+			return FAILURE;
+		}
+
+		if(pid == 0)
+		{
+			/* Dont outlive shard 0 */
+			prctl(PR_SET_PDEATHSIG, SIGTERM);
+			if(getppid() != parent)
+				_exit(0);
+
+			shard = i;
+			break;
+		}
+	}
+
+	if(first_cpu >= 0)
+	{
+		/* Threads started later inherit this */
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(first_cpu + shard, &cpus);
+		sched_setaffinity(0, sizeof(cpus), &cpus);
+	}
+
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: get_shard
+ * Description: Which shard this is.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		0 to get_shard_count() - 1
+ ***************************************************/
+uint8_t get_shard(void)
+{
+	return shard;
+}
+
+
+/****************************************************
+ *    Function: get_shard_count
+ * Description: How many shards were started.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		1 if not sharded
+ ***************************************************/
+uint8_t get_shard_count(void)
+{
+	return shard_count;
+}
+
+
+/****************************************************
+ *    Function: init_uc
+ * Description: Open the packet socket and join the
+ * 				fanout group.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		No interface, or not allowed
+ * 					(needs CAP_NET_RAW)
+ ***************************************************/
+RETURN_STATUS init_uc()
+{
+	if(bUCInitialised == true)
+		return SUCCESS;
+
+	if_index = if_nametoindex(PACKET_IFNAME);
+	if(if_index == 0)
+	{
+		return FAILURE;
+	}
+
+	packet_fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if(packet_fd < 0)
+	{
+		return FAILURE;
+	}
+
+	struct sockaddr_ll sll;
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = if_index;
+	if(bind(packet_fd, (struct sockaddr *)&sll, sizeof(sll)) < 0)
+	{
+		return FAILURE;
+	}
+
+	/* Dont see our own frames coming back (best effort, 4.20+) */
+	int opt = 1;
+	setsockopt(packet_fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &opt, sizeof(opt));
+
+	if(shard_count > 1)
+	{
+#ifdef PACKET_BY_QUEUE
+		opt = fanout_id | ((PACKET_FANOUT_QM | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+#else
+		opt = fanout_id | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+#endif
+		if(setsockopt(packet_fd, SOL_PACKET, PACKET_FANOUT, &opt, sizeof(opt)) < 0)
+		{
+			return FAILURE;
+		}
+	}
+
+	bUCInitialised = true;
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: init_mac
+ * Description: Start the receive thread, and start
+ * 				sharing ARP replies if sharded.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE
+ ***************************************************/
+RETURN_STATUS init_mac()
+{
+	if(bMACInitialised)
+		return SUCCESS;
+
+	if(shard_count > 1)
+	{
+		set_arp_learn_callback(&shard_arp_learnt);
+	}
+
+	if(packet_fd < 0)
+	{
+		return FAILURE;
+	}
+
+	int i = 0;
+	for(i = 0; i < PACKET_RX_BATCH; i++)
+	{
+		rx_iovs[i].iov_base = rx_frames[i];
+		rx_iovs[i].iov_len = PACKET_MAX_FRAME;
+		rx_msgs[i].msg_hdr.msg_iov = &rx_iovs[i];
+		rx_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+#ifndef MAC_POLL
+	if(pthread_create(&rx_thread, NULL, &packet_rx, sip_ctx_get()) != 0)
+	{
+		return FAILURE;
+	}
+#endif
+
+	bMACInitialised = true;
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: get_mac_offload
+ * Description: Packet sockets give us the raw frame,
+ * 				so all the checksums are ours.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		MAC_OFFLOAD_NONE
+ ***************************************************/
+uint8_t get_mac_offload(void)
+{
+	return MAC_OFFLOAD_NONE;
+}
+
+
+/****************************************************
+ *    Function: set_frame_complete
+ * Description: Sets the frame complete callback
+ *
+ *	Input:
+ * 		frame_complete_callback		Callback to function
+ *
+ *	Return:
+ * 		SUCCESS
+ ***************************************************/
+RETURN_STATUS set_frame_complete(void (*frame_complete_callback)(uint8_t *buffer, const uint16_t buffer_len))
+{
+	cb_frame_complete = frame_complete_callback;
+	return SUCCESS;
+}
+
+
+#ifdef MAC_RX_VECTOR
+/****************************************************
+ *    Function: set_frames_complete
+ * Description: Sets the callback for a whole batch of
+ * 				frames, used instead of frame_complete.
+ *
+ *	Input:
+ * 		frames_complete_callback	Callback to function
+ *
+ *	Return:
+ * 		SUCCESS
+ ***************************************************/
+RETURN_STATUS set_frames_complete(void (*frames_complete_callback)(struct mac_frame *frames, const uint16_t count))
+{
+	cb_frames_complete = frames_complete_callback;
+	return SUCCESS;
+}
+#endif
+
+
+/****************************************************
+ *    Function: register_ms_callback
+ * Description: Call handler every ms (from a thread).
+ *
+ *	Input:
+ * 		handler
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE
+ ***************************************************/
+RETURN_STATUS register_ms_callback(void(*handler)(void))
+{
+	bool start = (cb_timer == NULL);
+	cb_timer = handler;
+
+	if(start && pthread_create(&timer_thread, NULL, &packet_timer, sip_ctx_get()) != 0)
+	{
+		cb_timer = NULL;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: send_frame
+ * Description: Send a frame out of this shard's
+ * 				socket.
+ *
+ *	Input:
+ * 		buffer		Frame (with space for the CRC)
+ *		buffer_len	Length of buffer
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE
+ ***************************************************/
+RETURN_STATUS send_frame(const uint8_t *buffer, const uint16_t buffer_len)
+{
+	/* The NIC adds the FCS */
+	ssize_t len = buffer_len - ETH_CRCLEN;
+
+	if(send(packet_fd, buffer, len, 0) != len)
+	{
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: read_buffer
+ * Description: Not used, frames arrive through the
+ * 				frame complete callback.
+ ***************************************************/
+RETURN_STATUS read_buffer(uint8_t *buffer, const unsigned int buffer_len, unsigned int *actual_len, const unsigned int timeout_ms)
+{
+	(void)buffer;
+	(void)buffer_len;
+	(void)actual_len;
+	(void)timeout_ms;
+
+	return NOT_AVAILABLE;
+}
+
+
+/****************************************************
+ *    Function: shard_arp_learnt
+ * Description: ARP learn callback.  Post the new
+ * 				entry to every other shard.
+ *
+ * 				If a mailbox is full the entry is
+ * 				dropped; that shard will just ARP for
+ * 				it itself.
+ *
+ *	Input:
+ * 		ip4_addr
+ * 		hw_addr
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+static void shard_arp_learnt(const uint8_t *ip4_addr, const uint8_t *hw_addr)
+{
+	uint8_t to = 0;
+	for(to = 0; to < shard_count; to++)
+	{
+		if(to == shard)
+			continue;
+
+		struct shard_mailbox *box = &mailboxes[(to * shard_count) + shard];
+		uint32_t head = box->head;
+
+		if(head - __atomic_load_n(&box->tail, __ATOMIC_ACQUIRE) >= SHARD_MAILBOX_SIZE)
+			continue;
+
+		struct shard_msg *msg = &box->msg[head % SHARD_MAILBOX_SIZE];
+		memcpy(msg->ip_addr, ip4_addr, 4);
+		memcpy(msg->hw_addr, hw_addr, 6);
+
+		__atomic_store_n(&box->head, head + 1, __ATOMIC_RELEASE);
+	}
+}
+
+
+/****************************************************
+ *    Function: shard_read_mail
+ * Description: Add any ARP entries the other shards
+ * 				have learnt.
+ *
+ *		  NOTE:	Uses add_arp_entry, so they are not
+ *		  		posted back out again.
+ ***************************************************/
+static void shard_read_mail(void)
+{
+	uint8_t from = 0;
+	for(from = 0; from < shard_count; from++)
+	{
+		struct shard_mailbox *box = &mailboxes[(shard * shard_count) + from];
+		uint32_t tail = box->tail;
+		uint32_t head = __atomic_load_n(&box->head, __ATOMIC_ACQUIRE);
+
+		while(tail != head)
+		{
+			struct shard_msg *msg = &box->msg[tail % SHARD_MAILBOX_SIZE];
+			add_arp_entry(msg->ip_addr, msg->hw_addr, ARP_DEFAULT_TIMEOUT, true);
+			tail++;
+		}
+
+		__atomic_store_n(&box->tail, tail, __ATOMIC_RELEASE);
+	}
+}
+
+
+#ifdef MAC_POLL
+/****************************************************
+ *    Function: poll_mac
+ * Description: Read up to budget frames, and check
+ * 				the mailbox.
+ *
+ *	Input:
+ *		budget		Most frames to read
+ *
+ *	Return:
+ * 		Frames read
+ ***************************************************/
+uint16_t poll_mac(const uint16_t budget)
+{
+	if(mailboxes != NULL)
+	{
+		shard_read_mail();
+	}
+
+	uint16_t done = 0;
+	while(done < budget)
+	{
+		int count = packet_rx_batch(budget - done);
+		if(count <= 0)
+			break;
+
+		done += count;
+	}
+
+	return done;
+}
+
+
+/****************************************************
+ *    Function: mac_rx_irq
+ * Description: There is no receive interrupt to turn
+ * 				on, so ask to be polled again straight
+ * 				away.  Poll mode is always busy polling.
+ *
+ *	Input:
+ *		enable
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+void mac_rx_irq(const bool enable)
+{
+	if(enable)
+	{
+		ether_rx_schedule();
+	}
+}
+#endif
+
+
+/****************************************************
+ *    Function: packet_rx_batch
+ * Description: Read what is waiting, up to budget
+ * 				frames, in one system call and pass
+ * 				them up.
+ *
+ *	Input:
+ *		budget		Most frames to read
+ *
+ *	Return:
+ * 		Frames read (including any too big to use)
+ ***************************************************/
+static int packet_rx_batch(const unsigned int budget)
+{
+	unsigned int max = (budget < PACKET_RX_BATCH) ? budget : PACKET_RX_BATCH;
+
+	int count = recvmmsg(packet_fd, rx_msgs, max, MSG_DONTWAIT, NULL);
+
+	int i = 0;
+#ifdef MAC_RX_VECTOR
+	if(cb_frames_complete != NULL && count > 0)
+	{
+		struct mac_frame frames[PACKET_RX_BATCH];
+		uint16_t used = 0;
+		for(i = 0; i < count; i++)
+		{
+			if(rx_msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+				continue;
+
+			frames[used].buffer = rx_frames[i];
+			frames[used].len = (uint16_t)rx_msgs[i].msg_len;
+			used++;
+		}
+
+		(cb_frames_complete)(frames, used);
+		return count;
+	}
+#endif
+
+	for(i = 0; i < count; i++)
+	{
+		/* Too big for us, so only part of it is here */
+		if(rx_msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+			continue;
+
+		if(cb_frame_complete != NULL)
+		{
+			(cb_frame_complete)(rx_frames[i], (uint16_t)rx_msgs[i].msg_len);
+		}
+	}
+
+	return count;
+}
+
+
+#ifndef MAC_POLL
+/****************************************************
+ *    Function: packet_rx
+ * Description: Receive thread.  Reads frames in
+ * 				batches, and checks the mailbox.
+ ***************************************************/
+static void *packet_rx(void *arg)
+{
+	/* Run in the context we were started from */
+	sip_ctx_use((struct sip_ctx *)arg);
+
+	struct pollfd pfd;
+	pfd.fd = packet_fd;
+	pfd.events = POLLIN;
+
+	while(1)
+	{
+		if(mailboxes != NULL)
+		{
+			shard_read_mail();
+		}
+
+		if(packet_rx_batch(PACKET_RX_BATCH) <= 0)
+		{
+			poll(&pfd, 1, PACKET_POLL_MS);
+		}
+	}
+
+	return NULL;
+}
+#endif
+
+
+/****************************************************
+ *    Function: packet_timer
+ * Description: 1ms tick thread.  Sleeps to absolute
+ * 				times so the ticks dont drift.
+ ***************************************************/
+static void *packet_timer(void *arg)
+{
+	/* Run in the context we were started from */
+	sip_ctx_use((struct sip_ctx *)arg);
+
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while(cb_timer != NULL)
+	{
+		next.tv_nsec += 1000000;
+		if(next.tv_nsec >= 1000000000)
+		{
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		(cb_timer)();
+	}
+
+	return NULL;
+}
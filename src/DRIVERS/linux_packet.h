@@ -0,0 +1,64 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: linux_packet.h
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Sharded running for the Linux packet
+ *				 socket driver (linux_packet.c).
+ *
+ *				 The stack keeps all its state in globals, so
+ *				 one copy of it can only use one core.  To use
+ *				 more, start_shards forks a copy of the whole
+ *				 process per core.  Each one is pinned to its
+ *				 core and has its own ARP table, timers, UDP
+ *				 listeners and socket; the kernel shares the
+ *				 flows out between them (PACKET_FANOUT).
+ *
+ *				 The only thing they share is a mailbox, used
+ *				 to pass on ARP replies, which only arrive at
+ *				 one shard.
+ *
+ *				 Usage:
+ *				   start_shards(16, 0);		(forks)
+ *				   init_ethernet();			(in every shard)
+ *				   ...
+ *
+ *  History
+ *	DB/19 Oct 2026	Started
+ ****************************************************/
+#ifndef LINUX_PACKET_H_
+#define LINUX_PACKET_H_
+
+#include "../global.h"
+
+/* Most shards we will start */
+#define SHARD_MAX		64
+
+
+/** Fork into count shards, pinned to cores first_cpu.. (call before init_ethernet) **/
+RETURN_STATUS start_shards(const uint8_t count, const int first_cpu);
+
+/** Which shard this process is (0 is the original) **/
+uint8_t get_shard(void);
+
+/** How many shards there are **/
+uint8_t get_shard_count(void);
+
+#endif /* LINUX_PACKET_H_ */
@@ -0,0 +1,386 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: linux_rps.c
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: UDP worker pool (see linux_rps.h).
+ *
+ *				 Plugs into the UDP layer with
+ *				 set_udp_deliver, so it works with whichever
+ *				 driver is linked in.
+ *
+ *				 Workers spin on their ring for a while when
+ *				 it empties, then sleep on a futex.  The
+ *				 receive thread only makes a system call to
+ *				 wake a worker that has gone to sleep.
+ *
+ *				 Options (define at compile time):
+ *				  RPS_BY_PORT		Pick the worker by
+ *				  					destination port only, so
+ *				  					each handler runs on one
+ *				  					worker
+ *				  RPS_RING_SIZE		Datagrams waiting per worker
+ *				  					(power of 2)
+ *
+ *  History
+ *	DB/19 Oct 2026	stop_udp_workers waits for rps_deliver to finish
+ *	DB/19 Oct 2026	Started
+ ****************************************************************************/
+
+#define _GNU_SOURCE
+
+#include "linux_rps.h"
+#include "../stack_defines.h"
+#include "../ethernet.h"
+#include "../ip.h"
+#include "../udp.h"
+#include "../sip_ctx.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+
+/* Datagrams waiting per worker */
+#ifndef RPS_RING_SIZE
+#define RPS_RING_SIZE		256
+#endif
+
+#if (RPS_RING_SIZE & (RPS_RING_SIZE - 1)) != 0
+#error "RPS_RING_SIZE must be a power of 2"
+#endif
+
+/* Biggest datagram the stack can receive */
+#define RPS_MAX_DATA		(ETH_MAXDATA - IP_HEADERLEN - 8)
+
+/* Empty polls before a worker sleeps */
+#define RPS_SPIN			2000
+
+/* Longest a worker sleeps before checking for stop */
+#define RPS_SLEEP_MS		100
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RPS_PAUSE()			__builtin_ia32_pause()
+#else
+#define RPS_PAUSE()
+#endif
+
+
+/** A datagram, and who it is for **/
+struct rps_slot
+{
+	void (*handler)(const uint8_t *buffer, const uint16_t buffer_len);
+	uint16_t len;
+	uint8_t data[RPS_MAX_DATA];
+};
+
+/** One worker and its ring.  Only the receive thread
+ *  writes head, only the worker writes tail. **/
+struct rps_worker
+{
+	uint32_t head __attribute__((aligned(64)));
+	uint32_t sleeping;
+
+	uint32_t tail __attribute__((aligned(64)));
+
+	pthread_t thread;
+	int cpu;
+	struct sip_ctx *ctx;
+	struct rps_slot slots[RPS_RING_SIZE];
+};
+
+
+/* 'Private' variables */
+
+static struct rps_worker *workers[RPS_MAX_WORKERS];
+static uint8_t worker_count = 0;
+
+static volatile bool stopping = false;
+
+// Set while the receive thread is in rps_deliver
+static uint32_t delivering = 0;
+
+// Only the receive thread counts these
+static uint32_t drops = 0;
+
+
+/* 'Private' functions */
+static void rps_deliver(void (*handler)(const uint8_t *buffer, const uint16_t buffer_len),
+						const uint8_t *src_addr, const uint16_t src_port, const uint16_t port,
+						const uint8_t *buffer, const uint16_t buffer_len);
+static void *rps_worker(void *arg);
+
+
+/****************************************************
+ *    Function: start_udp_workers
+ * Description: Start count worker threads, and have
+ * 				UDP pass them every datagram for a
+ * 				listen_udp handler.
+ *
+ *		  NOTE:	Call after init_udp, from the stack
+ *		  		context the handlers should run in.
+ *
+ *	Input:
+ *		count		Number of workers (1 - RPS_MAX_WORKERS)
+ *		first_cpu	Core for worker 0, or -1 to not pin
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		Already started, or out of memory/threads
+ ***************************************************/
+RETURN_STATUS start_udp_workers(const uint8_t count, const int first_cpu)
+{
+	if(worker_count > 0 || count == 0 || count > RPS_MAX_WORKERS)
+		return FAILURE;
+
+	stopping = false;
+
+	uint8_t i = 0;
+	for(i = 0; i < count; i++)
+	{
+		struct rps_worker *worker = aligned_alloc(64, sizeof(struct rps_worker));
+		if(worker == NULL)
+			break;
+
+		memset(worker, 0, sizeof(struct rps_worker));
+		worker->cpu = (first_cpu >= 0) ? first_cpu + i : -1;
+		worker->ctx = sip_ctx_get();
+
+		if(pthread_create(&worker->thread, NULL, &rps_worker, worker) != 0)
+		{
+			free(worker);
+			break;
+		}
+
+		workers[worker_count++] = worker;
+	}
+
+	if(worker_count < count)
+	{
+		stop_udp_workers();
+		return FAILURE;
+	}
+
+	return set_udp_deliver(&rps_deliver);
+}
+
+
+/****************************************************
+ *    Function: stop_udp_workers
+ * Description: Go back to running handlers on the
+ * 				receive thread.  Datagrams already
+ * 				queued are handled first.
+ *
+ *		  NOTE:	Safe from any thread.  It waits for
+ *		  		the receive thread to be out of
+ *		  		rps_deliver before freeing the rings,
+ *		  		and anything delivered meanwhile is
+ *		  		handled on the receive thread.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		Not started
+ ***************************************************/
+RETURN_STATUS stop_udp_workers(void)
+{
+	if(worker_count == 0)
+		return FAILURE;
+
+	/* Either rps_deliver sees stopping, or we see it busy
+	 * and wait for it to finish with the rings */
+	__atomic_store_n(&stopping, true, __ATOMIC_SEQ_CST);
+	while(__atomic_load_n(&delivering, __ATOMIC_SEQ_CST))
+	{
+		RPS_PAUSE();
+	}
+
+	set_udp_deliver(NULL);
+
+	uint8_t i = 0;
+	for(i = 0; i < worker_count; i++)
+	{
+		syscall(SYS_futex, &workers[i]->head, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+		pthread_join(workers[i]->thread, NULL);
+		free(workers[i]);
+		workers[i] = NULL;
+	}
+
+	worker_count = 0;
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: get_udp_worker_drops
+ * Description: Datagrams dropped because their
+ * 				worker had a full ring (or they were
+ * 				too big for it).
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		Total since the program started
+ ***************************************************/
+uint32_t get_udp_worker_drops(void)
+{
+	return __atomic_load_n(&drops, __ATOMIC_RELAXED);
+}
+
+
+/****************************************************
+ *    Function: rps_deliver
+ * Description: UDP deliver hook, on the receive
+ * 				thread.  Copies the datagram into its
+ * 				worker's ring, or runs the handler
+ * 				here once stop_udp_workers has begun.
+ ***************************************************/
+static void rps_deliver(void (*handler)(const uint8_t *buffer, const uint16_t buffer_len),
+						const uint8_t *src_addr, const uint16_t src_port, const uint16_t port,
+						const uint8_t *buffer, const uint16_t buffer_len)
+{
+	__atomic_store_n(&delivering, 1, __ATOMIC_SEQ_CST);
+
+	const uint8_t count = worker_count;
+	if(__atomic_load_n(&stopping, __ATOMIC_SEQ_CST) || count == 0)
+	{
+		__atomic_store_n(&delivering, 0, __ATOMIC_RELEASE);
+		(handler)(buffer, buffer_len);
+		return;
+	}
+
+	/* FNV-1a, over whatever picks the flow */
+	uint32_t hash = 2166136261u;
+#ifndef RPS_BY_PORT
+	uint8_t i = 0;
+	for(i = 0; i < 4; i++)
+		hash = (hash ^ src_addr[i]) * 16777619u;
+	hash = (hash ^ (src_port >> 8)) * 16777619u;
+	hash = (hash ^ (src_port & 0xFF)) * 16777619u;
+#endif
+	hash = (hash ^ (port >> 8)) * 16777619u;
+	hash = (hash ^ (port & 0xFF)) * 16777619u;
+
+	struct rps_worker *worker = workers[hash % count];
+	uint32_t head = worker->head;
+
+	if(buffer_len > RPS_MAX_DATA
+		|| head - __atomic_load_n(&worker->tail, __ATOMIC_ACQUIRE) >= RPS_RING_SIZE)
+	{
+		__atomic_store_n(&drops, drops + 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&delivering, 0, __ATOMIC_RELEASE);
+		return;
+	}
+
+	struct rps_slot *slot = &worker->slots[head % RPS_RING_SIZE];
+	slot->handler = handler;
+	slot->len = buffer_len;
+	memcpy(slot->data, buffer, buffer_len);
+
+	/* Seq cst, so we see sleeping set if it missed this head */
+	__atomic_store_n(&worker->head, head + 1, __ATOMIC_SEQ_CST);
+
+	if(__atomic_load_n(&worker->sleeping, __ATOMIC_SEQ_CST))
+	{
+		syscall(SYS_futex, &worker->head, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+
+	__atomic_store_n(&delivering, 0, __ATOMIC_RELEASE);
+}
+
+
+/****************************************************
+ *    Function: rps_worker
+ * Description: Worker thread.  Runs handlers for
+ * 				whatever is in its ring, sleeping when
+ * 				there is nothing for a while.
+ ***************************************************/
+static void *rps_worker(void *arg)
+{
+	struct rps_worker *worker = (struct rps_worker *)arg;
+
+	/* Run in the context we were started from */
+	sip_ctx_use(worker->ctx);
+
+	if(worker->cpu >= 0)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(worker->cpu, &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+
+	struct timespec sleep_time;
+	sleep_time.tv_sec = 0;
+	sleep_time.tv_nsec = RPS_SLEEP_MS * 1000000;
+
+	uint32_t tail = worker->tail;
+	uint32_t idle = 0;
+
+	while(1)
+	{
+		uint32_t head = __atomic_load_n(&worker->head, __ATOMIC_ACQUIRE);
+
+		if(tail == head)
+		{
+			if(stopping)
+				break;
+
+			if(++idle < RPS_SPIN)
+			{
+				RPS_PAUSE();
+				continue;
+			}
+
+			/* Tell the receive thread to wake us, then check once more */
+			__atomic_store_n(&worker->sleeping, 1, __ATOMIC_SEQ_CST);
+			if(__atomic_load_n(&worker->head, __ATOMIC_SEQ_CST) == tail && !stopping)
+			{
+				syscall(SYS_futex, &worker->head, FUTEX_WAIT_PRIVATE, tail, &sleep_time, NULL, 0);
+			}
+			__atomic_store_n(&worker->sleeping, 0, __ATOMIC_RELAXED);
+
+			idle = 0;
+			continue;
+		}
+
+		idle = 0;
+
+		while(tail != head)
+		{
+			struct rps_slot *slot = &worker->slots[tail % RPS_RING_SIZE];
+			(slot->handler)(slot->data, slot->len);
+
+			/* Free the slot straight away, handlers may be slow */
+			tail++;
+			__atomic_store_n(&worker->tail, tail, __ATOMIC_RELEASE);
+		}
+	}
+
+	return NULL;
+}
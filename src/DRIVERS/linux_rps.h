@@ -0,0 +1,79 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: linux_rps.h
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Receive packet steering for any of the
+ *				 Linux drivers (linux_rps.c).
+ *
+ *				 Normally listen_udp handlers run on the
+ *				 receive thread, so a slow handler holds up
+ *				 every frame behind it.  start_udp_workers
+ *				 moves them onto a pool of worker threads.
+ *				 The receive thread still does Ethernet, IP
+ *				 and UDP, then copies each datagram into a
+ *				 ring for one worker, picked by flow (or by
+ *				 port, with RPS_BY_PORT), so each flow stays
+ *				 in order.
+ *
+ *				 Each ring has one writer (the receive
+ *				 thread) and one reader (its worker), so
+ *				 they need no locks.  A full ring drops the
+ *				 datagram, as a NIC would.
+ *
+ *				 Handlers may run at the same time as each
+ *				 other and the receive thread.  The stack is
+ *				 not thread safe, so handlers that send must
+ *				 do their own locking.
+ *
+ *				 stop_udp_workers can be called from any
+ *				 thread.  It waits for the receive thread to
+ *				 leave the ring it is writing, and datagrams
+ *				 arriving while it stops are handled on the
+ *				 receive thread.
+ *
+ *				 Usage:
+ *				   init_udp();
+ *				   listen_udp(...);
+ *				   start_udp_workers(4, 2);	(cores 2-5)
+ *
+ *  History
+ *	DB/19 Oct 2026	stop_udp_workers safe from any thread
+ *	DB/19 Oct 2026	Started
+ ****************************************************/
+#ifndef LINUX_RPS_H_
+#define LINUX_RPS_H_
+
+#include "../global.h"
+
+/* Most workers we will start */
+#define RPS_MAX_WORKERS		64
+
+
+/** Run listen_udp handlers on count worker threads, pinned to cores first_cpu.. **/
+RETURN_STATUS start_udp_workers(const uint8_t count, const int first_cpu);
+
+/** Run handlers on the receive thread again, once the workers have finished (any thread) **/
+RETURN_STATUS stop_udp_workers(void);
+
+/** Datagrams dropped because a worker's ring was full **/
+uint32_t get_udp_worker_drops(void);
+
+#endif /* LINUX_RPS_H_ */
@@ -0,0 +1,819 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: linux_tap.c
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Linux TAP device as the MAC.
+ *
+ *				 Every frame carries a virtio_net_hdr
+ *				 (IFF_VNET_HDR), which lets the kernel:
+ *				  - fill in UDP/ICMP checksums on the way out
+ *				  - tell us when a checksum has already been
+ *				    checked on the way in
+ *				  - cut one large UDP datagram into segments
+ *				    (USO, with UDP_SEG_OFFLOAD)
+ *				  - hand us GRO batches of UDP datagrams,
+ *				    which are split up again here
+ *
+ *				 A receive thread and a 1ms timer thread stand
+ *				 in for the interrupts of a real MAC.  In poll
+ *				 mode (MAC_POLL) there is no receive thread;
+ *				 the program busy polls with ether_poll.
+ *
+ *				 The interface needs bringing up and giving an
+ *				 address on the host side, eg:
+ *				   ip addr add 192.168.1.1/24 dev sip0
+ *				   ip link set sip0 up
+ *
+ *  History
+ *	DB/19 Oct 2026	tap_write refuses IP lengths shorter than the header
+ *	DB/19 Oct 2026	set_frames_complete (no batches)
+ *	DB/19 Oct 2026	Stop reading when the tap has gone
+ *	DB/19 Oct 2026	Added poll mode (MAC_POLL)
+ *	DB/19 Oct 2026	Threads run in the stack context of init_mac
+ *	DB/19 Oct 2026	Started
+ ****************************************************************************/
+
+#include "../link_uc_mac.h"
+#include "../ethernet.h"
+#include "../sip_ctx.h"
+#include "../ip.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+#include <linux/virtio_net.h>
+
+
+/* Interface to create (or attach to) */
+#ifndef TAP_IFNAME
+#define TAP_IFNAME		"sip0"
+#endif
+
+/* Older headers dont know about UDP segmentation */
+#ifndef TUN_F_USO4
+#define TUN_F_USO4		0x20
+#define TUN_F_USO6		0x40
+#endif
+#ifndef VIRTIO_NET_HDR_GSO_UDP_L4
+#define VIRTIO_NET_HDR_GSO_UDP_L4	5
+#endif
+
+/* Biggest thing the kernel will give us (a GRO batch) */
+#define TAP_MAX_FRAME	65550
+
+/* Where things are in a frame */
+#define TAP_IP			ETH_HEADERLEN
+#define TAP_UDP_HEADERLEN	8
+
+
+/* 'Private' variables */
+
+// Don't keep initialising
+static bool bUCInitialised = false;
+static bool bMACInitialised = false;
+
+static int tap_fd = -1;
+
+// What we (and the kernel) can do
+static uint8_t tap_offload = MAC_OFFLOAD_NONE;
+
+// Frame complete callback
+static void (*cb_frame_complete)(uint8_t *buffer, const uint16_t buffer_len) = NULL;
+
+// Timer callback
+static void (*cb_timer)(void) = NULL;
+
+#ifndef MAC_POLL
+static pthread_t rx_thread;
+#endif
+static pthread_t timer_thread;
+
+
+/* 'Private' functions */
+static RETURN_STATUS tap_write(const uint8_t *buffer, uint16_t buffer_len, const uint16_t segment_len);
+static void tap_deliver(uint8_t *frame, uint32_t frame_len, const struct virtio_net_hdr *hdr);
+static void tap_deliver_gro(uint8_t *frame, uint32_t frame_len, const uint16_t segment_len);
+static bool tap_checksums_ok(const uint8_t *frame, const uint16_t frame_len);
+static uint32_t tap_sum(const uint8_t *buffer, uint16_t len, uint32_t sum);
+static uint16_t tap_fold(uint32_t sum);
+static bool tap_rx_one(void);
+#ifndef MAC_POLL
+static void *tap_rx(void *arg);
+#endif
+static void *tap_timer(void *arg);
+
+
+/****************************************************
+ *    Function: init_uc
+ * Description: Open the TAP device and tell the
+ * 				kernel what we can cope with.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		No TAP (needs CAP_NET_ADMIN)
+ ***************************************************/
+RETURN_STATUS init_uc()
+{
+	if(bUCInitialised == true)
+		return SUCCESS;
+
+	tap_fd = open("/dev/net/tun", O_RDWR);
+	if(tap_fd < 0)
+	{
+		return FAILURE;
+	}
+
+	struct ifreq ifr;
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
+	strncpy(ifr.ifr_name, TAP_IFNAME, IFNAMSIZ - 1);
+
+	int hdr_len = sizeof(struct virtio_net_hdr);
+	if(ioctl(tap_fd, TUNSETIFF, &ifr) < 0 || ioctl(tap_fd, TUNSETVNETHDRSZ, &hdr_len) < 0)
+	{
+		close(tap_fd);
+		tap_fd = -1;
+		return FAILURE;
+	}
+
+	/* Partial checksums are fine by us, and so are
+	 * GRO batches of UDP (kernel 6.2 onwards, which
+	 * wants USO6 as well even though we wont see any) */
+	tap_offload = MAC_OFFLOAD_TX_CSUM | MAC_OFFLOAD_RX_CSUM;
+	if(ioctl(tap_fd, TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_USO4 | TUN_F_USO6) == 0)
+	{
+#ifdef UDP_SEG_OFFLOAD
+		tap_offload |= MAC_OFFLOAD_UDP_SEG;
+#endif
+	}
+	else
+	{
+		ioctl(tap_fd, TUNSETOFFLOAD, TUN_F_CSUM);
+	}
+
+	bUCInitialised = true;
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: init_mac
+ * Description: Start the receive thread.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE
+ ***************************************************/
+RETURN_STATUS init_mac()
+{
+	if(bMACInitialised)
+		return SUCCESS;
+
+	if(tap_fd < 0)
+	{
+		return FAILURE;
+	}
+
+#ifdef MAC_POLL
+	/* poll_mac must not wait */
+	if(fcntl(tap_fd, F_SETFL, fcntl(tap_fd, F_GETFL) | O_NONBLOCK) < 0)
+	{
+		return FAILURE;
+	}
+#else
+	if(pthread_create(&rx_thread, NULL, &tap_rx, sip_ctx_get()) != 0)
+	{
+		return FAILURE;
+	}
+#endif
+
+	bMACInitialised = true;
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: get_mac_offload
+ * Description: What the kernel will do for us.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		MAC_OFFLOAD_* flags
+ ***************************************************/
+uint8_t get_mac_offload(void)
+{
+	return tap_offload;
+}
+
+
+/****************************************************
+ *    Function: set_frame_complete
+ * Description: Sets the frame complete callback
+ *
+ *	Input:
+ * 		frame_complete_callback		Callback to function
+ *
+ *	Return:
+ * 		SUCCESS
+ ***************************************************/
+RETURN_STATUS set_frame_complete(void (*frame_complete_callback)(uint8_t *buffer, const uint16_t buffer_len))
+{
+	cb_frame_complete = frame_complete_callback;
+	return SUCCESS;
+}
+
+
+#ifdef MAC_RX_VECTOR
+/****************************************************
+ *    Function: set_frames_complete
+ * Description: No batches here, every frame goes to
+ * 				frame_complete.
+ *
+ *	Input:
+ * 		frames_complete_callback	Not used
+ *
+ *	Return:
+ * 		FAILURE
+ ***************************************************/
+RETURN_STATUS set_frames_complete(void (*frames_complete_callback)(struct mac_frame *frames, const uint16_t count))
+{
+	(void)frames_complete_callback;
+	return FAILURE;
+}
+#endif
+
+
+/****************************************************
+ *    Function: register_ms_callback
+ * Description: Call handler every ms (from a thread).
+ *
+ *	Input:
+ * 		handler
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE
+ ***************************************************/
+RETURN_STATUS register_ms_callback(void(*handler)(void))
+{
+	bool start = (cb_timer == NULL);
+	cb_timer = handler;
+
+	if(start && pthread_create(&timer_thread, NULL, &tap_timer, sip_ctx_get()) != 0)
+	{
+		cb_timer = NULL;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: send_frame
+ * Description: Send a frame to the kernel.
+ *
+ *	Input:
+ * 		buffer		Frame (with space for the CRC)
+ *		buffer_len	Length of buffer
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE
+ ***************************************************/
+RETURN_STATUS send_frame(const uint8_t *buffer, const uint16_t buffer_len)
+{
+	/* No FCS on a TAP */
+	return tap_write(buffer, buffer_len - ETH_CRCLEN, 0);
+}
+
+
+#ifdef UDP_SEG_OFFLOAD
+/****************************************************
+ *    Function: send_frame_segmented
+ * Description: Have the kernel cut a large UDP
+ * 				datagram into segment_len pieces.
+ *
+ *	Input:
+ * 		buffer		Frame (no CRC)
+ *		buffer_len	Length of buffer
+ *		segment_len	UDP payload bytes per segment
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE
+ ***************************************************/
+RETURN_STATUS send_frame_segmented(const uint8_t *buffer, const uint16_t buffer_len, const uint16_t segment_len)
+{
+	if(!(tap_offload & MAC_OFFLOAD_UDP_SEG))
+	{
+		return FAILURE;
+	}
+
+	return tap_write(buffer, buffer_len, segment_len);
+}
+#endif
+
+
+/****************************************************
+ *    Function: read_buffer
+ * Description: Not used, frames arrive through the
+ * 				frame complete callback.
+ ***************************************************/
+RETURN_STATUS read_buffer(uint8_t *buffer, const unsigned int buffer_len, unsigned int *actual_len, const unsigned int timeout_ms)
+{
+	(void)buffer;
+	(void)buffer_len;
+	(void)actual_len;
+	(void)timeout_ms;
+
+	return NOT_AVAILABLE;
+}
+
+
+/****************************************************
+ *    Function: tap_write
+ * Description: Put a virtio_net_hdr on the front of
+ * 				a frame and write it.
+ *
+ * 				The stack leaves checksums to us
+ * 				(MAC_OFFLOAD_TX_CSUM).  The IP header
+ * 				is only 20 bytes so is done here, the
+ * 				UDP/ICMP checksum is left to the kernel.
+ *
+ *		  NOTE:	Only the Ethernet and IP headers are
+ *		  		copied, the payload goes straight
+ *		  		from the stack's buffer.
+ *
+ *		  NOTE:	An IP length shorter than its header
+ *		  		is refused, and the kernel is only
+ *		  		asked to checksum or segment a UDP or
+ *		  		ICMP header that is all there.
+ *
+ *	Input:
+ * 		buffer		Frame (no CRC)
+ *		buffer_len	Length of frame
+ *		segment_len	UDP payload per segment (0 = dont)
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE
+ ***************************************************/
+static RETURN_STATUS tap_write(const uint8_t *buffer, uint16_t buffer_len, const uint16_t segment_len)
+{
+	struct virtio_net_hdr hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.gso_type = VIRTIO_NET_HDR_GSO_NONE;
+
+	uint8_t headers[ETH_HEADERLEN + 60];
+	uint16_t headers_len = 0;
+
+	if(buffer_len >= ETH_HEADERLEN + IP_HEADERLEN
+		&& buffer[ETH_PROTOCOL] == 0x08 && buffer[ETH_PROTOCOL + 1] == 0x00)
+	{
+		const uint8_t *ip = &buffer[TAP_IP];
+		const uint8_t ihl = (ip[IP_INCOMMING_HLEN_WORDS] & 0x0F) * 4;
+		const uint16_t ip_len = ((uint16_t)ip[2] << 8) | ip[3];
+
+		if(ihl < IP_HEADERLEN || ip_len < ihl || TAP_IP + ihl > buffer_len)
+		{
+			return FAILURE;
+		}
+
+		/* Drop the padding, the kernel doesnt want it */
+		if(TAP_IP + ip_len < buffer_len)
+		{
+			buffer_len = TAP_IP + ip_len;
+		}
+
+		/* IP header checksum */
+		headers_len = TAP_IP + ihl;
+		if(headers_len > buffer_len)
+		{
+			return FAILURE;
+		}
+
+		memcpy(headers, buffer, headers_len);
+		headers[TAP_IP + 10] = 0;
+		headers[TAP_IP + 11] = 0;
+		uint16_t ip_csum = ~tap_fold(tap_sum(&headers[TAP_IP], ihl, 0));
+		headers[TAP_IP + 10] = (uint8_t)(ip_csum >> 8);
+		headers[TAP_IP + 11] = (uint8_t)ip_csum;
+
+		/* Then the kernel does the rest, starting from what
+		 * is already in the checksum field */
+		const uint16_t payload_len = buffer_len - headers_len;
+		if(ip[IP_PROTOCOL] == IP_UDP && payload_len >= TAP_UDP_HEADERLEN)
+		{
+			hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+			hdr.csum_start = TAP_IP + ihl;
+			hdr.csum_offset = 6;
+		}
+		else if(ip[IP_PROTOCOL] == IP_ICMP && payload_len >= 4)
+		{
+			hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+			hdr.csum_start = TAP_IP + ihl;
+			hdr.csum_offset = 2;
+		}
+
+		if(segment_len != 0)
+		{
+			if(ip[IP_PROTOCOL] != IP_UDP || payload_len < TAP_UDP_HEADERLEN)
+			{
+				return FAILURE;
+			}
+
+			hdr.gso_type = VIRTIO_NET_HDR_GSO_UDP_L4;
+			hdr.gso_size = segment_len;
+			hdr.hdr_len = TAP_IP + ihl + TAP_UDP_HEADERLEN;
+		}
+	}
+
+	struct iovec iov[3];
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = headers;
+	iov[1].iov_len = headers_len;
+	iov[2].iov_base = (void *)&buffer[headers_len];
+	iov[2].iov_len = buffer_len - headers_len;
+
+	ssize_t written = writev(tap_fd, iov, 3);
+	return (written == (ssize_t)(sizeof(hdr) + buffer_len)) ? SUCCESS : FAILURE;
+}
+
+
+#ifdef MAC_POLL
+/****************************************************
+ *    Function: poll_mac
+ * Description: Read up to budget frames (a GRO batch
+ * 				counts as one).
+ *
+ *	Input:
+ *		budget		Most frames to read
+ *
+ *	Return:
+ * 		Frames read
+ ***************************************************/
+uint16_t poll_mac(const uint16_t budget)
+{
+	uint16_t done = 0;
+	while(done < budget && tap_rx_one())
+	{
+		done++;
+	}
+
+	return done;
+}
+
+
+/****************************************************
+ *    Function: mac_rx_irq
+ * Description: There is no receive interrupt to turn
+ * 				on, so ask to be polled again straight
+ * 				away.  Poll mode is always busy polling.
+ *
+ *	Input:
+ *		enable
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+void mac_rx_irq(const bool enable)
+{
+	if(enable)
+	{
+		ether_rx_schedule();
+	}
+}
+#endif
+
+
+/****************************************************
+ *    Function: tap_rx_one
+ * Description: Read one frame from the kernel (waits
+ * 				for it unless non-blocking) and pass
+ * 				it up.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		true		Read something
+ * 		false		Nothing there, or the tap has gone
+ ***************************************************/
+static bool tap_rx_one(void)
+{
+	static uint8_t rx_buffer[sizeof(struct virtio_net_hdr) + TAP_MAX_FRAME];
+
+	/* 0 is end of file, the tap has gone */
+	ssize_t len = read(tap_fd, rx_buffer, sizeof(rx_buffer));
+	if(len <= 0)
+	{
+		return false;
+	}
+
+	/* A runt is read and thrown away */
+	if(len >= (ssize_t)(sizeof(struct virtio_net_hdr) + ETH_HEADERLEN))
+	{
+		struct virtio_net_hdr hdr;
+		memcpy(&hdr, rx_buffer, sizeof(hdr));
+
+		tap_deliver(&rx_buffer[sizeof(hdr)], (uint32_t)(len - sizeof(hdr)), &hdr);
+	}
+
+	return true;
+}
+
+
+#ifndef MAC_POLL
+/****************************************************
+ *    Function: tap_rx
+ * Description: Receive thread.  Reads frames from
+ * 				the kernel and passes them up.
+ ***************************************************/
+static void *tap_rx(void *arg)
+{
+	/* Run in the context we were started from */
+	sip_ctx_use((struct sip_ctx *)arg);
+
+	while(tap_rx_one());
+
+	return NULL;
+}
+#endif
+
+
+/****************************************************
+ *    Function: tap_deliver
+ * Description: Pass a frame up, checking checksums
+ * 				if the kernel hasnt already.
+ *
+ *	Input:
+ * 		frame		Frame
+ *		frame_len	Length of frame
+ *		hdr			virtio_net_hdr that came with it
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+static void tap_deliver(uint8_t *frame, uint32_t frame_len, const struct virtio_net_hdr *hdr)
+{
+	if(cb_frame_complete == NULL)
+	{
+		return;
+	}
+
+	/* A GRO batch, which the stack can only take one at a time */
+	if((hdr->gso_type & ~VIRTIO_NET_HDR_GSO_ECN) == VIRTIO_NET_HDR_GSO_UDP_L4)
+	{
+		tap_deliver_gro(frame, frame_len, hdr->gso_size);
+		return;
+	}
+
+	/* DATA_VALID:  the kernel has checked it.
+	 * NEEDS_CSUM: it came from this host and hasn't been
+	 * 			   finished, so there is nothing to check. */
+	if(!(hdr->flags & (VIRTIO_NET_HDR_F_DATA_VALID | VIRTIO_NET_HDR_F_NEEDS_CSUM)))
+	{
+		if(!tap_checksums_ok(frame, frame_len))
+		{
+			return;
+		}
+	}
+
+	(cb_frame_complete)(frame, frame_len);
+}
+
+
+/****************************************************
+ *    Function: tap_deliver_gro
+ * Description: Split a GRO batch back into separate
+ * 				UDP datagrams.
+ *
+ *		  NOTE:	Checksums are not redone, they were
+ *		  		checked as a batch and the stack
+ *		  		trusts us (MAC_OFFLOAD_RX_CSUM).
+ *
+ *	Input:
+ * 		frame		One large frame
+ *		frame_len	Length of frame
+ *		segment_len	UDP payload per datagram
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+static void tap_deliver_gro(uint8_t *frame, uint32_t frame_len, const uint16_t segment_len)
+{
+	if(frame_len < ETH_HEADERLEN + IP_HEADERLEN + TAP_UDP_HEADERLEN || segment_len == 0)
+	{
+		return;
+	}
+
+	const uint8_t ihl = (frame[TAP_IP + IP_INCOMMING_HLEN_WORDS] & 0x0F) * 4;
+	const uint16_t headers_len = TAP_IP + ihl + TAP_UDP_HEADERLEN;
+	if(ihl < IP_HEADERLEN || headers_len > frame_len || frame[TAP_IP + IP_PROTOCOL] != IP_UDP)
+	{
+		return;
+	}
+
+	static uint8_t segment[ETH_HEADERLEN + 60 + TAP_UDP_HEADERLEN + TAP_MAX_FRAME];
+
+	uint32_t offset = headers_len;
+	while(offset < frame_len)
+	{
+		uint32_t payload_len = frame_len - offset;
+		if(payload_len > segment_len)
+		{
+			payload_len = segment_len;
+		}
+
+		memcpy(segment, frame, headers_len);
+		memcpy(&segment[headers_len], &frame[offset], payload_len);
+
+		/* Fix up the lengths, and say there's no UDP checksum */
+		uint16_t ip_len = ihl + TAP_UDP_HEADERLEN + payload_len;
+		segment[TAP_IP + 2] = (uint8_t)(ip_len >> 8);
+		segment[TAP_IP + 3] = (uint8_t)ip_len;
+
+		uint16_t udp_len = TAP_UDP_HEADERLEN + payload_len;
+		segment[TAP_IP + ihl + 4] = (uint8_t)(udp_len >> 8);
+		segment[TAP_IP + ihl + 5] = (uint8_t)udp_len;
+		segment[TAP_IP + ihl + 6] = 0;
+		segment[TAP_IP + ihl + 7] = 0;
+
+		(cb_frame_complete)(segment, headers_len + payload_len);
+
+		offset += payload_len;
+	}
+}
+
+
+/****************************************************
+ *    Function: tap_checksums_ok
+ * Description: Check IP, UDP and ICMP checksums of a
+ * 				frame the kernel hasnt vouched for.
+ *
+ *	Input:
+ * 		frame		Frame
+ *		frame_len	Length of frame
+ *
+ *	Return:
+ * 		true		If OK, or not IP
+ * 		false		If a checksum is wrong
+ ***************************************************/
+static bool tap_checksums_ok(const uint8_t *frame, const uint16_t frame_len)
+{
+	if(frame_len < ETH_HEADERLEN + IP_HEADERLEN
+		|| frame[ETH_PROTOCOL] != 0x08 || frame[ETH_PROTOCOL + 1] != 0x00)
+	{
+		return true;
+	}
+
+	const uint8_t *ip = &frame[TAP_IP];
+	const uint8_t ihl = (ip[IP_INCOMMING_HLEN_WORDS] & 0x0F) * 4;
+	const uint16_t ip_len = ((uint16_t)ip[2] << 8) | ip[3];
+
+	if(ihl < IP_HEADERLEN || ip_len < ihl || TAP_IP + ip_len > frame_len)
+	{
+		return false;
+	}
+
+	/* A good header adds up to 0xFFFF */
+	if(tap_fold(tap_sum(ip, ihl, 0)) != 0xFFFF)
+	{
+		return false;
+	}
+
+	const uint8_t *payload = &ip[ihl];
+	const uint16_t payload_len = ip_len - ihl;
+
+	if(ip[IP_PROTOCOL] == IP_UDP && payload_len >= TAP_UDP_HEADERLEN)
+	{
+		/* Checksum is optional */
+		if(payload[6] == 0 && payload[7] == 0)
+		{
+			return true;
+		}
+
+		/* Pseudo-header: addresses, protocol, length */
+		uint32_t sum = tap_sum(&ip[12], 8, 0);
+		sum += IP_UDP;
+		sum += payload_len;
+
+		return (tap_fold(tap_sum(payload, payload_len, sum)) == 0xFFFF);
+	}
+	else if(ip[IP_PROTOCOL] == IP_ICMP)
+	{
+		return (tap_fold(tap_sum(payload, payload_len, 0)) == 0xFFFF);
+	}
+
+	return true;
+}
+
+
+/****************************************************
+ *    Function: tap_sum
+ * Description: Add up 16-bit big endian words (odd
+ * 				byte at the end is padded with zero).
+ *
+ *	Input:
+ * 		buffer
+ *		len
+ *		sum		Sum so far
+ *
+ *	Return:
+ * 		uint32_t	New sum (not folded)
+ ***************************************************/
+static uint32_t tap_sum(const uint8_t *buffer, uint16_t len, uint32_t sum)
+{
+	uint16_t i = 0;
+	for(i = 0; i + 1 < len; i += 2)
+	{
+		sum += ((uint32_t)buffer[i] << 8) | buffer[i + 1];
+	}
+
+	if(len & 1)
+	{
+		sum += (uint32_t)buffer[len - 1] << 8;
+	}
+
+	return sum;
+}
+
+
+/****************************************************
+ *    Function: tap_fold
+ * Description: Fold the carries back into 16 bits.
+ ***************************************************/
+static uint16_t tap_fold(uint32_t sum)
+{
+	while(sum >> 16)
+	{
+		sum = (sum & 0x0000FFFF) + (sum >> 16);
+	}
+
+	return (uint16_t)sum;
+}
+
+
+/****************************************************
+ *    Function: tap_timer
+ * Description: 1ms tick thread.  Sleeps to absolute
+ * 				times so the ticks dont drift.
+ ***************************************************/
+static void *tap_timer(void *arg)
+{
+	/* Run in the context we were started from */
+	sip_ctx_use((struct sip_ctx *)arg);
+
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while(cb_timer != NULL)
+	{
+		next.tv_nsec += 1000000;
+		if(next.tv_nsec >= 1000000000)
+		{
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		(cb_timer)();
+	}
+
+	return NULL;
+}
@@ -0,0 +1,941 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: linux_xdp.c
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Linux AF_XDP socket as the MAC.
+ *
+ *				 Frames are DMA'd by the NIC straight into a
+ *				 block of our memory (the UMEM) and handed to
+ *				 ether_frame_available where they lie, so
+ *				 nothing is copied on the way in.  On the way
+ *				 out the frame is copied once into the UMEM
+ *				 (the stack builds frames in its own buffers).
+ *
+ *				 Four rings are shared with the kernel:
+ *				  fill		 - empty UMEM frames for the NIC
+ *				  rx		 - frames that have arrived
+ *				  tx		 - frames to send
+ *				  completion - sent frames, free to reuse
+ *
+ *				 The UMEM is split in two: the first half only
+ *				 ever goes round fill -> rx -> fill, the second
+ *				 half tx -> completion -> tx.
+ *
+ *				 No libxdp/libbpf is needed.  Unless
+ *				 XDP_PINNED_MAP is set, a four instruction XDP
+ *				 program (redirect this queue to our socket)
+ *				 is loaded and attached with bpf() directly.
+ *				 Otherwise our socket goes into an XSKMAP
+ *				 pinned by some other program.
+ *
+ *				 Options (define at compile time):
+ *				  XDP_IFNAME		Interface (default eth0)
+ *				  XDP_QUEUE			NIC queue to bind to
+ *				  XDP_PINNED_MAP	Path of a pinned XSKMAP
+ *				  XDP_BUSY_POLL		Spin on the socket instead
+ *				  					of sleeping in poll()
+ *
+ *				 In poll mode (MAC_POLL) there is no receive
+ *				 thread; the program busy polls with
+ *				 ether_poll instead.
+ *
+ *  History
+ *	DB/19 Oct 2026	init_uc undoes itself on failure
+ *	DB/19 Oct 2026	Whole batches handed up at once (MAC_RX_VECTOR)
+ *	DB/19 Oct 2026	UMEM from huge pages on the NIC's node
+ *	DB/19 Oct 2026	Added poll mode (MAC_POLL)
+ *	DB/19 Oct 2026	Threads run in the stack context of init_mac
+ *	DB/19 Oct 2026	Started
+ ****************************************************************************/
+
+#include "../link_uc_mac.h"
+#include "../ethernet.h"
+#include "../sip_ctx.h"
+#include "linux_hugepage.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+#include <linux/if_xdp.h>
+
+#ifndef AF_XDP
+#define AF_XDP			44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP			283
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL	69
+#define SO_BUSY_POLL_BUDGET	70
+#endif
+
+
+/* Interface and queue to attach to */
+#ifndef XDP_IFNAME
+#define XDP_IFNAME		"eth0"
+#endif
+
+#ifndef XDP_QUEUE
+#define XDP_QUEUE		0
+#endif
+
+/* UMEM frames (half rx, half tx) and their size */
+#ifndef XDP_FRAME_COUNT
+#define XDP_FRAME_COUNT	4096
+#endif
+
+#ifndef XDP_FRAME_SIZE
+#define XDP_FRAME_SIZE	2048
+#endif
+
+/* Slots in each ring (power of 2) */
+#define XDP_RING_SIZE	(XDP_FRAME_COUNT / 2)
+
+/* Frames to take off the rx ring in one go */
+#define XDP_RX_BATCH	64
+
+/* Busy poll settings (us, frames) */
+#define XDP_BUSY_POLL_US		20
+#define XDP_BUSY_POLL_BUDGET	XDP_RX_BATCH
+
+
+/** One of the four rings shared with the kernel **/
+struct xdp_ring
+{
+	uint32_t *producer;
+	uint32_t *consumer;
+	uint32_t *flags;
+	void *ring;
+	uint32_t mask;
+	void *map;
+	size_t map_len;
+};
+
+
+/* 'Private' variables */
+
+// Don't keep initialising
+static bool bUCInitialised = false;
+static bool bMACInitialised = false;
+
+static int xsk_fd = -1;
+static int link_fd = -1;
+
+static uint8_t *umem = NULL;
+static size_t umem_page_size = 0;
+static struct xdp_ring fill_ring, comp_ring, rx_ring, tx_ring;
+
+// Free tx frames (UMEM addresses)
+static uint64_t tx_free[XDP_RING_SIZE];
+static uint32_t tx_free_count = 0;
+
+// Stack can send from the rx thread and the main thread
+static pthread_mutex_t tx_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Frame complete callback
+static void (*cb_frame_complete)(uint8_t *buffer, const uint16_t buffer_len) = NULL;
+#ifdef MAC_RX_VECTOR
+static void (*cb_frames_complete)(struct mac_frame *frames, const uint16_t count) = NULL;
+#endif
+
+// Timer callback
+static void (*cb_timer)(void) = NULL;
+
+#ifndef MAC_POLL
+static pthread_t rx_thread;
+#endif
+static pthread_t timer_thread;
+
+
+/* 'Private' functions */
+static RETURN_STATUS xdp_map_ring(struct xdp_ring *ring, const struct xdp_ring_offset *off, const size_t entry_size, const uint64_t pgoff);
+static RETURN_STATUS xdp_attach(const int ifindex);
+static void xdp_release(void);
+static int xdp_bpf(const int cmd, union bpf_attr *attr);
+static void xdp_reclaim_tx(void);
+static void xdp_kick_tx(void);
+static uint32_t xdp_rx_batch(const uint32_t budget);
+#ifndef MAC_POLL
+static void *xdp_rx(void *arg);
+#endif
+static void *xdp_timer(void *arg);
+
+
+/****************************************************
+ *    Function: init_uc
+ * Description: Set up the UMEM, the rings and the
+ * 				socket, then point the NIC queue at it.
+ *
+ *		  NOTE:	Needs CAP_NET_ADMIN and CAP_BPF (or
+ *		  		root).  On failure everything done so
+ *		  		far is undone, so it can be tried again.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE
+ ***************************************************/
+RETURN_STATUS init_uc()
+{
+	if(bUCInitialised == true)
+		return SUCCESS;
+
+	int ifindex = if_nametoindex(XDP_IFNAME);
+	if(ifindex == 0)
+	{
+		return FAILURE;
+	}
+
+	xsk_fd = socket(AF_XDP, SOCK_RAW, 0);
+	if(xsk_fd < 0)
+	{
+		return FAILURE;
+	}
+
+	/* The UMEM, in huge pages on the NIC's node (page
+	 * aligned as the kernel wants) */
+	umem = hugepage_alloc((size_t)XDP_FRAME_COUNT * XDP_FRAME_SIZE, XDP_IFNAME, &umem_page_size);
+	if(umem == NULL)
+	{
+		xdp_release();
+		return FAILURE;
+	}
+
+	struct xdp_umem_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (uint64_t)(uintptr_t)umem;
+	reg.len = (uint64_t)XDP_FRAME_COUNT * XDP_FRAME_SIZE;
+	reg.chunk_size = XDP_FRAME_SIZE;
+	reg.headroom = 0;
+
+	int ring_size = XDP_RING_SIZE;
+	if(setsockopt(xsk_fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0
+		|| setsockopt(xsk_fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) < 0
+		|| setsockopt(xsk_fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(ring_size)) < 0
+		|| setsockopt(xsk_fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) < 0
+		|| setsockopt(xsk_fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(ring_size)) < 0)
+	{
+		xdp_release();
+		return FAILURE;
+	}
+
+	/* Map the rings */
+	struct xdp_mmap_offsets off;
+	socklen_t off_len = sizeof(off);
+	if(getsockopt(xsk_fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &off_len) < 0
+		|| xdp_map_ring(&fill_ring, &off.fr, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) != SUCCESS
+		|| xdp_map_ring(&comp_ring, &off.cr, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) != SUCCESS
+		|| xdp_map_ring(&rx_ring, &off.rx, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) != SUCCESS
+		|| xdp_map_ring(&tx_ring, &off.tx, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING) != SUCCESS)
+	{
+		xdp_release();
+		return FAILURE;
+	}
+
+	/* Give the NIC the first half of the UMEM to fill */
+	uint64_t *fill = (uint64_t *)fill_ring.ring;
+	uint32_t i = 0;
+	for(i = 0; i < XDP_RING_SIZE; i++)
+	{
+		fill[i] = (uint64_t)i * XDP_FRAME_SIZE;
+	}
+	__atomic_store_n(fill_ring.producer, XDP_RING_SIZE, __ATOMIC_RELEASE);
+
+	/* And keep the second half for sending */
+	for(i = 0; i < XDP_RING_SIZE; i++)
+	{
+		tx_free[i] = (uint64_t)(XDP_RING_SIZE + i) * XDP_FRAME_SIZE;
+	}
+	tx_free_count = XDP_RING_SIZE;
+
+	/* Zero copy if the driver can, copy mode if it can't */
+	struct sockaddr_xdp sxdp;
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = ifindex;
+	sxdp.sxdp_queue_id = XDP_QUEUE;
+	sxdp.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+
+	if(bind(xsk_fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0)
+	{
+		sxdp.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+		if(bind(xsk_fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0)
+		{
+			xdp_release();
+			return FAILURE;
+		}
+	}
+
+#ifdef XDP_BUSY_POLL
+	int opt = 1;
+	setsockopt(xsk_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &opt, sizeof(opt));
+	opt = XDP_BUSY_POLL_US;
+	setsockopt(xsk_fd, SOL_SOCKET, SO_BUSY_POLL, &opt, sizeof(opt));
+	opt = XDP_BUSY_POLL_BUDGET;
+	setsockopt(xsk_fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &opt, sizeof(opt));
+#endif
+
+	if(xdp_attach(ifindex) != SUCCESS)
+	{
+		xdp_release();
+		return FAILURE;
+	}
+
+	bUCInitialised = true;
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: init_mac
+ * Description: Start the receive thread.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE
+ ***************************************************/
+RETURN_STATUS init_mac()
+{
+	if(bMACInitialised)
+		return SUCCESS;
+
+	if(xsk_fd < 0)
+	{
+		return FAILURE;
+	}
+
+#ifndef MAC_POLL
+	if(pthread_create(&rx_thread, NULL, &xdp_rx, sip_ctx_get()) != 0)
+	{
+		return FAILURE;
+	}
+#endif
+
+	bMACInitialised = true;
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: get_mac_offload
+ * Description: AF_XDP leaves all the checksums to us.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		MAC_OFFLOAD_NONE
+ ***************************************************/
+uint8_t get_mac_offload(void)
+{
+	return MAC_OFFLOAD_NONE;
+}
+
+
+/****************************************************
+ *    Function: set_frame_complete
+ * Description: Sets the frame complete callback
+ *
+ *	Input:
+ * 		frame_complete_callback		Callback to function
+ *
+ *	Return:
+ * 		SUCCESS
+ ***************************************************/
+RETURN_STATUS set_frame_complete(void (*frame_complete_callback)(uint8_t *buffer, const uint16_t buffer_len))
+{
+	cb_frame_complete = frame_complete_callback;
+	return SUCCESS;
+}
+
+
+#ifdef MAC_RX_VECTOR
+/****************************************************
+ *    Function: set_frames_complete
+ * Description: Sets the callback for a whole batch of
+ * 				frames, used instead of frame_complete.
+ *
+ *	Input:
+ * 		frames_complete_callback	Callback to function
+ *
+ *	Return:
+ * 		SUCCESS
+ ***************************************************/
+RETURN_STATUS set_frames_complete(void (*frames_complete_callback)(struct mac_frame *frames, const uint16_t count))
+{
+	cb_frames_complete = frames_complete_callback;
+	return SUCCESS;
+}
+#endif
+
+
+/****************************************************
+ *    Function: register_ms_callback
+ * Description: Call handler every ms (from a thread).
+ *
+ *	Input:
+ * 		handler
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE
+ ***************************************************/
+RETURN_STATUS register_ms_callback(void(*handler)(void))
+{
+	bool start = (cb_timer == NULL);
+	cb_timer = handler;
+
+	if(start && pthread_create(&timer_thread, NULL, &xdp_timer, sip_ctx_get()) != 0)
+	{
+		cb_timer = NULL;
+		return FAILURE;
+	}
+
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: send_frame
+ * Description: Copy a frame into a free UMEM frame
+ * 				and put it on the tx ring.
+ *
+ *	Input:
+ * 		buffer		Frame (with space for the CRC)
+ *		buffer_len	Length of buffer
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		Too big, or no room (tx ring full)
+ ***************************************************/
+RETURN_STATUS send_frame(const uint8_t *buffer, const uint16_t buffer_len)
+{
+	/* The NIC adds the FCS */
+	uint16_t frame_len = buffer_len - ETH_CRCLEN;
+	if(frame_len > XDP_FRAME_SIZE)
+	{
+		return FAILURE;
+	}
+
+	pthread_mutex_lock(&tx_lock);
+
+	if(tx_free_count == 0)
+	{
+		xdp_reclaim_tx();
+
+		if(tx_free_count == 0)
+		{
+			/* Nudge the kernel so there's room next time */
+			xdp_kick_tx();
+			pthread_mutex_unlock(&tx_lock);
+			return FAILURE;
+		}
+	}
+
+	uint64_t addr = tx_free[--tx_free_count];
+	memcpy(&umem[addr], buffer, frame_len);
+
+	uint32_t prod = *tx_ring.producer;
+	struct xdp_desc *desc = &((struct xdp_desc *)tx_ring.ring)[prod & tx_ring.mask];
+	desc->addr = addr;
+	desc->len = frame_len;
+	desc->options = 0;
+
+	__atomic_store_n(tx_ring.producer, prod + 1, __ATOMIC_RELEASE);
+
+	xdp_kick_tx();
+
+	pthread_mutex_unlock(&tx_lock);
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: read_buffer
+ * Description: Not used, frames arrive through the
+ * 				frame complete callback.
+ ***************************************************/
+RETURN_STATUS read_buffer(uint8_t *buffer, const unsigned int buffer_len, unsigned int *actual_len, const unsigned int timeout_ms)
+{
+	(void)buffer;
+	(void)buffer_len;
+	(void)actual_len;
+	(void)timeout_ms;
+
+	return NOT_AVAILABLE;
+}
+
+
+/****************************************************
+ *    Function: xdp_map_ring
+ * Description: mmap one of the rings.
+ *
+ *	Input:
+ * 		ring		Ring to fill in
+ *		off			Offsets from XDP_MMAP_OFFSETS
+ *		entry_size	Size of each slot
+ *		pgoff		Which ring
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE
+ ***************************************************/
+static RETURN_STATUS xdp_map_ring(struct xdp_ring *ring, const struct xdp_ring_offset *off, const size_t entry_size, const uint64_t pgoff)
+{
+	ring->map_len = off->desc + (XDP_RING_SIZE * entry_size);
+	ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE,
+						MAP_SHARED | MAP_POPULATE, xsk_fd, pgoff);
+	if(ring->map == MAP_FAILED)
+	{
+		ring->map = NULL;
+		return FAILURE;
+	}
+
+	ring->producer = (uint32_t *)((uint8_t *)ring->map + off->producer);
+	ring->consumer = (uint32_t *)((uint8_t *)ring->map + off->consumer);
+	ring->flags = (uint32_t *)((uint8_t *)ring->map + off->flags);
+	ring->ring = (uint8_t *)ring->map + off->desc;
+	ring->mask = XDP_RING_SIZE - 1;
+
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: xdp_bpf
+ * Description: bpf() system call (glibc has no
+ * 				wrapper).
+ ***************************************************/
+static int xdp_bpf(const int cmd, union bpf_attr *attr)
+{
+	return (int)syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+
+/****************************************************
+ *    Function: xdp_attach
+ * Description: Get frames on our queue sent to our
+ * 				socket.
+ *
+ * 				Either put the socket in someone
+ * 				else's pinned XSKMAP, or load our own
+ * 				map and program:
+ *
+ *				  r2 = ctx->rx_queue_index
+ *				  r1 = map
+ *				  r3 = XDP_PASS
+ *				  return bpf_redirect_map(r1, r2, r3)
+ *
+ * 				which sends anything on a queue without
+ * 				a socket on to the kernel as normal.
+ *
+ *	Input:
+ * 		ifindex		Interface
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE
+ ***************************************************/
+static RETURN_STATUS xdp_attach(const int ifindex)
+{
+	union bpf_attr attr;
+	int map_fd = -1;
+
+#ifdef XDP_PINNED_MAP
+	(void)ifindex;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.pathname = (uint64_t)(uintptr_t)XDP_PINNED_MAP;
+	map_fd = xdp_bpf(BPF_OBJ_GET, &attr);
+	if(map_fd < 0)
+	{
+		return FAILURE;
+	}
+#else
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(uint32_t);
+	attr.max_entries = XDP_QUEUE + 1;
+	map_fd = xdp_bpf(BPF_MAP_CREATE, &attr);
+	if(map_fd < 0)
+	{
+		return FAILURE;
+	}
+
+	struct bpf_insn prog[] =
+	{
+		/* r2 = *(u32 *)(r1 + offsetof(struct xdp_md, rx_queue_index)) */
+		{ BPF_LDX | BPF_MEM | BPF_W, 2, 1, 16, 0 },
+		/* r1 = map (two slots) */
+		{ BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, map_fd },
+		{ 0, 0, 0, 0, 0 },
+		/* r3 = XDP_PASS */
+		{ BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS },
+		{ BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map },
+		{ BPF_JMP | BPF_EXIT, 0, 0, 0, 0 }
+	};
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uint64_t)(uintptr_t)prog;
+	attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+	attr.license = (uint64_t)(uintptr_t)"GPL";
+	int prog_fd = xdp_bpf(BPF_PROG_LOAD, &attr);
+	if(prog_fd < 0)
+	{
+		close(map_fd);
+		return FAILURE;
+	}
+
+	/* Attached for as long as link_fd is open (ie until we exit) */
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = prog_fd;
+	attr.link_create.target_ifindex = ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	link_fd = xdp_bpf(BPF_LINK_CREATE, &attr);
+	close(prog_fd);
+	if(link_fd < 0)
+	{
+		close(map_fd);
+		return FAILURE;
+	}
+#endif
+
+	uint32_t key = XDP_QUEUE;
+	uint32_t value = (uint32_t)xsk_fd;
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map_fd;
+	attr.key = (uint64_t)(uintptr_t)&key;
+	attr.value = (uint64_t)(uintptr_t)&value;
+	int ret = xdp_bpf(BPF_MAP_UPDATE_ELEM, &attr);
+
+	close(map_fd);
+	return (ret == 0) ? SUCCESS : FAILURE;
+}
+
+
+/****************************************************
+ *    Function: xdp_release
+ * Description: Undo whatever init_uc got done: detach,
+ * 				unmap the rings, close the socket and
+ * 				free the UMEM.
+ ***************************************************/
+static void xdp_release(void)
+{
+	if(link_fd >= 0)
+	{
+		close(link_fd);
+		link_fd = -1;
+	}
+
+	struct xdp_ring *rings[] = { &fill_ring, &comp_ring, &rx_ring, &tx_ring };
+	uint8_t i = 0;
+	for(i = 0; i < sizeof(rings) / sizeof(rings[0]); i++)
+	{
+		if(rings[i]->map != NULL)
+		{
+			munmap(rings[i]->map, rings[i]->map_len);
+		}
+		memset(rings[i], 0, sizeof(struct xdp_ring));
+	}
+
+	/* The UMEM stays registered until the socket goes */
+	if(xsk_fd >= 0)
+	{
+		close(xsk_fd);
+		xsk_fd = -1;
+	}
+
+	if(umem != NULL)
+	{
+		hugepage_free(umem, (size_t)XDP_FRAME_COUNT * XDP_FRAME_SIZE, umem_page_size);
+		umem = NULL;
+	}
+
+	tx_free_count = 0;
+}
+
+
+/****************************************************
+ *    Function: xdp_reclaim_tx
+ * Description: Take sent frames off the completion
+ * 				ring, ready to send again.
+ *
+ *		  NOTE:	Call with tx_lock held.
+ ***************************************************/
+static void xdp_reclaim_tx(void)
+{
+	uint32_t cons = *comp_ring.consumer;
+	uint32_t prod = __atomic_load_n(comp_ring.producer, __ATOMIC_ACQUIRE);
+	const uint64_t *comp = (const uint64_t *)comp_ring.ring;
+
+	while(cons != prod && tx_free_count < XDP_RING_SIZE)
+	{
+		tx_free[tx_free_count++] = comp[cons & comp_ring.mask];
+		cons++;
+	}
+
+	__atomic_store_n(comp_ring.consumer, cons, __ATOMIC_RELEASE);
+}
+
+
+/****************************************************
+ *    Function: xdp_kick_tx
+ * Description: Wake the kernel up to send, but only
+ * 				if it has asked (need_wakeup).  In
+ * 				zero copy mode the NIC's own interrupts
+ * 				usually keep it going without a syscall.
+ ***************************************************/
+static void xdp_kick_tx(void)
+{
+	if(__atomic_load_n(tx_ring.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP)
+	{
+		sendto(xsk_fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+	}
+}
+
+
+#ifdef MAC_POLL
+/****************************************************
+ *    Function: poll_mac
+ * Description: Read up to budget frames.  When the
+ * 				rx ring is empty, recvfrom() runs the
+ * 				NIC's NAPI poll here (as XDP_BUSY_POLL).
+ *
+ *	Input:
+ *		budget		Most frames to read
+ *
+ *	Return:
+ * 		Frames read
+ ***************************************************/
+uint16_t poll_mac(const uint16_t budget)
+{
+	uint16_t done = 0;
+	while(done < budget)
+	{
+		uint32_t count = xdp_rx_batch(budget - done);
+		if(count == 0)
+		{
+			recvfrom(xsk_fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+			break;
+		}
+
+		done += count;
+	}
+
+	return done;
+}
+
+
+/****************************************************
+ *    Function: mac_rx_irq
+ * Description: There is no receive interrupt to turn
+ * 				on, so ask to be polled again straight
+ * 				away.  Poll mode is always busy polling.
+ *
+ *	Input:
+ *		enable
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+void mac_rx_irq(const bool enable)
+{
+	if(enable)
+	{
+		ether_rx_schedule();
+	}
+}
+#endif
+
+
+/****************************************************
+ *    Function: xdp_rx_batch
+ * Description: Hand up to budget frames up in place,
+ * 				then give the UMEM frames back to the
+ * 				NIC.
+ *
+ *	Input:
+ *		budget		Most frames to read
+ *
+ *	Return:
+ * 		Frames read
+ ***************************************************/
+static uint32_t xdp_rx_batch(const uint32_t budget)
+{
+	const struct xdp_desc *rx = (const struct xdp_desc *)rx_ring.ring;
+	uint64_t *fill = (uint64_t *)fill_ring.ring;
+
+	uint32_t cons = *rx_ring.consumer;
+	uint32_t avail = __atomic_load_n(rx_ring.producer, __ATOMIC_ACQUIRE) - cons;
+
+	if(avail == 0)
+	{
+		return 0;
+	}
+
+	if(avail > XDP_RX_BATCH)
+	{
+		avail = XDP_RX_BATCH;
+	}
+	if(avail > budget)
+	{
+		avail = budget;
+	}
+
+	uint32_t i = 0;
+#ifdef MAC_RX_VECTOR
+	if(cb_frames_complete != NULL)
+	{
+		struct mac_frame frames[XDP_RX_BATCH];
+		for(i = 0; i < avail; i++)
+		{
+			const struct xdp_desc *desc = &rx[(cons + i) & rx_ring.mask];
+			frames[i].buffer = &umem[desc->addr];
+			frames[i].len = (uint16_t)desc->len;
+		}
+
+		(cb_frames_complete)(frames, (uint16_t)avail);
+	}
+	else
+#endif
+	for(i = 0; i < avail; i++)
+	{
+		const struct xdp_desc *desc = &rx[(cons + i) & rx_ring.mask];
+
+		if(cb_frame_complete != NULL)
+		{
+			(cb_frame_complete)(&umem[desc->addr], (uint16_t)desc->len);
+		}
+	}
+
+	/* Same frames go straight back on the fill ring.  Both
+	 * rings are the same size and only these frames go round
+	 * them, so there is always room. */
+	uint32_t fill_prod = *fill_ring.producer;
+	for(i = 0; i < avail; i++)
+	{
+		uint64_t addr = rx[(cons + i) & rx_ring.mask].addr;
+		fill[(fill_prod + i) & fill_ring.mask] = addr - (addr % XDP_FRAME_SIZE);
+	}
+
+	__atomic_store_n(rx_ring.consumer, cons + avail, __ATOMIC_RELEASE);
+	__atomic_store_n(fill_ring.producer, fill_prod + avail, __ATOMIC_RELEASE);
+
+	if(__atomic_load_n(fill_ring.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP)
+	{
+		recvfrom(xsk_fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+	}
+
+	/* Keep the tx side moving too */
+	pthread_mutex_lock(&tx_lock);
+	xdp_reclaim_tx();
+	pthread_mutex_unlock(&tx_lock);
+
+	return avail;
+}
+
+
+#ifndef MAC_POLL
+/****************************************************
+ *    Function: xdp_rx
+ * Description: Receive thread.
+ *
+ * 				Normally sleeps in poll() when there is
+ * 				nothing to do.  With XDP_BUSY_POLL it
+ * 				spins on recvfrom(), which runs the NIC's
+ * 				NAPI poll in this thread instead of
+ * 				waiting for an interrupt.
+ ***************************************************/
+static void *xdp_rx(void *arg)
+{
+	/* Run in the context we were started from */
+	sip_ctx_use((struct sip_ctx *)arg);
+
+#ifndef XDP_BUSY_POLL
+	struct pollfd pfd;
+	pfd.fd = xsk_fd;
+	pfd.events = POLLIN;
+#endif
+
+	while(1)
+	{
+		if(xdp_rx_batch(XDP_RX_BATCH) == 0)
+		{
+#ifdef XDP_BUSY_POLL
+			recvfrom(xsk_fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+#else
+			/* The fill ring is kept full, but if the kernel ever
+			 * ran dry it wants a syscall to start again */
+			if(poll(&pfd, 1, 1000) < 0 && errno != EINTR)
+				break;
+#endif
+		}
+	}
+
+	return NULL;
+}
+#endif
+
+
+/****************************************************
+ *    Function: xdp_timer
+ * Description: 1ms tick thread.  Sleeps to absolute
+ * 				times so the ticks dont drift.
+ ***************************************************/
+static void *xdp_timer(void *arg)
+{
+	/* Run in the context we were started from */
+	sip_ctx_use((struct sip_ctx *)arg);
+
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while(cb_timer != NULL)
+	{
+		next.tv_nsec += 1000000;
+		if(next.tv_nsec >= 1000000000)
+		{
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		(cb_timer)();
+	}
+
+	return NULL;
+}
@@ -32,6 +32,10 @@
  *
  *
  *  History
+ *	DB/19-10-26	Packets built and read through struct arp_view
+ *	DB/19-10-26	Count changes to the table (get_arp_generation)
+ *	DB/19-10-26	State moved into the stack context
+ *	DB/19-10-26	Added set_arp_learn_callback
  *	DB/16-12-10	Removed linked list code in favour of fixed buffer.
  *				Use home-grown sr_memset, sr_memcpy, sr_memcmp
  *				Code now compiles (but probably doesnt work!) under avr-gcc.
@@ -44,17 +48,13 @@
 #include "ethernet.h"
 #include "timer.h"
 #include "ip.h"	/* To get our IP address, even though this is not an IP based protocol. */
+#include "sip_ctx.h"
 
 
-/** ARP table / linked list **/
-struct arp_element
-{
-	volatile uint8_t hw_addr[6];
-	volatile uint8_t	ip_addr[4];
-	volatile uint16_t timeout_id;
-	volatile bool valid;
-};
-static volatile struct arp_element arp_table[ARP_TABLE_SIZE];
+/*
+ * The ARP table, and who is told about addresses learnt
+ * from replies, are kept in the stack context (SIP->arp).
+ */
 
 
 
@@ -70,35 +70,34 @@ static volatile struct arp_element arp_table[ARP_TABLE_SIZE];
  ***************************************************/
 RETURN_STATUS init_arp()
 {
-    static bool bInitedARP = false;
-    if(bInitedARP)
+    if(SIP->arp.initialised)
     {
         /* Assume this is OK */
         return SUCCESS;
     }
     else
     {
-        bInitedARP = true;
+        SIP->arp.initialised = true;
     }
 
     /* Initialise ARP table */
     uint16_t i = 0;
     for(i = 0; i < ARP_TABLE_SIZE; i++)
     {
-            arp_table[i].valid = false;
-            arp_table[i].timeout_id = 0;
-
-            arp_table[i].hw_addr[0] = 0;
-            arp_table[i].hw_addr[1] = 0;
-            arp_table[i].hw_addr[2] = 0;
-            arp_table[i].hw_addr[3] = 0;
-            arp_table[i].hw_addr[4] = 0;
-            arp_table[i].hw_addr[5] = 0;
-
-            arp_table[i].ip_addr[0] = 0;
-            arp_table[i].ip_addr[1] = 0;
-            arp_table[i].ip_addr[2] = 0;
-            arp_table[i].ip_addr[3] = 0;
+            SIP->arp.table[i].valid = false;
+            SIP->arp.table[i].timeout_id = 0;
+
+            SIP->arp.table[i].hw_addr[0] = 0;
+            SIP->arp.table[i].hw_addr[1] = 0;
+            SIP->arp.table[i].hw_addr[2] = 0;
+            SIP->arp.table[i].hw_addr[3] = 0;
+            SIP->arp.table[i].hw_addr[4] = 0;
+            SIP->arp.table[i].hw_addr[5] = 0;
+
+            SIP->arp.table[i].ip_addr[0] = 0;
+            SIP->arp.table[i].ip_addr[1] = 0;
+            SIP->arp.table[i].ip_addr[2] = 0;
+            SIP->arp.table[i].ip_addr[3] = 0;
     }
 
     // Add callback for any ARP packets.
@@ -133,17 +132,25 @@ RETURN_STATUS add_arp_entry(const uint8_t *ip4_addr/*[4]*/, const uint8_t *hw_ad
 	uint16_t i = 0;
 	for(i = 0; i < ARP_TABLE_SIZE; i++)
 	{
-		if( sr_memcmp( arp_table[i].ip_addr, ip4_addr, 4) == true)
+		if( sr_memcmp( SIP->arp.table[i].ip_addr, ip4_addr, 4) == true)
 		{
 			/* 
 			 * Assume that it is being updated.
 			 * You probably wouldn't be this trusting with
 			 * a normal stack!
 			 */
-			kill_timer(arp_table[i].timeout_id, false);
-			arp_table[i].timeout_id = add_timer(timeout, &arp_timeout_callback);
-			sr_memcpy(arp_table[i].hw_addr, hw_addr, 6);
-			arp_table[i].valid = valid;
+			kill_timer(SIP->arp.table[i].timeout_id, false);
+			SIP->arp.table[i].timeout_id = add_timer(timeout, &arp_timeout_callback);
+
+			/* Only a real change, not a refresh, makes copies stale */
+			if(SIP->arp.table[i].valid != valid
+				|| sr_memcmp(SIP->arp.table[i].hw_addr, hw_addr, 6) == false)
+			{
+				SIP->arp.generation++;
+			}
+
+			sr_memcpy(SIP->arp.table[i].hw_addr, hw_addr, 6);
+			SIP->arp.table[i].valid = valid;
 
 			return SUCCESS;
 		}
@@ -153,17 +160,17 @@ RETURN_STATUS add_arp_entry(const uint8_t *ip4_addr/*[4]*/, const uint8_t *hw_ad
 	for(i = 0; i < ARP_TABLE_SIZE; i++)
 	{
 		/* Found one so check it is OK then set the data */
-		if(arp_table[i].valid == false && arp_table[i].timeout_id == 0)
+		if(SIP->arp.table[i].valid == false && SIP->arp.table[i].timeout_id == 0)
 		{
-			arp_table[i].timeout_id = add_timer(timeout, &arp_timeout_callback);
-			if(arp_table[i].timeout_id == TIMER_ERROR)
+			SIP->arp.table[i].timeout_id = add_timer(timeout, &arp_timeout_callback);
+			if(SIP->arp.table[i].timeout_id == TIMER_ERROR)
 			{
 				return FAILURE;
 			}
 
-			sr_memcpy(arp_table[i].hw_addr, hw_addr, 6);
-			sr_memcpy(arp_table[i].ip_addr, ip4_addr, 4);
-			arp_table[i].valid = valid;
+			sr_memcpy(SIP->arp.table[i].hw_addr, hw_addr, 6);
+			sr_memcpy(SIP->arp.table[i].ip_addr, ip4_addr, 4);
+			SIP->arp.table[i].valid = valid;
 
 			/* Assume all OK */
 			return SUCCESS;
@@ -177,6 +184,48 @@ RETURN_STATUS add_arp_entry(const uint8_t *ip4_addr/*[4]*/, const uint8_t *hw_ad
 }
 
 
+/****************************************************
+ *    Function: set_arp_learn_callback
+ * Description: Be told whenever a reply adds to the
+ * 				table, eg to share it with other
+ * 				instances of the stack.
+ *
+ * 				Entries added with add_arp_entry
+ * 				are not passed on.
+ *
+ *	Input:
+ * 		learnt		Callback (NULL to stop)
+ *
+ *	Return:
+ * 		SUCCESS
+ ***************************************************/
+RETURN_STATUS set_arp_learn_callback(void (*learnt)(const uint8_t *ip4_addr, const uint8_t *hw_addr))
+{
+	SIP->arp.learn = learnt;
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: get_arp_generation
+ * Description: A count that goes up whenever a known
+ * 				address changes or is removed.  Anything
+ * 				holding on to an address from
+ * 				resolve_ether_addr (eg a UDP flow) checks
+ * 				it hasn't moved before using it again.
+ *
+ *	Input:
+ * 		NONE
+ *
+ *	Return:
+ * 		The count
+ ***************************************************/
+uint32_t get_arp_generation(void)
+{
+	return SIP->arp.generation;
+}
+
+
 /****************************************************
  *    Function: resolve_ether_addr
  * Description: Get Ethernet addr from IP addr
@@ -218,14 +267,14 @@ RETURN_STATUS resolve_ether_addr(const uint8_t *ip4_addr/*[4]*/, uint8_t *hw_add
 	uint16_t i = 0;
 	for(i = 0; i < ARP_TABLE_SIZE; i++)
 	{
-		if( sr_memcmp( arp_table[i].ip_addr, ip4_addr, 4) == true)
+		if( sr_memcmp( SIP->arp.table[i].ip_addr, ip4_addr, 4) == true)
 		{
 			cached_exists = true;
 			cached_index = i;
 
-			if(arp_table[i].valid == true)
+			if(SIP->arp.table[i].valid == true)
 			{
-				sr_memcpy(hw_addr, arp_table[i].hw_addr, 6);
+				sr_memcpy(hw_addr, SIP->arp.table[i].hw_addr, 6);
 
 				return SUCCESS;
 			}
@@ -245,7 +294,7 @@ RETURN_STATUS resolve_ether_addr(const uint8_t *ip4_addr/*[4]*/, uint8_t *hw_add
 		/* Find ourselves again */
 		for(i = 0; i < ARP_TABLE_SIZE; i++)
 		{
-			if( sr_memcmp( arp_table[i].ip_addr, ip4_addr, 4) == true)
+			if( sr_memcmp( SIP->arp.table[i].ip_addr, ip4_addr, 4) == true)
 			{
 				cached_exists = true;
 				cached_index = i;
@@ -263,6 +312,7 @@ RETURN_STATUS resolve_ether_addr(const uint8_t *ip4_addr/*[4]*/, uint8_t *hw_add
 	{
 		// Build packet
 		uint8_t arp_request[ARP_LEN];
+		struct arp_view *request = (struct arp_view *)arp_request;
 
 		// Send ARP request to broadcast.
 		uint8_t bcast_ether_addr[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
@@ -272,21 +322,21 @@ RETURN_STATUS resolve_ether_addr(const uint8_t *ip4_addr/*[4]*/, uint8_t *hw_add
 		const uint8_t *local_ip_addr = get_ipv4_addr();
 
 		/* Hardware */
-		*(uint16_t*)&arp_request[0] = uint16_to_nbo(ARP_HRD);
+		store_be16(request->hw_type, ARP_HRD);
 
 		/* Resolve protocol type (NOTE: only bother with IPv4 here)*/
-		*(uint16_t*)&arp_request[2] = uint16_to_nbo(IPv4);
+		store_be16(request->proto_type, IPv4);
 
 		/* Address lengths, hardware & protocol */
-		arp_request[4] = (uint8_t)ARP_HLN;
-		arp_request[5] = (uint8_t)ARP_PRO;
+		request->hw_len = (uint8_t)ARP_HLN;
+		request->proto_len = (uint8_t)ARP_PRO;
 
-		*(uint16_t*)&arp_request[6] = uint16_to_nbo(ARP_REQUEST);
+		store_be16(request->opcode, ARP_REQUEST);
 
-		sr_memcpy(&arp_request[8], local_hw_addr, 6);
-		sr_memcpy(&arp_request[14], local_ip_addr, 4);
-		sr_memcpy(&arp_request[18], bcast_ether_addr, 6); // Broadcast.
-		sr_memcpy(&arp_request[24], ip4_addr, 4);
+		sr_memcpy(request->sender_hw, local_hw_addr, 6);
+		sr_memcpy(request->sender_ip, local_ip_addr, 4);
+		sr_memcpy(request->target_hw, bcast_ether_addr, 6); // Broadcast.
+		sr_memcpy(request->target_ip, ip4_addr, 4);
 
 		/* Finally send...*/
 		send_ether_packet(bcast_ether_addr, arp_request, ARP_LEN, ARP);
@@ -298,9 +348,9 @@ RETURN_STATUS resolve_ether_addr(const uint8_t *ip4_addr/*[4]*/, uint8_t *hw_add
 		do
 		{
 			/* Has value become true?? */
-			if(arp_table[cached_index].valid == true)
+			if(SIP->arp.table[cached_index].valid == true)
 			{
-				sr_memcpy(hw_addr, arp_table[cached_index].hw_addr, 6);
+				sr_memcpy(hw_addr, SIP->arp.table[cached_index].hw_addr, 6);
 
 				kill_timer(timer, false);
 
@@ -312,9 +362,9 @@ RETURN_STATUS resolve_ether_addr(const uint8_t *ip4_addr/*[4]*/, uint8_t *hw_add
 	}
 
 	/* ARP request failed.  Make it timeout */
-	arp_table[cached_index].valid = false;
-	kill_timer(arp_table[cached_index].timeout_id, false);
-	arp_table[cached_index].timeout_id = 0;
+	SIP->arp.table[cached_index].valid = false;
+	kill_timer(SIP->arp.table[cached_index].timeout_id, false);
+	SIP->arp.table[cached_index].timeout_id = 0;
 
 	return FAILURE;
 }
@@ -344,11 +394,13 @@ void arp_arrival_callback(const uint8_t *buffer, const uint16_t buffer_len)
 		return;
 	}
 
-	uint16_t hw_type = uint16_to_nbo(*(uint16_t*)&buffer[0]);
-	uint16_t proto_type = uint16_to_nbo(*(uint16_t*)&buffer[2]);
-	uint8_t hw_addr_len = buffer[4];
-	uint8_t proto_addr_len = buffer[5];
-	uint16_t opcode = uint16_to_nbo(*(uint16_t*)&buffer[6]);
+	const struct arp_view *arp = (const struct arp_view *)buffer;
+
+	uint16_t hw_type = load_be16(arp->hw_type);
+	uint16_t proto_type = load_be16(arp->proto_type);
+	uint8_t hw_addr_len = arp->hw_len;
+	uint8_t proto_addr_len = arp->proto_len;
+	uint16_t opcode = load_be16(arp->opcode);
 
 	// Make sure we can handle this information;
 	if(hw_type != ARP_HRD)
@@ -362,10 +414,9 @@ void arp_arrival_callback(const uint8_t *buffer, const uint16_t buffer_len)
 
 
 	// Get the addresses...
-	uint8_t *src_hw_addr = (uint8_t*)&buffer[8];
-	uint8_t *src_prot_addr = (uint8_t*)&buffer[14];
-	//uint8_t *target_hw_addr = (uint8_t*)&buffer[18];
-	uint8_t *target_prot_addr = (uint8_t*)&buffer[24];
+	const uint8_t *src_hw_addr = arp->sender_hw;
+	const uint8_t *src_prot_addr = arp->sender_ip;
+	const uint8_t *target_prot_addr = arp->target_ip;
 
 	// Only bother doing anything if it is targeted at us;
 	if(sr_memcmp(target_prot_addr, get_ipv4_addr(), 4) == false)
@@ -380,7 +431,11 @@ void arp_arrival_callback(const uint8_t *buffer, const uint16_t buffer_len)
 
 		// Someone has replied to the request we (may have) sent.
 		// If not treat is as gratuitous
-		add_arp_entry(src_prot_addr, src_hw_addr, ARP_DEFAULT_TIMEOUT, true);
+		if(add_arp_entry(src_prot_addr, src_hw_addr, ARP_DEFAULT_TIMEOUT, true) == SUCCESS
+			&& SIP->arp.learn != NULL)
+		{
+			SIP->arp.learn(src_prot_addr, src_hw_addr);
+		}
 		break;
 
 	case ARP_REQUEST:
@@ -390,33 +445,32 @@ void arp_arrival_callback(const uint8_t *buffer, const uint16_t buffer_len)
 
 		// Build a response packet;
 		uint8_t response_packet[ARP_LEN];
+		struct arp_view *response;
+		response = (struct arp_view *)response_packet;
 
 
 		/* Hardware */
-		response_packet[0] = (uint8_t)(ARP_HRD >> 8);
-		response_packet[1] = (uint8_t)(ARP_HRD);
+		store_be16(response->hw_type, ARP_HRD);
 
 		/* Resolve protocol type (NOTE: only bother with IPv4 here)*/
-		response_packet[2] = (uint8_t)(IPv4 >> 8);
-		response_packet[3] = (uint8_t)(IPv4);
+		store_be16(response->proto_type, IPv4);
 
 		/* Address lengths, hardware & protocol */
-		response_packet[4] = (uint8_t)ARP_HLN;
-		response_packet[5] = (uint8_t)ARP_PRO;
+		response->hw_len = (uint8_t)ARP_HLN;
+		response->proto_len = (uint8_t)ARP_PRO;
 
-		response_packet[6] = (uint8_t)(ARP_REPLY >> 8);
-		response_packet[7] = (uint8_t)(ARP_REPLY);
+		store_be16(response->opcode, ARP_REPLY);
 
 
 		// Our Ethernet/hw addr.
-		sr_memcpy(&response_packet[8], get_ether_addr(), 6);
+		sr_memcpy(response->sender_hw, get_ether_addr(), 6);
 
 		// Our IP (using the one they sent is easier).
-		sr_memcpy(&response_packet[14], &buffer[24], 4);
+		sr_memcpy(response->sender_ip, arp->target_ip, 4);
 
 		// Set target to them (previous source)
-		sr_memcpy(&response_packet[18], &buffer[8], 6);
-		sr_memcpy(&response_packet[24], &buffer[14], 4);
+		sr_memcpy(response->target_hw, arp->sender_hw, 6);
+		sr_memcpy(response->target_ip, arp->sender_ip, 4);
 
 		// Send the packet.
 		send_ether_packet(src_hw_addr, response_packet, ARP_LEN, ARP);
@@ -449,9 +503,9 @@ void arp_timeout_callback(const uint16_t ident)
 	int i = 0;
 	for(i = 0; i < ARP_TABLE_SIZE; i++)
 	{
-		if(arp_table[i].timeout_id == ident)
+		if(SIP->arp.table[i].timeout_id == ident)
 		{
-			remove_arp_entry((const uint8_t*)arp_table[i].hw_addr, (const uint8_t*)arp_table[i].ip_addr);
+			remove_arp_entry((const uint8_t*)SIP->arp.table[i].hw_addr, (const uint8_t*)SIP->arp.table[i].ip_addr);
 
 			break;
 		}
@@ -475,13 +529,15 @@ void remove_arp_entry(const uint8_t* hw_addr, const uint8_t* ip4_addr)
 	int i = 0;
 	for(i = 0; i < ARP_TABLE_SIZE; i++)
 	{
-		if( (sr_memcmp( arp_table[i].ip_addr, ip4_addr, 4) == true)
-		   || (sr_memcmp( arp_table[i].hw_addr, hw_addr, 6) == true))
+		if( (sr_memcmp( SIP->arp.table[i].ip_addr, ip4_addr, 4) == true)
+		   || (sr_memcmp( SIP->arp.table[i].hw_addr, hw_addr, 6) == true))
 		{
-			sr_memset(arp_table[i].ip_addr, 0x00, 4);
-			sr_memset(arp_table[i].hw_addr, 0x00, 6);
-			arp_table[i].valid = false;
-			arp_table[i].timeout_id = 0;
+			sr_memset(SIP->arp.table[i].ip_addr, 0x00, 4);
+			sr_memset(SIP->arp.table[i].hw_addr, 0x00, 6);
+			SIP->arp.table[i].valid = false;
+			SIP->arp.table[i].timeout_id = 0;
+
+			SIP->arp.generation++;
 		}
 	}
 }
@@ -31,6 +31,9 @@
  *				 obscure networking that we wont have.
  *
  *  History
+ *	DB/19-10-26	Added struct arp_view
+ *	DB/19-10-26	Added get_arp_generation
+ *	DB/19-10-26	Added set_arp_learn_callback
  *	DB/16-12-10	Added remove_arp_entry
  *	DB/24-10-09	Started
  ****************************************************/
@@ -46,6 +49,21 @@
 #define ARP_PRO					4			/* Protocol address length, 4=IPv4 */
 
 
+/** ARP packet laid over a frame (only bytes, so any address will do) **/
+struct arp_view
+{
+	uint8_t hw_type[2];
+	uint8_t proto_type[2];
+	uint8_t hw_len;
+	uint8_t proto_len;
+	uint8_t opcode[2];
+	uint8_t sender_hw[6];
+	uint8_t sender_ip[4];
+	uint8_t target_hw[6];
+	uint8_t target_ip[4];
+};
+
+
 /** ARP opcodes **/
 enum opcodes
 {
@@ -72,6 +90,12 @@ RETURN_STATUS add_arp_entry(const uint8_t *ip4_addr/*[4]*/, const uint8_t *hw_ad
 /** Remove an ARP entry **/
 void remove_arp_entry(const uint8_t *hw_addr, const uint8_t *ip4_addr);
 
+/** Be told about entries learnt from replies **/
+RETURN_STATUS set_arp_learn_callback(void (*learnt)(const uint8_t *ip4_addr/*[4]*/, const uint8_t *hw_addr/*[6]*/));
+
+/** Changes whenever a known address changes or goes (to spot stale copies) **/
+uint32_t get_arp_generation(void);
+
 /** ARP packet arrival callback **/
 void arp_arrival_callback(const uint8_t *buffer, const uint16_t buffer_len);
 
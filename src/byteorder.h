@@ -0,0 +1,181 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: byteorder.h
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Reading and writing header fields.
+ *
+ *				 Fields are big endian and can be at any
+ *				 address (a UDP header after an Ethernet
+ *				 one is only 2 byte aligned, and IP options
+ *				 move it about), so never cast a buffer to
+ *				 uint16_t *.  Use these instead, eg:
+ *				   uint16_t port = load_be16(&buffer[2]);
+ *				   store_be16(&buffer[4], len);
+ *
+ *				 The host's byte order is worked out at
+ *				 compile time, so there is no test at run
+ *				 time, and a swap is one instruction where
+ *				 the compiler has a builtin for it.  If the
+ *				 order can't be found the fields are put
+ *				 together a byte at a time, which works
+ *				 anywhere.
+ *
+ *				 Each protocol's header has a 'view' (eg
+ *				 struct ip4_header_view in ip.h) made only
+ *				 of bytes, so it can be laid over a buffer
+ *				 at any address.
+ *
+ *  History
+ *	DB/19 Oct 2026	Started
+ ****************************************************/
+#ifndef BYTEORDER_H_
+#define BYTEORDER_H_
+
+#include "global.h"
+
+
+/* Host byte order, if the compiler will say */
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && defined(__ORDER_LITTLE_ENDIAN__)
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define SIP_BIG_ENDIAN
+#elif __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SIP_LITTLE_ENDIAN
+#endif
+#elif defined(__AVR32__) || defined(__BIG_ENDIAN__)
+#define SIP_BIG_ENDIAN
+#elif defined(__AVR__) || defined(__LITTLE_ENDIAN__) || defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#define SIP_LITTLE_ENDIAN
+#endif
+
+#ifdef __GNUC__
+#define SIP_INLINE		static __inline__
+#else
+#define SIP_INLINE		static inline
+#endif
+
+/* Byte swaps, as one instruction where there is one */
+#if defined(__GNUC__) && ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8))
+#define SIP_BSWAP16(x)	__builtin_bswap16(x)
+#define SIP_BSWAP32(x)	__builtin_bswap32(x)
+#else
+#define SIP_BSWAP16(x)	((uint16_t)((((x) & 0x00FF) << 8) | (((x) >> 8) & 0x00FF)))
+#define SIP_BSWAP32(x)	((uint32_t)((((x) & 0x000000FFUL) << 24) | (((x) & 0x0000FF00UL) << 8) \
+							| (((x) >> 8) & 0x0000FF00UL) | (((x) >> 24) & 0x000000FFUL)))
+#endif
+
+/* Whole words can be loaded from any address with memcpy */
+#if defined(__GNUC__) && (defined(SIP_BIG_ENDIAN) || defined(SIP_LITTLE_ENDIAN))
+#define SIP_WORD_ACCESS
+#endif
+
+
+/** Read a 16 bit field **/
+SIP_INLINE uint16_t load_be16(const uint8_t *field)
+{
+#ifdef SIP_WORD_ACCESS
+	uint16_t value;
+	__builtin_memcpy(&value, field, 2);
+#ifdef SIP_LITTLE_ENDIAN
+	value = SIP_BSWAP16(value);
+#endif
+	return value;
+#else
+	return (uint16_t)(((uint16_t)field[0] << 8) | field[1]);
+#endif
+}
+
+/** Read a 32 bit field **/
+SIP_INLINE uint32_t load_be32(const uint8_t *field)
+{
+#ifdef SIP_WORD_ACCESS
+	uint32_t value;
+	__builtin_memcpy(&value, field, 4);
+#ifdef SIP_LITTLE_ENDIAN
+	value = SIP_BSWAP32(value);
+#endif
+	return value;
+#else
+	return ((uint32_t)field[0] << 24) | ((uint32_t)field[1] << 16) | ((uint32_t)field[2] << 8) | field[3];
+#endif
+}
+
+/** Write a 16 bit field **/
+SIP_INLINE void store_be16(uint8_t *field, const uint16_t value)
+{
+#ifdef SIP_WORD_ACCESS
+#ifdef SIP_LITTLE_ENDIAN
+	uint16_t swapped = SIP_BSWAP16(value);
+	__builtin_memcpy(field, &swapped, 2);
+#else
+	__builtin_memcpy(field, &value, 2);
+#endif
+#else
+	field[0] = (uint8_t)(value >> 8);
+	field[1] = (uint8_t)value;
+#endif
+}
+
+/** Write a 32 bit field **/
+SIP_INLINE void store_be32(uint8_t *field, const uint32_t value)
+{
+#ifdef SIP_WORD_ACCESS
+#ifdef SIP_LITTLE_ENDIAN
+	uint32_t swapped = SIP_BSWAP32(value);
+	__builtin_memcpy(field, &swapped, 4);
+#else
+	__builtin_memcpy(field, &value, 4);
+#endif
+#else
+	field[0] = (uint8_t)(value >> 24);
+	field[1] = (uint8_t)(value >> 16);
+	field[2] = (uint8_t)(value >> 8);
+	field[3] = (uint8_t)value;
+#endif
+}
+
+/** A host value as it would sit in memory in network order (and back) **/
+SIP_INLINE uint16_t host_to_be16(const uint16_t value)
+{
+#if defined(SIP_BIG_ENDIAN)
+	return value;
+#elif defined(SIP_LITTLE_ENDIAN)
+	return SIP_BSWAP16(value);
+#else
+	uint16_t swapped;
+	store_be16((uint8_t *)&swapped, value);
+	return swapped;
+#endif
+}
+
+SIP_INLINE uint32_t host_to_be32(const uint32_t value)
+{
+#if defined(SIP_BIG_ENDIAN)
+	return value;
+#elif defined(SIP_LITTLE_ENDIAN)
+	return SIP_BSWAP32(value);
+#else
+	uint32_t swapped;
+	store_be32((uint8_t *)&swapped, value);
+	return swapped;
+#endif
+}
+
+#endif /* BYTEORDER_H_ */
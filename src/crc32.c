@@ -0,0 +1,404 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: crc32.c
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Ethernet CRC32 (frame check sequence).
+ *
+ *				 All engines work on the same running value
+ *				 (start at CRC32_INIT, invert at the end), so
+ *				 they can be mixed and checked against each other.
+ *
+ *  History
+ *	DB/19 Oct 2026	Started
+ ****************************************************************************/
+
+#include "crc32.h"
+
+#ifdef CRC32_CLMUL
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#ifdef CRC32_ARM
+#include <arm_acle.h>
+#endif
+
+
+#ifdef CRC32_SLICE_BY_8
+/** Table n gives the CRC of a byte followed by n zero bytes **/
+static uint32_t crc32_table[8][256];
+#endif
+
+
+/****************************************************
+ *    Function: init_crc32
+ * Description: Build the tables (if any).
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		SUCCESS
+ ***************************************************/
+RETURN_STATUS init_crc32(void)
+{
+#ifdef CRC32_SLICE_BY_8
+	/* Dont initialise more than once! */
+	static bool crc32_initialised = false;
+	if(crc32_initialised)
+		return SUCCESS;
+
+	uint16_t i = 0;
+	for(i = 0; i < 256; i++)
+	{
+		uint32_t crc = i;
+		uint8_t bit = 0;
+		for(bit = 0; bit < 8; bit++)
+		{
+			crc = (crc >> 1) ^ (CRC32_POLY & (0 - (crc & 1)));
+		}
+		crc32_table[0][i] = crc;
+	}
+
+	for(i = 0; i < 256; i++)
+	{
+		uint8_t n = 0;
+		for(n = 1; n < 8; n++)
+		{
+			uint32_t prev = crc32_table[n - 1][i];
+			crc32_table[n][i] = (prev >> 8) ^ crc32_table[0][prev & 0xFF];
+		}
+	}
+
+	crc32_initialised = true;
+#endif
+
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: crc32_update
+ * Description: Add some data to a running CRC, using
+ * 				the best engine we were built with.
+ *
+ *	Input:
+ *		crc		Running value (CRC32_INIT to start)
+ *		buffer	Data
+ *		len		Length of data
+ *
+ *	Return:
+ * 		uint32_t	New running value
+ ***************************************************/
+uint32_t crc32_update(uint32_t crc, const uint8_t *buffer, uint16_t len)
+{
+#if defined(CRC32_CLMUL)
+	return crc32_clmul(crc, buffer, len);
+#elif defined(CRC32_ARM)
+	return crc32_arm(crc, buffer, len);
+#elif defined(CRC32_SLICE_BY_8)
+	return crc32_slice8(crc, buffer, len);
+#else
+	return crc32_bitwise(crc, buffer, len);
+#endif
+}
+
+
+/****************************************************
+ *    Function: ether_crc32
+ * Description: Work out the Ethernet FCS of a frame
+ * 				(destination address to end of padding).
+ *
+ *		  NOTE: The FCS goes on the wire least
+ *		  		significant byte first.
+ *
+ *	Input:
+ *		buffer	Frame
+ *		len		Frame length (without FCS)
+ *
+ *	Return:
+ * 		uint32_t
+ ***************************************************/
+uint32_t ether_crc32(const uint8_t *buffer, uint16_t len)
+{
+	return ~crc32_update(CRC32_INIT, buffer, len);
+}
+
+
+/****************************************************
+ *    Function: crc32_bitwise
+ * Description: One bit at a time.  Slow, but needs
+ * 				no tables at all.
+ *
+ *	Input:
+ *		crc		Running value
+ *		buffer	Data
+ *		len		Length of data
+ *
+ *	Return:
+ * 		uint32_t	New running value
+ ***************************************************/
+uint32_t crc32_bitwise(uint32_t crc, const uint8_t *buffer, uint16_t len)
+{
+	uint16_t i = 0;
+	for(i = 0; i < len; i++)
+	{
+		crc ^= buffer[i];
+
+		uint8_t bit = 0;
+		for(bit = 0; bit < 8; bit++)
+		{
+			/* Subtract if the low bit is set, without a branch */
+			crc = (crc >> 1) ^ (CRC32_POLY & (0 - (crc & 1)));
+		}
+	}
+
+	return crc;
+}
+
+
+#ifdef CRC32_SLICE_BY_8
+/****************************************************
+ *    Function: crc32_slice8
+ * Description: Eight bytes per step, using eight
+ * 				lookup tables.
+ *
+ *	Input:
+ *		crc		Running value
+ *		buffer	Data
+ *		len		Length of data
+ *
+ *	Return:
+ * 		uint32_t	New running value
+ ***************************************************/
+uint32_t crc32_slice8(uint32_t crc, const uint8_t *buffer, uint16_t len)
+{
+	while(len >= 8)
+	{
+		/* Build the words up a byte at a time, so alignment
+		 * and endianness dont matter */
+		uint32_t one = crc ^ ((uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8)
+							| ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24));
+		uint32_t two = (uint32_t)buffer[4] | ((uint32_t)buffer[5] << 8)
+							| ((uint32_t)buffer[6] << 16) | ((uint32_t)buffer[7] << 24);
+
+		crc = crc32_table[7][one & 0xFF] ^ crc32_table[6][(one >> 8) & 0xFF]
+			^ crc32_table[5][(one >> 16) & 0xFF] ^ crc32_table[4][one >> 24]
+			^ crc32_table[3][two & 0xFF] ^ crc32_table[2][(two >> 8) & 0xFF]
+			^ crc32_table[1][(two >> 16) & 0xFF] ^ crc32_table[0][two >> 24];
+
+		buffer += 8;
+		len -= 8;
+	}
+
+	/* Then the odd bytes */
+	while(len > 0)
+	{
+		crc = (crc >> 8) ^ crc32_table[0][(crc ^ *buffer) & 0xFF];
+		buffer++;
+		len--;
+	}
+
+	return crc;
+}
+#endif /* CRC32_SLICE_BY_8 */
+
+
+#ifdef CRC32_CLMUL
+/****************************************************
+ *    Function: crc32_clmul
+ * Description: Carry-less multiply folding (Intel's
+ * 				"Fast CRC Computation for Generic
+ * 				Polynomials Using PCLMULQDQ").
+ *
+ * 				Four 128-bit lanes are folded 64 bytes at a
+ * 				time, then folded into one and Barrett
+ * 				reduced down to 32 bits.  Anything under
+ * 				64 bytes, and the odd bytes at the end,
+ * 				go through the tables.
+ *
+ *	Input:
+ *		crc		Running value
+ *		buffer	Data
+ *		len		Length of data
+ *
+ *	Return:
+ * 		uint32_t	New running value
+ ***************************************************/
+uint32_t crc32_clmul(uint32_t crc, const uint8_t *buffer, uint16_t len)
+{
+	/* x^(4*128+32) mod P, x^(4*128-32) mod P */
+	static const uint64_t k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+	/* x^(128+32) mod P, x^(128-32) mod P */
+	static const uint64_t k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0ULL, 0x00ccaa009eULL };
+	/* x^64 mod P */
+	static const uint64_t k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124ULL, 0x0000000000ULL };
+	/* P(x) and mu, for Barrett reduction */
+	static const uint64_t poly[2] __attribute__((aligned(16))) = { 0x01db710641ULL, 0x01f7011641ULL };
+
+	if(len < 64)
+	{
+		return crc32_slice8(crc, buffer, len);
+	}
+
+	uint16_t tail = len & 15;
+	len -= tail;
+
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	/* Load the first 64 bytes, with the CRC so far mixed in */
+	x1 = _mm_loadu_si128((const __m128i *)(buffer + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(buffer + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buffer + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buffer + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+
+	x0 = _mm_load_si128((const __m128i *)k1k2);
+
+	buffer += 64;
+	len -= 64;
+
+	/* Fold four lanes at a time */
+	while(len >= 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((const __m128i *)(buffer + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *)(buffer + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *)(buffer + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *)(buffer + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		buffer += 64;
+		len -= 64;
+	}
+
+	/* Fold the four lanes into one */
+	x0 = _mm_load_si128((const __m128i *)k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* Then 16 bytes at a time */
+	while(len >= 16)
+	{
+		x2 = _mm_loadu_si128((const __m128i *)buffer);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		buffer += 16;
+		len -= 16;
+	}
+
+	/* 128 bits down to 64 */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduce down to 32 */
+	x0 = _mm_load_si128((const __m128i *)poly);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	crc = (uint32_t)_mm_extract_epi32(x1, 1);
+
+	return crc32_slice8(crc, buffer, tail);
+}
+#endif /* CRC32_CLMUL */
+
+
+#ifdef CRC32_ARM
+/****************************************************
+ *    Function: crc32_arm
+ * Description: ARMv8 CRC32 instructions, which use
+ * 				the Ethernet polynomial directly.
+ *
+ *	Input:
+ *		crc		Running value
+ *		buffer	Data
+ *		len		Length of data
+ *
+ *	Return:
+ * 		uint32_t	New running value
+ ***************************************************/
+uint32_t crc32_arm(uint32_t crc, const uint8_t *buffer, uint16_t len)
+{
+	while(len >= 8)
+	{
+		/* Little endian, byte at a time so alignment doesnt matter */
+		uint64_t word = 0;
+		uint8_t i = 0;
+		for(i = 0; i < 8; i++)
+		{
+			word |= (uint64_t)buffer[i] << (i * 8);
+		}
+
+		crc = __crc32d(crc, word);
+		buffer += 8;
+		len -= 8;
+	}
+
+	while(len > 0)
+	{
+		crc = __crc32b(crc, *buffer);
+		buffer++;
+		len--;
+	}
+
+	return crc;
+}
+#endif /* CRC32_ARM */
@@ -0,0 +1,87 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: crc32.h
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Ethernet CRC32 (frame check sequence) for
+ *				 MACs that don't generate or check it.
+ *
+ *				 The engine is picked at compile time:
+ *				  - bitwise: no tables, for 8-bit micros (default)
+ *				  - CRC32_SLICE_BY_8: 8KB of tables, 8 bytes
+ *				    per step, for 32-bit micros
+ *				  - x86 with PCLMUL (-mpclmul -msse4.1) or ARMv8
+ *				    with the CRC extension use the hardware,
+ *				    unless CRC32_NO_HW is defined.
+ *
+ *  History
+ *	DB/19 Oct 2026	Started
+ ****************************************************/
+#ifndef CRC32_H_
+#define CRC32_H_
+
+#include "global.h"
+#include "stack_defines.h"
+
+/* Reflected Ethernet polynomial */
+#define CRC32_POLY		0xEDB88320UL
+
+/* Starting value for crc32_update */
+#define CRC32_INIT		0xFFFFFFFFUL
+
+#ifndef CRC32_NO_HW
+#if defined(__PCLMUL__) && defined(__SSE4_1__)
+#define CRC32_CLMUL
+#elif defined(__ARM_FEATURE_CRC32)
+#define CRC32_ARM
+#endif
+#endif
+
+/* Folding leaves a few bytes over, so use the tables for those */
+#if defined(CRC32_CLMUL) && !defined(CRC32_SLICE_BY_8)
+#define CRC32_SLICE_BY_8
+#endif
+
+
+/** Build any tables the engine needs **/
+RETURN_STATUS init_crc32(void);
+
+/** Add some data to a running CRC (start from CRC32_INIT) **/
+uint32_t crc32_update(uint32_t crc, const uint8_t *buffer, uint16_t len);
+
+/** Ethernet FCS of a buffer **/
+uint32_t ether_crc32(const uint8_t *buffer, uint16_t len);
+
+/** The engines themselves, same arguments as crc32_update **/
+uint32_t crc32_bitwise(uint32_t crc, const uint8_t *buffer, uint16_t len);
+
+#ifdef CRC32_SLICE_BY_8
+uint32_t crc32_slice8(uint32_t crc, const uint8_t *buffer, uint16_t len);
+#endif
+
+#ifdef CRC32_CLMUL
+uint32_t crc32_clmul(uint32_t crc, const uint8_t *buffer, uint16_t len);
+#endif
+
+#ifdef CRC32_ARM
+uint32_t crc32_arm(uint32_t crc, const uint8_t *buffer, uint16_t len);
+#endif
+
+#endif /* CRC32_H_ */
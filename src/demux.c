@@ -0,0 +1,506 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: demux.c
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Early demux (see demux.h).
+ *
+ *				 Entries are chained by index from a few
+ *				 buckets, hashed on the ports and the
+ *				 sender.  The destination address isn't
+ *				 hashed, so 'any' costs nothing extra.  A
+ *				 datagram is looked up with its sender (only
+ *				 if there are entries for one sender) and
+ *				 then without.
+ *
+ *  History
+ *	DB/19 Oct 2026	get_demux_stats counts the vector receive too
+ *	DB/19 Oct 2026	demux_frame split into steps, for the vector receive
+ *	DB/19 Oct 2026	Started
+ ****************************************************************************/
+
+#include "demux.h"
+#include "functions.h"
+#include "ethernet.h"
+#include "ip.h"
+#include "udp.h"
+#include "link_uc_mac.h"
+#include "sip_ctx.h"
+
+#ifdef ETH_EARLY_DEMUX
+
+/* Chains hold entry index + 1, so 0 ends them */
+#define DEMUX_NONE				0
+
+#define DEMUX_IP_CHECKSUM		10
+#define DEMUX_PSEUDO_HEADER_LEN	12
+#define DEMUX_UDP_CHECKSUM		6
+
+/* Fragment offset and more fragments bits */
+#define DEMUX_FRAGMENTED		0x3FFF
+
+
+static const uint8_t demux_any[4] = { 0, 0, 0, 0 };
+
+
+static uint8_t demux_hash(const uint16_t dest_port, const uint8_t *src_addr, const uint16_t src_port);
+static uint8_t demux_lookup(uint8_t next, const uint16_t dest_port, const uint8_t *dest_addr,
+							const uint8_t *src_addr, const uint16_t src_port);
+static bool demux_same_key(const struct demux_key *a, const struct demux_key *b);
+
+
+/****************************************************
+ *    Function: init_demux
+ * Description: Empty the current context's table.
+ *
+ *	Input:
+ * 		NONE
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+void init_demux(void)
+{
+	uint8_t i = 0;
+	for(i = 0; i < DEMUX_TABLE_SIZE; i++)
+	{
+		SIP->demux.entries[i].callback_fn = NULL;
+		SIP->demux.entries[i].next = DEMUX_NONE;
+	}
+
+	for(i = 0; i < DEMUX_BUCKETS; i++)
+	{
+		SIP->demux.buckets[i] = DEMUX_NONE;
+	}
+
+	SIP->demux.sourced = 0;
+	SIP->demux.delivered = 0;
+	SIP->demux.dropped = 0;
+}
+
+
+/****************************************************
+ *    Function: add_demux_entry
+ * Description: Send datagrams that match key straight
+ * 				to handler.  Handlers with the same key
+ * 				are called in the order they were
+ * 				added.
+ *
+ *	Input:
+ * 		key			What to match (ether_type IPv4,
+ * 					protocol IP_UDP, and the sender's
+ * 					address and port or neither)
+ * 		handler		Called with the payload
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		Table full, or a key it can't match
+ ***************************************************/
+RETURN_STATUS add_demux_entry(const struct demux_key *key, void (*handler)(const uint8_t *buffer, const uint16_t buffer_len))
+{
+	if(key == NULL || handler == NULL)
+		return FAILURE;
+
+	if(key->ether_type != IPv4 || key->protocol != IP_UDP || key->dest_port == 0)
+		return FAILURE;
+
+	/* A sender is its address and port, or neither */
+	bool sourced = (key->src_port != 0 || !sr_memcmp(key->src_addr, demux_any, 4));
+	if(sourced && (key->src_port == 0 || sr_memcmp(key->src_addr, demux_any, 4)))
+		return FAILURE;
+
+	uint8_t i = 0;
+	for(i = 0; i < DEMUX_TABLE_SIZE; i++)
+	{
+		if(SIP->demux.entries[i].callback_fn == NULL)
+			break;
+	}
+
+	if(i == DEMUX_TABLE_SIZE)
+		return FAILURE;
+
+	struct demux_entry *entry = &SIP->demux.entries[i];
+	entry->key = *key;
+	entry->callback_fn = handler;
+	entry->next = DEMUX_NONE;
+
+	/* On the end, to keep them in order */
+	uint8_t *link = &SIP->demux.buckets[demux_hash(key->dest_port, key->src_addr, key->src_port)];
+	while(*link != DEMUX_NONE)
+	{
+		link = &SIP->demux.entries[*link - 1].next;
+	}
+	*link = i + 1;
+
+	if(sourced)
+	{
+		SIP->demux.sourced++;
+	}
+
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: remove_demux_entry
+ * Description: Remove every handler added with key.
+ *
+ *	Input:
+ * 		key			As it was added
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		Not found
+ ***************************************************/
+RETURN_STATUS remove_demux_entry(const struct demux_key *key)
+{
+	if(key == NULL)
+		return FAILURE;
+
+	bool found = false;
+
+	uint8_t *link = &SIP->demux.buckets[demux_hash(key->dest_port, key->src_addr, key->src_port)];
+	while(*link != DEMUX_NONE)
+	{
+		struct demux_entry *entry = &SIP->demux.entries[*link - 1];
+
+		if(!demux_same_key(&entry->key, key))
+		{
+			link = &entry->next;
+			continue;
+		}
+
+		*link = entry->next;
+		entry->callback_fn = NULL;
+		entry->next = DEMUX_NONE;
+
+		if(key->src_port != 0 || !sr_memcmp(key->src_addr, demux_any, 4))
+		{
+			SIP->demux.sourced--;
+		}
+
+		found = true;
+	}
+
+	return (found) ? SUCCESS : FAILURE;
+}
+
+
+/****************************************************
+ *    Function: demux_frame
+ * Description: Look a frame up in the table, before
+ * 				the Ethernet callbacks see it.  If it
+ * 				is a whole UDP datagram it is checked
+ * 				and given to its handlers, or dropped
+ * 				if there are none.
+ *
+ *	Input:
+ * 		frame		Whole frame (no FCS)
+ * 		frame_len	Its length
+ *
+ *	Return:
+ * 		true		Delivered or dropped
+ * 		false		Not UDP (or a fragment), use
+ * 					the callbacks
+ ***************************************************/
+bool demux_frame(const uint8_t *frame, const uint16_t frame_len)
+{
+	if(frame_len < ETH_HEADERLEN)
+		return false;
+
+	const struct ether_header_view *eth = (const struct ether_header_view *)frame;
+	if(load_be16(eth->type) != IPv4)
+		return false;
+
+	const uint8_t *packet = &frame[ETH_HEADERLEN];
+	const uint16_t packet_len = frame_len - ETH_HEADERLEN;
+
+	uint8_t ihl = demux_udp_ihl(packet, packet_len);
+	if(ihl == 0)
+		return false;
+
+	uint8_t found = demux_find(packet, ihl);
+
+	/* Someone wants it, so now it is worth checking */
+	if(found == DEMUX_NONE || !demux_check(packet, packet_len, ihl))
+	{
+		SIP->demux.dropped++;
+		return true;
+	}
+
+	demux_deliver(found, packet, ihl);
+
+	SIP->demux.delivered++;
+	return true;
+}
+
+
+/****************************************************
+ *    Function: demux_udp_ihl
+ * Description: Whether an IP packet is a whole UDP
+ * 				datagram the table can take.
+ *
+ *	Input:
+ * 		packet		IP header onwards
+ * 		packet_len	Its length (Ethernet padding too)
+ *
+ *	Return:
+ * 		IP header length
+ * 		0			Not UDP, a fragment, or too short
+ ***************************************************/
+uint8_t demux_udp_ihl(const uint8_t *packet, const uint16_t packet_len)
+{
+	if(packet_len < IP_HEADERLEN + sizeof(struct udp_header_view))
+		return 0;
+
+	const struct ip4_header_view *ip = (const struct ip4_header_view *)packet;
+
+	uint8_t ihl = (ip->version_ihl & 0x0F) * 4;
+	if((ip->version_ihl >> 4) != 4 || ihl < IP_HEADERLEN || ip->protocol != IP_UDP)
+		return 0;
+
+	/* No reassembly here */
+	if(load_be16(ip->fragment) & DEMUX_FRAGMENTED)
+		return 0;
+
+	if(ihl + sizeof(struct udp_header_view) > packet_len)
+		return 0;
+
+	return ihl;
+}
+
+
+/****************************************************
+ *    Function: demux_find
+ * Description: First entry that wants a datagram.  One
+ * 				lookup for most, two if anyone wants a
+ * 				particular sender.
+ *
+ *	Input:
+ * 		packet		From demux_udp_ihl
+ * 		ihl			IP header length
+ *
+ *	Return:
+ * 		Entry (for demux_deliver)
+ * 		0			Nobody
+ ***************************************************/
+uint8_t demux_find(const uint8_t *packet, const uint8_t ihl)
+{
+	const struct ip4_header_view *ip = (const struct ip4_header_view *)packet;
+	const struct udp_header_view *udp = (const struct udp_header_view *)&packet[ihl];
+	const uint16_t port = load_be16(udp->dest_port);
+
+	uint8_t found = DEMUX_NONE;
+	if(SIP->demux.sourced > 0)
+	{
+		const uint16_t src_port = load_be16(udp->src_port);
+		found = demux_lookup(SIP->demux.buckets[demux_hash(port, ip->src, src_port)],
+								port, ip->dest, ip->src, src_port);
+	}
+
+	if(found == DEMUX_NONE)
+	{
+		found = demux_lookup(SIP->demux.buckets[demux_hash(port, demux_any, 0)],
+								port, ip->dest, demux_any, 0);
+	}
+
+	return found;
+}
+
+
+/****************************************************
+ *    Function: demux_check
+ * Description: Check a datagram's lengths, and its IP
+ * 				and UDP checksums (unless the MAC
+ * 				already has).
+ *
+ *	Input:
+ * 		packet		From demux_udp_ihl
+ * 		packet_len	Its length
+ * 		ihl			IP header length
+ *
+ *	Return:
+ * 		true		Good
+ * 		false		Drop it
+ ***************************************************/
+bool demux_check(const uint8_t *packet, const uint16_t packet_len, const uint8_t ihl)
+{
+	const struct ip4_header_view *ip = (const struct ip4_header_view *)packet;
+	const uint8_t *datagram = &packet[ihl];
+	const struct udp_header_view *udp = (const struct udp_header_view *)datagram;
+
+	uint16_t total_len = load_be16(ip->total_len);
+	uint16_t udp_len = load_be16(udp->len);
+	if(total_len > packet_len || total_len < ihl + sizeof(struct udp_header_view)
+		|| udp_len < sizeof(struct udp_header_view) || udp_len > total_len - ihl)
+	{
+		return false;
+	}
+
+	if(get_ether_offload() & MAC_OFFLOAD_RX_CSUM)
+		return true;
+
+	if(load_be16(ip->checksum) != checksum(packet, ihl, DEMUX_IP_CHECKSUM))
+		return false;
+
+	uint8_t pseudo_header[DEMUX_PSEUDO_HEADER_LEN] = { ip->src[0], ip->src[1], ip->src[2], ip->src[3],
+														ip->dest[0], ip->dest[1], ip->dest[2], ip->dest[3],
+														0x00, IP_UDP, udp->len[0], udp->len[1] };
+
+	return load_be16(udp->checksum) == checksum_fragmented(pseudo_header, sizeof(pseudo_header), datagram, udp_len,
+															DEMUX_PSEUDO_HEADER_LEN + DEMUX_UDP_CHECKSUM);
+}
+
+
+/****************************************************
+ *    Function: demux_deliver
+ * Description: Give a checked datagram's payload to
+ * 				the entry from demux_find, and every
+ * 				one after it with the same key.
+ *
+ *	Input:
+ * 		found		From demux_find
+ * 		packet		Checked by demux_check
+ * 		ihl			IP header length
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+void demux_deliver(uint8_t found, const uint8_t *packet, const uint8_t ihl)
+{
+	const struct ip4_header_view *ip = (const struct ip4_header_view *)packet;
+	const uint8_t *datagram = &packet[ihl];
+	const struct udp_header_view *udp = (const struct udp_header_view *)datagram;
+
+	const uint16_t port = load_be16(udp->dest_port);
+	const uint16_t src_port = load_be16(udp->src_port);
+	const uint8_t *payload = &datagram[sizeof(struct udp_header_view)];
+	const uint16_t payload_len = load_be16(udp->len) - sizeof(struct udp_header_view);
+
+	while(found != DEMUX_NONE)
+	{
+		const struct demux_entry *entry = &SIP->demux.entries[found - 1];
+
+		if(SIP->udp.deliver != NULL)
+		{
+			SIP->udp.deliver(entry->callback_fn, ip->src, src_port, port, payload, payload_len);
+		}
+		else
+		{
+			entry->callback_fn(payload, payload_len);
+		}
+
+		/* The rest have the same sender (or any) as this one */
+		found = demux_lookup(entry->next, port, ip->dest, entry->key.src_addr, entry->key.src_port);
+	}
+}
+
+
+/****************************************************
+ *    Function: get_demux_stats
+ * Description: How many datagrams demux_frame and
+ * 				the vector receive (rx_vector.c) have
+ * 				delivered, and dropped (nobody
+ * 				listening, or bad).
+ *
+ *	Input:
+ * 		delivered	Set (can be NULL)
+ * 		dropped		Set (can be NULL)
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+void get_demux_stats(uint32_t *delivered, uint32_t *dropped)
+{
+	if(delivered != NULL)
+		*delivered = SIP->demux.delivered;
+
+	if(dropped != NULL)
+		*dropped = SIP->demux.dropped;
+}
+
+
+/****************************************************
+ *    Function: demux_hash
+ * Description: Bucket for a port and sender.
+ ***************************************************/
+static uint8_t demux_hash(const uint16_t dest_port, const uint8_t *src_addr, const uint16_t src_port)
+{
+	uint16_t hash = dest_port ^ src_port ^ src_addr[2] ^ ((uint16_t)src_addr[3] << 4);
+	hash ^= hash >> 8;
+
+	return (uint8_t)(hash & (DEMUX_BUCKETS - 1));
+}
+
+
+/****************************************************
+ *    Function: demux_lookup
+ * Description: Follow a chain to the next entry that
+ * 				matches.
+ *
+ *	Input:
+ * 		next		Where to start in the chain
+ * 		dest_port	From the datagram
+ * 		dest_addr	From the datagram
+ * 		src_addr	As the entry has it (demux_any
+ * 					for any)
+ * 		src_port	As the entry has it
+ *
+ *	Return:
+ * 		Entry index + 1
+ * 		DEMUX_NONE	No more
+ ***************************************************/
+static uint8_t demux_lookup(uint8_t next, const uint16_t dest_port, const uint8_t *dest_addr,
+							const uint8_t *src_addr, const uint16_t src_port)
+{
+	while(next != DEMUX_NONE)
+	{
+		const struct demux_entry *entry = &SIP->demux.entries[next - 1];
+
+		if(entry->key.dest_port == dest_port
+			&& entry->key.src_port == src_port
+			&& sr_memcmp(entry->key.src_addr, src_addr, 4)
+			&& (sr_memcmp(entry->key.dest_addr, demux_any, 4) || sr_memcmp(entry->key.dest_addr, dest_addr, 4)))
+		{
+			return next;
+		}
+
+		next = entry->next;
+	}
+
+	return DEMUX_NONE;
+}
+
+
+/****************************************************
+ *    Function: demux_same_key
+ * Description: Whether two keys are the same.
+ ***************************************************/
+static bool demux_same_key(const struct demux_key *a, const struct demux_key *b)
+{
+	return a->ether_type == b->ether_type
+		&& a->protocol == b->protocol
+		&& a->dest_port == b->dest_port
+		&& a->src_port == b->src_port
+		&& sr_memcmp(a->dest_addr, b->dest_addr, 4)
+		&& sr_memcmp(a->src_addr, b->src_addr, 4);
+}
+
+#endif /* ETH_EARLY_DEMUX */
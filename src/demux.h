@@ -0,0 +1,95 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: demux.h
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Early demux (ETH_EARLY_DEMUX).  A small
+ *				 exact match table from the Ethernet, IP and
+ *				 UDP headers straight to the listen_udp
+ *				 handler, so a datagram doesn't walk the
+ *				 Ethernet, IP and UDP callback lists.
+ *
+ *				 Checksums are only checked for datagrams
+ *				 someone wants.  Anything else UDP (mostly
+ *				 broadcasts) is dropped after one lookup.
+ *				 Fragments, and everything that isn't UDP,
+ *				 still go through the callbacks.
+ *
+ *				 listen_udp and close_udp keep the table up
+ *				 to date.  Handlers for one sender only can
+ *				 be added with add_demux_entry.
+ *
+ *		  NOTE:	With ETH_EARLY_DEMUX, IP callbacks for
+ *				IP_UDP (other than UDP's own) no longer see
+ *				unfragmented datagrams.
+ *
+ *  History
+ *	DB/19 Oct 2026	demux_frame split into steps, for the vector receive
+ *	DB/19 Oct 2026	Started
+ ****************************************************/
+#ifndef DEMUX_H_
+#define DEMUX_H_
+
+#include "global.h"
+#include "stack_defines.h"
+
+
+/** What a datagram has to match **/
+struct demux_key
+{
+	uint16_t ether_type;	/* Only IPv4 for now */
+	uint8_t protocol;		/* Only IP_UDP for now */
+	uint8_t dest_addr[4];	/* 0.0.0.0 for any */
+	uint16_t dest_port;
+	uint8_t src_addr[4];	/* Both, or 0.0.0.0 and port 0 for any sender */
+	uint16_t src_port;
+};
+
+
+/** Empty the table **/
+void init_demux(void);
+
+/** Send datagrams matching key straight to handler **/
+RETURN_STATUS add_demux_entry(const struct demux_key *key, void (*handler)(const uint8_t *buffer, const uint16_t buffer_len));
+
+/** Stop doing so (every handler with that key) **/
+RETURN_STATUS remove_demux_entry(const struct demux_key *key);
+
+/** Deliver or drop a frame, false if it needs the callbacks **/
+bool demux_frame(const uint8_t *frame, const uint16_t frame_len);
+
+/* demux_frame a step at a time, for the vector receive (rx_vector.h) */
+
+/** IP header length if packet is a whole UDP datagram, or 0 **/
+uint8_t demux_udp_ihl(const uint8_t *packet, const uint16_t packet_len);
+
+/** First entry that wants it, 0 for none **/
+uint8_t demux_find(const uint8_t *packet, const uint8_t ihl);
+
+/** Lengths and checksums are good **/
+bool demux_check(const uint8_t *packet, const uint16_t packet_len, const uint8_t ihl);
+
+/** Give the payload to that entry and any others with its key **/
+void demux_deliver(uint8_t found, const uint8_t *packet, const uint8_t ihl);
+
+/** Datagrams delivered, and dropped, by demux_frame and the vector receive **/
+void get_demux_stats(uint32_t *delivered, uint32_t *dropped);
+
+#endif /* DEMUX_H_ */
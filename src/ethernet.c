@@ -24,6 +24,23 @@
  *				 payload to the correct handler.
  *
  *  History
+ *	DB/19-10-26	The tap gets received frames without the FCS
+ *	DB/19-10-26	A MAC without batches is fine (MAC_RX_VECTOR)
+ *	DB/19-10-26	Frames taken in batches (MAC_RX_VECTOR)
+ *	DB/19-10-26	ether_frame_available split into accept and dispatch
+ *	DB/19-10-26	UDP straight to its handler (ETH_EARLY_DEMUX)
+ *	DB/19-10-26	Type field read and written with byteorder.h
+ *	DB/19-10-26	Added send_ether_frame, for prebuilt headers
+ *	DB/19-10-26	Decide from the headers alone (MAC_RX_STREAM)
+ *	DB/19-10-26	Frames built in the MAC (MAC_STREAM)
+ *	DB/19-10-26	Header and payload sent separately (MAC_GATHER)
+ *	DB/19-10-26	Added poll mode (MAC_POLL)
+ *	DB/19-10-26	State moved into the stack context
+ *	DB/19-10-26	Added send_ether_packet_segmented
+ *	DB/19-10-26	Cache the MAC's checksum offload
+ *	DB/19-10-26	Software CRC generation and checking
+ *	DB/19-10-26	Added frame tap for packet capture
+ *	DB/19-10-26	Record receive latency
  *	DB/17-12-10	Compiles with gcc4 (but probably doesnt work!)
  *	DB/24-10-09	Started
  **************************************************************************/
@@ -32,20 +49,30 @@
 #include "ethernet.h"
 #include "link_uc_mac.h"
 #include "functions.h"
+#include "latency.h"
+#include "sip_ctx.h"
 
+#if defined(ETH_ADD_SW_CRC) || defined(ETH_CHECK_CRC)
+#include "crc32.h"
+#endif
+
+#ifdef ETH_EARLY_DEMUX
+#include "demux.h"
+#endif
+
+#ifdef MAC_RX_VECTOR
+#include "rx_vector.h"
+#endif
 
 
-/** Keep track of who wants what data. **/
-struct ether_packet_callback_element
-{
-  void (*fn_callback)(const uint8_t *buffer, const uint16_t buffer_len);
-  volatile ETHERNET_TYPE required_type;
-};
-static struct ether_packet_callback_element ether_packet_callbacks[ETHER_CALLBACK_SIZE];
 
+/*
+ * Who wants what data, who we are, what the MAC will do
+ * for us (MAC_OFFLOAD_*) and who wants a copy of all
+ * frames are kept in the stack context (SIP->ether).
+ */
 
-/** Keep track of who we are! */
-uint8_t ethernet_addr[6];
+static void build_ether_header(uint8_t *eth_buffer, const uint8_t *dest_addr/*[6]*/, const ETHERNET_TYPE type);
 
 /****************************************************
  *    Function: init_ethernet
@@ -60,8 +87,7 @@ uint8_t ethernet_addr[6];
 RETURN_STATUS init_ethernet(void)
 {
 	/* Dont initialise more than once! */
-	static bool eth_initialised = false;
-	if(eth_initialised)
+	if(SIP->ether.initialised)
 		return SUCCESS;
 
 
@@ -69,21 +95,41 @@ RETURN_STATUS init_ethernet(void)
 	uint8_t i = 0;
 	for(i = 0; i < ETHER_CALLBACK_SIZE; i++)
 	{
-		ether_packet_callbacks[i].required_type = INVALID;
+		SIP->ether.callbacks[i].required_type = INVALID;
 	}
 
 
 	/* Init everything else */
+#if defined(ETH_ADD_SW_CRC) || defined(ETH_CHECK_CRC)
+	init_crc32();
+#endif
 	init_uc();
 	init_mac();
 
+	SIP->ether.offload = get_mac_offload();
+
 	if(set_frame_complete(&ether_frame_available) != SUCCESS)
 	{
 		return FAILURE;
 	}
 
+#ifdef MAC_RX_VECTOR
+	/* FAILURE is a MAC without batches, frame_complete still works */
+	set_frames_complete(&ether_frames_available);
+#endif
 
-	eth_initialised = true;
+#ifdef MAC_RX_STREAM
+	if(set_frame_header(&ether_frame_header) != SUCCESS)
+	{
+		return FAILURE;
+	}
+#endif
+
+#ifdef MAC_POLL
+	mac_rx_irq(true);
+#endif
+
+	SIP->ether.initialised = true;
 
 	/* hoorah */
 	return SUCCESS;
@@ -102,7 +148,7 @@ RETURN_STATUS init_ethernet(void)
  ***************************************************/
 RETURN_STATUS set_ether_addr(const uint8_t *addr/*[6]*/)
 {
-	sr_memcpy(ethernet_addr, addr, 6);
+	sr_memcpy(SIP->ether.addr, addr, 6);
 	return SUCCESS;
 }
 
@@ -118,7 +164,7 @@ RETURN_STATUS set_ether_addr(const uint8_t *addr/*[6]*/)
  ***************************************************/
 const uint8_t * get_ether_addr(void)
 {
-	return ethernet_addr;
+	return SIP->ether.addr;
 }
 
 
@@ -144,10 +190,13 @@ RETURN_STATUS add_ether_packet_callback(ETHERNET_TYPE packet_type, void (*handle
 	uint8_t i = 0;
 	for(i = 0; i < ETHER_CALLBACK_SIZE; i++)
 	{
-		if(ether_packet_callbacks[i].required_type == INVALID)
+		if(SIP->ether.callbacks[i].required_type == INVALID)
 		{
-			ether_packet_callbacks[i].required_type = packet_type;
-			ether_packet_callbacks[i].fn_callback = handler;
+			SIP->ether.callbacks[i].required_type = packet_type;
+			SIP->ether.callbacks[i].fn_callback = handler;
+#ifdef MAC_RX_STREAM
+			SIP->ether.callbacks[i].header_fn = NULL;
+#endif
 
 			return SUCCESS;
 		}
@@ -177,11 +226,86 @@ RETURN_STATUS remove_ether_packet_callback(ETHERNET_TYPE packet_type, void (*han
 	bool bFound = false;
 	for(i = 0; i < ETHER_CALLBACK_SIZE; i++)
 	{
-		if(ether_packet_callbacks[i].required_type == packet_type 
-		&& ether_packet_callbacks[i].fn_callback == handler)
+		if(SIP->ether.callbacks[i].required_type == packet_type 
+		&& SIP->ether.callbacks[i].fn_callback == handler)
+		{
+			SIP->ether.callbacks[i].required_type = INVALID;
+			SIP->ether.callbacks[i].fn_callback = NULL;
+
+			bFound = true;
+		}
+	}
+
+	return (bFound) ? SUCCESS : FAILURE;
+}
+
+
+#ifdef MAC_RX_STREAM
+/****************************************************
+ *    Function: add_ether_header_callback
+ * Description: Adds a callback that gets just the
+ * 				start of a packet type, while the
+ * 				rest is still in the MAC.  It returns
+ * 				true if the whole frame is wanted
+ * 				(for the add_ether_packet_callback
+ * 				handlers of that type).
+ *
+ *		  NOTE: Once a type has one of these, its
+ *		  		other handlers only get frames that
+ *		  		one of these asks for.
+ *
+ *	Input:
+ * 		packet_type		packet type number
+ * 		handler			pointer to callback function
+ *
+ *	Return:
+ * 		SUCCESS			callback added
+ * 		FAILURE			not added
+ ***************************************************/
+RETURN_STATUS add_ether_header_callback(ETHERNET_TYPE packet_type, bool (*handler)(const uint8_t *header, const uint16_t header_len, const uint16_t packet_len))
+{
+	uint8_t i = 0;
+	for(i = 0; i < ETHER_CALLBACK_SIZE; i++)
+	{
+		if(SIP->ether.callbacks[i].required_type == INVALID)
+		{
+			SIP->ether.callbacks[i].required_type = packet_type;
+			SIP->ether.callbacks[i].fn_callback = NULL;
+			SIP->ether.callbacks[i].header_fn = handler;
+
+			return SUCCESS;
+		}
+	}
+
+	return FAILURE;
+}
+
+
+/****************************************************
+ *    Function: remove_ether_header_callback
+ * Description: Remove all header callbacks for a
+ * 				particular packet type and handler.
+ *
+ *	Input:
+ * 		packet_type		packet type number
+ * 		handler			pointer to callback function
+ *
+ *	Return:
+ * 		SUCCESS			callback removed
+ * 		FAILURE			not found
+ ***************************************************/
+RETURN_STATUS remove_ether_header_callback(ETHERNET_TYPE packet_type, bool (*handler)(const uint8_t *header, const uint16_t header_len, const uint16_t packet_len))
+{
+	uint8_t i;
+	bool bFound = false;
+	for(i = 0; i < ETHER_CALLBACK_SIZE; i++)
+	{
+		if(SIP->ether.callbacks[i].required_type == packet_type
+		&& SIP->ether.callbacks[i].fn_callback == NULL
+		&& SIP->ether.callbacks[i].header_fn == handler)
 		{
-			ether_packet_callbacks[i].required_type = INVALID;
-			ether_packet_callbacks[i].fn_callback = NULL;
+			SIP->ether.callbacks[i].required_type = INVALID;
+			SIP->ether.callbacks[i].header_fn = NULL;
 
 			bFound = true;
 		}
@@ -189,6 +313,135 @@ RETURN_STATUS remove_ether_packet_callback(ETHERNET_TYPE packet_type, void (*han
 
 	return (bFound) ? SUCCESS : FAILURE;
 }
+#endif
+
+
+/****************************************************
+ *    Function: get_ether_offload
+ * Description: Find out what checksum work the MAC
+ * 				will do, so the layers above can
+ * 				skip it.
+ *
+ *	Input:
+ * 		NONE
+ *
+ *	Return:
+ * 		MAC_OFFLOAD_* flags
+ ***************************************************/
+uint8_t get_ether_offload(void)
+{
+	return SIP->ether.offload;
+}
+
+
+/****************************************************
+ *    Function: set_ether_tap
+ * Description: Set a function that gets a copy of
+ * 				every frame received or sent.
+ *
+ *		  NOTE: The tap is called in the receive and
+ *		  		transmit paths, so keep it quick.
+ *		  		Frames go to it without their FCS.
+ *
+ *	Input:
+ * 		tap		Callback function, NULL to remove
+ *
+ *	Return:
+ * 		SUCCESS
+ ***************************************************/
+RETURN_STATUS set_ether_tap(void (*tap)(const uint8_t *frame, const uint16_t frame_len, const bool outgoing))
+{
+	SIP->ether.tap = tap;
+	return SUCCESS;
+}
+
+
+#ifdef MAC_POLL
+/****************************************************
+ *    Function: ether_rx_schedule
+ * Description: Frames have arrived.  Turn off the
+ * 				receive interrupt, and leave them for
+ * 				ether_poll.
+ *
+ *		  NOTE: Called from the MAC's receive
+ *		  		interrupt, so does no more than that.
+ *
+ *	Input:
+ * 		NONE
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+void ether_rx_schedule(void)
+{
+	mac_rx_irq(false);
+	SIP->ether.poll_pending = true;
+}
+
+
+/****************************************************
+ *    Function: ether_poll
+ * Description: Read up to budget frames from the MAC.
+ * 				Once it runs dry, turn the receive
+ * 				interrupt back on (unless busy polling).
+ *
+ * 				Call from the main loop.  A burst then
+ * 				costs one interrupt, however long it
+ * 				is, and a small budget lets the rest of
+ * 				the program run in between.
+ *
+ *	Input:
+ * 		budget		Most frames to read
+ *
+ *	Return:
+ * 		true		Budget used up, call again
+ * 		false		Nothing left
+ ***************************************************/
+bool ether_poll(const uint16_t budget)
+{
+	if(!SIP->ether.poll_pending)
+		return false;
+
+	if(poll_mac(budget) >= budget)
+		return true;
+
+	/* Dry.  Any frame that beats the interrupt back on
+	 * makes it go off straight away (see mac_rx_irq). */
+	if(!SIP->ether.busy_poll)
+	{
+		SIP->ether.poll_pending = false;
+		mac_rx_irq(true);
+	}
+
+	return false;
+}
+
+
+/****************************************************
+ *    Function: set_ether_busy_poll
+ * Description: Busy polling leaves the receive
+ * 				interrupt off, and ether_poll always
+ * 				asks the MAC.  Lowest latency, but the
+ * 				CPU never rests.
+ *
+ *	Input:
+ * 		busy		true to busy poll
+ *
+ *	Return:
+ * 		SUCCESS
+ ***************************************************/
+RETURN_STATUS set_ether_busy_poll(const bool busy)
+{
+	mac_rx_irq(false);
+	SIP->ether.busy_poll = busy;
+
+	/* Either way, the next ether_poll looks (and
+	 * turns the interrupt back on if it should) */
+	SIP->ether.poll_pending = true;
+
+	return SUCCESS;
+}
+#endif
 
 
 /****************************************************
@@ -205,31 +458,262 @@ RETURN_STATUS remove_ether_packet_callback(ETHERNET_TYPE packet_type, void (*han
  ***************************************************/
 void ether_frame_available(uint8_t *buffer, uint16_t buffer_len)
 {
-	if(buffer_len < ETH_MINDATA)
+	/* Time it all the way through the handlers */
+	uint32_t rx_start = latency_now();
+
+	if(!ether_frame_accept(buffer, &buffer_len))
 		return;
 
+	ether_frame_dispatch(buffer, buffer_len);
+
+	latency_record(LATENCY_RX, rx_start);
+}
+
+
+/****************************************************
+ *    Function: ether_frame_accept
+ * Description: First look at a received frame: give
+ * 				the tap its copy, and check (then take
+ * 				off) the FCS with ETH_CHECK_CRC.
+ *
+ *	Input:
+ * 		buffer		the frame data.
+ * 		buffer_len	length of the frame buffer, less
+ * 					the FCS on the way out.
+ *
+ *	Return:
+ * 		true		Pass it to ether_frame_dispatch
+ * 		false		Too short, or a bad FCS
+ ***************************************************/
+bool ether_frame_accept(uint8_t *buffer, uint16_t *buffer_len)
+{
+	if(*buffer_len < ETH_MINDATA)
+		return false;
+
+	/* Without the FCS, as the transmit side does */
+	if(SIP->ether.tap != NULL)
+	{
+		SIP->ether.tap(buffer, *buffer_len - ETH_CRCLEN, false);
+	}
+
 #ifdef ETH_CHECK_CRC
-//TODO Ethernet CRC check
-#warning "WARNING: ETH_CHECK_CRC set, but CRC check not yet implemented!"
+	/* The MAC has left the FCS on the end, so check it
+	 * and then hide it from the handlers.
+	 * NOTE: It is sent least significant byte first */
+	*buffer_len -= ETH_CRCLEN;
+
+	uint32_t fcs = ether_crc32(buffer, *buffer_len);
+	if(buffer[*buffer_len] != (uint8_t)fcs
+		|| buffer[*buffer_len + 1] != (uint8_t)(fcs >> 8)
+		|| buffer[*buffer_len + 2] != (uint8_t)(fcs >> 16)
+		|| buffer[*buffer_len + 3] != (uint8_t)(fcs >> 24))
+	{
+		return false;
+	}
 #endif
 
+	return true;
+}
+
+
+/****************************************************
+ *    Function: ether_frame_dispatch
+ * Description: Hand a frame that ether_frame_accept
+ * 				has passed to whoever wants it.
+ *
+ *	Input:
+ * 		buffer		the frame data.
+ * 		buffer_len	length of the frame (no FCS).
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+void ether_frame_dispatch(uint8_t *buffer, const uint16_t buffer_len)
+{
 #warning Ethernet layer is promiscuous!
 
+#ifdef ETH_EARLY_DEMUX
+	/* UDP goes straight to its handler, or nowhere */
+	if(demux_frame(buffer, buffer_len))
+	{
+		return;
+	}
+#endif
+
 	// NOTE: This could technically be a
 	// length, but we are only using standard protocols in this stack
-	uint16_t packet_type = uint16_to_nbo(*(uint16_t*)&buffer[ETH_PROTOCOL]);
+	uint16_t packet_type = load_be16(&buffer[ETH_PROTOCOL]);
 
 	/* Find callbacks that like this packet type. */
 	uint8_t i = 0;
 	for(i = 0; i < ETHER_CALLBACK_SIZE; i++)
 	{
-		if(ether_packet_callbacks[i].required_type == packet_type)
+		if(SIP->ether.callbacks[i].required_type == packet_type
+			&& SIP->ether.callbacks[i].fn_callback != NULL)
 		{	
-			(ether_packet_callbacks[i].fn_callback)(&buffer[ETH_HEADERLEN], buffer_len-ETH_HEADERLEN);
+			(SIP->ether.callbacks[i].fn_callback)(&buffer[ETH_HEADERLEN], buffer_len-ETH_HEADERLEN);
+		}
+	}
+}
+
+
+#ifdef MAC_RX_STREAM
+/****************************************************
+ *    Function: ether_frame_header
+ * Description: The start of a frame, the rest still
+ * 				in the MAC.  Header callbacks for its
+ * 				type decide whether it is worth
+ * 				reading (and may read what they need
+ * 				with ether_rx_read).
+ *
+ *	Input:
+ * 		header		Start of the frame
+ * 		header_len	How much of it there is
+ * 		frame_len	Length of the whole frame (FCS too)
+ *
+ *	Return:
+ * 		true		Read it all for ether_frame_available
+ * 		false		Nobody wants (the rest of) it
+ ***************************************************/
+bool ether_frame_header(const uint8_t *header, const uint16_t header_len, const uint16_t frame_len)
+{
+	if(frame_len < ETH_MINDATA || header_len < ETH_HEADERLEN)
+		return false;
+
+	uint32_t rx_start = latency_now();
+
+	uint16_t packet_type = load_be16(&header[ETH_PROTOCOL]);
+
+	bool has_header_fn = false;
+	bool has_packet_fn = false;
+	bool wanted = false;
+
+	uint8_t i = 0;
+	for(i = 0; i < ETHER_CALLBACK_SIZE; i++)
+	{
+		if(SIP->ether.callbacks[i].required_type != packet_type)
+			continue;
+
+		if(SIP->ether.callbacks[i].header_fn != NULL)
+		{
+			has_header_fn = true;
+			if((SIP->ether.callbacks[i].header_fn)(&header[ETH_HEADERLEN], header_len - ETH_HEADERLEN,
+													frame_len - ETH_HEADERLEN - ETH_CRCLEN))
+			{
+				wanted = true;
+			}
+		}
+		else if(SIP->ether.callbacks[i].fn_callback != NULL)
+		{
+			has_packet_fn = true;
 		}
 	}
+
+	if(!has_header_fn)
+	{
+		wanted = has_packet_fn;
+	}
+
+#ifdef ETH_CHECK_CRC
+	/* The FCS needs every byte.  Header callbacks have
+	 * already run, so rely on the MAC for those. */
+	wanted = true;
+#endif
+
+	/* The tap sees everything */
+	if(SIP->ether.tap != NULL)
+	{
+		wanted = true;
+	}
+
+	/* Otherwise ether_frame_available times it */
+	if(!wanted)
+	{
+		latency_record(LATENCY_RX, rx_start);
+	}
+
+	return wanted;
+}
+
+
+/****************************************************
+ *    Function: ether_rx_read
+ * Description: Read more of the frame that
+ * 				ether_frame_header is looking at.
+ *
+ *		  NOTE: Only from inside a header callback.
+ *
+ *	Input:
+ *		offset			Where in the payload
+ * 		buffer			Where to put it
+ * 		buffer_len		How much to read
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE			Off the end, or no frame
+ ***************************************************/
+RETURN_STATUS ether_rx_read(const uint16_t offset, uint8_t *buffer, const uint16_t buffer_len)
+{
+	return mac_rx_read(ETH_HEADERLEN + offset, buffer, buffer_len);
+}
+#endif
+
+/****************************************************
+ *    Function: build_ether_header
+ * Description: Fill in the Ethernet header.
+ *
+ *	Input:
+ *		eth_buffer		Where the header goes
+ *		dest_addr[6]	Destination MAC
+ *		ETHERNET_TYPE	Ethernet type
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+static void build_ether_header(uint8_t *eth_buffer, const uint8_t *dest_addr/*[6]*/, const ETHERNET_TYPE type)
+{
+	/* Destination */
+	eth_buffer[0] = dest_addr[0];
+	eth_buffer[1] = dest_addr[1];
+	eth_buffer[2] = dest_addr[2];
+	eth_buffer[3] = dest_addr[3];
+	eth_buffer[4] = dest_addr[4];
+	eth_buffer[5] = dest_addr[5];
+
+	/* Source */
+	eth_buffer[6] = SIP->ether.addr[0];
+	eth_buffer[7] = SIP->ether.addr[1];
+	eth_buffer[8] = SIP->ether.addr[2];
+	eth_buffer[9] = SIP->ether.addr[3];
+	eth_buffer[10] = SIP->ether.addr[4];
+	eth_buffer[11] = SIP->ether.addr[5];
+
+	/* Type (or length if not protocol) */
+	store_be16(&eth_buffer[12], type);
+}
+
+
+/****************************************************
+ *    Function: ether_header_template
+ * Description: Build an Ethernet header to be kept and
+ * 				reused, eg for a connected UDP flow.
+ * 				Frames are then sent with
+ * 				send_ether_frame.
+ *
+ *	Input:
+ *		header			Where it goes [ETH_HEADERLEN]
+ *		dest_addr[6]	Destination MAC
+ *		ETHERNET_TYPE	Ethernet type
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+void ether_header_template(uint8_t *header, const uint8_t *dest_addr/*[6]*/, const ETHERNET_TYPE type)
+{
+	build_ether_header(header, dest_addr, type);
 }
 
+
 /****************************************************
  *    Function: send_packet
  * Description: Hands an Ethernet frame to the
@@ -254,9 +738,61 @@ RETURN_STATUS send_ether_packet(const uint8_t *dest_addr/*[6]*/, const uint8_t *
 		return FAILURE;
 	}
 
+	uint8_t header[ETH_HEADERLEN];
+	build_ether_header(header, dest_addr, type);
+
+	return send_ether_frame(header, ETH_HEADERLEN, buffer, buffer_len);
+
+}
+
+
+/****************************************************
+ *    Function: send_ether_frame
+ * Description: Hands a frame whose headers are already
+ * 				built to the MAC.  The headers start
+ * 				with the Ethernet one, and whatever
+ * 				follows it (eg IP and UDP) counts as
+ * 				payload.
+ *
+ *	Input:
+ * 		header			Headers
+ * 		header_len		Length of them (at least
+ * 						ETH_HEADERLEN)
+ * 		buffer			Rest of the payload
+ * 		buffer_len		Length of it
+ *
+ *	Return:
+ * 		SUCCESS			Frame placed on the wire.
+ * 		FAIL			Frame not sent
+ ***************************************************/
+RETURN_STATUS send_ether_frame(const uint8_t *header, const uint16_t header_len, const uint8_t *buffer, const uint16_t buffer_len)
+{
+	if(header_len < ETH_HEADERLEN)
+	{
+		return FAILURE;
+	}
+
+	/* Everything after the Ethernet header */
+	const uint16_t data_len = header_len - ETH_HEADERLEN + buffer_len;
+
+	/* Assume we cant send jumbo frames (yet!) */
+	if((uint32_t)header_len - ETH_HEADERLEN + buffer_len > ETH_MAXDATA)
+	{
+		return FAILURE;
+	}
+
+#if defined(MAC_GATHER) && !defined(ETH_ADD_SW_CRC)
+	/* Needs no padding, so the MAC can take the payload
+	 * from where it is rather than from a copy */
+	if(data_len >= ETH_MINDATA && SIP->ether.tap == NULL)
+	{
+		return send_frame_gather(header, header_len, buffer, buffer_len);
+	}
+#endif
+
 	/* If sending min data then add padding */
-	uint16_t padded_buffer_len = buffer_len;
-	if(buffer_len < ETH_MINDATA)
+	uint16_t padded_buffer_len = data_len;
+	if(data_len < ETH_MINDATA)
 	{
 		padded_buffer_len = ETH_MINDATA;
 	}
@@ -275,51 +811,36 @@ RETURN_STATUS send_ether_packet(const uint8_t *dest_addr/*[6]*/, const uint8_t *
 	 */
 
 
-	/* Destination */
-	eth_buffer[0] = dest_addr[0];
-	eth_buffer[1] = dest_addr[1];
-	eth_buffer[2] = dest_addr[2];
-	eth_buffer[3] = dest_addr[3];
-	eth_buffer[4] = dest_addr[4];
-	eth_buffer[5] = dest_addr[5];
-
-	/* Source */
-	eth_buffer[6] = ethernet_addr[0];
-	eth_buffer[7] = ethernet_addr[1];
-	eth_buffer[8] = ethernet_addr[2];
-	eth_buffer[9] = ethernet_addr[3];
-	eth_buffer[10] = ethernet_addr[4];
-	eth_buffer[11] = ethernet_addr[5];
-
-	/* Type (or length if not protocol) */
-	*(uint16_t*)&eth_buffer[12] = uint16_to_nbo(type);
+	sr_memcpy(eth_buffer, header, header_len);
 
 	/* Copy across data & padding */
 	uint16_t i = 0;
-	for(i = 0; i < padded_buffer_len; i++)
+	for(i = 0; i < padded_buffer_len + ETH_HEADERLEN - header_len; i++)
 	{
 		if(i < buffer_len)
 		{
-			eth_buffer[ETH_HEADERLEN + i] = buffer[i];
+			eth_buffer[header_len + i] = buffer[i];
 		}
 		else
 		{
-			eth_buffer[ETH_HEADERLEN + i] = 0x00;
+			eth_buffer[header_len + i] = 0x00;
 		}
 	}
 
 	/* CRC
 	 *
-	 * This is quite complicated and
-	 * most MAC controllers will do
+	 * Most MAC controllers will do
 	 * it for us, so dont by default,
 	 * but do include it in the buffer 
 	 * just in case
 	 */
 #ifdef ETH_ADD_SW_CRC
-	// TODO CRC checksum - dont forget endianness!
-	*(uint32_t*)&eth_buffer[eth_buffer_len - ETH_CRCLEN] = 0x00000000;
-#warning "Ethernet CRC calculated in software.  This is not implemented yet!"
+	/* Least significant byte goes first on the wire */
+	uint32_t fcs = ether_crc32(eth_buffer, eth_buffer_len - ETH_CRCLEN);
+	eth_buffer[eth_buffer_len - 4] = (uint8_t)fcs;
+	eth_buffer[eth_buffer_len - 3] = (uint8_t)(fcs >> 8);
+	eth_buffer[eth_buffer_len - 2] = (uint8_t)(fcs >> 16);
+	eth_buffer[eth_buffer_len - 1] = (uint8_t)(fcs >> 24);
 #else
 	*(uint8_t*)&eth_buffer[eth_buffer_len - 4] = 0;
 	*(uint8_t*)&eth_buffer[eth_buffer_len - 3] = 0;
@@ -327,6 +848,141 @@ RETURN_STATUS send_ether_packet(const uint8_t *dest_addr/*[6]*/, const uint8_t *
 	*(uint8_t*)&eth_buffer[eth_buffer_len - 1] = 0;
 #endif
 
+	if(SIP->ether.tap != NULL)
+	{
+		SIP->ether.tap(eth_buffer, eth_buffer_len - ETH_CRCLEN, true);
+	}
+
 	return send_frame(eth_buffer, eth_buffer_len);
 
 }
+
+
+#ifdef MAC_STREAM
+/****************************************************
+ *    Function: ether_stream_begin
+ * Description: Start a frame in the MAC's memory and
+ * 				write its header.  The payload is
+ * 				written with ether_stream_write, and
+ * 				it goes with ether_stream_end, so the
+ * 				frame is never held here.
+ *
+ *		  NOTE: The tap doesn't see these.
+ *
+ *	Input:
+ *		dest_addr[6]	Destination MAC
+ * 		buffer_len		Length of the payload to come
+ *		ETHERNET_TYPE	Ethernet type
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE			Too long, or no room in the MAC
+ ***************************************************/
+RETURN_STATUS ether_stream_begin(const uint8_t *dest_addr/*[6]*/, const uint16_t buffer_len, const ETHERNET_TYPE type)
+{
+	if(buffer_len > ETH_STREAM_MAXDATA)
+	{
+		return FAILURE;
+	}
+
+	/* The MAC pads it if it is short */
+	RETURN_STATUS ret = mac_tx_begin(ETH_HEADERLEN + buffer_len);
+	if(ret != SUCCESS)
+	{
+		return ret;
+	}
+
+	uint8_t header[ETH_HEADERLEN];
+	build_ether_header(header, dest_addr, type);
+
+	ret = mac_tx_write(0, header, ETH_HEADERLEN);
+	if(ret != SUCCESS)
+	{
+		mac_tx_end(false);
+	}
+
+	return ret;
+}
+
+
+/****************************************************
+ *    Function: ether_stream_write
+ * Description: Write part of the payload of the frame
+ * 				started by ether_stream_begin.
+ *
+ *	Input:
+ *		offset			Where in the payload
+ * 		buffer			Data
+ * 		buffer_len		Length of data
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE			Off the end, or no frame
+ ***************************************************/
+RETURN_STATUS ether_stream_write(const uint16_t offset, const uint8_t *buffer, const uint16_t buffer_len)
+{
+	return mac_tx_write(ETH_HEADERLEN + offset, buffer, buffer_len);
+}
+
+
+/****************************************************
+ *    Function: ether_stream_end
+ * Description: Send the frame started by
+ * 				ether_stream_begin, or throw it away.
+ *
+ *	Input:
+ *		send			false to throw it away
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE			No frame
+ ***************************************************/
+RETURN_STATUS ether_stream_end(const bool send)
+{
+	return mac_tx_end(send);
+}
+#endif /* MAC_STREAM */
+
+
+#ifdef UDP_SEG_OFFLOAD
+/****************************************************
+ *    Function: send_ether_packet_segmented
+ * Description: Hands the MAC one large frame that it
+ * 				will cut into segment_len sized UDP
+ * 				datagrams.
+ *
+ *		  NOTE: Only for MACs with MAC_OFFLOAD_UDP_SEG.
+ *		  		No padding or CRC, the segments get
+ *		  		those on their way out.
+ *
+ *	Input:
+ *		dest_addr[6]	Destination MAC
+ * 		buffer			IP packet to send
+ * 		buffer_len		Length of the buffer
+ *		ETHERNET_TYPE	Ethernet type
+ *		segment_len		UDP payload bytes per segment
+ *
+ *	Return:
+ * 		SUCCESS			Frame handed to the MAC.
+ * 		FAILURE			Frame not sent
+ ***************************************************/
+RETURN_STATUS send_ether_packet_segmented(const uint8_t *dest_addr/*[6]*/, const uint8_t *buffer, uint16_t buffer_len, const ETHERNET_TYPE type, const uint16_t segment_len)
+{
+	if(!(SIP->ether.offload & MAC_OFFLOAD_UDP_SEG) || buffer_len > UDP_SEG_MAX_PACKET)
+	{
+		return FAILURE;
+	}
+
+	uint8_t eth_buffer[UDP_SEG_MAX_PACKET + ETH_HEADERLEN];
+
+	build_ether_header(eth_buffer, dest_addr, type);
+	sr_memcpy(&eth_buffer[ETH_HEADERLEN], buffer, buffer_len);
+
+	if(SIP->ether.tap != NULL)
+	{
+		SIP->ether.tap(eth_buffer, buffer_len + ETH_HEADERLEN, true);
+	}
+
+	return send_frame_segmented(eth_buffer, buffer_len + ETH_HEADERLEN, segment_len);
+}
+#endif /* UDP_SEG_OFFLOAD */
@@ -24,6 +24,13 @@
  *				 payload to the correct handler.
  *
  *  History
+ *	DB/19-10-26	Added struct ether_header_view
+ *	DB/19-10-26	Added ether_header_template and send_ether_frame
+ *	DB/19-10-26	Added ether_stream_begin/write/end (MAC_STREAM)
+ *	DB/19-10-26	Added ether_poll (MAC_POLL)
+ *	DB/19-10-26	Added send_ether_packet_segmented
+ *	DB/19-10-26	Added get_ether_offload
+ *	DB/19-10-26	Added set_ether_tap
  *	DB/24-10-09	Started
  ****************************************************/
 #ifndef ETHERNET_H_
@@ -46,6 +53,15 @@
 
 
 
+/** Ethernet header laid over a frame (only bytes, so any address will do) **/
+struct ether_header_view
+{
+	uint8_t dest[6];
+	uint8_t src[6];
+	uint8_t type[2];	/* load_be16 */
+};
+
+
 typedef enum ETHERNET_TYPE
 {
 	INVALID = 0,
@@ -72,9 +88,68 @@ RETURN_STATUS remove_ether_packet_callback(ETHERNET_TYPE packet_type, void (*han
 /** Callback to get ethernet frame from lower level in the first place. **/
 void ether_frame_available(uint8_t *buffer, uint16_t buffer_len);
 
+/** ether_frame_available in two steps: tap and check it (taking off the FCS)... **/
+bool ether_frame_accept(uint8_t *buffer, uint16_t *buffer_len);
+
+/** ...then hand it to the callbacks **/
+void ether_frame_dispatch(uint8_t *buffer, const uint16_t buffer_len);
+
+#ifdef MAC_RX_STREAM
+/** Add a callback that sees only the headers of a packet type, and says if the rest is wanted **/
+RETURN_STATUS add_ether_header_callback(ETHERNET_TYPE packet_type, bool (*handler)(const uint8_t *header, const uint16_t header_len, const uint16_t packet_len));
+
+/** Remove a header callback **/
+RETURN_STATUS remove_ether_header_callback(ETHERNET_TYPE packet_type, bool (*handler)(const uint8_t *header, const uint16_t header_len, const uint16_t packet_len));
+
+/** Callback to get the start of a frame, still in the MAC.  True to read all of it **/
+bool ether_frame_header(const uint8_t *header, const uint16_t header_len, const uint16_t frame_len);
+
+/** Read more of that frame's payload (only from a header callback) **/
+RETURN_STATUS ether_rx_read(const uint16_t offset, uint8_t *buffer, const uint16_t buffer_len);
+#endif
+
+#ifdef MAC_POLL
+/** Called from the MAC's receive interrupt: turns it off until ether_poll has read everything **/
+void ether_rx_schedule(void);
+
+/** Read up to budget frames, returns true if there may be more **/
+bool ether_poll(const uint16_t budget);
+
+/** Always poll, never use the receive interrupt **/
+RETURN_STATUS set_ether_busy_poll(const bool busy);
+#endif
+
+/** Get a copy of every frame going in or out (eg for packet capture) **/
+RETURN_STATUS set_ether_tap(void (*tap)(const uint8_t *frame, const uint16_t frame_len, const bool outgoing));
+
+/** Checksum offload the MAC supports (MAC_OFFLOAD_* in link_uc_mac.h) **/
+uint8_t get_ether_offload(void);
+
 /** Submit a payload to send **/
 RETURN_STATUS send_ether_packet(const uint8_t *dest_addr/*[6]*/, const uint8_t *buffer, const uint16_t buffer_len, const ETHERNET_TYPE type);
 
+/** Build a header to keep, for send_ether_frame **/
+void ether_header_template(uint8_t *header/*[ETH_HEADERLEN]*/, const uint8_t *dest_addr/*[6]*/, const ETHERNET_TYPE type);
+
+/** Submit a frame with its headers already built **/
+RETURN_STATUS send_ether_frame(const uint8_t *header, const uint16_t header_len, const uint8_t *buffer, const uint16_t buffer_len);
+
+#ifdef MAC_STREAM
+/** Start a frame in the MAC, writing its header **/
+RETURN_STATUS ether_stream_begin(const uint8_t *dest_addr/*[6]*/, const uint16_t buffer_len, const ETHERNET_TYPE type);
+
+/** Write part of its payload **/
+RETURN_STATUS ether_stream_write(const uint16_t offset, const uint8_t *buffer, const uint16_t buffer_len);
+
+/** Send it (or not) **/
+RETURN_STATUS ether_stream_end(const bool send);
+#endif
+
+#ifdef UDP_SEG_OFFLOAD
+/** Submit one large UDP/IP packet for the MAC to segment **/
+RETURN_STATUS send_ether_packet_segmented(const uint8_t *dest_addr/*[6]*/, const uint8_t *buffer, uint16_t buffer_len, const ETHERNET_TYPE type, const uint16_t segment_len);
+#endif
+
 
 
 #endif
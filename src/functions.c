@@ -23,12 +23,76 @@
  *	Description: General functions.
  *
  *  History
+ *	DB/19-10-26	Assembler loops only with SR_MEM_ASM
+ *	DB/19-10-26	uint16_to_nbo no longer tests the byte order every call
+ *	DB/19-10-26	Assembler loops for AVR, AVR32 and Cortex-M3/M4
+ *	DB/19-10-26	Added checksum_partial, checksum_copy and
+ *				checksum_finish, with word and SSE2 loops.
+ *				Checksums of more than 255 bytes no longer
+ *				loop forever
+ *	DB/19-10-26	Checksums pad odd lengths with zero, not
+ *				whatever is past the end
  *	DB/16-12-10	Added home-brew memory functions, sr_memcmp,
  *				sr_memset, sr_memcpy
  *	DB/05-12-10	Started
  ****************************************************************************/
 #include "functions.h"
 
+/*
+ * Checksum loops.  Bytes at a time unless the compiler can
+ * say which way round words go, then four bytes at a time,
+ * or 16 with SSE2.  CHECKSUM_BYTEWISE forces the byte loop.
+ */
+#if !defined(CHECKSUM_BYTEWISE) && !defined(__AVR__) && defined(__GNUC__) \
+	&& (defined(__BYTE_ORDER__) || defined(__AVR32__))
+#define CHECKSUM_WORDS
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CHECKSUM_SWAP		/* Native sums come out byte swapped */
+#endif
+#if defined(__SSE2__) && !defined(CHECKSUM_NO_SIMD)
+#define CHECKSUM_SIMD
+#include <emmintrin.h>
+#endif
+#endif
+
+/*
+ * Assembler loops, picked by processor when SR_MEM_ASM is
+ * defined.  Off by default: the C versions are the
+ * reference (functions_test.cpp checks against them), and
+ * the assembler ones can't be run on the PC.
+ *
+ *  AVR				ld/st with post increment, and an adc
+ *  				chain for the checksum
+ *  Cortex-M3/M4	ldm/stm four words at a time, and adcs
+ *  AVR32			ldm/stm four words at a time
+ */
+#if defined(__GNUC__) && defined(SR_MEM_ASM)
+#if defined(__AVR__)
+#define SR_MEM_AVR
+#elif defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+#define SR_MEM_CORTEX_M
+#elif defined(__AVR32__)
+#define SR_MEM_AVR32
+#endif
+#endif
+
+static uint32_t checksum_skip(const uint8_t *buffer, uint16_t len, uint16_t checksum_location, uint32_t sum);
+static uint32_t checksum_run(uint8_t *dest, const uint8_t *src, uint16_t len, uint32_t sum);
+#ifdef CHECKSUM_WORDS
+static uint64_t checksum_words(uint8_t *dest, const uint8_t *src, uint16_t len);
+#else
+static uint32_t checksum_bytes(uint8_t *dest, const uint8_t *src, uint16_t len, uint32_t sum);
+#endif
+#ifdef CHECKSUM_SIMD
+static uint16_t checksum_sse2(uint8_t *dest, const uint8_t *src, uint16_t len, uint64_t *sum);
+#endif
+#if defined(SR_MEM_CORTEX_M) || defined(SR_MEM_AVR32)
+static uint16_t copy_blocks(uint8_t *dest, const uint8_t *src, uint16_t len);
+#endif
+#ifdef SR_MEM_CORTEX_M
+static uint16_t checksum_blocks(uint8_t *dest, const uint8_t *src, uint16_t len, uint64_t *sum);
+#endif
+
 
 /****************************************************
  *    Function: uint16_to_nbo
@@ -43,20 +107,8 @@
  ***************************************************/
 uint16_t uint16_to_nbo(uint16_t val)
 {
-    uint16_t iTestString = 0x00FF;
-    uint8_t iResult = *(uint8_t*)&iTestString;
-
-    if(iResult == 0xFF) /* Little Endian (truncated high byte) */
-    {
-    	/* Copy current value into single byte chunks */
-        uint8_t rev[2] = {0};
-    	*(uint16_t*)rev = (uint16_t)val;
-
-    	/* Put chunks back into whole value, backwards */
-        val = (rev[0] << 8) | rev[1];
-    }
-
-    return val;
+	/* Byte order is known at compile time (byteorder.h) */
+	return host_to_be16(val);
 }
 
 
@@ -94,11 +146,29 @@ uint16_t uint16_from_nbo(uint16_t val)
  ***************************************************/
 void sr_memset(volatile uint8_t* buffer, volatile uint8_t value, uint16_t len)
 {
+	/* Every byte is still written once, so the loop needn't
+	 * be volatile (which would stop it being optimised) */
+	uint8_t *dest = (uint8_t *)buffer;
+	const uint8_t fill = value;
+
+#ifdef SR_MEM_AVR
+	if(len > 0)
+	{
+		__asm__ __volatile__(
+			"1:	st %a[dest]+, %[fill]"	"\n\t"
+			"	sbiw %[len], 1"			"\n\t"
+			"	brne 1b"				"\n\t"
+			: [dest] "+e" (dest), [len] "+w" (len)
+			: [fill] "r" (fill)
+			: "memory");
+	}
+#else
 	uint16_t i = 0;
 	for(i = 0; i < len; i++)
 	{
-		buffer[i] = value;
+		dest[i] = fill;
 	}
+#endif
 }
 
 
@@ -117,11 +187,32 @@ void sr_memset(volatile uint8_t* buffer, volatile uint8_t value, uint16_t len)
  ***************************************************/
 void sr_memcpy(volatile uint8_t* dest, volatile const uint8_t* src, uint16_t len)
 {
+	uint8_t *to = (uint8_t *)dest;
+	const uint8_t *from = (const uint8_t *)src;
+
+#ifdef SR_MEM_AVR
+	uint8_t byte;
+	if(len > 0)
+	{
+		__asm__ __volatile__(
+			"1:	ld %[byte], %a[from]+"	"\n\t"
+			"	st %a[to]+, %[byte]"	"\n\t"
+			"	sbiw %[len], 1"			"\n\t"
+			"	brne 1b"				"\n\t"
+			: [to] "+e" (to), [from] "+e" (from), [len] "+w" (len), [byte] "=&r" (byte)
+			:
+			: "memory");
+	}
+#else
 	uint16_t i = 0;
-	for(i = 0; i < len; i++)
+#if defined(SR_MEM_CORTEX_M) || defined(SR_MEM_AVR32)
+	i = copy_blocks(to, from, len);
+#endif
+	for(; i < len; i++)
 	{
-		dest[i] = src[i];
+		to[i] = from[i];
 	}
+#endif
 }
 
 /****************************************************
@@ -142,16 +233,40 @@ void sr_memcpy(volatile uint8_t* dest, volatile const uint8_t* src, uint16_t len
  ***************************************************/
 bool sr_memcmp(volatile const uint8_t* buffa, volatile const uint8_t* buffb, uint16_t len)
 {
+	const uint8_t *a = (const uint8_t *)buffa;
+	const uint8_t *b = (const uint8_t *)buffb;
+
+#ifdef SR_MEM_AVR
+	uint8_t byte_a, byte_b;
+	if(len > 0)
+	{
+		/* Stops with len non-zero at the first difference */
+		__asm__ __volatile__(
+			"1:	ld %[byte_a], %a[a]+"	"\n\t"
+			"	ld %[byte_b], %a[b]+"	"\n\t"
+			"	cp %[byte_a], %[byte_b]"	"\n\t"
+			"	brne 2f"				"\n\t"
+			"	sbiw %[len], 1"			"\n\t"
+			"	brne 1b"				"\n\t"
+			"2:"						"\n\t"
+			: [a] "+e" (a), [b] "+e" (b), [len] "+w" (len), [byte_a] "=&r" (byte_a), [byte_b] "=&r" (byte_b)
+			:
+			: "memory");
+	}
+
+	return (len == 0);
+#else
 	uint16_t i = 0;
 	for(i = 0; i < len; i++)
 	{
-		if(buffa[i] != buffb[i])
+		if(a[i] != b[i])
 		{
 			return false;
 		}
 	}
 
 	return true;
+#endif
 }
 
 
@@ -170,18 +285,103 @@ bool sr_memcmp(volatile const uint8_t* buffa, volatile const uint8_t* buffb, uin
  ***************************************************/
 uint16_t checksum(const uint8_t *buffer, uint16_t len, uint8_t checksum_location)
 {
-	uint32_t sum = 0;
-	uint8_t i = 0;
+	return checksum_finish(checksum_skip(buffer, len, checksum_location, 0));
+}
+
 
-	/* Sum in 16-bit blocks */
-	for(i = 0; i < len; i+=2)
+/****************************************************
+ *    Function: checksum_fragmented
+ * Description: Creates network checksum from a couple
+ *				of buffers, where 'header' is (usually)
+ *				a pseudo-header (eg UDP)
+ *
+ *	Input:
+ *		header		First fragment data
+ *		header_len	First fragment len
+ *		data		Second fragment data
+ *		data_len	Second fragment len
+ *		checksum_location	Location in the CONCATENATED buffers where the checksum (to ignore) is expected
+ *
+ *	Return:
+ * 		uint16_t
+ ***************************************************/
+uint16_t checksum_fragmented(const uint8_t *header, uint16_t header_len, const uint8_t *data, uint16_t data_len, uint8_t checksum_location)
+{
+	/* Each fragment is summed as if it starts a word */
+	uint32_t sum = checksum_skip(header, header_len, checksum_location, 0);
+
+	if(checksum_location >= header_len)
 	{
-		if(i != checksum_location) /* Mask out where the checksum should go */
-		{
-			sum += (buffer[i] << 8) | buffer[i+1];
-		}
+		sum = checksum_skip(data, data_len, checksum_location - header_len, sum);
+	}
+	else
+	{
+		sum = checksum_partial(data, data_len, sum);
 	}
 
+	return checksum_finish(sum);
+}
+
+
+/****************************************************
+ *    Function: checksum_partial
+ * Description: Add a buffer to a running checksum
+ * 				(as Linux's csum_partial).  The buffer
+ * 				is taken to start on a 16 bit word of
+ * 				the packet; an odd last byte is padded
+ * 				with zero.
+ *
+ *	Input:
+ *		buffer		Data
+ *		len			Length of it
+ *		sum			Sum so far (0 to start)
+ *
+ *	Return:
+ * 		New sum, folded to 16 bits but not
+ * 		complemented (see checksum_finish)
+ ***************************************************/
+uint32_t checksum_partial(const uint8_t *buffer, uint16_t len, uint32_t sum)
+{
+	return checksum_run(NULL, buffer, len, sum);
+}
+
+
+/****************************************************
+ *    Function: checksum_copy
+ * Description: Copy a buffer and add it to a running
+ * 				checksum, reading each byte only once
+ * 				(as Linux's csum_partial_copy).  Use it
+ * 				wherever data is both moved and
+ * 				summed.
+ *
+ *	Input:
+ *		dest		Where it goes (must not overlap src)
+ *		src			Data
+ *		len			Length of it
+ *		sum			Sum so far (0 to start)
+ *
+ *	Return:
+ * 		New sum, as checksum_partial
+ ***************************************************/
+uint32_t checksum_copy(uint8_t *dest, const uint8_t *src, uint16_t len, uint32_t sum)
+{
+	return checksum_run(dest, src, len, sum);
+}
+
+
+/****************************************************
+ *    Function: checksum_finish
+ * Description: Turn a running sum into the checksum
+ * 				to put in a header.
+ *
+ *	Input:
+ *		sum			From checksum_partial/copy
+ *
+ *	Return:
+ * 		uint16_t	(never 0, as checksum)
+ ***************************************************/
+uint16_t checksum_finish(uint32_t sum)
+{
 	/* Keep folding until all carry bits are added */
 	while(sum >> 16)
 	{
@@ -192,60 +392,402 @@ uint16_t checksum(const uint8_t *buffer, uint16_t len, uint8_t checksum_location
 	sum = ~sum;
 
 	return ((uint16_t)sum == 0) ? 0xFFFF : (uint16_t)sum;
+}
 
+
+/****************************************************
+ *    Function: checksum_skip
+ * Description: checksum_partial, leaving out the word
+ * 				at checksum_location (if it is in the
+ * 				buffer, on a word).
+ ***************************************************/
+static uint32_t checksum_skip(const uint8_t *buffer, uint16_t len, uint16_t checksum_location, uint32_t sum)
+{
+	if((checksum_location & 1) || checksum_location >= len)
+	{
+		return checksum_partial(buffer, len, sum);
+	}
+
+	sum = checksum_partial(buffer, checksum_location, sum);
+
+	if(checksum_location + 2 < len)
+	{
+		sum = checksum_partial(&buffer[checksum_location + 2], len - checksum_location - 2, sum);
+	}
+
+	return sum;
 }
 
 
 /****************************************************
- *    Function: checksum_fragmented
- * Description: Creates network checksum from a couple
- *				of buffers, where 'header' is (usually)
- *				a pseudo-header (eg UDP)
+ *    Function: checksum_run
+ * Description: Sum (and maybe copy) a buffer, with
+ * 				whichever of the loops below suits the
+ * 				processor.
  *
  *	Input:
- *		header		First fragment data
- *		header_len	First fragment len
- *		data		Second fragment data
- *		data_len	Second fragment len
- *		checksum_location	Location in the CONCATENATED buffers where the checksum (to ignore) is expected
+ *		dest		Where to copy it, or NULL
+ *		src			Data
+ *		len			Length of it
+ *		sum			Sum so far
  *
  *	Return:
- * 		uint16_t
+ * 		New sum, folded to 16 bits
  ***************************************************/
-uint16_t checksum_fragmented(const uint8_t *header, uint16_t header_len, const uint8_t *data, uint16_t data_len, uint8_t checksum_location)
+static uint32_t checksum_run(uint8_t *dest, const uint8_t *src, uint16_t len, uint32_t sum)
+{
+#if defined(CHECKSUM_SIMD) || defined(CHECKSUM_WORDS)
+	/* Native order sum, which is the packet's order with
+	 * the two bytes swapped on little endian machines */
+	uint64_t native = 0;
+	uint16_t done = 0;
+
+#ifdef CHECKSUM_SIMD
+	done = checksum_sse2(dest, src, len, &native);
+#endif
+	native += checksum_words(dest ? &dest[done] : NULL, &src[done], len - done);
+
+	while(native >> 16)
+	{
+		native = (native & 0xFFFF) + (native >> 16);
+	}
+
+#ifdef CHECKSUM_SWAP
+	native = ((native & 0xFF) << 8) | (native >> 8);
+#endif
+
+	sum += (uint32_t)native;
+#else
+	sum = checksum_bytes(dest, src, len, sum);
+#endif
+
+	while(sum >> 16)
+	{
+		sum = (sum & 0x0000FFFF) + (sum >> 16);
+	}
+
+	return sum;
+}
+
+
+#if !defined(CHECKSUM_SIMD) && !defined(CHECKSUM_WORDS)
+/****************************************************
+ *    Function: checksum_bytes
+ * Description: A byte at a time, for small processors
+ * 				and compilers that can't say which way
+ * 				round words are.
+ ***************************************************/
+static uint32_t checksum_bytes(uint8_t *dest, const uint8_t *src, uint16_t len, uint32_t sum)
 {
-	uint32_t sum = 0;
-	uint8_t i = 0;
+	uint16_t i = 0;
 
-	/* Sum header first */
-	for(i = 0; i < header_len; i+=2)
+#ifdef SR_MEM_AVR
+	/* A word at a time into 16 bits, carries added straight
+	 * back in (it can't carry twice) */
+	uint16_t words = len >> 1;
+	if(words > 0)
 	{
-		if(i != checksum_location)
+		uint16_t acc = 0;
+		uint8_t high, low;
+		const uint8_t *from = src;
+		uint8_t *to = dest;
+
+		if(to != NULL)
+		{
+			__asm__ __volatile__(
+				"1:	ld %[high], %a[from]+"		"\n\t"
+				"	ld %[low], %a[from]+"		"\n\t"
+				"	st %a[to]+, %[high]"		"\n\t"
+				"	st %a[to]+, %[low]"			"\n\t"
+				"	add %A[acc], %[low]"		"\n\t"
+				"	adc %B[acc], %[high]"		"\n\t"
+				"	adc %A[acc], __zero_reg__"	"\n\t"
+				"	adc %B[acc], __zero_reg__"	"\n\t"
+				"	sbiw %[words], 1"			"\n\t"
+				"	brne 1b"					"\n\t"
+				: [acc] "+r" (acc), [words] "+w" (words), [high] "=&r" (high), [low] "=&r" (low),
+				  [from] "+e" (from), [to] "+e" (to)
+				:
+				: "memory");
+		}
+		else
 		{
-			sum += (header[i] << 8) | header[i+1];
+			__asm__ __volatile__(
+				"1:	ld %[high], %a[from]+"		"\n\t"
+				"	ld %[low], %a[from]+"		"\n\t"
+				"	add %A[acc], %[low]"		"\n\t"
+				"	adc %B[acc], %[high]"		"\n\t"
+				"	adc %A[acc], __zero_reg__"	"\n\t"
+				"	adc %B[acc], __zero_reg__"	"\n\t"
+				"	sbiw %[words], 1"			"\n\t"
+				"	brne 1b"					"\n\t"
+				: [acc] "+r" (acc), [words] "+w" (words), [high] "=&r" (high), [low] "=&r" (low),
+				  [from] "+e" (from)
+				:
+				: "memory");
 		}
+
+		sum += acc;
 	}
+	i = len & ~1;
+#else
+	for(i = 0; i + 1 < len; i += 2)
+	{
+		if(dest != NULL)
+		{
+			dest[i] = src[i];
+			dest[i + 1] = src[i + 1];
+		}
 
-	/* Then sum data */
-	for(i = 0; i < data_len; i+=2)
+		sum += ((uint32_t)src[i] << 8) | src[i + 1];
+
+		/* Never let it overflow, however long */
+		if(sum & 0x80000000UL)
+		{
+			sum = (sum & 0x0000FFFF) + (sum >> 16);
+		}
+	}
+#endif
+
+	/* Odd length, pad with a zero byte */
+	if(i < len)
 	{
-		if(i + header_len != checksum_location)
+		if(dest != NULL)
 		{
-			sum += (data[i] << 8) | data[i+1];
+			dest[i] = src[i];
 		}
+
+		sum += (uint32_t)src[i] << 8;
 	}
 
+	return sum;
+}
+#else
+/****************************************************
+ *    Function: checksum_words
+ * Description: Four bytes at a time, summed in the
+ * 				machine's own byte order (the ones
+ * 				complement sum comes out the same,
+ * 				just byte swapped, RFC 1071).
+ *
+ *	Return:
+ * 		The sum in native order (not folded)
+ ***************************************************/
+static uint64_t checksum_words(uint8_t *dest, const uint8_t *src, uint16_t len)
+{
+	uint64_t sum = 0;
+	uint32_t word = 0;
 
-	/* Keep folding until all carry bits are added */
-	while(sum >> 16)
+#ifdef SR_MEM_CORTEX_M
+	uint16_t done = checksum_blocks(dest, src, len, &sum);
+	src += done;
+	len -= done;
+	if(dest != NULL)
 	{
-		sum = (sum & 0x0000FFFF) + (sum >> 16);
+		dest += done;
 	}
+#endif
 
-	/* Ones-complement */
-	sum = ~sum;
+	while(len >= 4)
+	{
+		/* memcpy so unaligned packets are fine */
+		__builtin_memcpy(&word, src, 4);
+		if(dest != NULL)
+		{
+			__builtin_memcpy(dest, &word, 4);
+			dest += 4;
+		}
+
+		sum += word;
+		src += 4;
+		len -= 4;
+	}
+
+	if(len >= 2)
+	{
+		uint16_t half = 0;
+		__builtin_memcpy(&half, src, 2);
+		if(dest != NULL)
+		{
+			__builtin_memcpy(dest, &half, 2);
+			dest += 2;
+		}
+
+		sum += half;
+		src += 2;
+		len -= 2;
+	}
+
+	/* Odd length, pad with a zero byte */
+	if(len == 1)
+	{
+		if(dest != NULL)
+		{
+			*dest = *src;
+		}
+
+#ifdef CHECKSUM_SWAP
+		sum += *src;
+#else
+		sum += (uint32_t)*src << 8;
+#endif
+	}
+
+	return sum;
+}
+#endif
+
+
+#ifdef CHECKSUM_SIMD
+/****************************************************
+ *    Function: checksum_sse2
+ * Description: 16 bytes at a time.  Each 16 bit word
+ * 				is widened to 32 bits and added in its
+ * 				own lane; a lane can't overflow in a
+ * 				64 KB buffer.
+ *
+ *	Input:
+ *		dest		Where to copy it, or NULL
+ *		src			Data
+ *		len			Length of it
+ *		sum			Native order sum to add to
+ *
+ *	Return:
+ * 		Bytes done (the rest is for checksum_words)
+ ***************************************************/
+static uint16_t checksum_sse2(uint8_t *dest, const uint8_t *src, uint16_t len, uint64_t *sum)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lanes = _mm_setzero_si128();
 
-	return (sum == 0) ? 0xFFFF : (uint16_t)sum;
+	uint16_t i = 0;
+	for(i = 0; i + 16 <= len; i += 16)
+	{
+		__m128i data = _mm_loadu_si128((const __m128i *)&src[i]);
+		if(dest != NULL)
+		{
+			_mm_storeu_si128((__m128i *)&dest[i], data);
+		}
+
+		lanes = _mm_add_epi32(lanes, _mm_unpacklo_epi16(data, zero));
+		lanes = _mm_add_epi32(lanes, _mm_unpackhi_epi16(data, zero));
+	}
 
+	uint32_t lane[4];
+	_mm_storeu_si128((__m128i *)lane, lanes);
+	*sum += (uint64_t)lane[0] + lane[1] + lane[2] + lane[3];
+
+	return i;
 }
+#endif
+
 
+#if defined(SR_MEM_CORTEX_M) || defined(SR_MEM_AVR32)
+/****************************************************
+ *    Function: copy_blocks
+ * Description: Copy 16 bytes at a time with ldm/stm,
+ * 				if both buffers are word aligned (ldm
+ * 				and stm fault otherwise).
+ *
+ *	Return:
+ * 		Bytes copied (the rest is for the caller)
+ ***************************************************/
+static uint16_t copy_blocks(uint8_t *dest, const uint8_t *src, uint16_t len)
+{
+	uint32_t blocks = len >> 4;
+	if(blocks == 0 || (((uintptr_t)dest | (uintptr_t)src) & 3) != 0)
+	{
+		return 0;
+	}
+
+#ifdef SR_MEM_CORTEX_M
+	/* r7 can be the frame pointer, so it is left alone */
+	__asm__ __volatile__(
+		"1:	ldmia %[src]!, {r4, r5, r6, r8}"	"\n\t"
+		"	stmia %[dest]!, {r4, r5, r6, r8}"	"\n\t"
+		"	subs %[blocks], %[blocks], #1"		"\n\t"
+		"	bne 1b"								"\n\t"
+		: [dest] "+r" (dest), [src] "+r" (src), [blocks] "+r" (blocks)
+		:
+		: "r4", "r5", "r6", "r8", "cc", "memory");
+#else
+	/* stm has no post increment, so step dest by hand */
+	__asm__ __volatile__(
+		"1:	ldm %[src]++, r0-r3"		"\n\t"
+		"	stm %[dest], r0-r3"			"\n\t"
+		"	sub %[dest], -16"			"\n\t"
+		"	sub %[blocks], 1"			"\n\t"
+		"	brne 1b"					"\n\t"
+		: [dest] "+r" (dest), [src] "+r" (src), [blocks] "+r" (blocks)
+		:
+		: "r0", "r1", "r2", "r3", "cc", "memory");
+#endif
+
+	return len & ~15;
+}
+#endif
+
+
+#ifdef SR_MEM_CORTEX_M
+/****************************************************
+ *    Function: checksum_blocks
+ * Description: Sum (and maybe copy) 16 bytes at a time
+ * 				with ldm and an adcs chain, the carry
+ * 				going straight back in.  Word aligned
+ * 				buffers only, as copy_blocks.
+ *
+ *	Input:
+ *		dest		Where to copy it, or NULL
+ *		src			Data
+ *		len			Length of it
+ *		sum			Native order sum to add to
+ *
+ *	Return:
+ * 		Bytes done (the rest is for checksum_words)
+ ***************************************************/
+static uint16_t checksum_blocks(uint8_t *dest, const uint8_t *src, uint16_t len, uint64_t *sum)
+{
+	uint32_t blocks = len >> 4;
+	if(blocks == 0 || (((uintptr_t)dest | (uintptr_t)src) & 3) != 0)
+	{
+		return 0;
+	}
+
+	uint32_t acc = 0;
+	if(dest != NULL)
+	{
+		__asm__ __volatile__(
+			"1:	ldmia %[src]!, {r4, r5, r6, r8}"	"\n\t"
+			"	stmia %[dest]!, {r4, r5, r6, r8}"	"\n\t"
+			"	adds %[acc], %[acc], r4"			"\n\t"
+			"	adcs %[acc], %[acc], r5"			"\n\t"
+			"	adcs %[acc], %[acc], r6"			"\n\t"
+			"	adcs %[acc], %[acc], r8"			"\n\t"
+			"	adc %[acc], %[acc], #0"				"\n\t"
+			"	subs %[blocks], %[blocks], #1"		"\n\t"
+			"	bne 1b"								"\n\t"
+			: [acc] "+r" (acc), [dest] "+r" (dest), [src] "+r" (src), [blocks] "+r" (blocks)
+			:
+			: "r4", "r5", "r6", "r8", "cc", "memory");
+	}
+	else
+	{
+		__asm__ __volatile__(
+			"1:	ldmia %[src]!, {r4, r5, r6, r8}"	"\n\t"
+			"	adds %[acc], %[acc], r4"			"\n\t"
+			"	adcs %[acc], %[acc], r5"			"\n\t"
+			"	adcs %[acc], %[acc], r6"			"\n\t"
+			"	adcs %[acc], %[acc], r8"			"\n\t"
+			"	adc %[acc], %[acc], #0"				"\n\t"
+			"	subs %[blocks], %[blocks], #1"		"\n\t"
+			"	bne 1b"								"\n\t"
+			: [acc] "+r" (acc), [src] "+r" (src), [blocks] "+r" (blocks)
+			:
+			: "r4", "r5", "r6", "r8", "cc", "memory");
+	}
+
+	*sum += acc;
+
+	return len & ~15;
+}
+#endif
@@ -23,6 +23,8 @@
  *	Description: General functions.
  *
  *  History
+ *	DB/19-10-26	Byte order worked out at compile time (byteorder.h)
+ *	DB/19-10-26	Added checksum_partial, checksum_copy, checksum_finish
  *	DB/16-12-10	Added home-grown sr_memset, sr_memcpy, sr_memcmp functions
  *	DB/05-12-10	Started
  ****************************************************************************/
@@ -30,6 +32,7 @@
 #define FUNCTIONS_H_
 
 #include "global.h"
+#include "byteorder.h"
 
 /** Convert a uint16_t to Network Byte Order (big endian) **/
 uint16_t uint16_to_nbo(uint16_t val);
@@ -52,5 +55,14 @@ uint16_t checksum(const uint8_t *buffer, uint16_t len, uint8_t checksum_location
 /** Checksum packet from fragmented data */
 uint16_t checksum_fragmented(const uint8_t *header, uint16_t header_len, const uint8_t *data, uint16_t data_len, uint8_t checksum_location);
 
+/** Add a buffer to a running checksum (not complemented) */
+uint32_t checksum_partial(const uint8_t *buffer, uint16_t len, uint32_t sum);
+
+/** Copy a buffer and add it to a running checksum, in one pass */
+uint32_t checksum_copy(uint8_t *dest, const uint8_t *src, uint16_t len, uint32_t sum);
+
+/** Make a running checksum into the one for the header */
+uint16_t checksum_finish(uint32_t sum);
+
 
 #endif /* FUNCTIONS_H_ */
@@ -38,6 +38,10 @@
  *
  *
  *  History
+ *	DB/19 Oct 2026	Header fields read and written with byteorder.h
+ *	DB/19 Oct 2026	Ping replies copied and summed in one pass
+ *	DB/19 Oct 2026	State moved into the stack context
+ *	DB/19 Oct 2026	Skip checksums the MAC does for us
  *	DB/06 Oct 2010	Started
  ****************************************************************************/
 
@@ -46,6 +50,9 @@
 #include "ip.h" // The layer below.
 #include "functions.h"
 #include "timer.h"
+#include "ethernet.h"
+#include "link_uc_mac.h"
+#include "sip_ctx.h"
 
 
 /* Defines the location of certain bytes in the ICMP header */
@@ -63,14 +70,10 @@
 #define ICMP_PING_REQUEST_TYPE	8
 
 
-/* Dont keep initialising this protocol */
-static bool icmp_initialised = false;
-
-/* Keep track of outgoing ping */
-static uint16_t ping_timeout_id = 0;
-static bool ping_host_available = false;
-
-static enum error_list last_error = NONE;
+/*
+ * Whether we are initialised, the outgoing ping and the
+ * last error are kept in the stack context (SIP->icmp).
+ */
 
 
 /****************************************************
@@ -85,7 +88,7 @@ static enum error_list last_error = NONE;
  ***************************************************/
 RETURN_STATUS init_icmp()
 {
-	if(icmp_initialised)
+	if(SIP->icmp.initialised)
 		return FAILURE;
 
 	/*
@@ -100,7 +103,7 @@ RETURN_STATUS init_icmp()
 	RETURN_STATUS ret = add_ip4_packet_callback(IP_ICMP, &icmp_arrival_callback);
 
 	if(ret == SUCCESS)
-		icmp_initialised = true;
+		SIP->icmp.initialised = true;
 
 	return ret;
 
@@ -117,8 +120,8 @@ RETURN_STATUS init_icmp()
  ***************************************************/
 enum error_list get_last_error()
 {
-	enum error_list temp = last_error;
-	last_error = NONE;
+	enum error_list temp = SIP->icmp.last_error;
+	SIP->icmp.last_error = NONE;
 	return temp;
 }
 
@@ -150,13 +153,16 @@ void icmp_arrival_callback(const uint8_t *src_addr, const uint8_t* buffer, const
 		return;
 	}
 
-	/* Check the checksum */
-	uint16_t incomming_checksum = *(uint16_t*)&buffer[ICMP_CHECKSUM];
-	uint16_t rechecked_checksum = uint16_to_nbo( checksum(buffer, buffer_len, ICMP_CHECKSUM) );
-	if(incomming_checksum != rechecked_checksum)
+	/* Check the checksum (unless the MAC already has) */
+	if(!(get_ether_offload() & MAC_OFFLOAD_RX_CSUM))
 	{
-//		last_error = INCOMMING_CHECKSUM;
-		return;
+		uint16_t incomming_checksum = load_be16(&buffer[ICMP_CHECKSUM]);
+		uint16_t rechecked_checksum = checksum(buffer, buffer_len, ICMP_CHECKSUM);
+		if(incomming_checksum != rechecked_checksum)
+		{
+//			SIP->icmp.last_error = INCOMMING_CHECKSUM;
+			return;
+		}
 	}
 
 
@@ -168,9 +174,9 @@ void icmp_arrival_callback(const uint8_t *src_addr, const uint8_t* buffer, const
 	/* Ping reply - dont worry about checking authenticity. */
 	if(type == ICMP_PING_REPLY_TYPE)
 	{
-		ping_host_available = true;
-		kill_timer(ping_timeout_id, false);
-		ping_timeout_id = 0; /* Just in case someone keeps sending replies! */
+		SIP->icmp.ping_host_available = true;
+		kill_timer(SIP->icmp.ping_timeout_id, false);
+		SIP->icmp.ping_timeout_id = 0; /* Just in case someone keeps sending replies! */
 	}
 
 	/* Ping request */
@@ -181,11 +187,28 @@ void icmp_arrival_callback(const uint8_t *src_addr, const uint8_t* buffer, const
 			return;
 
 		uint8_t ping_reply[MAX_PING_REPLY_LEN];
-		sr_memcpy(ping_reply, buffer, buffer_len);
 
 		/* Convert type to 0 (response) re-checksum then send back packet */
-		ping_reply[ICMP_TYPE] = 0;
-		*(uint16_t*)&ping_reply[ICMP_CHECKSUM] = uint16_to_nbo( checksum(ping_reply, buffer_len, ICMP_CHECKSUM) );
+		if(get_ether_offload() & MAC_OFFLOAD_TX_CSUM)
+		{
+			sr_memcpy(ping_reply, buffer, buffer_len);
+			ping_reply[ICMP_TYPE] = 0;
+			store_be16(&ping_reply[ICMP_CHECKSUM], 0x0000);
+		}
+		else
+		{
+			/* Sum it as it is copied, then swap the request's
+			 * type and checksum words for the reply's (adding
+			 * the complement takes a word away) */
+			uint32_t sum = checksum_copy(ping_reply, buffer, buffer_len, 0);
+			sum += (uint16_t)~((ping_reply[ICMP_TYPE] << 8) | ping_reply[ICMP_TYPE + 1]);
+			sum += (uint16_t)~((ping_reply[ICMP_CHECKSUM] << 8) | ping_reply[ICMP_CHECKSUM + 1]);
+
+			ping_reply[ICMP_TYPE] = 0;
+			sum += (ping_reply[ICMP_TYPE] << 8) | ping_reply[ICMP_TYPE + 1];
+
+			store_be16(&ping_reply[ICMP_CHECKSUM], checksum_finish(sum));
+		}
 
 		send_ip4_datagram(src_addr, ping_reply, buffer_len, IP_ICMP);
 	}
@@ -239,28 +262,31 @@ RETURN_STATUS ping(const uint8_t* dest_addr)
 	ping_header[ICMP_CODE] = 0x00;
 
 	/* Checksum 0 to start */
-	*(uint16_t*)&ping_header[ICMP_CHECKSUM] = 0x0000;
+	store_be16(&ping_header[ICMP_CHECKSUM], 0x0000);
 	
 	/* ID */
-	*(uint16_t*)&ping_header[4] = 0x0101;
+	store_be16(&ping_header[4], 0x0101);
 
 	/* Sequence */
-	*(uint16_t*)&ping_header[6] = 0x1010;
+	store_be16(&ping_header[6], 0x1010);
 
 	/* Data, 4 bytes of padding */
-	*(uint32_t*)&ping_header[8] = 0x11223344;
+	store_be32(&ping_header[8], 0x11223344);
 
 
-	/* Now calculate the checksum */
-	uint16_t icmp_checksum = checksum(ping_header, ICMP_PING_LEN, ICMP_CHECKSUM);
-	*(uint16_t*)&ping_header[ICMP_CHECKSUM] = uint16_to_nbo( icmp_checksum );
+	/* Now calculate the checksum (left as zero if the MAC does it) */
+	if(!(get_ether_offload() & MAC_OFFLOAD_TX_CSUM))
+	{
+		uint16_t icmp_checksum = checksum(ping_header, ICMP_PING_LEN, ICMP_CHECKSUM);
+		store_be16(&ping_header[ICMP_CHECKSUM], icmp_checksum);
+	}
 
 
 	/* Create a timer and start counting */
-	ping_timeout_id = add_timer(PING_TIMEOUT, NULL);
+	SIP->icmp.ping_timeout_id = add_timer(PING_TIMEOUT, NULL);
 
 	/* Prepare for the worst */
-	ping_host_available = false;
+	SIP->icmp.ping_host_available = false;
 
 
 	/* Wrap it up in an IP packet for sending */
@@ -270,10 +296,10 @@ RETURN_STATUS ping(const uint8_t* dest_addr)
 		return ret;
 
 
-	while(is_running(ping_timeout_id) == true)
+	while(is_running(SIP->icmp.ping_timeout_id) == true)
 	{
 		/* Busy-wait (block) until timeout or packet arrives. */
 	}
 
-	return (ping_host_available) ? SUCCESS : FAILURE;
+	return (SIP->icmp.ping_host_available) ? SUCCESS : FAILURE;
 }
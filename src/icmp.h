@@ -24,6 +24,7 @@
  *
  *
  *  History
+ *	DB/19 Oct 2026	Added struct icmp_header_view
  *	DB/06 Oct 2010	Started
  ****************************************************/
 #ifndef ICMP_H_
@@ -31,6 +32,17 @@
 
 #include "global.h"
 
+/** ICMP echo header laid over a packet (only bytes, so any address will do) **/
+struct icmp_header_view
+{
+	uint8_t type;
+	uint8_t code;
+	uint8_t checksum[2];
+	uint8_t ident[2];
+	uint8_t sequence[2];
+};
+
+
 enum error_list
 {
 	NONE,
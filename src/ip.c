@@ -24,6 +24,13 @@
  *
  *
  *  History
+ *	DB/19 Oct 2026	Header fields read and written with byteorder.h
+ *	DB/19 Oct 2026	Added ip4_header_template/complete, for flows
+ *	DB/19 Oct 2026	Decide from the header alone (MAC_RX_STREAM)
+ *	DB/19 Oct 2026	Packets built in the MAC (MAC_STREAM)
+ *	DB/19 Oct 2026	State moved into the stack context
+ *	DB/19 Oct 2026	Added send_ip4_datagram_segmented
+ *	DB/19 Oct 2026	Skip checksums the MAC does for us
  *	DB/21 Dec 2010	Added get_ipv4_addr
  *	DB/14 Oct 2010	Started
  ****************************************************/
@@ -32,21 +39,19 @@
 #include "ip.h"
 #include "functions.h"
 #include "arp.h"
+#include "link_uc_mac.h"
+#include "sip_ctx.h"
 
-/** Keep track of who to call when a packet arrives **/
-struct ip_callback_element
-{
-	IP_TYPE packet_type;
-	void (*callback_fn)(const uint8_t* src_addr, const uint8_t *buffer, uint16_t const buffer_len);
-};
-static struct ip_callback_element ip_callbacks[IP_CALLBACK_SIZE];
-
-/** Our IP address */
-static uint8_t ip_addr[4] = { 0xFF, 0xFF, 0xFF, 0xFF };
+/*
+ * Who to call when a packet arrives, and our IP address,
+ * are kept in the stack context (SIP->ip).
+ */
 
 
 #define IP_CHECKSUM		10
 
+static void build_ip4_header(uint8_t *data, const uint8_t *dest/*[4]*/, const uint16_t total_len, IP_TYPE type);
+
 /****************************************************
  *    Function: init_ip
  * Description: Initialise IPv4.
@@ -60,9 +65,7 @@ static uint8_t ip_addr[4] = { 0xFF, 0xFF, 0xFF, 0xFF };
 RETURN_STATUS init_ip(void)
 {
 	/* Dont initialise this protocol more than once */
-	static bool ip_initialised = false;
-
-	if(ip_initialised)
+	if(SIP->ip.initialised)
 		return SUCCESS;
 
 
@@ -76,13 +79,20 @@ RETURN_STATUS init_ip(void)
 	uint16_t i = 0;
 	for(i = 0; i < IP_CALLBACK_SIZE; i++)
 	{
-		ip_callbacks[i].packet_type = IP_NULL;
-		ip_callbacks[i].callback_fn = NULL;
+		SIP->ip.callbacks[i].packet_type = IP_NULL;
+		SIP->ip.callbacks[i].callback_fn = NULL;
+#ifdef MAC_RX_STREAM
+		SIP->ip.callbacks[i].header_fn = NULL;
+#endif
 	}
 
 	RETURN_STATUS ret = add_ether_packet_callback(IPv4, &ip_arrival_callback);
+#ifdef MAC_RX_STREAM
 	if(ret == SUCCESS)
-		ip_initialised = true;
+		ret = add_ether_header_callback(IPv4, &ip_header_arrival);
+#endif
+	if(ret == SUCCESS)
+		SIP->ip.initialised = true;
 
 	return ret;
 }
@@ -100,10 +110,10 @@ RETURN_STATUS init_ip(void)
  ***************************************************/
 RETURN_STATUS set_ipv4_addr(uint8_t *addr/*[4]*/)
 {
-	ip_addr[0] = addr[0];
-	ip_addr[1] = addr[1];
-	ip_addr[2] = addr[2];
-	ip_addr[3] = addr[3];
+	SIP->ip.addr[0] = addr[0];
+	SIP->ip.addr[1] = addr[1];
+	SIP->ip.addr[2] = addr[2];
+	SIP->ip.addr[3] = addr[3];
 
 
 	return SUCCESS;
@@ -121,9 +131,51 @@ RETURN_STATUS set_ipv4_addr(uint8_t *addr/*[4]*/)
  ***************************************************/
 const uint8_t * get_ipv4_addr(void)
 {
-	return ip_addr;
+	return SIP->ip.addr;
+}
+
+/****************************************************
+ *    Function: build_ip4_header
+ * Description: Fill in an IP header (and checksum,
+ * 				unless the MAC does it for us)
+ *
+ *	Input:
+ * 		data		Where the header goes
+ * 		dest		Destination IP
+ * 		total_len	Header + payload length
+ * 		type		IP Packet Type (eg UPD/TCP)
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+static void build_ip4_header(uint8_t *data, const uint8_t *dest/*[4]*/, const uint16_t total_len, IP_TYPE type)
+{
+	struct ip4_header_view *ip = (struct ip4_header_view *)data;
+
+	ip->version_ihl = 0x45; /* 4 in high nibble = IPv4.  5 = length of header in 32b words*/
+	ip->tos = 0x00;	/* Normal traffic */
+
+	store_be16(ip->total_len, total_len);
+
+
+	store_be16(ip->ident, 0x0000); /* Identification */
+	store_be16(ip->fragment, 0x0000); /* Fragmentation info */
+
+	ip->ttl = IP_TTL;
+	ip->protocol = type;
+	store_be16(ip->checksum, 0x0000); /* Checksum (first pass) */
+
+	sr_memcpy(ip->src, SIP->ip.addr, 4); /* Source address */
+	sr_memcpy(ip->dest, dest, 4); /* Destination address */
+
+	/* Check the header checksum (left as zero if the MAC does it) */
+	if(!(get_ether_offload() & MAC_OFFLOAD_TX_CSUM))
+	{
+		store_be16(ip->checksum, checksum(data, IP_HEADERLEN, IP_CHECKSUM));
+	}
 }
 
+
 /****************************************************
  *    Function: send_ip4_datagram
  * Description: Send IP packet
@@ -151,37 +203,135 @@ RETURN_STATUS send_ip4_datagram(const uint8_t *dest/*[4]*/, uint8_t* buffer, con
 
 	uint8_t data[IP_MAX_PACKET + IP_HEADERLEN] = {0};
 
-	data[0] = 0x45; /* 4 in high nibble = IPv4.  5 = length of header in 32b words*/
-	data[1] = 0x00;	/* Normal traffic */
+	build_ip4_header(data, dest, (uint16_t)(IP_HEADERLEN + buff_len), type);
 
-	*(uint16_t*)&data[2] = uint16_to_nbo((uint16_t)(IP_HEADERLEN + buff_len));
+    /* Copy in the data */
+    sr_memcpy(&data[IP_HEADERLEN], buffer, buff_len);
 
+	/* Get the Ethernet address from the ARP table,
+	 * then send the data (if we have the address */
+	uint8_t dest_ether[6] = {0};
+	RETURN_STATUS ret = resolve_ether_addr(dest, dest_ether);
 
-	*(uint16_t*)&data[4] = 0x0000; /* Identification (note that casting like this might be little endian!) */
-	*(uint16_t*)&data[6] = 0x0000; /* Fragmentation info */
+	if(ret != SUCCESS)
+	{
+		return ret;
+	}
+	else
+	{
+		return send_ether_packet(dest_ether, data, buff_len + IP_HEADERLEN, IPv4);
+	}
 
-	data[8] = IP_TTL;
-	data[9] = type;
-	*(uint16_t*)&data[IP_CHECKSUM] = 0x0000; /* Checksum (first pass) */
+}
 
-	data[12] = ip_addr[0]; /* Source address */
-	data[13] = ip_addr[1];
-	data[14] = ip_addr[2];
-	data[15] = ip_addr[3];
 
-	data[16] = dest[0]; /* Destination address */
-	data[17] = dest[1];
-	data[18] = dest[2];
-	data[19] = dest[3];
+/****************************************************
+ *    Function: ip4_header_template
+ * Description: Build the Ethernet and IP headers to
+ * 				reach dest, to be kept and reused for
+ * 				many packets (eg a connected UDP flow).
+ * 				The length and checksum are left for
+ * 				ip4_header_complete.
+ *
+ * 		  NOTE: Blocks in ARP, as send_ip4_datagram
+ * 		  		does, if dest isn't known yet.
+ *
+ *	Input:
+ * 		header		Where they go [ETH_HEADERLEN + IP_HEADERLEN]
+ * 		dest		Destination IP
+ * 		type		IP Packet Type (eg UPD/TCP)
+ * 		sum			Set to the header's sum without
+ * 					the length (not folded)
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		dest couldn't be resolved
+ ***************************************************/
+RETURN_STATUS ip4_header_template(uint8_t *header, const uint8_t *dest/*[4]*/, IP_TYPE type, uint32_t *sum)
+{
+	uint8_t dest_ether[6] = {0};
+	RETURN_STATUS ret = resolve_ether_addr(dest, dest_ether);
+	if(ret != SUCCESS)
+	{
+		return ret;
+	}
 
-	/* Check the header checksum */
-	*(uint16_t*)&data[10] = uint16_to_nbo(checksum(data, IP_HEADERLEN, IP_CHECKSUM));
+	ether_header_template(header, dest_ether, IPv4);
 
-    /* Copy in the data */
-    sr_memcpy(&data[IP_HEADERLEN], buffer, buff_len);
+	uint8_t *ip_header = &header[ETH_HEADERLEN];
+	build_ip4_header(ip_header, dest, 0, type);
+	store_be16(&ip_header[IP_CHECKSUM], 0x0000);
+
+	*sum = (uint16_t)~checksum(ip_header, IP_HEADERLEN, IP_CHECKSUM);
+
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: ip4_header_complete
+ * Description: Fill in the length and checksum of an
+ * 				IP header from ip4_header_template.
+ *
+ *	Input:
+ * 		ip_header	The IP header (after the Ethernet one)
+ * 		sum			Its sum, from ip4_header_template
+ * 		total_len	Header + payload length
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+void ip4_header_complete(uint8_t *ip_header, const uint32_t sum, const uint16_t total_len)
+{
+	ip_header[2] = (uint8_t)(total_len >> 8);
+	ip_header[3] = (uint8_t)total_len;
+
+	/* Left as zero if the MAC does it */
+	if(!(get_ether_offload() & MAC_OFFLOAD_TX_CSUM))
+	{
+		uint32_t total = sum + total_len;
+		while(total >> 16)
+		{
+			total = (total & 0x0000FFFF) + (total >> 16);
+		}
+
+		uint16_t csum = ~(uint16_t)total;
+		ip_header[IP_CHECKSUM] = (uint8_t)(csum >> 8);
+		ip_header[IP_CHECKSUM + 1] = (uint8_t)csum;
+	}
+}
+
+
+#ifdef UDP_SEG_OFFLOAD
+/****************************************************
+ *    Function: send_ip4_datagram_segmented
+ * Description: Send one large IP packet for the MAC
+ * 				to cut up (see send_udp_segmented).
+ *
+ *	Input:
+ * 		dest		Destination IP
+ * 		buffer		Payload (UDP header onwards)
+ * 		buffer_len	Payload size
+ * 		type		IP Packet Type (only UDP for now)
+ * 		segment_len	Payload bytes per segment
+ *
+ *	Return:
+ * 		RETURN_STATUS
+ ***************************************************/
+RETURN_STATUS send_ip4_datagram_segmented(const uint8_t *dest/*[4]*/, uint8_t* buffer, const uint16_t buff_len, IP_TYPE type, const uint16_t segment_len)
+{
+	if(buff_len + IP_HEADERLEN > UDP_SEG_MAX_PACKET || type != IP_UDP)
+	{
+		return FAILURE;
+	}
+
+	uint8_t data[UDP_SEG_MAX_PACKET];
+
+	/* The MAC fixes up the length, ID and checksum of each segment */
+	build_ip4_header(data, dest, (uint16_t)(IP_HEADERLEN + buff_len), type);
+
+	sr_memcpy(&data[IP_HEADERLEN], buffer, buff_len);
 
-	/* Get the Ethernet address from the ARP table,
-	 * then send the data (if we have the address */
 	uint8_t dest_ether[6] = {0};
 	RETURN_STATUS ret = resolve_ether_addr(dest, dest_ether);
 
@@ -189,12 +339,96 @@ RETURN_STATUS send_ip4_datagram(const uint8_t *dest/*[4]*/, uint8_t* buffer, con
 	{
 		return ret;
 	}
-	else
+
+	return send_ether_packet_segmented(dest_ether, data, buff_len + IP_HEADERLEN, IPv4, segment_len);
+}
+#endif /* UDP_SEG_OFFLOAD */
+
+
+#ifdef MAC_STREAM
+/****************************************************
+ *    Function: ip4_stream_begin
+ * Description: Start an IP packet in the MAC's memory
+ * 				(see ether_stream_begin), writing the
+ * 				Ethernet and IP headers.
+ *
+ *	Input:
+ * 		dest		Destination IP
+ * 		buff_len	Payload size to come
+ * 		type		IP Packet Type (eg UPD/TCP)
+ *
+ *	Return:
+ * 		RETURN_STATUS
+ ***************************************************/
+RETURN_STATUS ip4_stream_begin(const uint8_t *dest/*[4]*/, const uint16_t buff_len, IP_TYPE type)
+{
+	if((uint32_t)buff_len + IP_HEADERLEN > ETH_STREAM_MAXDATA)
 	{
-		return send_ether_packet(dest_ether, data, buff_len + IP_HEADERLEN, IPv4);
+		return FAILURE;
+	}
+
+	uint8_t dest_ether[6] = {0};
+	RETURN_STATUS ret = resolve_ether_addr(dest, dest_ether);
+
+	if(ret != SUCCESS)
+	{
+		return ret;
+	}
+
+	ret = ether_stream_begin(dest_ether, buff_len + IP_HEADERLEN, IPv4);
+	if(ret != SUCCESS)
+	{
+		return ret;
 	}
 
+	uint8_t header[IP_HEADERLEN];
+	build_ip4_header(header, dest, (uint16_t)(IP_HEADERLEN + buff_len), type);
+
+	ret = ether_stream_write(0, header, IP_HEADERLEN);
+	if(ret != SUCCESS)
+	{
+		ether_stream_end(false);
+	}
+
+	return ret;
+}
+
+
+/****************************************************
+ *    Function: ip4_stream_write
+ * Description: Write part of the payload of the packet
+ * 				started by ip4_stream_begin.
+ *
+ *	Input:
+ * 		offset		Where in the payload
+ * 		buffer		Data
+ * 		buff_len	Length of data
+ *
+ *	Return:
+ * 		RETURN_STATUS
+ ***************************************************/
+RETURN_STATUS ip4_stream_write(const uint16_t offset, const uint8_t *buffer, const uint16_t buff_len)
+{
+	return ether_stream_write(IP_HEADERLEN + offset, buffer, buff_len);
+}
+
+
+/****************************************************
+ *    Function: ip4_stream_end
+ * Description: Send the packet started by
+ * 				ip4_stream_begin, or throw it away.
+ *
+ *	Input:
+ * 		send		false to throw it away
+ *
+ *	Return:
+ * 		RETURN_STATUS
+ ***************************************************/
+RETURN_STATUS ip4_stream_end(const bool send)
+{
+	return ether_stream_end(send);
 }
+#endif /* MAC_STREAM */
 
 
 /****************************************************
@@ -214,10 +448,50 @@ RETURN_STATUS add_ip4_packet_callback(IP_TYPE packet_type, void(*handler)(const
 	uint16_t i = 0;
 	for(i = 0; i < IP_CALLBACK_SIZE; i++)
 	{
-		if(ip_callbacks[i].packet_type == IP_NULL)
+		if(SIP->ip.callbacks[i].packet_type == IP_NULL)
+		{
+			SIP->ip.callbacks[i].packet_type = packet_type;
+			SIP->ip.callbacks[i].callback_fn = handler;
+#ifdef MAC_RX_STREAM
+			SIP->ip.callbacks[i].header_fn = NULL;
+#endif
+
+			return SUCCESS;
+		}
+	}
+
+	return FAILURE;
+}
+
+
+#ifdef MAC_RX_STREAM
+/****************************************************
+ *    Function: add_ip4_header_callback
+ * Description: Add a callback that gets just the
+ * 				start of a protocol's packets, while
+ * 				the rest is still in the MAC (see
+ * 				add_ether_header_callback).
+ *
+ *	Input:
+ * 		packet_type		IP Packet Type (eg UPD/TCP)
+ * 		handler			Callback function, returning
+ * 						true if the whole packet is
+ * 						wanted
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE			If no room left in storage
+ ***************************************************/
+RETURN_STATUS add_ip4_header_callback(IP_TYPE packet_type, bool (*handler)(const uint8_t* src_addr, const uint8_t* header, const uint16_t header_len, const uint16_t packet_len))
+{
+	uint16_t i = 0;
+	for(i = 0; i < IP_CALLBACK_SIZE; i++)
+	{
+		if(SIP->ip.callbacks[i].packet_type == IP_NULL)
 		{
-			ip_callbacks[i].packet_type = packet_type;
-			ip_callbacks[i].callback_fn = handler;
+			SIP->ip.callbacks[i].packet_type = packet_type;
+			SIP->ip.callbacks[i].callback_fn = NULL;
+			SIP->ip.callbacks[i].header_fn = handler;
 
 			return SUCCESS;
 		}
@@ -226,6 +500,102 @@ RETURN_STATUS add_ip4_packet_callback(IP_TYPE packet_type, void(*handler)(const
 	return FAILURE;
 }
 
+
+/****************************************************
+ *    Function: ip_header_arrival
+ * Description: The start of an IP packet, the rest
+ * 				still in the MAC.  Passes it to the
+ * 				protocol's header callbacks, if it has
+ * 				any.
+ *
+ *	Input:
+ * 		header			Start of the packet
+ * 		header_len		How much of it there is
+ * 		packet_len		Length of the whole packet
+ *
+ *	Return:
+ * 		true			Read it all for ip_arrival_callback
+ * 		false			Nobody wants (the rest of) it
+ ***************************************************/
+bool ip_header_arrival(const uint8_t* header, const uint16_t header_len, const uint16_t packet_len)
+{
+	if(header_len < IP_HEADERLEN)
+	{
+		return true;
+	}
+
+	/* Options push the next header past what we have */
+	uint8_t ihl = (header[IP_INCOMMING_HLEN_WORDS] & 0x0F) * 4;
+	if(ihl != IP_HEADERLEN)
+	{
+		return true;
+	}
+
+	if(!(get_ether_offload() & MAC_OFFLOAD_RX_CSUM))
+	{
+		if(load_be16(&header[IP_CHECKSUM]) != checksum(header, ihl, IP_CHECKSUM))
+		{
+			return false;
+		}
+	}
+
+	/* Ethernet may have padded it */
+	uint16_t total_len = load_be16(&header[2]);
+	if(total_len < ihl || total_len > packet_len)
+	{
+		return false;
+	}
+
+	uint8_t type = header[IP_PROTOCOL];
+
+	bool has_header_fn = false;
+	bool has_packet_fn = false;
+	bool wanted = false;
+
+	uint16_t i = 0;
+	for(i = 0; i < IP_CALLBACK_SIZE; i++)
+	{
+		if(SIP->ip.callbacks[i].packet_type != type)
+			continue;
+
+		if(SIP->ip.callbacks[i].header_fn != NULL)
+		{
+			has_header_fn = true;
+			// 12 = source address.
+			if(SIP->ip.callbacks[i].header_fn(&header[12], &header[ihl], header_len - ihl, total_len - ihl))
+			{
+				wanted = true;
+			}
+		}
+		else if(SIP->ip.callbacks[i].callback_fn != NULL)
+		{
+			has_packet_fn = true;
+		}
+	}
+
+	return has_header_fn ? wanted : has_packet_fn;
+}
+
+
+/****************************************************
+ *    Function: ip4_rx_read
+ * Description: Read more of the payload of the packet
+ * 				ip_header_arrival is looking at.
+ *
+ *	Input:
+ * 		offset		Where in the payload
+ * 		buffer		Where to put it
+ * 		buff_len	How much to read
+ *
+ *	Return:
+ * 		RETURN_STATUS
+ ***************************************************/
+RETURN_STATUS ip4_rx_read(const uint16_t offset, uint8_t *buffer, const uint16_t buff_len)
+{
+	return ether_rx_read(IP_HEADERLEN + offset, buffer, buff_len);
+}
+#endif /* MAC_RX_STREAM */
+
 /****************************************************
  *    Function: remove_ip4_packet_callback
  * Description: Remove a callback for a particular protocol
@@ -243,10 +613,10 @@ RETURN_STATUS remove_ip4_packet_callback(IP_TYPE packet_type, void (*handler)(co
 	bool cb_found = false;
 	for(i = 0; i < IP_CALLBACK_SIZE; i++)
 	{
-		if(ip_callbacks[i].packet_type == packet_type)
+		if(SIP->ip.callbacks[i].packet_type == packet_type)
 		{
-			ip_callbacks[i].packet_type = IP_NULL;
-			ip_callbacks[i].callback_fn = NULL;
+			SIP->ip.callbacks[i].packet_type = IP_NULL;
+			SIP->ip.callbacks[i].callback_fn = NULL;
 
 			cb_found = true;
 		}
@@ -286,12 +656,14 @@ void ip_arrival_callback(const uint8_t* buffer, const uint16_t buffer_len)
 	ihl *= 4;
 
 
-	/* Check checksum */
-	uint16_t *checksum_in = (uint16_t*)&buffer[IP_CHECKSUM];
-	uint16_t checksum_verify = uint16_to_nbo( checksum( buffer, ihl, IP_CHECKSUM) );
-	if(*checksum_in != checksum_verify)
-        {
-            return;
+	/* Check checksum (unless the MAC already has) */
+	if(!(get_ether_offload() & MAC_OFFLOAD_RX_CSUM))
+	{
+		uint16_t checksum_verify = checksum(buffer, ihl, IP_CHECKSUM);
+		if(load_be16(&buffer[IP_CHECKSUM]) != checksum_verify)
+	        {
+	            return;
+		}
 	}
 
 
@@ -303,10 +675,10 @@ void ip_arrival_callback(const uint8_t* buffer, const uint16_t buffer_len)
 	uint16_t i = 0;
 	for(i = 0; i < IP_CALLBACK_SIZE; i++)
 	{
-		if(ip_callbacks[i].packet_type == type)
+		if(SIP->ip.callbacks[i].packet_type == type && SIP->ip.callbacks[i].callback_fn != NULL)
 		{
 			// 12 = source address.
-			ip_callbacks[i].callback_fn(&buffer[12], &buffer[ihl], buffer_len - ihl);
+			SIP->ip.callbacks[i].callback_fn(&buffer[12], &buffer[ihl], buffer_len - ihl);
 		}
 	}
 }
@@ -23,6 +23,10 @@
  *	Description: Handles all IPv4 data.
  *
  *  History
+ *	DB/19 Oct 2026	Added struct ip4_header_view
+ *	DB/19 Oct 2026	Added ip4_header_template/complete
+ *	DB/19 Oct 2026	Added ip4_stream_begin/write/end (MAC_STREAM)
+ *	DB/19 Oct 2026	Added send_ip4_datagram_segmented
  *	DB/21 Dec 2010	Added get_ipv4_addr
  *	DB/30 Oct 2009	Started
  ****************************************************/
@@ -47,6 +51,22 @@
 
 
 
+/** IPv4 header laid over a packet (only bytes, so any address will do) **/
+struct ip4_header_view
+{
+	uint8_t version_ihl;	/* Version << 4 | header length in words */
+	uint8_t tos;
+	uint8_t total_len[2];
+	uint8_t ident[2];
+	uint8_t fragment[2];
+	uint8_t ttl;
+	uint8_t protocol;
+	uint8_t checksum[2];
+	uint8_t src[4];
+	uint8_t dest[4];
+};
+
+
 typedef enum IP_TYPE
 {
 	IP_NULL = 0x00,
@@ -66,6 +86,28 @@ const uint8_t * get_ipv4_addr(void);
 /** Send datagram **/
 RETURN_STATUS send_ip4_datagram(const uint8_t *dest/*[4]*/, uint8_t* buffer, const uint16_t buff_len, IP_TYPE type);
 
+/** Build Ethernet and IP headers to reuse (length and checksum left out) **/
+RETURN_STATUS ip4_header_template(uint8_t *header/*[ETH_HEADERLEN + IP_HEADERLEN]*/, const uint8_t *dest/*[4]*/, IP_TYPE type, uint32_t *sum);
+
+/** Fill in the length and checksum of one of those IP headers **/
+void ip4_header_complete(uint8_t *ip_header, const uint32_t sum, const uint16_t total_len);
+
+#ifdef UDP_SEG_OFFLOAD
+/** Send one large datagram for the MAC to segment **/
+RETURN_STATUS send_ip4_datagram_segmented(const uint8_t *dest/*[4]*/, uint8_t* buffer, const uint16_t buff_len, IP_TYPE type, const uint16_t segment_len);
+#endif
+
+#ifdef MAC_STREAM
+/** Start a packet in the MAC, writing the headers **/
+RETURN_STATUS ip4_stream_begin(const uint8_t *dest/*[4]*/, const uint16_t buff_len, IP_TYPE type);
+
+/** Write part of its payload **/
+RETURN_STATUS ip4_stream_write(const uint16_t offset, const uint8_t *buffer, const uint16_t buff_len);
+
+/** Send it (or not) **/
+RETURN_STATUS ip4_stream_end(const bool send);
+#endif
+
 /** Manage who to call when a packet arrives. */
 RETURN_STATUS add_ip4_packet_callback(IP_TYPE packet_type, void(*handler)(const uint8_t* src_addr, const uint8_t* buffer, const uint16_t buffer_len));
 
@@ -75,4 +117,15 @@ RETURN_STATUS remove_ip4_packet_callback(IP_TYPE packet_type, void (*handler)(co
 /** Notification of incoming packet */
 void ip_arrival_callback(const uint8_t* buffer, const uint16_t buffer_len);
 
+#ifdef MAC_RX_STREAM
+/** Add a callback that sees only the headers, and says if the rest is wanted */
+RETURN_STATUS add_ip4_header_callback(IP_TYPE packet_type, bool (*handler)(const uint8_t* src_addr, const uint8_t* header, const uint16_t header_len, const uint16_t packet_len));
+
+/** Notification of the start of an incoming packet, still in the MAC */
+bool ip_header_arrival(const uint8_t* header, const uint16_t header_len, const uint16_t packet_len);
+
+/** Read more of its payload (only from a header callback) */
+RETURN_STATUS ip4_rx_read(const uint16_t offset, uint8_t *buffer, const uint16_t buff_len);
+#endif
+
 #endif /* IP_H_ */
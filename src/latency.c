@@ -0,0 +1,300 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: latency.c
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Fixed size latency histograms for the
+ *				 receive and transmit paths.
+ *
+ *				 Buckets are log-linear (like HDR histograms),
+ *				 so small values are exact and large values
+ *				 are within 1/(2^LATENCY_SUB_BITS) of the truth.
+ *				 Memory use is fixed at compile time, and
+ *				 recording a value is a handful of shifts.
+ *
+ *				 Averages are not kept on purpose; a 15 second
+ *				 ARP stall is what we want to see, not hide.
+ *
+ *  History
+ *	DB/19 Oct 2026	LATENCY_BUCKETS checked against the uint8_t index
+ *	DB/19 Oct 2026	Histograms moved into the stack context
+ *	DB/19 Oct 2026	Started
+ ****************************************************************************/
+
+#include "latency.h"
+#include "timer.h"
+#include "sip_ctx.h"
+
+#ifndef WITHOUT_LATENCY_STATS
+
+/* Buckets are counted in a uint8_t */
+#if LATENCY_BUCKETS > 255
+#error "LATENCY_BUCKETS must be 255 or fewer, make LATENCY_MAX_BITS or LATENCY_SUB_BITS smaller"
+#endif
+
+/* One histogram per path, kept in the stack context (SIP->latency) */
+
+
+/****************************************************
+ *    Function: latency_bucket
+ * Description: Find which bucket a value lives in.
+ *
+ *	Input:
+ *		value	Value to be recorded
+ *
+ *	Return:
+ * 		uint8_t	Bucket index
+ ***************************************************/
+static uint8_t latency_bucket(uint32_t value)
+{
+	/* Small values are recorded exactly */
+	if(value < LATENCY_LINEAR)
+	{
+		return (uint8_t)value;
+	}
+
+	/* Find the highest bit set */
+	uint8_t msb = LATENCY_SUB_BITS;
+	while(msb < 31 && (value >> (msb + 1)) != 0)
+	{
+		msb++;
+	}
+
+	/* Too big, so it goes in the last bucket */
+	if(msb >= LATENCY_MAX_BITS)
+	{
+		return LATENCY_BUCKETS - 1;
+	}
+
+	/* Power of two, then the linear step within it */
+	return (uint8_t)(((msb - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+			+ ((value >> (msb - LATENCY_SUB_BITS)) & (LATENCY_LINEAR - 1)));
+}
+
+
+/****************************************************
+ *    Function: latency_bucket_top
+ * Description: Largest value that would be recorded
+ *				in a bucket.
+ *
+ *	Input:
+ *		bucket	Bucket index
+ *
+ *	Return:
+ * 		uint32_t
+ ***************************************************/
+static uint32_t latency_bucket_top(uint8_t bucket)
+{
+	if(bucket < LATENCY_LINEAR)
+	{
+		return bucket;
+	}
+
+	uint8_t msb = (bucket >> LATENCY_SUB_BITS) + LATENCY_SUB_BITS - 1;
+	uint32_t step = 1UL << (msb - LATENCY_SUB_BITS);
+	uint32_t bottom = (1UL << msb) + (bucket & (LATENCY_LINEAR - 1)) * step;
+
+	return bottom + step - 1;
+}
+
+
+/****************************************************
+ *    Function: latency_now
+ * Description: Get the time, for use as a start
+ *				point in latency_record.
+ *
+ *	Return:
+ * 		uint32_t	LATENCY_CLOCK ticks
+ ***************************************************/
+uint32_t latency_now(void)
+{
+	return LATENCY_CLOCK();
+}
+
+
+/****************************************************
+ *    Function: latency_record
+ * Description: Record how long something took.
+ *
+ *	Input:
+ *		path	Which histogram
+ *		start	latency_now() when it started
+ *
+ *	Return:
+ * 		void
+ ***************************************************/
+void latency_record(LATENCY_PATH path, uint32_t start)
+{
+	/* Unsigned subtraction copes with the clock wrapping */
+	latency_add(path, latency_now() - start);
+}
+
+
+/****************************************************
+ *    Function: latency_add
+ * Description: Add a value to a histogram.
+ *
+ *	Input:
+ *		path	Which histogram
+ *		value	Value to add
+ *
+ *	Return:
+ * 		void
+ ***************************************************/
+void latency_add(LATENCY_PATH path, uint32_t value)
+{
+	struct latency_histogram *hist = &SIP->latency[path];
+
+	/* Stop counting rather than wrap, so percentiles stay sane */
+	uint8_t bucket = latency_bucket(value);
+	if(hist->count == 0xFFFFFFFF || hist->buckets[bucket] == 0xFFFFFFFF)
+	{
+		return;
+	}
+
+	hist->buckets[bucket]++;
+	hist->count++;
+
+	if(value > hist->max)
+	{
+		hist->max = value;
+	}
+}
+
+
+/****************************************************
+ *    Function: get_latency_percentile
+ * Description: Find the value that per_mille/1000 of
+ *				the recorded values are at or below.
+ *
+ *				The top of the bucket is returned, so
+ *				the answer errs on the pessimistic side
+ *				(but never above the largest value seen).
+ *
+ *	Input:
+ *		path		Which histogram
+ *		per_mille	Percentile in 1/1000ths (500 = p50,
+ *					990 = p99, 999 = p99.9)
+ *
+ *	Return:
+ * 		uint32_t	0 if nothing recorded
+ ***************************************************/
+uint32_t get_latency_percentile(LATENCY_PATH path, uint16_t per_mille)
+{
+	struct latency_histogram *hist = &SIP->latency[path];
+
+	if(hist->count == 0)
+	{
+		return 0;
+	}
+
+	if(per_mille > 1000)
+	{
+		per_mille = 1000;
+	}
+
+	/* Rank of the value we want (rounded up), split
+	 * up so that it doesn't need 64-bit maths */
+	uint32_t rank = (hist->count / 1000) * per_mille
+					+ ((hist->count % 1000) * per_mille + 999) / 1000;
+	if(rank == 0)
+	{
+		rank = 1;
+	}
+
+	uint32_t seen = 0;
+	uint8_t i = 0;
+	for(i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		seen += hist->buckets[i];
+		if(seen >= rank)
+		{
+			break;
+		}
+	}
+
+	/* The last bucket has no top, it holds everything too big */
+	if(i >= LATENCY_BUCKETS - 1)
+	{
+		return hist->max;
+	}
+
+	uint32_t top = latency_bucket_top(i);
+	return (top > hist->max) ? hist->max : top;
+}
+
+
+/****************************************************
+ *    Function: get_latency_count
+ * Description: Number of values in a histogram.
+ *
+ *	Input:
+ *		path	Which histogram
+ *
+ *	Return:
+ * 		uint32_t
+ ***************************************************/
+uint32_t get_latency_count(LATENCY_PATH path)
+{
+	return SIP->latency[path].count;
+}
+
+
+/****************************************************
+ *    Function: get_latency_max
+ * Description: Largest value in a histogram.
+ *
+ *	Input:
+ *		path	Which histogram
+ *
+ *	Return:
+ * 		uint32_t
+ ***************************************************/
+uint32_t get_latency_max(LATENCY_PATH path)
+{
+	return SIP->latency[path].max;
+}
+
+
+/****************************************************
+ *    Function: reset_latency
+ * Description: Empty a histogram.
+ *
+ *	Input:
+ *		path	Which histogram
+ *
+ *	Return:
+ * 		void
+ ***************************************************/
+void reset_latency(LATENCY_PATH path)
+{
+	struct latency_histogram *hist = &SIP->latency[path];
+
+	uint8_t i = 0;
+	for(i = 0; i < LATENCY_BUCKETS; i++)
+	{
+		hist->buckets[i] = 0;
+	}
+
+	hist->count = 0;
+	hist->max = 0;
+}
+
+#endif /* WITHOUT_LATENCY_STATS */
@@ -0,0 +1,85 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: latency.h
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Fixed size latency histograms for the
+ *				 receive and transmit paths.
+ *
+ *				 Define WITHOUT_LATENCY_STATS to compile
+ *				 the histograms out altogether.
+ *
+ *  History
+ *	DB/19 Oct 2026	latency_record uses start when compiled out
+ *	DB/19 Oct 2026	Started
+ ****************************************************/
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include "global.h"
+#include "stack_defines.h"
+
+
+/* Values below 2^LATENCY_SUB_BITS get a bucket each, above that
+ * every power of two is split into 2^LATENCY_SUB_BITS buckets. */
+#define LATENCY_LINEAR		(1UL << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS		(((LATENCY_MAX_BITS - LATENCY_SUB_BITS) + 1) << LATENCY_SUB_BITS)
+
+
+typedef enum LATENCY_PATH
+{
+	LATENCY_RX,		/* ether_frame_available -> handler return */
+	LATENCY_TX,		/* send_udp -> send_frame return */
+	LATENCY_PATHS
+} LATENCY_PATH;
+
+
+#ifndef WITHOUT_LATENCY_STATS
+
+/** Current time in LATENCY_CLOCK ticks **/
+uint32_t latency_now(void);
+
+/** Record the time elapsed since 'start' **/
+void latency_record(LATENCY_PATH path, uint32_t start);
+
+/** Add a single value to a histogram **/
+void latency_add(LATENCY_PATH path, uint32_t value);
+
+/** Get a percentile (in 1/1000ths, eg 999 = p99.9) **/
+uint32_t get_latency_percentile(LATENCY_PATH path, uint16_t per_mille);
+
+/** Number of values recorded **/
+uint32_t get_latency_count(LATENCY_PATH path);
+
+/** Largest value recorded **/
+uint32_t get_latency_max(LATENCY_PATH path);
+
+/** Empty a histogram **/
+void reset_latency(LATENCY_PATH path);
+
+#else
+
+/* start still 'used', so timing code builds warning free */
+#define latency_now()					0
+#define latency_record(path, start)		((void)(start))
+
+#endif /* WITHOUT_LATENCY_STATS */
+
+#endif /* LATENCY_H_ */
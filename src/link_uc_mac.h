@@ -31,6 +31,14 @@
  *
  *
  *  History
+ *	DB/19-10-26	set_frames_complete can fail (no batches)
+ *	DB/19-10-26	Added set_frames_complete (MAC_RX_VECTOR)
+ *	DB/19-10-26	Added set_frame_header and mac_rx_read (MAC_RX_STREAM)
+ *	DB/19-10-26	Added mac_tx_begin/write/end (MAC_STREAM)
+ *	DB/19-10-26	Added send_frame_gather (MAC_GATHER)
+ *	DB/19-10-26	Added poll_mac and mac_rx_irq (MAC_POLL)
+ *	DB/19-10-26	Added send_frame_segmented
+ *	DB/19-10-26	Added get_mac_offload
  *	DB/17-10-09	Started
  ****************************************************/
 #ifndef LINK_H_
@@ -39,6 +47,18 @@
 /** Return types **/
 #include "global.h"
 
+/** Checksum offload flags (from get_mac_offload) **/
+#define MAC_OFFLOAD_NONE		0x00
+/* MAC fills in the IPv4 header, UDP and ICMP checksums when sending.
+ * The stack leaves IP/ICMP checksums as zero, and puts the (not
+ * complemented) pseudo-header sum in the UDP checksum. */
+#define MAC_OFFLOAD_TX_CSUM		0x01
+/* MAC has already checked the IPv4 header, UDP and ICMP checksums,
+ * and drops frames that are wrong. */
+#define MAC_OFFLOAD_RX_CSUM		0x02
+/* MAC can cut one large UDP datagram into several (see send_frame_segmented) */
+#define MAC_OFFLOAD_UDP_SEG		0x04
+
 /** Initialise IC **/
 RETURN_STATUS init_uc(void);
 
@@ -48,15 +68,93 @@ RETURN_STATUS init_mac(void);
 /** Complete frame to drop onto the wire */
 RETURN_STATUS send_frame(const uint8_t *buffer, const uint16_t buffer_len);
 
+#ifdef MAC_GATHER
+/** Frame in two pieces, the Ethernet header then the payload (no FCS,
+ * at least ETH_MINDATA long).  The MAC must be done with both before
+ * this returns. */
+RETURN_STATUS send_frame_gather(const uint8_t *header, const uint16_t header_len, const uint8_t *payload, const uint16_t payload_len);
+#endif
+
+#ifdef MAC_STREAM
+/* Streaming send.  The frame is built a piece at a time in the MAC's
+ * own memory, so it never has to fit in ours.  One at a time, and
+ * the MAC pads short frames and adds the FCS itself. */
+
+/** Make room for a frame_len byte frame (no FCS) **/
+RETURN_STATUS mac_tx_begin(const uint16_t frame_len);
+
+/** Write buffer at offset into the frame **/
+RETURN_STATUS mac_tx_write(const uint16_t offset, const uint8_t *buffer, const uint16_t buffer_len);
+
+/** Send the frame, or throw it away **/
+RETURN_STATUS mac_tx_end(const bool send);
+#endif
+
+#ifdef UDP_SEG_OFFLOAD
+/** Frame holding one large UDP datagram, for the MAC to send as
+ * segment_len sized datagrams (no FCS).  Needs MAC_OFFLOAD_UDP_SEG. */
+RETURN_STATUS send_frame_segmented(const uint8_t *buffer, const uint16_t buffer_len, const uint16_t segment_len);
+#endif
+
 /** Read from MAC **/
 RETURN_STATUS read_buffer(uint8_t *buffer, const unsigned int buffer_len, unsigned int *actual_len, const unsigned int timeout_ms);
 
 /** Callback to next layer when we have a whole packet */
 RETURN_STATUS set_frame_complete(void (*frame_complete_callback)(uint8_t *buffer, const uint16_t buffer_len));
 
+#ifdef MAC_RX_VECTOR
+/* Vector receive.  A driver that reads frames in batches hands the
+ * whole batch to frames_complete in one call, rather than each frame
+ * to frame_complete.  The frames are only needed until it returns.
+ * A driver that doesn't read batches returns FAILURE from
+ * set_frames_complete, and frame_complete gets every frame. */
+
+/** A received frame (FCS included, as for frame_complete) **/
+struct mac_frame
+{
+	uint8_t *buffer;
+	uint16_t len;
+};
+
+/** Callback for a batch of frames **/
+RETURN_STATUS set_frames_complete(void (*frames_complete_callback)(struct mac_frame *frames, const uint16_t count));
+#endif
+
+#ifdef MAC_RX_STREAM
+/* Streaming receive.  Only the first ETH_RX_PEEKLEN bytes of a frame
+ * are read, and handed to frame_header (with the whole length, FCS
+ * included).  While it runs it may read more with mac_rx_read.  If
+ * it returns true the rest is read and goes to frame_complete as
+ * usual, otherwise the frame is thrown away without reading it.
+ * With MAC_OFFLOAD_RX_CSUM, checksums are checked before the call. */
+
+/** Callback for the start of each frame **/
+RETURN_STATUS set_frame_header(bool (*frame_header_callback)(const uint8_t *header, const uint16_t header_len, const uint16_t frame_len));
+
+/** Read part of the frame frame_header is looking at **/
+RETURN_STATUS mac_rx_read(const uint16_t offset, uint8_t *buffer, const uint16_t buffer_len);
+#endif
+
+/** What the MAC can do for us (MAC_OFFLOAD_* flags) **/
+uint8_t get_mac_offload(void);
+
 /** Set up a 1ms timer/counter so stack has idea of time. */
 RETURN_STATUS register_ms_callback(void(*handler)(void));
 
+#ifdef MAC_POLL
+/* Poll mode.  The receive interrupt calls ether_rx_schedule (which
+ * turns it off) instead of reading frames, then ether_poll reads
+ * them with poll_mac, a budget at a time, and turns the interrupt
+ * back on once there are none left. */
+
+/** Hand up to budget waiting frames to frame_complete, returning how many */
+uint16_t poll_mac(const uint16_t budget);
+
+/** Turn the receive interrupt on or off.  Turning it on must interrupt
+ * straight away if frames are already waiting. */
+void mac_rx_irq(const bool enable);
+#endif
+
 
 /** INCLUDE INTERUPT ROUTINES IN IMPLEMENTATION **/
 
@@ -9,13 +9,96 @@
  *
  *
  *  History
+ *	DB/19-10-26	set_frames_complete (no batches)
+ *	DB/19-10-26	Receive off while the DMA checks a received frame (errata)
+ *	DB/19-10-26	Long frames only for frame_header, so rx_frame can be smaller
+ *	DB/19-10-26	mac_rx_irq turns the MAC interrupt off, except in enc28j60_int
+ *	DB/19-10-26	Builds on the host (avr_spi.h included)
+ *	DB/19-10-26	poll_mac reads with the MAC interrupt off
+ *	DB/19-10-26	TXIF cleared once the last frame is done
+ *	DB/19-10-26	Read only the headers until asked (MAC_RX_STREAM)
+ *	DB/19-10-26	Build frames in place (MAC_STREAM)
+ *	DB/19-10-26	Queue several frames in the transmit buffer
+ *	DB/19-10-26	One chip select per SPI command
+ *	DB/19-10-26	Receive on the INT pin, a whole frame per read
+ *	DB/19-10-26	Checksum offload using the DMA
  *	DB/19-10-09	Started
  ****************************************************/
 
 #include "enc28j60.h"
+#include "link_uc_mac.h"
+#include "avr_spi.h"
 #include "timer.h"
 #include "ethernet.h"
+#include "ip.h"
 #include "stack_defines.h"
+#include "functions.h"
+
+/** Where the next frame to read starts in buffer memory **/
+static uint16_t next_packet = RX_START;
+
+/** The frame being handed up (FCS left on the end) **/
+static uint8_t rx_frame[ENC28J60_RX_FRAMELEN];
+
+#if defined(MAC_RX_STREAM) && (ENC28J60_RX_FRAMELEN < ETH_RX_PEEKLEN)
+#error "ENC28J60_RX_FRAMELEN must hold ETH_RX_PEEKLEN"
+#endif
+
+/** Largest frame the receive buffer can hold (FCS too) **/
+#define RX_FRAME_MAX	(RX_END - RX_START + 1 - RX_HEADER_LEN)
+
+static void (*frame_complete)(uint8_t *buffer, const uint16_t buffer_len) = NULL;
+
+#ifdef MAC_RX_STREAM
+static bool (*frame_header)(const uint8_t *header, const uint16_t header_len, const uint16_t frame_len) = NULL;
+
+/** The frame frame_header is looking at (0 length outside it) **/
+static uint16_t rx_stream_start = RX_START;
+static uint16_t rx_stream_len = 0;
+#endif
+
+/** A frame in the transmit buffer, control byte to last byte **/
+struct tx_slot
+{
+	uint16_t start;
+	uint16_t end;
+	bool ready;			/* false while still being written */
+	bool discard;		/* Thrown away once written */
+};
+
+/** Frames queued, oldest (the one on the wire if tx_busy) first **/
+static struct tx_slot tx_queue[TX_QUEUE_LEN];
+static uint8_t tx_head = 0;
+static uint8_t tx_count = 0;
+static bool tx_busy = false;
+
+/** In enc28j60_int, where the MAC interrupt is already off **/
+static bool in_int = false;
+
+#ifdef MAC_STREAM
+/** The frame mac_tx_write is writing, and a copy of its headers **/
+static struct tx_slot *tx_stream = NULL;
+static uint8_t tx_headers[ETH_HEADERLEN + IP_HEADERLEN];
+#endif
+
+static RETURN_STATUS spi_write(const uint8_t *buffer, const uint16_t buffer_len);
+static void spi_read(const uint8_t command, uint8_t *buffer, const uint16_t buffer_len);
+static void bit_field_set(const uint8_t address, const uint8_t bits);
+static void bit_field_clear(const uint8_t address, const uint8_t bits);
+static void read_memory(const uint16_t address, uint8_t *buffer, const uint16_t buffer_len);
+static uint8_t rx_pending(void);
+static bool rx_read_frame(void);
+static void rx_reset(void);
+#ifdef MAC_RX_STREAM
+static bool rx_stream_frame(const uint16_t frame_start, const uint16_t byte_count);
+#endif
+static bool tx_space(const uint16_t len, uint16_t *start);
+static void tx_service(void);
+static void insert_tx_checksums(const uint8_t *frame, const uint16_t frame_len, const uint16_t address);
+static bool rx_checksums_ok(const uint8_t *frame, const uint16_t frame_len, const uint16_t address);
+static void write_checksum(const uint16_t address, const uint16_t csum);
+static uint16_t rx_dma_checksum(const uint16_t start, const uint16_t end);
+static uint16_t rx_wrap(uint16_t address);
 
 /****************************************************
  *    Function: init_mac
@@ -37,11 +120,16 @@ RETURN_STATUS init_mac()
 	//
 	init_link();
 
-	frame_buffer_pos = 0;
-	mac_header_pos = 0;
+	next_packet = RX_START;
+	tx_head = 0;
+	tx_count = 0;
+	tx_busy = false;
+#ifdef MAC_STREAM
+	tx_stream = NULL;
+#endif
 
-	// Set callback so that all received data comes back here.
-	set_recv_data_callback(&recv_frame_bytes);
+	// Frames are read when the INT pin says there are some.
+	set_mac_int_callback(&enc28j60_int);
 
 
 
@@ -54,11 +142,13 @@ RETURN_STATUS init_mac()
 	// Set receive buffer;
 	write_control_register(ERXSTL, (RX_START & 0xFF));
 	write_control_register(ERXSTH, (RX_START >> 8));
+	write_control_register(ERXNDL, (RX_END & 0xFF));
+	write_control_register(ERXNDH, (RX_END >> 8));
 
 
-	// Rx pointer
-	write_control_register(ERXRDPTL, (RX_START & 0xFF));
-	write_control_register(ERXRDPTH, (RX_START >> 8));
+	// Rx pointer (see rx_read_frame for why RX_END)
+	write_control_register(ERXRDPTL, (RX_END & 0xFF));
+	write_control_register(ERXRDPTH, (RX_END >> 8));
 
 
 	  //
@@ -88,8 +178,7 @@ RETURN_STATUS init_mac()
 	write_control_register(ECON1, ECON1_BSEL0 | ECON1_BSEL1);
 
 	/* Get our address and write to device */
-	uint8_t mac_addr[6];
-	get_ether_addr(&mac_addr);
+	const uint8_t *mac_addr = get_ether_addr();
 
 	write_control_register(MAADR1, mac_addr[0]);
 	write_control_register(MAADR2, mac_addr[1]);
@@ -113,6 +202,9 @@ RETURN_STATUS init_mac()
 
 
 
+	// Interrupt on each frame received or sent, and on errors
+	write_control_register(EIE, EIE_INTIE | EIE_PKTIE | EIE_RXERIE | EIE_TXIE | EIE_TXERIE);
+
 	// Now set up ECON1 properly (and leave on bank0)
 	write_control_register(ECON1, ECON1_RXEN | ECON1_CSUMEN);
 
@@ -121,12 +213,29 @@ RETURN_STATUS init_mac()
 	uint16_t waiting = add_timer(1, NULL);
 	if(waiting != 0)
 	{
-		while(is_running(waiting) == TRUE);
+		while(is_running(waiting));
 	}
 
 	return SUCCESS;
 }
 
+/****************************************************
+ *    Function: get_mac_offload
+ * Description: The DMA checksum engine lets us fill
+ * 				in and check IP/UDP/ICMP checksums
+ * 				without the uC touching the data.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		MAC_OFFLOAD_* flags
+ ***************************************************/
+uint8_t get_mac_offload(void)
+{
+	return MAC_OFFLOAD_TX_CSUM | MAC_OFFLOAD_RX_CSUM;
+}
+
 /****************************************************
  *    Function: set_frame_complete
  * Description: Sets the frame complete callback function
@@ -138,13 +247,82 @@ RETURN_STATUS init_mac()
  *	Return:
  * 		SUCCESS
  ***************************************************/
-RETURN_STATUS set_frame_complete(void (*frame_complete_callback)(const uint8_t *buffer, const uint16_t buffer_len))
+RETURN_STATUS set_frame_complete(void (*frame_complete_callback)(uint8_t *buffer, const uint16_t buffer_len))
 {
 	frame_complete = frame_complete_callback;
 
 	return SUCCESS;
 }
 
+#ifdef MAC_RX_VECTOR
+/****************************************************
+ *    Function: set_frames_complete
+ * Description: No batches here, every frame goes to
+ * 				frame_complete.
+ *
+ *	Input:
+ * 		frames_complete_callback	Not used
+ *
+ *	Return:
+ * 		FAILURE
+ ***************************************************/
+RETURN_STATUS set_frames_complete(void (*frames_complete_callback)(struct mac_frame *frames, const uint16_t count))
+{
+	(void)frames_complete_callback;
+	return FAILURE;
+}
+#endif
+
+#ifdef MAC_RX_STREAM
+/****************************************************
+ *    Function: set_frame_header
+ * Description: Sets the callback for the start of
+ * 				each frame (see rx_stream_frame).
+ *
+ *	Input:
+ * 		frame_header_callback		Callback to function
+ *
+ *	Return:
+ * 		SUCCESS
+ ***************************************************/
+RETURN_STATUS set_frame_header(bool (*frame_header_callback)(const uint8_t *header, const uint16_t header_len, const uint16_t frame_len))
+{
+	frame_header = frame_header_callback;
+
+	return SUCCESS;
+}
+
+/****************************************************
+ *    Function: mac_rx_read
+ * Description: Read part of the frame frame_header is
+ * 				looking at, straight from the receive
+ * 				buffer.
+ *
+ *	Input:
+ * 		offset		From the start of the frame
+ * 		buffer		Where to put it
+ * 		buffer_len	How much to read
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		Off the end, or not in frame_header
+ ***************************************************/
+RETURN_STATUS mac_rx_read(const uint16_t offset, uint8_t *buffer, const uint16_t buffer_len)
+{
+	if(rx_stream_len == 0 || (uint32_t)offset + buffer_len > rx_stream_len)
+	{
+		return FAILURE;
+	}
+
+	if(buffer_len > 0)
+	{
+		read_memory(rx_wrap(rx_stream_start + offset), buffer, buffer_len);
+	}
+
+	return SUCCESS;
+}
+#endif
+
 /****************************************************
  *    Function: write_control_register
  * Description: Write to a control register
@@ -161,136 +339,1035 @@ RETURN_STATUS write_control_register(uint8_t pRegister, uint8_t cParams)
 {
 	uint8_t pRegisterData[2];
 
-	pRegisterData[1] = WCR | pRegister;
-	pRegisterData[2] = cParams;
+	pRegisterData[0] = WCR | pRegister;
+	pRegisterData[1] = cParams;
+
+	return spi_write(pRegisterData, 2);
+}
+
+/****************************************************
+ *    Function: read_control_register
+ * Description: Read from a control register
+ *
+ *		  NOTE: MAC and MII registers send a dummy
+ *		  		byte first, so this is only good for
+ *		  		ETH registers.
+ *
+ *	Input:
+ * 		pRegister	Address to read from
+ *
+ *	Return:
+ * 		uint8_t		Register value
+ ***************************************************/
+uint8_t read_control_register(uint8_t pRegister)
+{
+	uint8_t value = 0;
+
+	spi_read(RCR | pRegister, &value, 1);
+
+	return value;
+}
+
+/****************************************************
+ *    Function: dma_checksum
+ * Description: Get the DMA to work out the network
+ * 				checksum of part of the buffer memory.
+ *
+ *		  NOTE: Takes about 1 clock per byte, which is
+ *		  		far quicker than pulling the data over
+ *		  		SPI and adding it up ourselves.
+ *
+ *		  NOTE: Wraps round the receive buffer on its
+ *		  		own if end < start.
+ *
+ *		  NOTE:	The silicon errata (DS80349) has the
+ *		  		sum corrupted if a frame is received
+ *		  		while it runs, so anything checked on
+ *		  		receive goes through rx_dma_checksum.
+ *
+ *	Input:
+ * 		start	First byte
+ *		end		Last byte (inclusive)
+ *
+ *	Return:
+ * 		uint16_t	Ones complement of the sum,
+ * 					ready to go in a header
+ ***************************************************/
+uint16_t dma_checksum(uint16_t start, uint16_t end)
+{
+	write_control_register(EDMASTL, (start & 0xFF));
+	write_control_register(EDMASTH, (start >> 8));
+	write_control_register(EDMANDL, (end & 0xFF));
+	write_control_register(EDMANDH, (end >> 8));
+
+	/* Bit field set, so RXEN is left alone */
+	uint8_t data[2] = { BFS | ECON1, ECON1_CSUMEN | ECON1_DMAST };
+	spi_write(data, 2);
+
+	while(read_control_register(ECON1) & ECON1_DMAST);
 
-	return write_buffer(pRegisterData, 2);
+	return (read_control_register(EDMACSH) << 8) | read_control_register(EDMACSL);
+}
+
+/****************************************************
+ *    Function: rx_dma_checksum
+ * Description: dma_checksum with receive turned off
+ * 				(see the errata note there).
+ *
+ *		  NOTE:	A frame arriving meanwhile is lost,
+ *		  		which beats passing a bad one up.
+ *
+ *	Input:
+ * 		start	First byte
+ *		end		Last byte (inclusive)
+ *
+ *	Return:
+ * 		uint16_t	As dma_checksum
+ ***************************************************/
+static uint16_t rx_dma_checksum(const uint16_t start, const uint16_t end)
+{
+	bit_field_clear(ECON1, ECON1_RXEN);
+	const uint16_t csum = dma_checksum(start, end);
+	bit_field_set(ECON1, ECON1_RXEN);
+
+	return csum;
+}
+
+/****************************************************
+ *    Function: write_checksum
+ * Description: Put a checksum into the buffer memory
+ *
+ *	Input:
+ * 		address		Where it goes
+ *		csum		Checksum (as from dma_checksum)
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+static void write_checksum(const uint16_t address, const uint16_t csum)
+{
+	write_control_register(EWRPTL, (address & 0xFF));
+	write_control_register(EWRPTH, (address >> 8));
+
+	uint8_t data[3] = { WBM | WBM_ARG, (csum >> 8), (csum & 0xFF) };
+	spi_write(data, 3);
+}
+
+/****************************************************
+ *    Function: insert_tx_checksums
+ * Description: Fill in the IP, UDP and ICMP checksums
+ * 				of a frame in the transmit buffer.
+ *
+ *		  NOTE:	The stack leaves the IP and ICMP
+ *		  		checksums as zero, and puts the
+ *		  		pseudo-header sum in the UDP checksum
+ *		  		so the DMA can do the rest.
+ *
+ *	Input:
+ * 		frame		Frame (Ethernet header onwards)
+ *		frame_len	Length of frame
+ *		address		Where the frame is in buffer memory
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+static void insert_tx_checksums(const uint8_t *frame, const uint16_t frame_len, const uint16_t address)
+{
+	if(frame_len < ETH_HEADERLEN + IP_HEADERLEN
+		|| frame[ETH_PROTOCOL] != 0x08 || frame[ETH_PROTOCOL + 1] != 0x00)
+	{
+		return;
+	}
+
+	const uint8_t *ip = &frame[ETH_HEADERLEN];
+	const uint16_t ip_start = address + ETH_HEADERLEN;
+	const uint8_t ihl = (ip[IP_INCOMMING_HLEN_WORDS] & 0x0F) * 4;
+	const uint16_t ip_len = ((uint16_t)ip[2] << 8) | ip[3];
+
+	if(ihl < IP_HEADERLEN || ip_len < ihl || ETH_HEADERLEN + ip_len > frame_len)
+	{
+		return;
+	}
+
+	/* IP header */
+	write_checksum(ip_start + 10, dma_checksum(ip_start, ip_start + ihl - 1));
+
+	/* Then the payload */
+	const uint16_t payload_start = ip_start + ihl;
+	const uint16_t payload_len = ip_len - ihl;
+
+	if(ip[IP_PROTOCOL] == IP_UDP && payload_len >= 8)
+	{
+		/* Zero means 'no checksum' in UDP */
+		uint16_t csum = dma_checksum(payload_start, payload_start + payload_len - 1);
+		write_checksum(payload_start + 6, (csum == 0) ? 0xFFFF : csum);
+	}
+	else if(ip[IP_PROTOCOL] == IP_ICMP && payload_len >= 4)
+	{
+		write_checksum(payload_start + 2, dma_checksum(payload_start, payload_start + payload_len - 1));
+	}
+}
+
+/****************************************************
+ *    Function: rx_checksums_ok
+ * Description: Check the IP, UDP and ICMP checksums
+ * 				of a frame still in the receive buffer.
+ *
+ *	Input:
+ * 		frame		Frame (Ethernet header onwards)
+ *		frame_len	Length of frame
+ *		address		Where the frame is in buffer memory
+ *
+ *	Return:
+ * 		true		If OK, or not IP
+ * 		false		If a checksum is wrong
+ ***************************************************/
+static bool rx_checksums_ok(const uint8_t *frame, const uint16_t frame_len, const uint16_t address)
+{
+	if(frame_len < ETH_HEADERLEN + IP_HEADERLEN
+		|| frame[ETH_PROTOCOL] != 0x08 || frame[ETH_PROTOCOL + 1] != 0x00)
+	{
+		return true;
+	}
+
+	const uint8_t *ip = &frame[ETH_HEADERLEN];
+	const uint16_t ip_start = rx_wrap(address + ETH_HEADERLEN);
+	const uint8_t ihl = (ip[IP_INCOMMING_HLEN_WORDS] & 0x0F) * 4;
+	const uint16_t ip_len = ((uint16_t)ip[2] << 8) | ip[3];
+
+	if(ihl < IP_HEADERLEN || ip_len < ihl || ETH_HEADERLEN + ip_len > frame_len)
+	{
+		return false;
+	}
+
+	/* A good header (or ICMP message) adds up to zero */
+	if(rx_dma_checksum(ip_start, rx_wrap(ip_start + ihl - 1)) != 0)
+	{
+		return false;
+	}
+
+	const uint16_t payload_start = rx_wrap(ip_start + ihl);
+	const uint16_t payload_len = ip_len - ihl;
+	const uint8_t *payload = &ip[ihl];
+
+	if(ip[IP_PROTOCOL] == IP_UDP && payload_len >= 8)
+	{
+		/* Checksum is optional */
+		if(payload[6] == 0 && payload[7] == 0)
+		{
+			return true;
+		}
+
+		/* Add the pseudo-header to what the DMA found */
+		uint32_t sum = (uint16_t)~rx_dma_checksum(payload_start, rx_wrap(payload_start + payload_len - 1));
+
+		uint8_t i = 0;
+		for(i = 12; i < 20; i += 2)
+		{
+			sum += ((uint16_t)ip[i] << 8) | ip[i + 1];
+		}
+		sum += IP_UDP;
+		sum += payload_len;
+
+		while(sum >> 16)
+		{
+			sum = (sum & 0x0000FFFF) + (sum >> 16);
+		}
+
+		return (sum == 0xFFFF);
+	}
+	else if(ip[IP_PROTOCOL] == IP_ICMP && payload_len >= 4)
+	{
+		return (rx_dma_checksum(payload_start, rx_wrap(payload_start + payload_len - 1)) == 0);
+	}
+
+	return true;
+}
+
+/****************************************************
+ *    Function: rx_wrap
+ * Description: Wrap an address round the end of the
+ * 				receive buffer.
+ *
+ *	Input:
+ * 		address
+ *
+ *	Return:
+ * 		uint16_t
+ ***************************************************/
+static uint16_t rx_wrap(uint16_t address)
+{
+	if(address > RX_END)
+	{
+		address -= (RX_END - RX_START + 1);
+	}
+
+	return address;
 }
 
 /****************************************************
  *    Function: send_frame
- * Description: Dump a complete packet onto the wire.
+ * Description: Queue a frame in the transmit buffer,
+ * 				and start it if the wire is free.
+ *
+ *		  NOTE:	Only waits if the queue is full, so
+ *		  		the next frame can be written while
+ *		  		this one goes.
  *
  *	Input:
- * 		buffer		Packet data
+ * 		buffer		Frame (room for the FCS on the end,
+ * 					which the MAC fills in)
  *		buffer_len	Length of buffer
  *
  *	Return:
- * 		SUCCESS
- * 		FAILURE
+ * 		SUCCESS		Queued
+ * 		FAILURE		Frame too big or too small
  ***************************************************/
 RETURN_STATUS send_frame(const uint8_t *buffer, const uint16_t buffer_len)
 {
-	//TODO: Find address to write packet to.
-	uint8_t buffer_start = 0x00;
+	if(buffer_len < ETH_HEADERLEN + ETH_CRCLEN
+		|| buffer_len - ETH_CRCLEN > FRAMELEN_MAX)
+	{
+		return FAILURE;
+	}
+
+	const uint16_t frame_len = buffer_len - ETH_CRCLEN;
+
+	/* The INT handler talks to the MAC as well */
+	mac_int_enable(false);
+
+	uint16_t start = 0;
+	while(!tx_space(TX_CONTROL_LEN + frame_len + TX_STATUS_LEN, &start))
+	{
+#ifdef MAC_STREAM
+		/* Waiting could mean waiting for ourselves */
+		if(tx_stream != NULL)
+		{
+			mac_int_enable(true);
+			return FAILURE;
+		}
+#endif
+		tx_service();
+	}
+
+	write_control_register(EWRPTL, (start & 0xFF));
+	write_control_register(EWRPTH, (start >> 8));
 
 	/*
 	 * Send start of packet control byte
 	 * ZERO means use defaults in MACON3
 	 */
-	uint8_t data[ETH_MAXDATA + ((ETH_HEADERLEN - ETH_PREAMBLELEN) - ETH_CRCLEN) + 2] = {0};
-	data[0] = WBM | WBM_ARG;		/* write to buffer memory */
-	data[1] = 0x00;					/* don't override defaults */
+	uint8_t command[2] = { WBM | WBM_ARG, 0x00 };
+
+	mac_cs(true);
+	write_buffer(command, 2);
+	write_buffer(buffer, frame_len);
+	mac_cs(false);
 
-	/* We get entire Ethernet header in buffer.
-	 * Chop out the preamble and CRC as we don't need them */
-	uint16_t i = 0, j = 0;
-	for(j = 0, i = ETH_PREAMBLELEN; i < buffer_len - ETH_CRCLEN; i++, j++)
+	/* Frame starts after the control byte */
+	if(get_ether_offload() & MAC_OFFLOAD_TX_CSUM)
 	{
-		data[2+j] = buffer[i];
+		insert_tx_checksums(buffer, frame_len, start + TX_CONTROL_LEN);
 	}
 
-	/* Send it all. */
-	write_buffer(data, ETH_MAXDATA + ((ETH_HEADERLEN - ETH_PREAMBLELEN) - ETH_CRCLEN) + 2);
+	struct tx_slot *slot = &tx_queue[(tx_head + tx_count) % TX_QUEUE_LEN];
+	slot->start = start;
+	slot->end = start + TX_CONTROL_LEN + frame_len - 1;
+	slot->ready = true;
+	slot->discard = false;
+	tx_count++;
 
+	tx_service();
 
-	// TODO read & act on status vector
+	mac_int_enable(true);
 
-	return NOT_AVAILABLE;
+	return SUCCESS;
 }
 
+/****************************************************
+ *    Function: tx_space
+ * Description: Find room for a frame in the transmit
+ * 				buffer.  Frames can't wrap, so each
+ * 				goes after the last one queued, or
+ * 				back at TX_START if there is no room
+ * 				at the end.
+ *
+ *	Input:
+ * 		len			Control byte, frame and status vector
+ *		start		Where it can go
+ *
+ *	Return:
+ * 		true		If there is room
+ * 		false		If it has to wait
+ ***************************************************/
+static bool tx_space(const uint16_t len, uint16_t *start)
+{
+	if(tx_count == 0)
+	{
+		*start = TX_START;
+		return true;
+	}
+
+	if(tx_count == TX_QUEUE_LEN)
+	{
+		return false;
+	}
+
+	const uint16_t oldest = tx_queue[tx_head].start;
+	const uint16_t next = tx_queue[(tx_head + tx_count - 1) % TX_QUEUE_LEN].end + 1 + TX_STATUS_LEN;
+
+	if(next > oldest)
+	{
+		/* Room at the end, else at the start before the oldest */
+		if((uint32_t)next + len <= (uint32_t)TX_END + 1)
+		{
+			*start = next;
+			return true;
+		}
+
+		if(TX_START + len <= oldest)
+		{
+			*start = TX_START;
+			return true;
+		}
+
+		return false;
+	}
+
+	/* Already wrapped, so only up to the oldest */
+	if(next + len <= oldest)
+	{
+		*start = next;
+		return true;
+	}
+
+	return false;
+}
 
 /****************************************************
- *    Function: recv_frame_bytes
- * Description: Dump a complete packet onto the wire.
+ *    Function: tx_service
+ * Description: Finish off the frame on the wire if
+ * 				the MAC is done with it, and start the
+ * 				next one queued.
+ *
+ *		  NOTE:	TXRTS clearing is what says it is
+ *		  		done.  TXIF is only what wakes us, and
+ *		  		is cleared once nothing is on the wire,
+ *		  		or INT would stay low.
  *
- *		  NOTE:	If malloc returns NULL, the MAC buffer
- *		  		will be left to overflow.
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+static void tx_service(void)
+{
+	if(tx_busy)
+	{
+		if(read_control_register(ECON1) & ECON1_TXRTS)
+		{
+			/* Still going, unless it has given up (errata) */
+			if(!(read_control_register(EIR) & EIR_TXERIF))
+			{
+				return;
+			}
+		}
+
+		uint8_t status[TX_STATUS_LEN];
+		read_memory(tx_queue[tx_head].end + 1, status, TX_STATUS_LEN);
+
+		if((read_control_register(EIR) & EIR_TXERIF) || !TSV_SENT(status))
+		{
+			/* Late collision or similar leaves the TX logic stuck */
+			bit_field_set(ECON1, ECON1_TXRST);
+			bit_field_clear(ECON1, ECON1_TXRST);
+			bit_field_clear(ECON1, ECON1_TXRTS);
+		}
+
+		tx_head = (tx_head + 1) % TX_QUEUE_LEN;
+		tx_count--;
+		tx_busy = false;
+	}
+
+	bit_field_clear(EIR, EIR_TXIF | EIR_TXERIF);
+
+	while(!tx_busy && tx_count > 0 && tx_queue[tx_head].ready && tx_queue[tx_head].discard)
+	{
+		tx_head = (tx_head + 1) % TX_QUEUE_LEN;
+		tx_count--;
+	}
+
+	if(tx_count > 0 && tx_queue[tx_head].ready)
+	{
+		const struct tx_slot *slot = &tx_queue[tx_head];
+
+		write_control_register(ETXSTL, (slot->start & 0xFF));
+		write_control_register(ETXSTH, (slot->start >> 8));
+		write_control_register(ETXNDL, (slot->end & 0xFF));
+		write_control_register(ETXNDH, (slot->end >> 8));
+
+		bit_field_set(ECON1, ECON1_TXRTS);
+		tx_busy = true;
+	}
+}
+
+/****************************************************
+ *    Function: spi_write
+ * Description: Send one whole command, with its data,
+ * 				in a single chip select.
  *
  *	Input:
- * 		buffer		Packet data
+ * 		buffer		Command then data
  *		buffer_len	Length of buffer
  *
- *	TODO: Implement some form of timeout so that if
- *		  part of a packet is missed for some reason,
- *		  it doesn't cause the rest to go out of sync.
+ *	Return:
+ * 		As write_buffer
+ ***************************************************/
+static RETURN_STATUS spi_write(const uint8_t *buffer, const uint16_t buffer_len)
+{
+	mac_cs(true);
+	RETURN_STATUS status = write_buffer(buffer, buffer_len);
+	mac_cs(false);
+
+	return status;
+}
+
+/****************************************************
+ *    Function: spi_read
+ * Description: Send a one byte command and read what
+ * 				it returns, in a single chip select.
+ *
+ *	Input:
+ * 		command		RCR or RBM command
+ *		buffer		Where to put the reply
+ *		buffer_len	How much to read
  *
  *	Return:
- * 		SUCCESS
- * 		FAILURE
+ * 		NONE
+ ***************************************************/
+static void spi_read(const uint8_t command, uint8_t *buffer, const uint16_t buffer_len)
+{
+	unsigned int actual_len = 0;
+
+	mac_cs(true);
+	write_buffer(&command, 1);
+	read_buffer(buffer, buffer_len, &actual_len, 0);
+	mac_cs(false);
+}
+
+/****************************************************
+ *    Function: bit_field_set
+ * Description: Set bits in an ETH register, leaving
+ * 				the others alone.
+ *
+ *	Input:
+ * 		address		Register
+ *		bits		Bits to set
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+static void bit_field_set(const uint8_t address, const uint8_t bits)
+{
+	uint8_t data[2] = { BFS | address, bits };
+	spi_write(data, 2);
+}
+
+/****************************************************
+ *    Function: bit_field_clear
+ * Description: Clear bits in an ETH register, leaving
+ * 				the others alone.
+ *
+ *	Input:
+ * 		address		Register
+ *		bits		Bits to clear
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+static void bit_field_clear(const uint8_t address, const uint8_t bits)
+{
+	uint8_t data[2] = { BFC | address, bits };
+	spi_write(data, 2);
+}
+
+/****************************************************
+ *    Function: read_memory
+ * Description: Read part of the buffer memory with a
+ * 				single RBM.
+ *
+ *		  NOTE: With ECON2_AUTOINC (the default) the
+ *		  		read pointer wraps from RX_END back to
+ *		  		RX_START on its own.
+ *
+ *	Input:
+ * 		address		First byte
+ *		buffer		Where to put it
+ *		buffer_len	How much to read
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+static void read_memory(const uint16_t address, uint8_t *buffer, const uint16_t buffer_len)
+{
+	write_control_register(ERDPTL, (address & 0xFF));
+	write_control_register(ERDPTH, (address >> 8));
+
+	spi_read(RBM | RBM_ARG, buffer, buffer_len);
+}
+
+/****************************************************
+ *    Function: rx_pending
+ * Description: How many frames are waiting.
+ *
+ *		  NOTE: PKTIF can't be trusted (errata), so
+ *		  		EPKTCNT is the only way to tell.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		EPKTCNT
+ ***************************************************/
+static uint8_t rx_pending(void)
+{
+	bit_field_set(ECON1, ECON1_BSEL0);
+	uint8_t count = read_control_register(EPKTCNT);
+	bit_field_clear(ECON1, ECON1_BSEL0);
+
+	return count;
+}
+
+/****************************************************
+ *    Function: rx_read_frame
+ * Description: Read the next frame out of the receive
+ * 				buffer, hand it up if it is good, and
+ * 				give the space back to the MAC.
+ *
+ *		  NOTE:	Frames longer than rx_frame are only
+ *		  		seen by frame_header (MAC_RX_STREAM).
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		true		If there was a frame
+ * 		false		If there were none waiting
  ***************************************************/
-void recv_frame_bytes(uint8_t next_byte)
+static bool rx_read_frame(void)
 {
-	// Collect the initial MAC header first.
-	if(mac_header_pos < 6)
+	if(rx_pending() == 0)
+	{
+		return false;
+	}
+
+	uint8_t header[RX_HEADER_LEN];
+	read_memory(next_packet, header, RX_HEADER_LEN);
+
+	const uint16_t following = ((uint16_t)header[RSV_NEXT + 1] << 8) | header[RSV_NEXT];
+	const uint16_t byte_count = ((uint16_t)header[RSV_COUNT + 1] << 8) | header[RSV_COUNT];
+	const uint8_t status = header[RSV_STATUS];
+
+	/* Lost our place, so start again with an empty buffer
+	 * (RX_START is 0, so only the top can be passed) */
+	if(following > RX_END || (following & 0x01))
 	{
-		mac_header[mac_header_pos] = next_byte;
-		mac_header_pos++;
+		rx_reset();
+		return false;
 	}
 
-	// Get details
-	if(mac_header_pos == 6)
+	/* With no filters on, bad frames still get written, so check */
+	if((status & RSV_RX_OK) && !(status & (RSV_CRC_ERROR | RSV_LEN_ERROR))
+		&& byte_count >= ETH_HEADERLEN + ETH_CRCLEN && byte_count <= RX_FRAME_MAX)
 	{
-		// Set header position out of bounds for a while;
-		mac_header_pos++;
+		const uint16_t frame_start = rx_wrap(next_packet + RX_HEADER_LEN);
+
+#ifdef MAC_RX_STREAM
+		/* Only the headers have to fit in rx_frame */
+		if(frame_header != NULL)
+		{
+			if(rx_stream_frame(frame_start, byte_count) && frame_complete != NULL)
+			{
+				(*frame_complete)(rx_frame, byte_count);
+			}
+		}
+		else
+#endif
+		if(byte_count <= sizeof(rx_frame))
+		{
+			read_memory(frame_start, rx_frame, byte_count);
+
+			// Checksums are checked while the frame is still in the MAC
+			if(frame_complete != NULL
+				&& (!(get_ether_offload() & MAC_OFFLOAD_RX_CSUM)
+					|| rx_checksums_ok(rx_frame, byte_count - ETH_CRCLEN, frame_start)))
+			{
+				(*frame_complete)(rx_frame, byte_count);
+			}
+		}
+	}
+
+	next_packet = following;
+
+	/* Free it in the MAC.  ERXRDPT must be odd (errata), so
+	 * stop one short of the next frame, which is always even. */
+	const uint16_t read_to = (following == RX_START) ? RX_END : following - 1;
+	write_control_register(ERXRDPTL, (read_to & 0xFF));
+	write_control_register(ERXRDPTH, (read_to >> 8));
 
-		// Frame length
-		frame_length = 0;
-		frame_length |= (mac_header[1] << 8);	// Shift in high bytes
-		frame_length |= (mac_header[0]);			// and low bytes
+	bit_field_set(ECON2, ECON2_PKTDEC);
 
-		// Allocate
-		//TODO: remove malloc calls
-		frame_buffer = (uint8_t *)malloc(frame_length);
-		frame_buffer_pos = 0;
+	return true;
+}
 
+#ifdef MAC_RX_STREAM
+/****************************************************
+ *    Function: rx_stream_frame
+ * Description: Read just the headers of a frame, and
+ * 				let frame_header decide if the rest is
+ * 				worth the SPI time.  It may read parts
+ * 				itself with mac_rx_read.
+ *
+ *		  NOTE:	Any length of frame can be looked at
+ *		  		this way, but only one that fits in
+ *		  		rx_frame can be read in full.
+ *
+ *	Input:
+ *		frame_start		Where the frame is in buffer memory
+ *		byte_count		Length of frame (FCS too)
+ *
+ *	Return:
+ * 		true		All of it is now in rx_frame
+ * 		false		Thrown away without reading it (or
+ * 					too long to read)
+ ***************************************************/
+static bool rx_stream_frame(const uint16_t frame_start, const uint16_t byte_count)
+{
+	const uint16_t peek_len = (byte_count < ETH_RX_PEEKLEN) ? byte_count : ETH_RX_PEEKLEN;
+	read_memory(frame_start, rx_frame, peek_len);
+
+	const bool offload = (get_ether_offload() & MAC_OFFLOAD_RX_CSUM);
+	bool checked = false;
 
-		/** Might have a problem, ditch this packet and try next.
-		 * eventually MAC buffer will overflow so we will notice
-		 * somethings up sooner or later.
-		 */
-		if(frame_buffer == NULL)
+	/* The DMA checks it before anyone reads the payload, as
+	 * long as the headers rx_checksums_ok looks at are here */
+	const bool is_ip = (rx_frame[ETH_PROTOCOL] == 0x08 && rx_frame[ETH_PROTOCOL + 1] == 0x00);
+	if(offload && (!is_ip || (peek_len >= ETH_HEADERLEN + IP_HEADERLEN
+			&& ETH_HEADERLEN + (rx_frame[ETH_HEADERLEN + IP_INCOMMING_HLEN_WORDS] & 0x0F) * 4 + 8 <= peek_len)))
+	{
+		if(!rx_checksums_ok(rx_frame, byte_count - ETH_CRCLEN, frame_start))
 		{
-			mac_header_pos = 0;
-			return;
+			return false;
 		}
+		checked = true;
+	}
+
+	rx_stream_start = frame_start;
+	rx_stream_len = byte_count - ETH_CRCLEN;
+
+	const bool wanted = (*frame_header)(rx_frame, peek_len, byte_count);
+
+	rx_stream_len = 0;
 
+	if(!wanted || byte_count > sizeof(rx_frame))
+	{
+		return false;
 	}
 
-	// Get frame data
-	if(mac_header_pos > 6)
+	if(peek_len < byte_count)
 	{
-		frame_buffer[frame_buffer_pos] = next_byte;
-		frame_buffer_pos++;
+		read_memory(rx_wrap(frame_start + peek_len), &rx_frame[peek_len], byte_count - peek_len);
 	}
 
-	// If we have a full packet, then bubble it up the chain.
-	if(frame_buffer_pos > frame_length) // (Only above by 1 due to last ++)
+	return checked || !offload || rx_checksums_ok(rx_frame, byte_count - ETH_CRCLEN, frame_start);
+}
+#endif
+
+/****************************************************
+ *    Function: rx_reset
+ * Description: Throw away everything in the receive
+ * 				buffer and start from RX_START again.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+static void rx_reset(void)
+{
+	bit_field_clear(ECON1, ECON1_RXEN);
+	bit_field_set(ECON1, ECON1_RXRST);
+	bit_field_clear(ECON1, ECON1_RXRST);
+
+	next_packet = RX_START;
+	write_control_register(ERXRDPTL, (RX_END & 0xFF));
+	write_control_register(ERXRDPTH, (RX_END >> 8));
+
+	bit_field_clear(EIR, EIR_PKTIF | EIR_RXERIF);
+	bit_field_set(ECON1, ECON1_RXEN);
+}
+
+/****************************************************
+ *    Function: enc28j60_int
+ * Description: The INT pin has gone low.  Reads every
+ * 				frame waiting, not just the one that
+ * 				caused it.
+ *
+ *		  NOTE:	INTIE is off while we are in here, so
+ *		  		a frame arriving part way through
+ *		  		makes a fresh edge when it goes back on.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+void enc28j60_int(void)
+{
+	in_int = true;
+	bit_field_clear(EIE, EIE_INTIE);
+
+#ifdef MAC_POLL
+	if(rx_pending() > 0)
+	{
+		ether_rx_schedule();
+	}
+#else
+	while(rx_read_frame());
+#endif
+
+	/* Overflowed, but whatever made it in is still good */
+	bit_field_clear(EIR, EIR_RXERIF);
+
+	if(read_control_register(EIR) & (EIR_TXIF | EIR_TXERIF))
+	{
+		tx_service();
+	}
+
+	bit_field_set(EIE, EIE_INTIE);
+	in_int = false;
+}
+
+#ifdef MAC_STREAM
+/****************************************************
+ *    Function: mac_tx_begin
+ * Description: Make room for a frame in the transmit
+ * 				buffer, to be written a piece at a
+ * 				time with mac_tx_write.
+ *
+ *		  NOTE:	Frames sent meanwhile queue up
+ *		  		behind this one.
+ *
+ *	Input:
+ * 		frame_len	Length of the frame (no FCS)
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		Too big, or already building one
+ ***************************************************/
+RETURN_STATUS mac_tx_begin(const uint16_t frame_len)
+{
+	if(tx_stream != NULL || frame_len < ETH_HEADERLEN || frame_len > FRAMELEN_MAX)
+	{
+		return FAILURE;
+	}
+
+	mac_int_enable(false);
+
+	uint16_t start = 0;
+	while(!tx_space(TX_CONTROL_LEN + frame_len + TX_STATUS_LEN, &start))
 	{
-		// Complete packet callback
-		//(*frame_complete)(frame_buffer, frame_length);
+		tx_service();
+	}
+
+	/* Control byte, ZERO means use defaults in MACON3 */
+	write_control_register(EWRPTL, (start & 0xFF));
+	write_control_register(EWRPTH, (start >> 8));
+
+	uint8_t command[2] = { WBM | WBM_ARG, 0x00 };
+	spi_write(command, 2);
+
+	tx_stream = &tx_queue[(tx_head + tx_count) % TX_QUEUE_LEN];
+	tx_stream->start = start;
+	tx_stream->end = start + TX_CONTROL_LEN + frame_len - 1;
+	tx_stream->ready = false;
+	tx_stream->discard = false;
+	tx_count++;
+
+	sr_memset(tx_headers, 0, sizeof(tx_headers));
+
+	mac_int_enable(true);
 
-		// Clean up.
-		frame_buffer_pos = 0;
-		mac_header_pos = 0;
+	return SUCCESS;
+}
+
+/****************************************************
+ *    Function: mac_tx_write
+ * Description: Write part of the frame being built.
+ *
+ *	Input:
+ * 		offset		Where in the frame
+ *		buffer		Data
+ *		buffer_len	Length of data
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		Not building one, or off the end
+ ***************************************************/
+RETURN_STATUS mac_tx_write(const uint16_t offset, const uint8_t *buffer, const uint16_t buffer_len)
+{
+	if(tx_stream == NULL
+		|| (uint32_t)offset + buffer_len > (uint32_t)(tx_stream->end - tx_stream->start))
+	{
+		return FAILURE;
+	}
 
-		// Free frame in MAC (already at bank0)
-		write_control_register(ERXWRPTL, mac_header[0]);
-		write_control_register(ERXWRPTH, mac_header[1]);
+	if(buffer_len == 0)
+	{
+		return SUCCESS;
+	}
 
-		// Say we've finished with it, write '1' to PKTDEC register (keep others the same)
-		write_control_register(ECON2, ECON2_AUTOINC | ECON2_PKTDEC);
+	/* Keep the headers, insert_tx_checksums needs them */
+	uint16_t i = 0;
+	for(i = 0; i < buffer_len && offset + i < sizeof(tx_headers); i++)
+	{
+		tx_headers[offset + i] = buffer[i];
 	}
 
-	return;
+	const uint16_t address = tx_stream->start + TX_CONTROL_LEN + offset;
+	uint8_t command = WBM | WBM_ARG;
+
+	mac_int_enable(false);
+
+	write_control_register(EWRPTL, (address & 0xFF));
+	write_control_register(EWRPTH, (address >> 8));
+
+	mac_cs(true);
+	write_buffer(&command, 1);
+	write_buffer(buffer, buffer_len);
+	mac_cs(false);
+
+	mac_int_enable(true);
+
+	return SUCCESS;
+}
+
+/****************************************************
+ *    Function: mac_tx_end
+ * Description: Send the frame being built, or throw
+ * 				it away.
+ *
+ *	Input:
+ * 		send		false to throw it away
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		Not building one
+ ***************************************************/
+RETURN_STATUS mac_tx_end(const bool send)
+{
+	if(tx_stream == NULL)
+	{
+		return FAILURE;
+	}
+
+	const uint16_t frame_len = tx_stream->end - tx_stream->start;
+
+	mac_int_enable(false);
+
+	if(send && (get_ether_offload() & MAC_OFFLOAD_TX_CSUM))
+	{
+		insert_tx_checksums(tx_headers, frame_len, tx_stream->start + TX_CONTROL_LEN);
+	}
+
+	/* Frames may have been queued behind it, so it keeps
+	 * its place and tx_service skips it */
+	tx_stream->discard = !send;
+	tx_stream->ready = true;
+	tx_stream = NULL;
+
+	tx_service();
+
+	mac_int_enable(true);
+
+	return SUCCESS;
+}
+#endif
+
+#ifdef MAC_POLL
+/****************************************************
+ *    Function: poll_mac
+ * Description: Read up to budget frames.
+ *
+ *		  NOTE:	With the MAC interrupt off, as
+ *		  		enc28j60_int moves the bank and the
+ *		  		read pointer too.
+ *
+ *	Input:
+ * 		budget		Most frames to read
+ *
+ *	Return:
+ * 		How many were read
+ ***************************************************/
+uint16_t poll_mac(const uint16_t budget)
+{
+	uint16_t done = 0;
+
+	mac_int_enable(false);
+
+	while(done < budget && rx_read_frame())
+	{
+		done++;
+	}
+
+	mac_int_enable(true);
+
+	return done;
+}
+
+/****************************************************
+ *    Function: mac_rx_irq
+ * Description: Turn the receive interrupt on or off.
+ * 				PKTIF stays set while EPKTCNT > 0, so
+ * 				turning it on with frames waiting
+ * 				interrupts straight away.
+ *
+ *		  NOTE:	With the MAC interrupt off, as for
+ *		  		poll_mac, unless called from
+ *		  		enc28j60_int (ether_rx_schedule),
+ *		  		where it is off already and must
+ *		  		stay off.
+ *
+ *	Input:
+ * 		enable
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+void mac_rx_irq(const bool enable)
+{
+	const bool masked = !in_int;
+
+	if(masked)
+	{
+		mac_int_enable(false);
+	}
+
+	if(enable)
+	{
+		bit_field_set(EIE, EIE_PKTIE);
+	}
+	else
+	{
+		bit_field_clear(EIE, EIE_PKTIE);
+	}
+
+	if(masked)
+	{
+		mac_int_enable(true);
+	}
 }
+#endif
@@ -9,6 +9,11 @@
  *
  *
  *  History
+ *	DB/19-10-26	ENC28J60_RX_FRAMELEN
+ *	DB/19-10-26	Transmit done is TSV bit 23
+ *	DB/19-10-26	Transmit queue, receive buffer at 0x0000
+ *	DB/19-10-26	Interrupt registers and receive status vector
+ *	DB/19-10-26	DMA checksum registers
  *	DB/11-10-09	Started
  ****************************************************/
 
@@ -16,24 +21,41 @@
 #define ENC28J60_H_
 
 #include "global.h"
-#include "link_uc.h"
+#include "link_uc_mac.h"
 
-/** This will be implemented here. */
-#include "link_mac.h"
+/** Write value to control register **/
+RETURN_STATUS write_control_register(uint8_t pRegister, uint8_t cParams);
 
-/** Data buffer to store packet (6 bytes header from MAC)**/
-uint8_t mac_header[6];
-unsigned int mac_header_pos;
+/** Read value from control register (ETH registers only) **/
+uint8_t read_control_register(uint8_t pRegister);
 
-/** Ethernet frame buffer **/
-uint8_t *frame_buffer;
-unsigned int frame_buffer_pos;
+/** Checksum part of the buffer memory with the DMA **/
+uint16_t dma_checksum(uint16_t start, uint16_t end);
 
-/** Length of the current frame **/
-unsigned int frame_length;
+/** Call from the INT pin interrupt **/
+void enc28j60_int(void);
 
-/** Write value to control register **/
-RETURN_STATUS write_control_register(uint8_t pRegister, uint8_t cParams);
+
+/** EIE **/
+#define EIE				0x1B
+#define EIE_INTIE		(1 << 0x07)
+#define EIE_PKTIE		(1 << 0x06)
+#define EIE_DMAIE		(1 << 0x05)
+#define EIE_LINKIE		(1 << 0x04)
+#define EIE_TXIE		(1 << 0x03)
+#define EIE_TXERIE		(1 << 0x01)
+#define EIE_RXERIE		(1 << 0x00)
+
+
+
+/** EIR **/
+#define EIR				0x1C
+#define EIR_PKTIF		(1 << 0x06)
+#define EIR_DMAIF		(1 << 0x05)
+#define EIR_LINKIF		(1 << 0x04)
+#define EIR_TXIF		(1 << 0x03)
+#define EIR_TXERIF		(1 << 0x01)
+#define EIR_RXERIF		(1 << 0x00)
 
 
 /** ECON1 **/
@@ -57,23 +79,83 @@ RETURN_STATUS write_control_register(uint8_t pRegister, uint8_t cParams);
 
 
 /** BANK0 **/
+#define ERDPTL			0x00
+#define ERDPTH			0x01
+#define EWRPTL			0x02
+#define EWRPTH			0x03
+#define ETXSTL			0x04
+#define ETXSTH			0x05
+#define ETXNDL			0x06
+#define ETXNDH			0x07
 #define ERXSTL			0x08
 #define ERXSTH			0x09
+#define ERXNDL			0x0A
+#define ERXNDH			0x0B
 #define ERXRDPTL		0x0C
 #define ERXRDPTH		0x0D
 #define ERXWRPTL		0x0E
 #define ERXWRPTH		0x0F
+#define EDMASTL			0x10
+#define EDMASTH			0x11
+#define EDMANDL			0x12
+#define EDMANDH			0x13
+#define EDMADSTL		0x14
+#define EDMADSTH		0x15
+#define EDMACSL			0x16
+#define EDMACSH			0x17
 /*
  * Tx / Rx memory buffer on device:
  *
- * TX_START defaults to 0x0000
- * RX_SEND defaults to 0x1FFF
- * TX_END is not required as long as the above stays true
- *
- * Set RX_START between 0x0000 and 0x1FFF
- * More Rx space if expecting more Rx data... etc
+ * The receive buffer starts at 0x0000 (errata), and
+ * the transmit buffer has the rest.  Each frame sent
+ * takes a control byte, the frame, and 7 bytes of
+ * status vector after it, so 4K holds a few.
  */
-#define RX_START	0x0700
+#define RX_START	0x0000
+#define RX_END		0x0FFF
+#define TX_START	0x1000
+#define TX_END		0x1FFF
+
+/* Frames waiting to go, including the one going */
+#ifndef TX_QUEUE_LEN
+#define TX_QUEUE_LEN	4
+#endif
+
+/* Longest frame read whole into memory (FCS too).  With
+ * MAC_RX_STREAM longer ones still reach frame_header, which
+ * can read them with mac_rx_read, so this can be cut down
+ * to ETH_RX_PEEKLEN to save RAM. */
+#ifndef ENC28J60_RX_FRAMELEN
+#define ENC28J60_RX_FRAMELEN	(ETH_HEADERLEN + ETH_MAXDATA + ETH_CRCLEN)
+#endif
+
+/* Control byte ahead of each frame sent */
+#define TX_CONTROL_LEN	1
+
+/* Transmit status vector after each frame sent */
+#define TX_STATUS_LEN	7
+#define TSV_STATUS		2
+#define TSV_DONE		(1 << 0x07)	/* Bit 23 */
+
+/** The status vector says the frame went **/
+#define TSV_SENT(status)	(((status)[TSV_STATUS] & TSV_DONE) != 0)
+
+/* Receive status vector ahead of each frame:
+ * next packet pointer (2), byte count (2), status (2),
+ * all least significant byte first */
+#define RX_HEADER_LEN	6
+#define RSV_NEXT		0
+#define RSV_COUNT		2
+#define RSV_STATUS		4
+
+/* In the low status byte */
+#define RSV_CRC_ERROR	(1 << 0x04)
+#define RSV_LEN_ERROR	(1 << 0x05)
+#define RSV_RX_OK		(1 << 0x07)
+
+
+/** BANK1 **/
+#define EPKTCNT		0x19
 
 
 /** BANK2 **/
@@ -0,0 +1,341 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: pool.c
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Fixed size packet buffers (see pool.h).
+ *
+ *				 Each size class is a stack of free buffers,
+ *				 linked by index through the buffers
+ *				 themselves.  The top of the stack and a tag
+ *				 share one 32 bit word, which is only ever
+ *				 changed by compare and swap.  The tag goes
+ *				 up on every change, so a buffer that is
+ *				 taken and given back while someone else is
+ *				 part way through can't fool them.
+ *
+ *				 Every buffer has a pointer back to its class
+ *				 just in front of it, so pool_free doesn't
+ *				 care which context (or thread) it is called
+ *				 from.
+ *
+ *				 Compilers without the __atomic builtins get
+ *				 plain loads and stores, which are only safe
+ *				 from one thread with interrupts that don't
+ *				 use the pool.
+ *
+ *  History
+ *	DB/19 Oct 2026	Started
+ ****************************************************************************/
+
+#include "pool.h"
+#include "sip_ctx.h"
+
+
+/* No next buffer */
+#define POOL_NONE			0xFFFF
+
+#define POOL_INDEX(head)	((uint16_t)((head) & 0xFFFF))
+#define POOL_TAG(head)		((head) & 0xFFFF0000UL)
+#define POOL_HEAD(tag, index)	((((tag) + 0x10000UL) & 0xFFFF0000UL) | (index))
+
+#if defined(__GNUC__) && ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+#define POOL_LOAD(p)			__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define POOL_CAS(p, old, new)	__atomic_compare_exchange_n((p), (old), (new), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define POOL_ADD(p, n)			__atomic_add_fetch((p), (n), __ATOMIC_RELAXED)
+#define POOL_SUB(p, n)			__atomic_sub_fetch((p), (n), __ATOMIC_RELAXED)
+#else
+#define POOL_LOAD(p)			(*(p))
+#define POOL_CAS(p, old, new)	pool_cas((p), (old), (new))
+#define POOL_ADD(p, n)			(*(p) += (n))
+#define POOL_SUB(p, n)			(*(p) -= (n))
+
+static bool pool_cas(volatile uint32_t *p, uint32_t *old, const uint32_t new_value)
+{
+	if(*p != *old)
+	{
+		*old = *p;
+		return false;
+	}
+
+	*p = new_value;
+	return true;
+}
+#endif
+
+
+/** Sizes and counts of each class **/
+static const uint16_t pool_sizes[POOL_CLASSES] = { POOL_HEADER_SIZE, POOL_SMALL_SIZE, POOL_MTU_SIZE };
+static const uint16_t pool_counts[POOL_CLASSES] = { POOL_HEADER_COUNT, POOL_SMALL_COUNT, POOL_MTU_COUNT };
+
+
+static uint8_t *pool_block(const struct pool_class *pc, const uint16_t index);
+static uint8_t *pool_pop(struct pool_class *pc);
+
+
+/****************************************************
+ *    Function: init_pool
+ * Description: Carve the arena into POOL_*_COUNT
+ * 				buffers of each size, for the current
+ * 				context.  Anything already allocated
+ * 				from its old arena is forgotten.
+ *
+ *	Input:
+ *		arena		Memory for the buffers (the caller
+ *					keeps it for as long as the pool
+ *					is used)
+ *		arena_len	At least POOL_ARENA_SIZE
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		Arena too small
+ ***************************************************/
+RETURN_STATUS init_pool(uint8_t *arena, const uint32_t arena_len)
+{
+	if(arena == NULL || arena_len < POOL_ARENA_SIZE)
+		return FAILURE;
+
+	/* The caller's array could start anywhere */
+	uint8_t *next = arena + ((8 - ((uintptr_t)arena & 7)) & 7);
+
+	uint8_t c = 0;
+	for(c = 0; c < POOL_CLASSES; c++)
+	{
+		struct pool_class *pc = &SIP->pool.classes[c];
+
+		pc->id = (POOL_CLASS)c;
+		pc->base = next;
+		pc->size = pool_sizes[c];
+		pc->stride = POOL_STRIDE(pool_sizes[c]);
+		pc->count = pool_counts[c];
+		pc->free = pc->count;
+		pc->low = pc->count;
+		pc->allocs = 0;
+		pc->fails = 0;
+		pc->watermark = 0;
+		pc->low_callback = NULL;
+
+		/* Stack them up, lowest at the top */
+		uint16_t i = 0;
+		for(i = 0; i < pc->count; i++)
+		{
+			uint8_t *block = pool_block(pc, i);
+			*(struct pool_class **)block = pc;
+			*(uint16_t *)(block + POOL_BLOCK_HEADER) = (i + 1 < pc->count) ? i + 1 : POOL_NONE;
+		}
+		pc->head = (pc->count > 0) ? 0 : POOL_NONE;
+
+		next += (uint32_t)pc->stride * pc->count;
+	}
+
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: pool_alloc
+ * Description: Get a buffer from the current context's
+ * 				pool.  The smallest size that fits is
+ * 				used, or the next one up if those have
+ * 				all gone.
+ *
+ *	Input:
+ *		len			Bytes needed
+ *
+ *	Return:
+ * 		The buffer
+ * 		NULL		Too big, or none left
+ ***************************************************/
+uint8_t *pool_alloc(const uint16_t len)
+{
+	struct pool_class *first = NULL;
+
+	uint8_t c = 0;
+	for(c = 0; c < POOL_CLASSES; c++)
+	{
+		struct pool_class *pc = &SIP->pool.classes[c];
+		if(pc->count == 0 || pc->size < len)
+			continue;
+
+		if(first == NULL)
+			first = pc;
+
+		uint8_t *buffer = pool_pop(pc);
+		if(buffer == NULL)
+			continue;
+
+		POOL_ADD(&pc->allocs, 1);
+
+		uint32_t free_now = POOL_SUB(&pc->free, 1);
+
+		uint32_t low = POOL_LOAD(&pc->low);
+		while(free_now < low && !POOL_CAS(&pc->low, &low, free_now));
+
+		/* Only as it goes past, not every time below */
+		if(free_now == pc->watermark && pc->low_callback != NULL)
+		{
+			pc->low_callback(pc->id, (uint16_t)free_now);
+		}
+
+		return buffer;
+	}
+
+	if(first != NULL)
+	{
+		POOL_ADD(&first->fails, 1);
+	}
+
+	return NULL;
+}
+
+
+/****************************************************
+ *    Function: pool_free
+ * Description: Give a buffer back to the pool it came
+ * 				from.
+ *
+ *	Input:
+ *		buffer		From pool_alloc (NULL is ignored)
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+void pool_free(uint8_t *buffer)
+{
+	if(buffer == NULL)
+		return;
+
+	uint8_t *block = buffer - POOL_BLOCK_HEADER;
+	struct pool_class *pc = *(struct pool_class **)block;
+	const uint16_t index = (uint16_t)((block - pc->base) / pc->stride);
+
+	/* Counted first, so pool_alloc can't take it before
+	 * it is counted and send free below zero */
+	POOL_ADD(&pc->free, 1);
+
+	uint32_t head = POOL_LOAD(&pc->head);
+	do
+	{
+		*(uint16_t *)buffer = POOL_INDEX(head);
+	}
+	while(!POOL_CAS(&pc->head, &head, POOL_HEAD(POOL_TAG(head), index)));
+}
+
+
+/****************************************************
+ *    Function: set_pool_watermark
+ * Description: Have callback called when an
+ * 				allocation leaves only level buffers
+ * 				of a size free (eg to start dropping
+ * 				low priority traffic).  It is called on
+ * 				the way down only, from pool_alloc.
+ *
+ *	Input:
+ *		cls			Size class
+ *		level		Buffers left
+ *		callback	Function, or NULL for none
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		No such class
+ ***************************************************/
+RETURN_STATUS set_pool_watermark(const POOL_CLASS cls, const uint16_t level, void (*callback)(const POOL_CLASS cls, const uint16_t free))
+{
+	if(cls >= POOL_CLASSES)
+		return FAILURE;
+
+	SIP->pool.classes[cls].watermark = level;
+	SIP->pool.classes[cls].low_callback = callback;
+
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: get_pool_stats
+ * Description: How a size class in the current
+ * 				context's pool is doing.
+ *
+ *	Input:
+ *		cls			Size class
+ *		stats		Filled in
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		No such class
+ ***************************************************/
+RETURN_STATUS get_pool_stats(const POOL_CLASS cls, struct pool_stats *stats)
+{
+	if(cls >= POOL_CLASSES || stats == NULL)
+		return FAILURE;
+
+	struct pool_class *pc = &SIP->pool.classes[cls];
+
+	stats->size = pc->size;
+	stats->count = pc->count;
+	stats->free = (uint16_t)POOL_LOAD(&pc->free);
+	stats->low = (uint16_t)POOL_LOAD(&pc->low);
+	stats->allocs = POOL_LOAD(&pc->allocs);
+	stats->fails = POOL_LOAD(&pc->fails);
+
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: pool_block
+ * Description: Where a buffer's header is.
+ ***************************************************/
+static uint8_t *pool_block(const struct pool_class *pc, const uint16_t index)
+{
+	return pc->base + (uint32_t)pc->stride * index;
+}
+
+
+/****************************************************
+ *    Function: pool_pop
+ * Description: Take the buffer off the top of a
+ * 				class's free stack.
+ *
+ *	Input:
+ *		pc			Size class
+ *
+ *	Return:
+ * 		The buffer
+ * 		NULL		None left
+ ***************************************************/
+static uint8_t *pool_pop(struct pool_class *pc)
+{
+	uint32_t head = POOL_LOAD(&pc->head);
+	uint8_t *buffer = NULL;
+
+	do
+	{
+		if(POOL_INDEX(head) == POOL_NONE)
+			return NULL;
+
+		/* Could be stale if someone beats us to it,
+		 * but then the tag has moved and we go round */
+		buffer = pool_block(pc, POOL_INDEX(head)) + POOL_BLOCK_HEADER;
+	}
+	while(!POOL_CAS(&pc->head, &head, POOL_HEAD(POOL_TAG(head), *(volatile uint16_t *)buffer)));
+
+	return buffer;
+}
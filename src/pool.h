@@ -0,0 +1,96 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: pool.h
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Fixed size packet buffers, carved out of one
+ *				 arena the caller provides, so there is no
+ *				 malloc and memory use is known up front.
+ *
+ *				 Buffers come in three sizes, each with its
+ *				 own free list.  Each stack context (one per
+ *				 core, see sip_ctx.h) has its own pool, but
+ *				 a buffer can be freed from anywhere.
+ *
+ *		  Usage: static uint8_t arena[POOL_ARENA_SIZE];
+ *		  		 init_pool(arena, sizeof(arena));
+ *		  		 uint8_t *frame = pool_alloc(60);
+ *		  		 ...
+ *		  		 pool_free(frame);
+ *
+ *  History
+ *	DB/19 Oct 2026	Started
+ ****************************************************/
+#ifndef POOL_H_
+#define POOL_H_
+
+#include "global.h"
+#include "stack_defines.h"
+
+
+typedef enum POOL_CLASS
+{
+	POOL_HEADER,	/* Just the headers */
+	POOL_SMALL,		/* Short datagrams */
+	POOL_MTU,		/* A whole frame */
+	POOL_CLASSES
+} POOL_CLASS;
+
+
+/* Room before each buffer for the pool it goes back to */
+#define POOL_BLOCK_HEADER	8
+
+/* Buffer plus header, rounded up to keep buffers aligned */
+#define POOL_STRIDE(size)	((((size) + POOL_BLOCK_HEADER) + 7) & ~7UL)
+
+/* Arena needed for POOL_*_COUNT buffers (with room to align it) */
+#define POOL_ARENA_SIZE		(POOL_STRIDE(POOL_HEADER_SIZE) * POOL_HEADER_COUNT \
+							+ POOL_STRIDE(POOL_SMALL_SIZE) * POOL_SMALL_COUNT \
+							+ POOL_STRIDE(POOL_MTU_SIZE) * POOL_MTU_COUNT + 8)
+
+
+/** How one size class is doing **/
+struct pool_stats
+{
+	uint16_t size;		/* Bytes per buffer */
+	uint16_t count;		/* Buffers in all */
+	uint16_t free;		/* Buffers free now */
+	uint16_t low;		/* Fewest ever free */
+	uint32_t allocs;
+	uint32_t fails;		/* Nothing big enough left */
+};
+
+
+/** Carve POOL_*_COUNT buffers out of arena, for this context **/
+RETURN_STATUS init_pool(uint8_t *arena, const uint32_t arena_len);
+
+/** Get a buffer of at least len bytes, or NULL **/
+uint8_t *pool_alloc(const uint16_t len);
+
+/** Give a buffer back (from any context or thread) **/
+void pool_free(uint8_t *buffer);
+
+/** Call callback when an allocation leaves only level buffers free **/
+RETURN_STATUS set_pool_watermark(const POOL_CLASS cls, const uint16_t level, void (*callback)(const POOL_CLASS cls, const uint16_t free));
+
+/** How a size class is doing **/
+RETURN_STATUS get_pool_stats(const POOL_CLASS cls, struct pool_stats *stats);
+
+#endif /* POOL_H_ */
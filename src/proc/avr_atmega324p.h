@@ -10,6 +10,8 @@
  *
  *
  *  History
+ *	DB/19-10-26	SPI and USART1 pins
+ *	DB/19-10-26	MAC INT pin
  *	DB/11-10-09	Started
  ****************************************************/
 
@@ -22,8 +24,26 @@
 #define MAC_CS_DDR	DDRB
 #define MAC_CS_PIN	PB4
 
-/** SPI registers **/
-#define SPI_IN_REG	SPDR
-#define SPI_ISR_IN	SPI_STC_vect
+/** MAC INT pin (INT2, PB2) **/
+#define MAC_INT_vect	INT2_vect
+#define MAC_INT_MASK	(1 << INT2)
+#define MAC_INT_EDGE	(1 << ISC21)		/* Falling */
+
+/** SPI pins **/
+#define SPI_PORT	PORTB
+#define SPI_DDR		DDRB
+#define SPI_MOSI	PB5
+#define SPI_MISO	PB6
+#define SPI_SCK		PB7
+
+/** USART1 as a SPI master (SPI_USART) **/
+#define USPI_DDR	DDRD
+#define USPI_XCK	PD4
+#define USPI_TXD	PD3
+#define USPI_UDR	UDR1
+#define USPI_UCSRA	UCSR1A
+#define USPI_UCSRB	UCSR1B
+#define USPI_UCSRC	UCSR1C
+#define USPI_UBRR	UBRR1
 
 #endif /* ATMEGA324P_H_ */
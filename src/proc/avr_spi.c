@@ -8,8 +8,25 @@
  *				 chip interfacing.  Handles GPIO,
  *               SPI.
  *
+ *				 Transfers are whole buffers in a tight
+ *				 polled loop.  At 10MHz a byte takes 16
+ *				 CPU clocks, less than getting in and out
+ *				 of an interrupt, so nothing would be
+ *				 gained by giving the CPU back between
+ *				 bytes.
+ *
+ *				 Options (define at compile time):
+ *				  SPI_USART		Use USART1 in master SPI
+ *				  				mode.  Its transmit buffer
+ *				  				keeps the clock running
+ *				  				between bytes, which the SPI
+ *				  				can't.
+ *
  *
  *  History
+ *	DB/19-10-26	Added mac_int_enable
+ *	DB/19-10-26	Polled whole-buffer transfers, USART option
+ *	DB/19-10-26	MAC INT pin interrupt
  *	DB/11-10-09	Started
  ****************************************************/
 
@@ -19,6 +36,7 @@
 #include "avr_atmega324p.h"
 
 static void(*timer_callback)(void) = NULL;
+static void(*mac_int_callback)(void) = NULL;
 
 /****************************************************
  *    Function: register_ms_callback
@@ -56,14 +74,14 @@ ISR(TIMER0_COMPA_vect)
  *     Assumes: !CS
  *
  *	Input:
- * 		BOOL	chip_enable
+ * 		chip_enable
  *
  *	Return:
  * 		SUCCESS	always
  ***************************************************/
-RETURN_STATUS mac_cs(BOOL chip_enable)
+RETURN_STATUS mac_cs(const bool chip_enable)
 {
-	if(TRUE == chip_enable)
+	if(chip_enable)
 	{
 		// Enable = pin low = sink.
 
@@ -93,21 +111,29 @@ RETURN_STATUS mac_cs(BOOL chip_enable)
  ***************************************************/
 RETURN_STATUS init_link()
 {
-	data_sending = FALSE;
-	/*
+	// Deselected until there is something to say
+	mac_cs(false);
+
+#ifdef SPI_USART
+	// XCK and TXD output, RXD input.
+	USPI_DDR |= (1 << USPI_XCK) | (1 << USPI_TXD);
+
+	// Master SPI mode 0, clock/2 (UBRR must be zero while enabling)
+	USPI_UBRR = 0;
+	USPI_UCSRC = (1 << UMSEL11) | (1 << UMSEL10);
+	USPI_UCSRB = (1 << RXEN1) | (1 << TXEN1);
+	USPI_UBRR = 0;
+#else
 	// Clock & MO output, MI input.
-	SPI_DDR |= (1 << PB5) | (1 << PB7);
-
-	DDRB &= ~(1 << PB6);
-	PORTB |= (1 << PB6); // Pull-up (assumes PUD = 0)
+	SPI_DDR |= (1 << SPI_MOSI) | (1 << SPI_SCK);
 
+	SPI_DDR &= ~(1 << SPI_MISO);
+	SPI_PORT |= (1 << SPI_MISO); // Pull-up (assumes PUD = 0)
 
-	//Set clock speed
-	// SPCR &= ~(1 << SPR0) | ~(1 << SPR1); // div4
-
-	// Enable & set SPI master.
-	SPCR |= (1 << SPE) | (1 << MSTR);
-	*/
+	// Enable & set SPI master, mode 0, clock/2.  No interrupt.
+	SPCR = (1 << SPE) | (1 << MSTR);
+	SPSR |= (1 << SPI2X);
+#endif
 
 	/*
 	 * Initialise Timer0 for 1ms ticks (to interrupt)
@@ -122,109 +148,152 @@ RETURN_STATUS init_link()
 
 	TIMSK0 |= (1 << OCIE0A);
 
+	/*
+	 * MAC INT pin.  It stays low until the MAC is serviced,
+	 * so trigger on the falling edge, not the level.
+	 */
+	EICRA |= MAC_INT_EDGE;
+	EIFR = MAC_INT_MASK;
+	EIMSK |= MAC_INT_MASK;
+
 
-	return NOT_AVAILABLE;
+	return SUCCESS;
 }
 
 
 /****************************************************
  *    Function: write_buffer
- * Description: Write data to SPI
+ * Description: Write data to SPI, throwing away what
+ * 				comes back.
+ *
+ *		  NOTE: Chip select is left to the caller, so
+ *		  		a command and its data can be sent in
+ *		  		separate calls.
  *
  *	Input:
  * 		buffer			Data to be sent
  * 		buffer_len		Length of data to be sent
- * 		TODO timeout
  *
  *	Return:
  * 		SUCCESS			Data written.
- * 		FAILURE			Unable to write data.
+ * 		FAILURE			Nothing to write.
  ***************************************************/
 RETURN_STATUS write_buffer(const uint8_t *buffer, const unsigned int buffer_len)
 {
-	return NOT_AVAILABLE;
+	unsigned int i = 0;
+
+	if(buffer_len == 0)
+	{
+		return FAILURE;
+	}
+
+#ifdef SPI_USART
+	USPI_UCSRA = (1 << TXC1);	// Clear TXC
+
+	for(i = 0; i < buffer_len; i++)
+	{
+		while(!(USPI_UCSRA & (1 << UDRE1)));
+		USPI_UDR = buffer[i];
+	}
+
+	// Wait for the last bit to go, then empty the receiver
+	while(!(USPI_UCSRA & (1 << TXC1)));
+	while(USPI_UCSRA & (1 << RXC1))
+	{
+		(void)USPI_UDR;
+	}
+#else
+	SPDR = buffer[0];
+
+	for(i = 1; i < buffer_len; i++)
+	{
+		// Fetch the next byte while this one goes
+		uint8_t next = buffer[i];
+		while(!(SPSR & (1 << SPIF)));
+		SPDR = next;
+	}
+
+	while(!(SPSR & (1 << SPIF)));
+	(void)SPDR;
+#endif
+
+	return SUCCESS;
 }
 
 
 /****************************************************
  *    Function: read_buffer
- * Description: Read SPI.  Will attempt to read
- * 				buffer_len number of bytes before timeout.
+ * Description: Read SPI, clocking out 0xFF.
+ *
+ *		  NOTE: We drive the clock, so a transfer
+ *		  		can't stall and the timeout is not
+ *		  		needed.  Chip select is left to the
+ *		  		caller.
  *
  *	Input:
  * 		buffer			Data buffer
  * 		buffer_len		Requested length
  * 		actual_len		Length read to buffer
- * 		timeout			ms timeout (0 = no timeout)
+ * 		timeout			Ignored
  *
  *	Return:
  * 		SUCCESS			Data read.
- * 		FAILURE			Somethings wrong.
- * 		TIMEOUT			Timeout occurred before completion
+ * 		FAILURE			Nothing to read.
  ***************************************************/
 RETURN_STATUS read_buffer(uint8_t *buffer, const unsigned int buffer_len, unsigned int *actual_len, const unsigned int timeout)
 {
-	return NOT_AVAILABLE;
-}
-/**
- * TODO Implement read_buffer(avr_spi)
- *
-	// In case we exist early;
+	unsigned int i = 0;
+
 	*actual_len = 0;
 
-	// Quick sanity check
 	if(buffer_len == 0)
 	{
-		// Getting nothing is too easy.
 		return FAILURE;
 	}
 
-	// Do we need to start timer?
-	if(timeout > 0)
+#ifdef SPI_USART
+	// Keep two bytes in flight, so the clock never stops
+	unsigned int sent = 0;
+
+	while(i < buffer_len)
 	{
-		if (start_async_timer_cs(timeout) != SUCCESS)
+		if(sent < buffer_len && sent - i < 2 && (USPI_UCSRA & (1 << UDRE1)))
 		{
-			// Probably because 'timeout' is invalid
-			return FAILURE;
+			USPI_UDR = 0xFF;
+			sent++;
 		}
-	}
-
 
-
-	do{
-
-		// Wait for data ready signal and check for timeout.
-		while(1)
+		if(USPI_UCSRA & (1 << RXC1))
 		{
-			if(async_timer_running() == FALSE)
-			{
-				return TIMEOUT;
-			}
-			else if (data_sending == FALSE)
-			{
-				// Break out of while(1).
-				break;
-			}
+			buffer[i++] = USPI_UDR;
 		}
+	}
+#else
+	SPDR = 0xFF;
 
+	for(i = 0; i < buffer_len - 1; i++)
+	{
+		// Start the next byte before storing this one
+		while(!(SPSR & (1 << SPIF)));
+		uint8_t in = SPDR;
+		SPDR = 0xFF;
+		buffer[i] = in;
+	}
 
-		// Read the next byte.
-		data_sending
-		buffer[*actual_len] = SPI_IN_REG;
-		(*actual_len)++;
+	while(!(SPSR & (1 << SPIF)));
+	buffer[i] = SPDR;
+#endif
 
-	}while( *actual_len < buffer_len );
+	*actual_len = buffer_len;
 
-	// Only get here if we have all the data.
 	return SUCCESS;
 }
-*/
 
 
 /****************************************************
- *    Function: set_recv_data_callback
+ *    Function: set_mac_int_callback
  * Description: Set the callback function for when
- * 				data is received.
+ * 				the MAC pulls its INT pin low.
  *
  *	Input:
  * 		fn_callback
@@ -232,28 +301,50 @@ RETURN_STATUS read_buffer(uint8_t *buffer, const unsigned int buffer_len, unsign
  *	Return:
  * 		SUCCESS
  ***************************************************/
-RETURN_STATUS set_recv_data_callback(void (*fn_callback)(uint8_t next_byte))
+RETURN_STATUS set_mac_int_callback(void (*fn_callback)(void))
 {
-	data_in_callback = fn_callback;
+	mac_int_callback = fn_callback;
 	return SUCCESS;
 }
 
 
 /****************************************************
- *    Function: ISR_recv_data
- * Description: Receive data from MAC.
+ *    Function: mac_int_enable
+ * Description: Hold off the MAC INT pin interrupt
+ * 				while the driver talks to the MAC
+ * 				itself.  An edge while it is held off
+ * 				is remembered, and runs when it is
+ * 				allowed again.
  *
  *	Input:
- * 		NONE
+ * 		enable
  *
  *	Return:
- * 		NONE
+ * 		SUCCESS	always
  ***************************************************/
-ISR(SPI_ISR_IN)
+RETURN_STATUS mac_int_enable(const bool enable)
 {
-	// Read and add to overall frame buffer
-	uint8_t byte_in = (uint8_t)SPI_IN_REG;
+	if(enable)
+	{
+		EIMSK |= MAC_INT_MASK;
+	}
+	else
+	{
+		EIMSK &= ~MAC_INT_MASK;
+	}
+
+	return SUCCESS;
+}
 
-	// Callback to MAC controller.
-	(*data_in_callback)(byte_in);
+
+/****************************************************
+ *    Function: ISR, MAC INT pin
+ * Description: Hand the interrupt to the MAC driver.
+ ***************************************************/
+ISR(MAC_INT_vect)
+{
+	if(mac_int_callback != NULL)
+	{
+		(*mac_int_callback)();
+	}
 }
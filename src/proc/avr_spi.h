@@ -10,8 +10,27 @@
  *
  *
  *  History
+ *	DB/19-10-26	Declares init_link and write_buffer, includes link_uc_mac.h
+ *	DB/19-10-26	Added mac_int_enable
+ *	DB/19-10-26	Added mac_cs
+ *	DB/19-10-26	Added set_mac_int_callback
  *	DB/11-10-09	Started
  *****************************************************/
 
 /** Prototypes to derive from **/
-#include "link_uc.h"
+#include "link_uc_mac.h"
+
+/** Set up the SPI and the MAC pins **/
+RETURN_STATUS init_link(void);
+
+/** Send buffer to the MAC (chip select is up to the caller) **/
+RETURN_STATUS write_buffer(const uint8_t *buffer, const unsigned int buffer_len);
+
+/** Select (true) or release the MAC **/
+RETURN_STATUS mac_cs(const bool chip_enable);
+
+/** Hold off (false) or allow the MAC INT pin interrupt **/
+RETURN_STATUS mac_int_enable(const bool enable);
+
+/** Called from the MAC INT pin interrupt **/
+RETURN_STATUS set_mac_int_callback(void (*fn_callback)(void));
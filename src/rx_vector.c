@@ -0,0 +1,280 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: rx_vector.c
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Vector receive (see rx_vector.h).
+ *
+ *				 A batch is cut into vectors of up to
+ *				 RX_VECTOR_SIZE frames.  Each stage takes the
+ *				 frames the last one kept and packs the ones
+ *				 it keeps to the front, so the next stage
+ *				 has no gaps to step over.
+ *
+ *  History
+ *	DB/19 Oct 2026	Counted in get_demux_stats too
+ *	DB/19 Oct 2026	Started
+ ****************************************************************************/
+
+#include "rx_vector.h"
+#include "ethernet.h"
+#include "demux.h"
+#include "latency.h"
+#include "functions.h"
+#include "sip_ctx.h"
+
+#ifdef MAC_RX_VECTOR
+
+#ifndef ETH_EARLY_DEMUX
+#error MAC_RX_VECTOR needs ETH_EARLY_DEMUX
+#endif
+
+
+/* Frames ahead of the one being worked on to prefetch */
+#define RX_PREFETCH_AHEAD	4
+
+#if defined(__GNUC__)
+#define RX_PREFETCH(p)		__builtin_prefetch((p), 0, 3)
+#else
+#define RX_PREFETCH(p)
+#endif
+
+
+/** One frame on its way through the stages **/
+struct rx_vector_packet
+{
+	uint8_t *frame;
+	uint16_t len;			/* No FCS */
+	uint8_t ihl;			/* IP header length */
+	uint8_t found;			/* Demux entry */
+};
+
+
+static void rx_vector_run(struct mac_frame *frames, const uint16_t count);
+static void rx_stage_begin(const RX_STAGE stage, const uint16_t frames, uint32_t *start);
+static void rx_stage_end(const RX_STAGE stage, const uint16_t punted, const uint16_t dropped, const uint32_t start);
+
+
+/****************************************************
+ *    Function: ether_frames_available
+ * Description: A batch of frames from the MAC (see
+ * 				set_frames_complete).
+ *
+ *	Input:
+ * 		frames		The frames (FCS and all, as for
+ * 					ether_frame_available)
+ * 		count		How many
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+void ether_frames_available(struct mac_frame *frames, const uint16_t count)
+{
+	uint16_t done = 0;
+	while(done < count)
+	{
+		uint16_t size = count - done;
+		if(size > RX_VECTOR_SIZE)
+		{
+			size = RX_VECTOR_SIZE;
+		}
+
+		rx_vector_run(&frames[done], size);
+		done += size;
+	}
+}
+
+
+/****************************************************
+ *    Function: get_rx_stage_stats
+ * Description: How a stage is doing, in the current
+ * 				context.
+ *
+ *	Input:
+ * 		stage		Stage
+ * 		stats		Filled in
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		No such stage
+ ***************************************************/
+RETURN_STATUS get_rx_stage_stats(const RX_STAGE stage, struct rx_stage_stats *stats)
+{
+	if(stage >= RX_STAGES || stats == NULL)
+		return FAILURE;
+
+	*stats = SIP->rx_vector.stages[stage];
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: rx_vector_run
+ * Description: Put one vector through every stage.
+ *
+ *	Input:
+ * 		frames		Up to RX_VECTOR_SIZE frames
+ * 		count		How many
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+static void rx_vector_run(struct mac_frame *frames, const uint16_t count)
+{
+	struct rx_vector_packet packets[RX_VECTOR_SIZE];
+	struct rx_vector_packet punts[RX_VECTOR_SIZE];
+	uint16_t kept = 0;
+	uint16_t punted = 0;
+	uint16_t dropped = 0;
+	uint16_t i = 0;
+	uint32_t start = 0;
+
+	/* Every frame waits for the whole vector */
+	uint32_t rx_start = latency_now();
+
+
+	/* Ethernet: tap, FCS and type */
+	rx_stage_begin(RX_STAGE_ETHER, count, &start);
+	for(i = 0; i < count; i++)
+	{
+		if(i + RX_PREFETCH_AHEAD < count)
+		{
+			RX_PREFETCH(frames[i + RX_PREFETCH_AHEAD].buffer);
+		}
+
+		uint8_t *frame = frames[i].buffer;
+		uint16_t len = frames[i].len;
+
+		if(!ether_frame_accept(frame, &len))
+		{
+			dropped++;
+			continue;
+		}
+
+		struct rx_vector_packet *packet = (load_be16(&frame[ETH_PROTOCOL]) == IPv4) ? &packets[kept++] : &punts[punted++];
+		packet->frame = frame;
+		packet->len = len;
+	}
+	rx_stage_end(RX_STAGE_ETHER, punted, dropped, start);
+
+
+	/* IP: only whole UDP datagrams go on */
+	uint16_t count_in = kept;
+	uint16_t punted_before = punted;
+
+	rx_stage_begin(RX_STAGE_IP4, count_in, &start);
+	kept = 0;
+	for(i = 0; i < count_in; i++)
+	{
+		if(i + RX_PREFETCH_AHEAD < count_in)
+		{
+			RX_PREFETCH(&packets[i + RX_PREFETCH_AHEAD].frame[ETH_HEADERLEN]);
+		}
+
+		struct rx_vector_packet packet = packets[i];
+		packet.ihl = demux_udp_ihl(&packet.frame[ETH_HEADERLEN], packet.len - ETH_HEADERLEN);
+
+		if(packet.ihl == 0)
+		{
+			punts[punted++] = packet;
+			continue;
+		}
+
+		packets[kept++] = packet;
+	}
+	rx_stage_end(RX_STAGE_IP4, punted - punted_before, 0, start);
+
+
+	/* UDP: who wants it, and is it good */
+	count_in = kept;
+	dropped = 0;
+
+	rx_stage_begin(RX_STAGE_UDP, count_in, &start);
+	kept = 0;
+	for(i = 0; i < count_in; i++)
+	{
+		struct rx_vector_packet packet = packets[i];
+		const uint8_t *ip = &packet.frame[ETH_HEADERLEN];
+
+		packet.found = demux_find(ip, packet.ihl);
+		if(packet.found == 0 || !demux_check(ip, packet.len - ETH_HEADERLEN, packet.ihl))
+		{
+			dropped++;
+			continue;
+		}
+
+		packets[kept++] = packet;
+	}
+	rx_stage_end(RX_STAGE_UDP, 0, dropped, start);
+	SIP->demux.dropped += dropped;
+
+
+	/* Handlers */
+	rx_stage_begin(RX_STAGE_DELIVER, kept, &start);
+	for(i = 0; i < kept; i++)
+	{
+		demux_deliver(packets[i].found, &packets[i].frame[ETH_HEADERLEN], packets[i].ihl);
+	}
+	rx_stage_end(RX_STAGE_DELIVER, 0, 0, start);
+	SIP->demux.delivered += kept;
+
+
+	/* Whatever the stages couldn't do, the usual way */
+	for(i = 0; i < punted; i++)
+	{
+		ether_frame_dispatch(punts[i].frame, punts[i].len);
+	}
+
+	for(i = 0; i < count; i++)
+	{
+		latency_record(LATENCY_RX, rx_start);
+	}
+}
+
+
+/****************************************************
+ *    Function: rx_stage_begin
+ * Description: Count a stage in and start its clock.
+ ***************************************************/
+static void rx_stage_begin(const RX_STAGE stage, const uint16_t frames, uint32_t *start)
+{
+	struct rx_stage_stats *stats = &SIP->rx_vector.stages[stage];
+
+	stats->vectors++;
+	stats->frames += frames;
+
+	*start = latency_now();
+}
+
+
+/****************************************************
+ *    Function: rx_stage_end
+ * Description: Count what a stage did with its frames.
+ ***************************************************/
+static void rx_stage_end(const RX_STAGE stage, const uint16_t punted, const uint16_t dropped, const uint32_t start)
+{
+	struct rx_stage_stats *stats = &SIP->rx_vector.stages[stage];
+
+	stats->punted += punted;
+	stats->dropped += dropped;
+	stats->ticks += latency_now() - start;
+}
+
+#endif /* MAC_RX_VECTOR */
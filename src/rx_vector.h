@@ -0,0 +1,83 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: rx_vector.h
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Vector receive (MAC_RX_VECTOR).  A driver
+ *				 that reads frames in batches hands over the
+ *				 whole batch, and it goes through the stack
+ *				 a stage at a time:
+ *				   ether	tap, FCS, Ethernet type
+ *				   ip4		whole UDP datagram or not
+ *				   udp		early demux lookup, checksums
+ *				   deliver	handlers
+ *				 Each stage runs over every frame before the
+ *				 next starts, so its code and the demux
+ *				 table stay in cache, and the next frames
+ *				 are prefetched while one is worked on.
+ *
+ *				 Frames a stage can't handle (ARP, ICMP,
+ *				 fragments...) are 'punted' to the usual
+ *				 callbacks once the vector is done.
+ *
+ *				 Needs ETH_EARLY_DEMUX, and a driver with
+ *				 set_frames_complete (link_uc_mac.h).
+ *
+ *  History
+ *	DB/19 Oct 2026	Started
+ ****************************************************/
+#ifndef RX_VECTOR_H_
+#define RX_VECTOR_H_
+
+#include "global.h"
+#include "stack_defines.h"
+#include "link_uc_mac.h"
+
+
+typedef enum RX_STAGE
+{
+	RX_STAGE_ETHER,
+	RX_STAGE_IP4,
+	RX_STAGE_UDP,
+	RX_STAGE_DELIVER,
+	RX_STAGES
+} RX_STAGE;
+
+
+/** How a stage is doing **/
+struct rx_stage_stats
+{
+	uint32_t vectors;	/* Times it has run */
+	uint32_t frames;	/* Frames it has seen */
+	uint32_t punted;	/* Sent to the callbacks instead */
+	uint32_t dropped;
+	uint32_t ticks;		/* Time spent in it (LATENCY_CLOCK) */
+};
+
+
+#ifdef MAC_RX_VECTOR
+/** Callback to get a batch of frames from the MAC **/
+void ether_frames_available(struct mac_frame *frames, const uint16_t count);
+
+/** How a stage is doing **/
+RETURN_STATUS get_rx_stage_stats(const RX_STAGE stage, struct rx_stage_stats *stats);
+#endif
+
+#endif /* RX_VECTOR_H_ */
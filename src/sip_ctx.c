@@ -0,0 +1,105 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: sip_ctx.c
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Stack contexts (see sip_ctx.h).
+ *
+ *  History
+ *	DB/19 Oct 2026	Started
+ ****************************************************************************/
+
+#include "sip_ctx.h"
+
+
+/** Used until someone picks another.  The IP address
+ *  starts as broadcast, which is why it comes first. **/
+static struct sip_ctx sip_default_ctx = { { { 0xFF, 0xFF, 0xFF, 0xFF } } };
+
+SIP_CTX_TLS struct sip_ctx *sip_current = &sip_default_ctx;
+
+
+/****************************************************
+ *    Function: sip_ctx_init
+ * Description: Clear a context, as if the program
+ * 				had just started.
+ *
+ *	Input:
+ *		ctx		Context (memory owned by the caller)
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		ctx is NULL
+ ***************************************************/
+RETURN_STATUS sip_ctx_init(struct sip_ctx *ctx)
+{
+	if(ctx == NULL)
+		return FAILURE;
+
+	/* Can be too big for sr_memset with big tables */
+	uint8_t *bytes = (uint8_t*)ctx;
+	uint32_t i = 0;
+	for(i = 0; i < sizeof(struct sip_ctx); i++)
+	{
+		bytes[i] = 0;
+	}
+
+	ctx->ip.addr[0] = 0xFF;
+	ctx->ip.addr[1] = 0xFF;
+	ctx->ip.addr[2] = 0xFF;
+	ctx->ip.addr[3] = 0xFF;
+
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: sip_ctx_use
+ * Description: Make ctx the current context (for
+ * 				this thread).
+ *
+ *	Input:
+ *		ctx		Context, or NULL for the default
+ *
+ *	Return:
+ * 		The previous context
+ ***************************************************/
+struct sip_ctx *sip_ctx_use(struct sip_ctx *ctx)
+{
+	struct sip_ctx *old = sip_current;
+	sip_current = (ctx == NULL) ? &sip_default_ctx : ctx;
+	return old;
+}
+
+
+/****************************************************
+ *    Function: sip_ctx_get
+ * Description: Get the current context.
+ *
+ *	Input:
+ *		NONE
+ *
+ *	Return:
+ * 		The current context
+ ***************************************************/
+struct sip_ctx *sip_ctx_get(void)
+{
+	return sip_current;
+}
@@ -0,0 +1,298 @@
+/****************************************************************************
+ * Copyright 2026 Dave Barnard
+ *
+ *  This file is part of sIP
+ *
+ *  sIP is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  sIP is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with sIP.  If not, see <http://www.gnu.org/licenses/>.
+ ****************************************************************************
+ *     Filename: sip_ctx.h
+ *
+ *  	 Author: Dave Barnard
+ *
+ *	Description: Stack context.  Everything the stack
+ *				 remembers (addresses, ARP table, timers,
+ *				 callbacks...) lives in one struct sip_ctx,
+ *				 so a program can run as many stacks as it
+ *				 has memory for.
+ *
+ *				 The API is unchanged: every call works on
+ *				 the current context, which is picked with
+ *				 sip_ctx_use.  Until then it is a built in
+ *				 default, so single stack programs need not
+ *				 know contexts exist.  The current context
+ *				 is per thread on hosted builds (SIP_CTX_TLS).
+ *
+ *				 The caller owns the memory, eg:
+ *				   static struct sip_ctx tenant;
+ *				   sip_ctx_init(&tenant);
+ *				   sip_ctx_use(&tenant);
+ *				   init_ethernet(); ...
+ *
+ *				 The MAC driver is still one per program;
+ *				 drivers with their own threads run them in
+ *				 the context that was current at init_mac.
+ *
+ *  History
+ *	DB/19 Oct 2026	Added vector receive stage counts (MAC_RX_VECTOR)
+ *	DB/19 Oct 2026	Added the early demux table (ETH_EARLY_DEMUX)
+ *	DB/19 Oct 2026	Started
+ ****************************************************/
+#ifndef SIP_CTX_H_
+#define SIP_CTX_H_
+
+#include "global.h"
+#include "stack_defines.h"
+#include "ethernet.h"
+#include "ip.h"
+#include "icmp.h"
+#include "udp.h"
+#include "pool.h"
+#include "demux.h"
+#include "rx_vector.h"
+#include "latency.h"
+
+/* Current context is per thread where there are threads */
+#ifndef SIP_CTX_TLS
+#if defined(__linux__) || defined(__APPLE__)
+#define SIP_CTX_TLS		__thread
+#else
+#define SIP_CTX_TLS
+#endif
+#endif
+
+
+/** ethernet.c **/
+struct ether_packet_callback_element
+{
+  void (*fn_callback)(const uint8_t *buffer, const uint16_t buffer_len);
+#ifdef MAC_RX_STREAM
+  bool (*header_fn)(const uint8_t *header, const uint16_t header_len, const uint16_t packet_len);
+#endif
+  volatile ETHERNET_TYPE required_type;
+};
+
+struct ether_state
+{
+	bool initialised;
+	uint8_t addr[6];
+	uint8_t offload;
+	void (*tap)(const uint8_t *frame, const uint16_t frame_len, const bool outgoing);
+	struct ether_packet_callback_element callbacks[ETHER_CALLBACK_SIZE];
+#ifdef MAC_POLL
+	volatile bool poll_pending;	/* Set by the receive interrupt */
+	bool busy_poll;
+#endif
+};
+
+
+/** arp.c **/
+struct arp_element
+{
+	volatile uint8_t hw_addr[6];
+	volatile uint8_t	ip_addr[4];
+	volatile uint16_t timeout_id;
+	volatile bool valid;
+};
+
+struct arp_state
+{
+	bool initialised;
+	void (*learn)(const uint8_t *ip4_addr, const uint8_t *hw_addr);
+	volatile uint32_t generation;	/* Goes up when an address changes */
+	volatile struct arp_element table[ARP_TABLE_SIZE];
+};
+
+
+/** ip.c **/
+struct ip_callback_element
+{
+	IP_TYPE packet_type;
+	void (*callback_fn)(const uint8_t* src_addr, const uint8_t *buffer, uint16_t const buffer_len);
+#ifdef MAC_RX_STREAM
+	bool (*header_fn)(const uint8_t* src_addr, const uint8_t *header, const uint16_t header_len, const uint16_t packet_len);
+#endif
+};
+
+struct ip_state
+{
+	uint8_t addr[4];	/* Must be first, see sip_ctx.c */
+	bool initialised;
+	struct ip_callback_element callbacks[IP_CALLBACK_SIZE];
+};
+
+
+/** udp.c **/
+struct udp_callback_element
+{
+	uint16_t port;
+	void (*callback_fn)(const uint8_t *buffer, uint16_t const buffer_len);
+#ifdef MAC_RX_STREAM
+	void (*stream_fn)(struct udp_reader *reader);
+#endif
+};
+
+struct udp_state
+{
+	struct udp_callback_element callbacks[UDP_LISTEN_SIZE];
+	void (*deliver)(void (*handler)(const uint8_t *buffer, const uint16_t buffer_len),
+					const uint8_t *src_addr, const uint16_t src_port, const uint16_t port,
+					const uint8_t *buffer, const uint16_t buffer_len);
+#ifdef MAC_STREAM
+	/* Datagram being written by udp_stream_write */
+	uint16_t stream_len;
+	uint16_t stream_offset;
+	uint32_t stream_sum;		/* Not folded */
+	bool stream_odd;			/* Next byte is the low half of a word */
+	uint32_t stream_start;
+#endif
+};
+
+
+/** icmp.c **/
+struct icmp_state
+{
+	bool initialised;
+	uint16_t ping_timeout_id;
+	bool ping_host_available;
+	enum error_list last_error;
+};
+
+
+/** timer.c **/
+enum timer_status_t
+{
+	TIMER_EMPTY,
+	TIMER_RUNNING,
+	/*TIMER_PAUSED, - might be useful in the future*/
+};
+
+struct timer_element
+{
+	/*TODO: Should any of these be volatile, as they
+	 * will be updated in an interrupt callback. */
+	volatile uint16_t timeout;
+	volatile enum timer_status_t status;
+	void(*callback)(uint16_t);
+};
+
+struct timer_state
+{
+	bool initialised;
+	volatile uint32_t ms_ticks;
+	volatile uint16_t top;		/* One past the highest slot in use */
+	void (*idle)(void);
+	volatile struct timer_element store[TIMER_COUNT];
+};
+
+
+/** latency.c **/
+#ifndef WITHOUT_LATENCY_STATS
+struct latency_histogram
+{
+	volatile uint32_t buckets[LATENCY_BUCKETS];
+	volatile uint32_t count;
+	volatile uint32_t max;
+};
+#endif
+
+
+/** pool.c **/
+struct pool_class
+{
+	POOL_CLASS id;
+	uint8_t *base;			/* First buffer's header */
+	uint16_t size;
+	uint16_t stride;		/* Header and buffer */
+	uint16_t count;
+	uint32_t head;			/* Tag << 16 | top of the free stack */
+	uint32_t free;
+	uint32_t low;
+	uint32_t allocs;
+	uint32_t fails;
+	uint16_t watermark;
+	void (*low_callback)(const POOL_CLASS cls, const uint16_t free);
+};
+
+struct pool_state
+{
+	struct pool_class classes[POOL_CLASSES];
+};
+
+
+/** demux.c **/
+#ifdef ETH_EARLY_DEMUX
+struct demux_entry
+{
+	struct demux_key key;
+	void (*callback_fn)(const uint8_t *buffer, const uint16_t buffer_len);	/* NULL when free */
+	uint8_t next;			/* Entry index + 1, 0 at the end */
+};
+
+struct demux_state
+{
+	struct demux_entry entries[DEMUX_TABLE_SIZE];
+	uint8_t buckets[DEMUX_BUCKETS];
+	uint8_t sourced;		/* Entries for one sender */
+	uint32_t delivered;
+	uint32_t dropped;
+};
+#endif
+
+
+/** rx_vector.c **/
+#ifdef MAC_RX_VECTOR
+struct rx_vector_state
+{
+	struct rx_stage_stats stages[RX_STAGES];
+};
+#endif
+
+
+/** The whole stack **/
+struct sip_ctx
+{
+	struct ip_state ip;		/* Must be first, see sip_ctx.c */
+	struct ether_state ether;
+	struct arp_state arp;
+	struct udp_state udp;
+	struct icmp_state icmp;
+	struct timer_state timer;
+	struct pool_state pool;
+#ifdef ETH_EARLY_DEMUX
+	struct demux_state demux;
+#endif
+#ifdef MAC_RX_VECTOR
+	struct rx_vector_state rx_vector;
+#endif
+#ifndef WITHOUT_LATENCY_STATS
+	struct latency_histogram latency[LATENCY_PATHS];
+#endif
+};
+
+
+/** The current context (use SIP in the stack itself) **/
+extern SIP_CTX_TLS struct sip_ctx *sip_current;
+#define SIP		sip_current
+
+
+/** Set up a context ready for init_ethernet etc. **/
+RETURN_STATUS sip_ctx_init(struct sip_ctx *ctx);
+
+/** Make ctx the current context, returning the old one **/
+struct sip_ctx *sip_ctx_use(struct sip_ctx *ctx);
+
+/** Get the current context **/
+struct sip_ctx *sip_ctx_get(void);
+
+#endif /* SIP_CTX_H_ */
@@ -76,6 +76,42 @@
 #define ETH_MAXDATA			1000
 #endif
 
+/*
+ * Max Ethernet data length for the streaming send (MAC_STREAM).
+ * Frames are built in the MAC, so this costs no memory.
+ */
+#ifndef ETH_STREAM_MAXDATA
+#define ETH_STREAM_MAXDATA	1500
+#endif
+
+/*
+ * How much of each frame is read to decide who wants it, for the
+ * streaming receive (MAC_RX_STREAM).  Ethernet, IP and UDP headers.
+ */
+#ifndef ETH_RX_PEEKLEN
+#define ETH_RX_PEEKLEN		(14 + 20 + 8)
+#endif
+
+/*
+ * Early demux (ETH_EARLY_DEMUX) entries, at least one per listen_udp,
+ * and buckets they are hashed into (a power of two).
+ */
+#ifndef DEMUX_TABLE_SIZE
+#define DEMUX_TABLE_SIZE	8
+#endif
+
+#ifndef DEMUX_BUCKETS
+#define DEMUX_BUCKETS		8
+#endif
+
+/*
+ * Most frames taken through the stages together, for the vector
+ * receive (MAC_RX_VECTOR).  Bigger batches are cut up.
+ */
+#ifndef RX_VECTOR_SIZE
+#define RX_VECTOR_SIZE		64
+#endif
+
 /* Number of IP protocols allowed */
 #ifndef IP_CALLBACK_SIZE
 #define IP_CALLBACK_SIZE	5
@@ -100,3 +136,57 @@
 #ifndef MAX_PING_REPLY_LEN
 #define MAX_PING_REPLY_LEN	150
 #endif
+
+/*
+ * Latency histogram clock.  Defaults to the 1ms stack timer,
+ * a port with a free running us counter can use that instead.
+ */
+#ifndef LATENCY_CLOCK
+#define LATENCY_CLOCK()		get_ms_ticks()
+#endif
+
+/* Latency histogram resolution (sub-buckets per power of two, as bits) */
+#ifndef LATENCY_SUB_BITS
+#define LATENCY_SUB_BITS	2
+#endif
+
+/* Latency values of 2^LATENCY_MAX_BITS and above share the last bucket */
+#ifndef LATENCY_MAX_BITS
+#define LATENCY_MAX_BITS	20
+#endif
+
+/*
+ * Largest IP packet (headers included) that send_udp_segmented will
+ * hand to the MAC in one go.  Only used with UDP_SEG_OFFLOAD.
+ */
+#ifndef UDP_SEG_MAX_PACKET
+#define UDP_SEG_MAX_PACKET	65000
+#endif
+
+/*
+ * Packet buffer pool (pool.c) sizes, in bytes, and how many of
+ * each there are.  Headers only, short datagrams and whole frames.
+ */
+#ifndef POOL_HEADER_SIZE
+#define POOL_HEADER_SIZE	64
+#endif
+
+#ifndef POOL_SMALL_SIZE
+#define POOL_SMALL_SIZE		256
+#endif
+
+#ifndef POOL_MTU_SIZE
+#define POOL_MTU_SIZE		(14 + ETH_MAXDATA + 4)
+#endif
+
+#ifndef POOL_HEADER_COUNT
+#define POOL_HEADER_COUNT	4
+#endif
+
+#ifndef POOL_SMALL_COUNT
+#define POOL_SMALL_COUNT	4
+#endif
+
+#ifndef POOL_MTU_COUNT
+#define POOL_MTU_COUNT		2
+#endif
@@ -24,6 +24,9 @@
  *
  *
  *  History
+ *	DB/19 Oct 2026	Added set_timer_idle, ticks only scan used slots
+ *	DB/19 Oct 2026	State moved into the stack context
+ *	DB/19 Oct 2026	Added get_ms_ticks
  *	DB/17 Dec 2010	Updated to compile with gcc4 (but probably doesnt work!)
  *	DB/06 Oct 2010	Started
  ****************************************************************************/
@@ -31,24 +34,10 @@
 #include "stack_defines.h"
 #include "timer.h"
 #include "link_uc_mac.h"
+#include "sip_ctx.h"
 
-enum timer_status_t
-{
-	TIMER_EMPTY,
-	TIMER_RUNNING,
-	/*TIMER_PAUSED, - might be useful in the future*/
-};
-
-/** Keep track of timers */
-struct timer_element
-{
-	/*TODO: Should any of these be volatile, as they
-	 * will be updated in an interrupt callback. */
-	volatile uint16_t timeout;
-	volatile enum timer_status_t status;
-	void(*callback)(uint16_t);
-};
-volatile struct timer_element timer_store[TIMER_COUNT];
+/* The timers and the free running tick count are kept
+ * in the stack context (SIP->timer) */
 
 /****************************************************
  *    Function: init_timer
@@ -59,10 +48,9 @@ volatile struct timer_element timer_store[TIMER_COUNT];
  *	Return:
  * 		SUCCESS
  ***************************************************/
-static bool timer_initialised = false;
 RETURN_STATUS init_timer()
 {
-	if(timer_initialised)
+	if(SIP->timer.initialised)
 		return SUCCESS;
 
 
@@ -70,10 +58,11 @@ RETURN_STATUS init_timer()
 	uint16_t i = 0;
 	for(i = 0; i < TIMER_COUNT; i++)
 	{
-		timer_store[i].callback = NULL;
-		timer_store[i].timeout = 0;
-		timer_store[i].status = TIMER_EMPTY;
+		SIP->timer.store[i].callback = NULL;
+		SIP->timer.store[i].timeout = 0;
+		SIP->timer.store[i].status = TIMER_EMPTY;
 	}
+	SIP->timer.top = 0;
 
 	/*
 	 * Register a timer tick callback with the micro,
@@ -81,7 +70,7 @@ RETURN_STATUS init_timer()
 	 */
 	register_ms_callback(&timer_tick_callback);
 
-	timer_initialised = true;
+	SIP->timer.initialised = true;
 
 	return SUCCESS;
 }
@@ -114,11 +103,16 @@ uint16_t add_timer(uint32_t ms, void(*handler)(uint16_t))
 
 	for(i = 0; i < TIMER_COUNT; i++)
 	{
-		if(timer_store[i].status == TIMER_EMPTY)
+		if(SIP->timer.store[i].status == TIMER_EMPTY)
 		{
-			timer_store[i].timeout = ms;
-			timer_store[i].status = TIMER_RUNNING;
-			timer_store[i].callback = handler;
+			SIP->timer.store[i].timeout = ms;
+			SIP->timer.store[i].status = TIMER_RUNNING;
+			SIP->timer.store[i].callback = handler;
+
+			if(i >= SIP->timer.top)
+			{
+				SIP->timer.top = i + 1;
+			}
 
 			/* 0 is impossible, so can be used as invalid marker - add 1.
 			 * NOTE: this also means the max timer limit is 0xFFFE */
@@ -147,10 +141,10 @@ RETURN_STATUS kill_timer(uint16_t id, bool fire_timeout)
 {
 	id--; /* Because 0 is used as an error code elsewhere */
 
-	if(timer_store[id].timeout != 0 && timer_store[id].status != TIMER_EMPTY)
+	if(SIP->timer.store[id].timeout != 0 && SIP->timer.store[id].status != TIMER_EMPTY)
 	{
-		timer_store[id].status = TIMER_EMPTY;
-		timer_store[id].timeout = 0;
+		SIP->timer.store[id].status = TIMER_EMPTY;
+		SIP->timer.store[id].timeout = 0;
 	}
 	else
 	{
@@ -160,8 +154,8 @@ RETURN_STATUS kill_timer(uint16_t id, bool fire_timeout)
 	/* Check if they want to fire timeout one last time */
 	if(fire_timeout)
 	{
-		timer_store[id].callback(id);
-		timer_store[id].callback = NULL;
+		SIP->timer.store[id].callback(id);
+		SIP->timer.store[id].callback = NULL;
 	}
 
 
@@ -184,7 +178,13 @@ bool is_running(uint16_t id)
 {
 	id--; /* Because 0 is used as en error code, so 1 was added */
 
-	if(timer_store[id].status == TIMER_RUNNING)
+	/* Whoever asks is probably waiting on it */
+	if(SIP->timer.idle != NULL)
+	{
+		SIP->timer.idle();
+	}
+
+	if(SIP->timer.store[id].status == TIMER_RUNNING)
 	{
 		return true;
 	}
@@ -206,6 +206,7 @@ bool is_running(uint16_t id)
  ***************************************************/
 void timer_tick_callback()
 {
+	SIP->timer.ms_ticks++;
 
 	/*
 	 * Iterate through all timers, decrementing timeout.
@@ -213,23 +214,70 @@ void timer_tick_callback()
 	 */
 
 	uint16_t i = 0;
-	for(i = 0; i < TIMER_COUNT; i++)
+	for(i = 0; i < SIP->timer.top; i++)
 	{
-		if(timer_store[i].timeout > 0 && timer_store[i].status == TIMER_RUNNING)
+		if(SIP->timer.store[i].timeout > 0 && SIP->timer.store[i].status == TIMER_RUNNING)
 		{
-			timer_store[i].timeout--;
+			SIP->timer.store[i].timeout--;
 
-			if(timer_store[i].timeout == 0 )
+			if(SIP->timer.store[i].timeout == 0 )
 			{
-				if(timer_store[i].callback != NULL)
+				if(SIP->timer.store[i].callback != NULL)
 				{
-					timer_store[i].callback(i+1); /* +1 so '0' isn't used as an ID */
+					SIP->timer.store[i].callback(i+1); /* +1 so '0' isn't used as an ID */
 				}
-				timer_store[i].status = TIMER_EMPTY;
-				timer_store[i].callback = NULL;
+				SIP->timer.store[i].status = TIMER_EMPTY;
+				SIP->timer.store[i].callback = NULL;
 			}
 		}
 	}
+
+	/* Dont scan empty slots at the end next time */
+	while(SIP->timer.top > 0 && SIP->timer.store[SIP->timer.top - 1].status == TIMER_EMPTY)
+	{
+		SIP->timer.top--;
+	}
+}
+
+
+/****************************************************
+ *    Function: set_timer_idle
+ * Description: Set something to call while the stack
+ * 				is busy waiting on a timer (eg for an
+ * 				ARP reply).
+ *
+ * 				Normally the tick interrupt moves time
+ * 				on by itself.  Where there is no
+ * 				interrupt (eg a simulator), this is
+ * 				the chance to do it.
+ *
+ *	Input:
+ *		idle	Callback, NULL for none
+ *	Return:
+ * 		SUCCESS
+ ***************************************************/
+RETURN_STATUS set_timer_idle(void (*idle)(void))
+{
+	SIP->timer.idle = idle;
+	return SUCCESS;
 }
 
 
+/****************************************************
+ *    Function: get_ms_ticks
+ * Description: Get the number of ms ticks since the
+ * 				timer started.  Wraps after ~49 days.
+ *
+ *		  NOTE:	On 8-bit micros this is not an atomic
+ *		  		read, so it may (rarely) be torn by the
+ *		  		tick interrupt.
+ *
+ *	Input:
+ *		NONE
+ *	Return:
+ * 		uint32_t
+ ***************************************************/
+uint32_t get_ms_ticks()
+{
+	return SIP->timer.ms_ticks;
+}
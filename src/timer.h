@@ -24,6 +24,8 @@
  *
  *
  *  History
+ *	DB/19 Oct 2026	Added set_timer_idle
+ *	DB/19 Oct 2026	Added get_ms_ticks
  *	DB/06 Oct 2010	Started
  ****************************************************/
 #ifndef TIMER_H_
@@ -49,5 +51,11 @@ bool is_running(uint16_t id);
 /** Get notified whenever the micro ticks */
 void timer_tick_callback(void);
 
+/** Number of ms ticks since init (wraps) */
+uint32_t get_ms_ticks(void);
+
+/** Call idle while waiting on a timer */
+RETURN_STATUS set_timer_idle(void (*idle)(void));
+
 
 #endif
@@ -24,6 +24,19 @@
  *
  *
  *  History
+ *	DB/19 Oct 2026	udp_arrival_callback goes by the UDP length, not what IP hands over
+ *	DB/19 Oct 2026	Listeners kept in the early demux table (ETH_EARLY_DEMUX)
+ *	DB/19 Oct 2026	Checksum only checked if someone is listening
+ *	DB/19 Oct 2026	Header fields read and written with byteorder.h
+ *	DB/19 Oct 2026	Payload copied and summed in one pass
+ *	DB/19 Oct 2026	Added connected flows (udp_flow_connect/send)
+ *	DB/19 Oct 2026	Added listen_udp_stream and udp_read (MAC_RX_STREAM)
+ *	DB/19 Oct 2026	Added udp_stream_begin/write/end (MAC_STREAM)
+ *	DB/19 Oct 2026	Added set_udp_deliver
+ *	DB/19 Oct 2026	State moved into the stack context
+ *	DB/19 Oct 2026	Added send_udp_segmented
+ *	DB/19 Oct 2026	Skip checksums the MAC does for us
+ *	DB/19 Oct 2026	Record transmit latency
  *	DB/21 Dec 2010	Added UDP checksum to outgoing packets
  *	DB/18 Dec 2010	Changed to compile with gcc4 (but probably wont work!)
  *	DB/06 Oct 2010	Started
@@ -33,15 +46,18 @@
 #include "udp.h"
 #include "ip.h" // The layer below.
 #include "functions.h"
+#include "latency.h"
+#include "ethernet.h"
+#include "arp.h"
+#include "link_uc_mac.h"
+#include "sip_ctx.h"
 
+#ifdef ETH_EARLY_DEMUX
+#include "demux.h"
+#endif
 
-/* Keep track of who is listening to what port */
-struct udp_callback_element
-{
-	uint16_t port;
-	void (*callback_fn)(const uint8_t *buffer, uint16_t const buffer_len);
-};
-static struct udp_callback_element udp_callbacks[UDP_LISTEN_SIZE];
+
+/* Who is listening to what port is kept in the stack context (SIP->udp) */
 
 
 #define UDP_PSEUDO_HEADER_LEN	12
@@ -49,6 +65,11 @@ static struct udp_callback_element udp_callbacks[UDP_LISTEN_SIZE];
 
 #define UDP_CHECKSUM			6
 
+
+#ifdef ETH_EARLY_DEMUX
+static void udp_demux_key(struct demux_key *key, const uint16_t port);
+#endif
+
 /****************************************************
  *    Function: init_udp
  * Description: Initialise udp.
@@ -65,14 +86,29 @@ RETURN_STATUS init_udp()
 	uint8_t i = 0;
 	for(i = 0; i < UDP_LISTEN_SIZE; i++)
 	{
-		udp_callbacks[i].port = 0;
-		udp_callbacks[i].callback_fn = NULL;
+		SIP->udp.callbacks[i].port = 0;
+		SIP->udp.callbacks[i].callback_fn = NULL;
+#ifdef MAC_RX_STREAM
+		SIP->udp.callbacks[i].stream_fn = NULL;
+#endif
 	}
 
+#ifdef ETH_EARLY_DEMUX
+	init_demux();
+#endif
+
 	/*
 	 * UDP is an IP protocol.  Set up a callback to get
 	 * all UDP data when it arrives
 	 */
+#ifdef MAC_RX_STREAM
+	RETURN_STATUS ret = add_ip4_header_callback(IP_UDP, &udp_header_arrival);
+	if(ret != SUCCESS)
+	{
+		return ret;
+	}
+#endif
+
 	return add_ip4_packet_callback(IP_UDP, &udp_arrival_callback);
 
 }
@@ -103,10 +139,25 @@ RETURN_STATUS listen_udp(const uint16_t port, void(*handler)(const uint8_t* buff
 	uint8_t i = 0;
 	for(i = 0; i < UDP_LISTEN_SIZE; i++)
 	{
-		if(udp_callbacks[i].port == 0)
+		if(SIP->udp.callbacks[i].port == 0)
 		{
-			udp_callbacks[i].port = port;
-			udp_callbacks[i].callback_fn = handler;
+			SIP->udp.callbacks[i].port = port;
+			SIP->udp.callbacks[i].callback_fn = handler;
+#ifdef MAC_RX_STREAM
+			SIP->udp.callbacks[i].stream_fn = NULL;
+#endif
+
+#ifdef ETH_EARLY_DEMUX
+			/* Datagrams for it skip the callbacks altogether */
+			struct demux_key key;
+			udp_demux_key(&key, port);
+			if(add_demux_entry(&key, handler) != SUCCESS)
+			{
+				SIP->udp.callbacks[i].port = 0;
+				SIP->udp.callbacks[i].callback_fn = NULL;
+				return FAILURE;
+			}
+#endif
 
 			return SUCCESS;
 		}
@@ -118,6 +169,48 @@ RETURN_STATUS listen_udp(const uint16_t port, void(*handler)(const uint8_t* buff
 }
 
 
+#ifdef MAC_RX_STREAM
+/****************************************************
+ *    Function: listen_udp_stream
+ * Description: Start listening to a UDP port, getting
+ * 				each datagram while it is still in the
+ * 				MAC.  The handler reads what it wants
+ * 				with udp_read, and the rest is never
+ * 				fetched.
+ *
+ * 		  NOTE:	The reader is only good until the
+ * 				handler returns, so these handlers
+ * 				always run here, never through
+ * 				set_udp_deliver.
+ *
+ *	Input:
+ * 		port		Port to listen to
+ * 		handler		Callback function
+ *
+ *	Return:
+ * 		SUCCESS		If callback added
+ * 		FAILURE		If callback not added
+ ***************************************************/
+RETURN_STATUS listen_udp_stream(const uint16_t port, void (*handler)(struct udp_reader *reader))
+{
+	uint8_t i = 0;
+	for(i = 0; i < UDP_LISTEN_SIZE; i++)
+	{
+		if(SIP->udp.callbacks[i].port == 0)
+		{
+			SIP->udp.callbacks[i].port = port;
+			SIP->udp.callbacks[i].callback_fn = NULL;
+			SIP->udp.callbacks[i].stream_fn = handler;
+
+			return SUCCESS;
+		}
+	}
+
+	return FAILURE;
+}
+#endif
+
+
 
 
 /****************************************************
@@ -142,15 +235,27 @@ RETURN_STATUS close_udp(uint16_t port)
 	bool nodes_found = false;
 	for(i = 0; i < UDP_LISTEN_SIZE; i++)
 	{
-		if(udp_callbacks[i].port == port)
+		if(SIP->udp.callbacks[i].port == port)
 		{
-			udp_callbacks[i].port = 0;
-			udp_callbacks[i].callback_fn = NULL;
+			SIP->udp.callbacks[i].port = 0;
+			SIP->udp.callbacks[i].callback_fn = NULL;
+#ifdef MAC_RX_STREAM
+			SIP->udp.callbacks[i].stream_fn = NULL;
+#endif
 
 			nodes_found = true;
 		}
 	}
 
+#ifdef ETH_EARLY_DEMUX
+	if(nodes_found == true)
+	{
+		struct demux_key key;
+		udp_demux_key(&key, port);
+		remove_demux_entry(&key);
+	}
+#endif
+
 	if(nodes_found == true)
 	{
 		return SUCCESS;
@@ -163,6 +268,47 @@ RETURN_STATUS close_udp(uint16_t port)
 }
 
 
+#ifdef ETH_EARLY_DEMUX
+/****************************************************
+ *    Function: udp_demux_key
+ * Description: Early demux key for a listen_udp port
+ * 				(any sender, any of our addresses).
+ ***************************************************/
+static void udp_demux_key(struct demux_key *key, const uint16_t port)
+{
+	sr_memset((uint8_t *)key, 0, sizeof(struct demux_key));
+	key->ether_type = IPv4;
+	key->protocol = IP_UDP;
+	key->dest_port = port;
+}
+#endif
+
+
+/****************************************************
+ *    Function: set_udp_deliver
+ * Description: Hand datagrams to deliver, instead of
+ * 				calling the listen_udp handler here.
+ * 				deliver must call handler itself
+ * 				(eg on a worker thread).  Data is only
+ * 				valid until deliver returns.
+ *
+ *	Input:
+ * 		deliver		Called for each datagram and
+ * 					handler, or NULL to call handlers
+ * 					directly again
+ *
+ *	Return:
+ * 		SUCCESS
+ ***************************************************/
+RETURN_STATUS set_udp_deliver(void (*deliver)(void (*handler)(const uint8_t *buffer, const uint16_t buffer_len),
+								const uint8_t *src_addr, const uint16_t src_port, const uint16_t port,
+								const uint8_t *buffer, const uint16_t buffer_len))
+{
+	SIP->udp.deliver = deliver;
+	return SUCCESS;
+}
+
+
 /****************************************************
  *    Function: udp_arrival_callback
  * Description: Get data when it arrives.
@@ -179,14 +325,50 @@ void udp_arrival_callback(const uint8_t  *src_addr, const uint8_t* buffer, const
 	/*
 	 * Have retrieved a whole UDP packet.
 	 *
-	 * Check the checksum, then find out who
-	 * wants the data and forward it on to them.
+	 * Find out who wants the data, check the
+	 * checksum, then forward it on to them.
 	 */
 	if(buffer_len < UDP_HEADER_LEN)
 	{
 		return;
 	}
 
+	/* IP hands over Ethernet padding (and the FCS) too,
+	 * so go by the UDP length */
+	const uint16_t udp_len = load_be16(&buffer[4]);
+	if(udp_len < UDP_HEADER_LEN || udp_len > buffer_len)
+	{
+		return;
+	}
+
+
+	/*
+	 * Find out who is listening to the port.
+	 * If nobody, then packet wont get any further,
+	 * so don't bother checking it.
+	 */
+	uint16_t port = load_be16(&buffer[2]);
+	if(port == 0)
+	{
+		return;
+	}
+
+	bool listening = false;
+	uint8_t i = 0;
+	for(i = 0; i < UDP_LISTEN_SIZE; i++)
+	{
+		if(SIP->udp.callbacks[i].port == port && SIP->udp.callbacks[i].callback_fn != NULL)
+		{
+			listening = true;
+			break;
+		}
+	}
+
+	if(!listening)
+	{
+		return;
+	}
+
 
 	/* Build the pseudo-header 
 	 *
@@ -200,34 +382,35 @@ void udp_arrival_callback(const uint8_t  *src_addr, const uint8_t* buffer, const
      *     +--------+--------+--------+--------+
 	 *
 	 */
-	const uint8_t *dest_addr = get_ipv4_addr();
-	uint8_t pseudo_header[UDP_PSEUDO_HEADER_LEN] = { src_addr[0], src_addr[1], src_addr[2], src_addr[3],
-									dest_addr[0], dest_addr[1], dest_addr[2], dest_addr[3],
-                                                                        0x00, IP_UDP, buffer[4], buffer[5] /*udp_packet[4 & 5] are udp_packet_len*/
-								};
-
-	uint16_t checksum_verify = checksum_fragmented(pseudo_header, sizeof(pseudo_header), buffer, buffer_len, UDP_PSEUDO_HEADER_LEN + UDP_CHECKSUM);
-	uint16_t *incomming_checksum = (uint16_t*)&buffer[UDP_CHECKSUM];
-        if( *incomming_checksum != uint16_to_nbo(checksum_verify))
+	if(!(get_ether_offload() & MAC_OFFLOAD_RX_CSUM))
 	{
-		return;
-	}
+		const uint8_t *dest_addr = get_ipv4_addr();
+		uint8_t pseudo_header[UDP_PSEUDO_HEADER_LEN] = { src_addr[0], src_addr[1], src_addr[2], src_addr[3],
+										dest_addr[0], dest_addr[1], dest_addr[2], dest_addr[3],
+	                                                                        0x00, IP_UDP, buffer[4], buffer[5] /*udp_packet[4 & 5] are udp_packet_len*/
+									};
 
+		uint16_t checksum_verify = checksum_fragmented(pseudo_header, sizeof(pseudo_header), buffer, udp_len, UDP_PSEUDO_HEADER_LEN + UDP_CHECKSUM);
+	        if(load_be16(&buffer[UDP_CHECKSUM]) != checksum_verify)
+		{
+			return;
+		}
+	}
 
-	/*
-	 * Find out who is listening to the port.
-	 * If nobody, then packet wont get any further.
-	 */
-	uint16_t port = uint16_from_nbo(*(uint16_t*)&buffer[2]);
 
-	uint8_t i = 0;
+	/* Hand it to everyone on the port */
 	for(i = 0; i < UDP_LISTEN_SIZE; i++)
 	{
-		if(port != 0)
+		if(SIP->udp.callbacks[i].port == port && SIP->udp.callbacks[i].callback_fn != NULL)
 		{
-			if(udp_callbacks[i].port == port && udp_callbacks[i].callback_fn != NULL)
+			if(SIP->udp.deliver != NULL)
+			{
+				SIP->udp.deliver(SIP->udp.callbacks[i].callback_fn, src_addr, load_be16(&buffer[0]),
+								port, &buffer[UDP_HEADER_LEN], udp_len - UDP_HEADER_LEN);
+			}
+			else
 			{
-				udp_callbacks[i].callback_fn(&buffer[UDP_HEADER_LEN], buffer_len - UDP_HEADER_LEN);
+				SIP->udp.callbacks[i].callback_fn(&buffer[UDP_HEADER_LEN], udp_len - UDP_HEADER_LEN);
 			}
 		}
 	}
@@ -277,23 +460,23 @@ RETURN_STATUS send_udp(const uint8_t* dest_addr, const uint16_t port, const uint
 		return FAILURE;
 	}
 
+	/* Time it all the way down to the MAC, including any ARP wait */
+	uint32_t tx_start = latency_now();
+
 	/*
 	 * Create a new storage space for both header and buffer.
 	 */
 	uint8_t udp_packet[UDP_MAX_PACKET];
 
 	/* Port */
-	*(uint16_t*)&udp_packet[0] = uint16_to_nbo(port);
-	*(uint16_t*)&udp_packet[2] = uint16_to_nbo(port);
+	store_be16(&udp_packet[0], port);
+	store_be16(&udp_packet[2], port);
 
 	/* Length */
-	*(uint16_t*)&udp_packet[4] = uint16_to_nbo(udp_packet_len);
+	store_be16(&udp_packet[4], udp_packet_len);
 
 	/* Checksum */
-	*(uint16_t*)&udp_packet[UDP_CHECKSUM] = 0x0000; /* Initialise checksum to 0*/
-
-	/* Data */
-	sr_memcpy(&udp_packet[UDP_HEADER_LEN], buffer, buffer_len);
+	store_be16(&udp_packet[UDP_CHECKSUM], 0x0000); /* Initialise checksum to 0*/
 
 
 	/*
@@ -315,10 +498,683 @@ RETURN_STATUS send_udp(const uint8_t* dest_addr, const uint16_t port, const uint
                                                         0x00, IP_UDP, udp_packet[4], udp_packet[5] /*udp_packet[4 & 5] are udp_packet_len*/
                                                         };
 
-	uint16_t checksum = checksum_fragmented(pseudo_header, sizeof(pseudo_header), udp_packet, udp_packet_len, UDP_PSEUDO_HEADER_LEN + UDP_CHECKSUM);
-	*(uint16_t*)&udp_packet[UDP_CHECKSUM] = uint16_to_nbo(checksum);
+	if(get_ether_offload() & MAC_OFFLOAD_TX_CSUM)
+	{
+		/* Data */
+		sr_memcpy(&udp_packet[UDP_HEADER_LEN], buffer, buffer_len);
+
+		/* The MAC only sees the packet, so give it the
+		 * pseudo-header sum to start from */
+		uint16_t pseudo_sum = ~checksum(pseudo_header, sizeof(pseudo_header), UDP_PSEUDO_HEADER_LEN);
+		store_be16(&udp_packet[UDP_CHECKSUM], pseudo_sum);
+	}
+	else
+	{
+		/* Data, summed on the way in so it is only read once */
+		uint32_t sum = checksum_partial(pseudo_header, sizeof(pseudo_header), 0);
+		sum = checksum_partial(udp_packet, UDP_HEADER_LEN, sum);
+		sum = checksum_copy(&udp_packet[UDP_HEADER_LEN], buffer, buffer_len, sum);
+
+		store_be16(&udp_packet[UDP_CHECKSUM], checksum_finish(sum));
+	}
 
 	/* Wrap it up in an IP packet for sending */
-	return send_ip4_datagram(dest_addr, udp_packet, udp_packet_len, IP_UDP);
+	RETURN_STATUS ret = send_ip4_datagram(dest_addr, udp_packet, udp_packet_len, IP_UDP);
+
+	latency_record(LATENCY_TX, tx_start);
+
+	return ret;
+
+}
+
+
+/****************************************************
+ *    Function: udp_running_sum
+ * Description: Add some of a datagram to a running
+ * 				checksum.  Pieces can be any length,
+ * 				odd or even.
+ *
+ *	Input:
+ * 		sum			Sum so far (not folded)
+ * 		odd			Next byte is the low half of a word
+ * 		buffer		Data
+ * 		buffer_len	Length of data
+ *
+ *	Return:
+ * 		NONE
+ ***************************************************/
+static void udp_running_sum(uint32_t *sum, bool *odd, const uint8_t* buffer, const uint16_t buffer_len)
+{
+	uint32_t total = *sum;
+	uint16_t len = buffer_len;
+
+	/* Finish the word the last piece started */
+	if(*odd && len > 0)
+	{
+		total += buffer[0];
+		buffer++;
+		len--;
+		*odd = false;
+	}
+
+	/* An odd last byte goes in the high half, as it should */
+	*sum = checksum_partial(buffer, len, total);
+	if(len & 1)
+	{
+		*odd = true;
+	}
+}
+
+
+/****************************************************
+ *    Function: udp_flow_connect
+ * Description: Set up a connected flow.  The Ethernet,
+ * 				IP and UDP headers are built (and the
+ * 				address resolved) now, so each
+ * 				udp_flow_send only fills in lengths and
+ * 				checksums.  The caller keeps the flow;
+ * 				there is nothing to close.
+ *
+ * 				If the ARP entry, or our own address,
+ * 				changes the flow rebuilds itself on the
+ * 				next send.
+ *
+ *		  Usage: static struct udp_flow sensor;
+ *		  		 udp_flow_connect(&sensor, dest, 5000);
+ *		  		 while(...)
+ *		  		 	udp_flow_send(&sensor, reading, len);
+ *
+ *	Input:
+ *		flow		Flow to set up
+ *		dest_addr	IP4 address to send to
+ *		port		Port (source and destination)
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		dest_addr couldn't be resolved
+ ***************************************************/
+RETURN_STATUS udp_flow_connect(struct udp_flow *flow, const uint8_t* dest_addr, const uint16_t port)
+{
+	flow->valid = false;
+	sr_memcpy(flow->dest_addr, dest_addr, 4);
+	flow->port = port;
+
+	/* Before resolving, so a change while we wait isn't missed */
+	flow->generation = get_arp_generation();
+
+	RETURN_STATUS ret = ip4_header_template(flow->header, dest_addr, IP_UDP, &flow->ip_sum);
+	if(ret != SUCCESS)
+	{
+		return ret;
+	}
+
+	uint8_t *udp_header = &flow->header[ETH_HEADERLEN + IP_HEADERLEN];
+	store_be16(&udp_header[0], port);
+	store_be16(&udp_header[2], port);
+	store_be16(&udp_header[4], 0x0000);
+	store_be16(&udp_header[UDP_CHECKSUM], 0x0000);
+
+	/* Pseudo-header, as in send_udp, less the length */
+	const uint8_t *local_addr = get_ipv4_addr();
+	uint8_t pseudo_header[UDP_PSEUDO_HEADER_LEN] = { local_addr[0], local_addr[1], local_addr[2], local_addr[3],
+                                                        dest_addr[0], dest_addr[1], dest_addr[2], dest_addr[3],
+                                                        0x00, IP_UDP, 0x00, 0x00
+                                                        };
+
+	flow->pseudo_sum = (uint16_t)~checksum(pseudo_header, sizeof(pseudo_header), UDP_PSEUDO_HEADER_LEN);
+	flow->valid = true;
+
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: udp_flow_send
+ * Description: Send data down a connected flow.  The
+ * 				headers are copied from the flow, so
+ * 				only the payload is summed.
+ *
+ *	Input:
+ *		flow		From udp_flow_connect
+ * 		buffer		Data to send
+ * 		buffer_len	Length of data
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		Max packet length, the address
+ * 					couldn't be resolved again, or
+ * 					send failure
+ ***************************************************/
+RETURN_STATUS udp_flow_send(struct udp_flow *flow, const uint8_t* buffer, const uint16_t buffer_len)
+{
+	const uint16_t udp_packet_len = UDP_HEADER_LEN + buffer_len;
+	if(udp_packet_len > UDP_MAX_PACKET)
+	{
+		return FAILURE;
+	}
+
+	uint32_t tx_start = latency_now();
+
+	/* Something the headers were built from has moved */
+	if(flow->valid == false
+		|| flow->generation != get_arp_generation()
+		|| sr_memcmp(&flow->header[6], get_ether_addr(), 6) == false
+		|| sr_memcmp(&flow->header[ETH_HEADERLEN + 12], get_ipv4_addr(), 4) == false)
+	{
+		uint8_t dest_addr[4];
+		sr_memcpy(dest_addr, flow->dest_addr, 4);
+
+		RETURN_STATUS ret = udp_flow_connect(flow, dest_addr, flow->port);
+		if(ret != SUCCESS)
+		{
+			return ret;
+		}
+	}
+
+	uint8_t header[UDP_FLOW_HEADER_LEN];
+	sr_memcpy(header, flow->header, UDP_FLOW_HEADER_LEN);
+
+	ip4_header_complete(&header[ETH_HEADERLEN], flow->ip_sum, IP_HEADERLEN + udp_packet_len);
+
+	uint8_t *udp_header = &header[ETH_HEADERLEN + IP_HEADERLEN];
+	udp_header[4] = (uint8_t)(udp_packet_len >> 8);
+	udp_header[5] = (uint8_t)udp_packet_len;
+
+	if(get_ether_offload() & MAC_OFFLOAD_TX_CSUM)
+	{
+		/* The MAC only sees the packet, so give it the
+		 * pseudo-header sum to start from */
+		uint32_t sum = flow->pseudo_sum + udp_packet_len;
+		while(sum >> 16)
+		{
+			sum = (sum & 0x0000FFFF) + (sum >> 16);
+		}
+
+		udp_header[UDP_CHECKSUM] = (uint8_t)(sum >> 8);
+		udp_header[UDP_CHECKSUM + 1] = (uint8_t)sum;
+	}
+	else
+	{
+		/* The length is in both the pseudo-header and the header */
+		uint32_t sum = flow->pseudo_sum + 2 * (uint32_t)udp_packet_len + 2 * (uint32_t)flow->port;
+		bool odd = false;
+		udp_running_sum(&sum, &odd, buffer, buffer_len);
+
+		while(sum >> 16)
+		{
+			sum = (sum & 0x0000FFFF) + (sum >> 16);
+		}
+
+		/* Zero means 'no checksum' in UDP */
+		uint16_t csum = ~(uint16_t)sum;
+		if(csum == 0)
+		{
+			csum = 0xFFFF;
+		}
+
+		udp_header[UDP_CHECKSUM] = (uint8_t)(csum >> 8);
+		udp_header[UDP_CHECKSUM + 1] = (uint8_t)csum;
+	}
+
+	RETURN_STATUS ret = send_ether_frame(header, UDP_FLOW_HEADER_LEN, buffer, buffer_len);
+
+	latency_record(LATENCY_TX, tx_start);
+
+	return ret;
+}
+
+
+#ifdef MAC_STREAM
+
+
+/****************************************************
+ *    Function: udp_stream_begin
+ * Description: Start a datagram that is written
+ * 				straight into the MAC, a piece at a
+ * 				time, with udp_stream_write.  Only the
+ * 				headers are ever held here, so it can
+ * 				be far bigger than send_udp allows.
+ *
+ *		  Usage: udp_stream_begin(dest, port, 1000);
+ *		  		 udp_stream_write(part1, 600);
+ *		  		 udp_stream_write(part2, 400);
+ *		  		 udp_stream_end();
+ *
+ *	Input:
+ *		dest_addr	IP4 address to send to
+ *		port		Port (source and destination)
+ * 		buffer_len	Length of data to come
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		Too long, or the MAC is busy
+ ***************************************************/
+RETURN_STATUS udp_stream_begin(const uint8_t* dest_addr, const uint16_t port, const uint16_t buffer_len)
+{
+	const uint32_t udp_packet_len = UDP_HEADER_LEN + (uint32_t)buffer_len;
+	if(udp_packet_len > 0xFFFF)
+	{
+		return FAILURE;
+	}
+
+	SIP->udp.stream_start = latency_now();
+
+	RETURN_STATUS ret = ip4_stream_begin(dest_addr, (uint16_t)udp_packet_len, IP_UDP);
+	if(ret != SUCCESS)
+	{
+		return ret;
+	}
+
+	uint8_t header[UDP_HEADER_LEN];
+	store_be16(&header[0], port);
+	store_be16(&header[2], port);
+	store_be16(&header[4], (uint16_t)udp_packet_len);
+	store_be16(&header[UDP_CHECKSUM], 0x0000);
+
+	/* Pseudo-header, as in send_udp */
+	const uint8_t *local_addr = get_ipv4_addr();
+	uint8_t pseudo_header[UDP_PSEUDO_HEADER_LEN] = { local_addr[0], local_addr[1], local_addr[2], local_addr[3],
+                                                        dest_addr[0], dest_addr[1], dest_addr[2], dest_addr[3],
+                                                        0x00, IP_UDP, header[4], header[5]
+                                                        };
+
+	SIP->udp.stream_sum = 0;
+	SIP->udp.stream_odd = false;
+	SIP->udp.stream_len = buffer_len;
+	SIP->udp.stream_offset = 0;
+
+	if(get_ether_offload() & MAC_OFFLOAD_TX_CSUM)
+	{
+		uint16_t pseudo_sum = ~checksum(pseudo_header, sizeof(pseudo_header), UDP_PSEUDO_HEADER_LEN);
+		store_be16(&header[UDP_CHECKSUM], pseudo_sum);
+	}
+	else
+	{
+		udp_running_sum(&SIP->udp.stream_sum, &SIP->udp.stream_odd, pseudo_header, sizeof(pseudo_header));
+		udp_running_sum(&SIP->udp.stream_sum, &SIP->udp.stream_odd, header, UDP_HEADER_LEN);
+	}
+
+	ret = ip4_stream_write(0, header, UDP_HEADER_LEN);
+	if(ret != SUCCESS)
+	{
+		ip4_stream_end(false);
+	}
+
+	return ret;
+}
+
+
+/****************************************************
+ *    Function: udp_stream_write
+ * Description: Write the next piece of the datagram
+ * 				started with udp_stream_begin.
+ *
+ *	Input:
+ * 		buffer		Data
+ * 		buffer_len	Length of data
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		More than was promised
+ ***************************************************/
+RETURN_STATUS udp_stream_write(const uint8_t* buffer, const uint16_t buffer_len)
+{
+	if((uint32_t)SIP->udp.stream_offset + buffer_len > SIP->udp.stream_len)
+	{
+		return FAILURE;
+	}
+
+	RETURN_STATUS ret = ip4_stream_write(UDP_HEADER_LEN + SIP->udp.stream_offset, buffer, buffer_len);
+	if(ret != SUCCESS)
+	{
+		return ret;
+	}
+
+	if(!(get_ether_offload() & MAC_OFFLOAD_TX_CSUM))
+	{
+		udp_running_sum(&SIP->udp.stream_sum, &SIP->udp.stream_odd, buffer, buffer_len);
+	}
+
+	SIP->udp.stream_offset += buffer_len;
+
+	return SUCCESS;
+}
+
+
+/****************************************************
+ *    Function: udp_stream_end
+ * Description: Finish off the checksum and send the
+ * 				datagram.
+ *
+ *	Input:
+ * 		NONE
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		Less was written than promised
+ * 					(so nothing is sent)
+ ***************************************************/
+RETURN_STATUS udp_stream_end(void)
+{
+	if(SIP->udp.stream_offset != SIP->udp.stream_len)
+	{
+		ip4_stream_end(false);
+		return FAILURE;
+	}
+
+	if(!(get_ether_offload() & MAC_OFFLOAD_TX_CSUM))
+	{
+		uint32_t sum = SIP->udp.stream_sum;
+		while(sum >> 16)
+		{
+			sum = (sum & 0x0000FFFF) + (sum >> 16);
+		}
+
+		/* Zero means 'no checksum' in UDP */
+		uint16_t csum = ~(uint16_t)sum;
+		if(csum == 0)
+		{
+			csum = 0xFFFF;
+		}
+
+		uint8_t csum_bytes[2] = { (uint8_t)(csum >> 8), (uint8_t)csum };
+		RETURN_STATUS ret = ip4_stream_write(UDP_CHECKSUM, csum_bytes, 2);
+		if(ret != SUCCESS)
+		{
+			ip4_stream_end(false);
+			return ret;
+		}
+	}
+
+	RETURN_STATUS ret = ip4_stream_end(true);
+
+	latency_record(LATENCY_TX, SIP->udp.stream_start);
+
+	return ret;
+}
+#endif /* MAC_STREAM */
+
+
+#ifdef MAC_RX_STREAM
+/****************************************************
+ *    Function: udp_header_arrival
+ * Description: The header of a datagram, the payload
+ * 				still in the MAC.  listen_udp_stream
+ * 				handlers get it now, listen_udp ones
+ * 				need the whole thing read.
+ *
+ *	Input:
+ * 		src_addr	Sender's IP address
+ * 		header		Start of the datagram
+ * 		header_len	How much of it there is
+ * 		packet_len	Length of the IP payload
+ *
+ *	Return:
+ * 		true		Read it all for udp_arrival_callback
+ * 		false		Nobody else wants it
+ ***************************************************/
+bool udp_header_arrival(const uint8_t *src_addr, const uint8_t* header, const uint16_t header_len, const uint16_t packet_len)
+{
+	if(packet_len < UDP_HEADER_LEN)
+	{
+		return false;
+	}
+
+	if(header_len < UDP_HEADER_LEN)
+	{
+		return true;
+	}
+
+	const struct udp_header_view *udp = (const struct udp_header_view *)header;
+
+	uint16_t udp_len = load_be16(udp->len);
+	uint16_t port = load_be16(udp->dest_port);
+	if(udp_len < UDP_HEADER_LEN || udp_len > packet_len || port == 0)
+	{
+		return false;
+	}
+
+	bool wanted = false;
+
+	uint8_t i = 0;
+	for(i = 0; i < UDP_LISTEN_SIZE; i++)
+	{
+		if(SIP->udp.callbacks[i].port != port)
+			continue;
+
+		if(SIP->udp.callbacks[i].stream_fn != NULL)
+		{
+			struct udp_reader reader;
+			reader.src_addr = src_addr;
+			reader.src_port = load_be16(udp->src_port);
+			reader.len = udp_len - UDP_HEADER_LEN;
+			reader.offset = 0;
+
+			/* Either already checked, or not sent */
+			reader.checked = (get_ether_offload() & MAC_OFFLOAD_RX_CSUM)
+								|| (header[UDP_CHECKSUM] == 0 && header[UDP_CHECKSUM + 1] == 0);
+			reader.summing = !reader.checked;
+			reader.sum = 0;
+			reader.odd = false;
+
+			if(reader.summing)
+			{
+				const uint8_t *dest_addr = get_ipv4_addr();
+				uint8_t pseudo_header[UDP_PSEUDO_HEADER_LEN] = { src_addr[0], src_addr[1], src_addr[2], src_addr[3],
+																dest_addr[0], dest_addr[1], dest_addr[2], dest_addr[3],
+																0x00, IP_UDP, header[4], header[5]
+																};
+
+				udp_running_sum(&reader.sum, &reader.odd, pseudo_header, sizeof(pseudo_header));
+				udp_running_sum(&reader.sum, &reader.odd, header, UDP_HEADER_LEN);
+			}
+
+			SIP->udp.callbacks[i].stream_fn(&reader);
+		}
+		else if(SIP->udp.callbacks[i].callback_fn != NULL)
+		{
+			wanted = true;
+		}
+	}
+
+	return wanted;
+}
+
+
+/****************************************************
+ *    Function: udp_read
+ * Description: Read the next part of a datagram for
+ * 				a listen_udp_stream handler.
+ *
+ *	Input:
+ * 		reader		From the handler
+ * 		buffer		Where to put it
+ * 		buffer_len	Most to read
+ *
+ *	Return:
+ * 		How much was read (0 at the end)
+ ***************************************************/
+uint16_t udp_read(struct udp_reader *reader, uint8_t *buffer, const uint16_t buffer_len)
+{
+	uint16_t len = reader->len - reader->offset;
+	if(buffer_len < len)
+	{
+		len = buffer_len;
+	}
+
+	if(len == 0 || ip4_rx_read(UDP_HEADER_LEN + reader->offset, buffer, len) != SUCCESS)
+	{
+		return 0;
+	}
+
+	if(reader->summing)
+	{
+		udp_running_sum(&reader->sum, &reader->odd, buffer, len);
+	}
+
+	reader->offset += len;
+
+	return len;
+}
+
+
+/****************************************************
+ *    Function: udp_skip
+ * Description: Step over part of a datagram without
+ * 				reading it from the MAC.
+ *
+ * 		  NOTE:	Unless the MAC checks it for us, the
+ * 				checksum can't be checked after this.
+ *
+ *	Input:
+ * 		reader		From the handler
+ * 		len			Most to skip
+ *
+ *	Return:
+ * 		How much was skipped
+ ***************************************************/
+uint16_t udp_skip(struct udp_reader *reader, const uint16_t len)
+{
+	uint16_t skipped = reader->len - reader->offset;
+	if(len < skipped)
+	{
+		skipped = len;
+	}
+
+	if(skipped > 0)
+	{
+		reader->summing = false;
+		reader->offset += skipped;
+	}
+
+	return skipped;
+}
+
+
+/****************************************************
+ *    Function: udp_read_ok
+ * Description: Whether the datagram is known to be
+ * 				good.  If the MAC hasn't checked it,
+ * 				this is only once every byte has been
+ * 				read with udp_read.
+ *
+ *	Input:
+ * 		reader		From the handler
+ *
+ *	Return:
+ * 		true		Checksum good (or none sent)
+ * 		false		Bad, or not all read
+ ***************************************************/
+bool udp_read_ok(const struct udp_reader *reader)
+{
+	if(reader->checked)
+	{
+		return true;
+	}
+
+	if(!reader->summing || reader->offset != reader->len)
+	{
+		return false;
+	}
+
+	uint32_t sum = reader->sum;
+	while(sum >> 16)
+	{
+		sum = (sum & 0x0000FFFF) + (sum >> 16);
+	}
+
+	/* Good ones add up to all ones, checksum included */
+	return (sum == 0xFFFF);
+}
+#endif /* MAC_RX_STREAM */
+
+
+#ifdef UDP_SEG_OFFLOAD
+/****************************************************
+ *    Function: send_udp_segmented
+ * Description: Send a lot of data as segment_len
+ * 				sized UDP datagrams.
+ *
+ * 				If the MAC can segment for us, the
+ * 				headers and checksums are only done
+ * 				once for the lot.  Otherwise each
+ * 				datagram goes through send_udp.
+ *
+ *	Input:
+ *		dest_addr	IP4 address to send to
+ *		port		Port (source and destination)
+ * 		buffer		Data to send
+ * 		buffer_len	Length of data
+ * 		segment_len	Data bytes per datagram
+ *
+ *	Return:
+ * 		SUCCESS
+ * 		FAILURE		Too long or send failure
+ ***************************************************/
+RETURN_STATUS send_udp_segmented(const uint8_t* dest_addr, const uint16_t port, const uint8_t* buffer, const uint16_t buffer_len, const uint16_t segment_len)
+{
+	if(segment_len == 0)
+	{
+		return FAILURE;
+	}
+
+	const uint8_t offload = get_ether_offload();
+	if(!(offload & MAC_OFFLOAD_UDP_SEG) || !(offload & MAC_OFFLOAD_TX_CSUM) || buffer_len <= segment_len)
+	{
+		/* One at a time then */
+		uint16_t offset = 0;
+		do
+		{
+			uint16_t len = buffer_len - offset;
+			if(len > segment_len)
+			{
+				len = segment_len;
+			}
+
+			RETURN_STATUS ret = send_udp(dest_addr, port, &buffer[offset], len);
+			if(ret != SUCCESS)
+			{
+				return ret;
+			}
+
+			offset += len;
+		} while(offset < buffer_len);
+
+		return SUCCESS;
+	}
+
+	if((uint32_t)buffer_len + UDP_HEADER_LEN + IP_HEADERLEN > UDP_SEG_MAX_PACKET)
+	{
+		return FAILURE;
+	}
+
+	uint32_t tx_start = latency_now();
+
+	/* One header for the whole lot, the MAC
+	 * fixes up the length of each segment */
+	const uint16_t udp_packet_len = UDP_HEADER_LEN + buffer_len;
+	uint8_t udp_packet[UDP_SEG_MAX_PACKET];
+
+	store_be16(&udp_packet[0], port);
+	store_be16(&udp_packet[2], port);
+	store_be16(&udp_packet[4], udp_packet_len);
+
+	sr_memcpy(&udp_packet[UDP_HEADER_LEN], buffer, buffer_len);
+
+	/* Seed the checksum with the pseudo-header, as for MAC_OFFLOAD_TX_CSUM */
+	const uint8_t *local_addr = get_ipv4_addr();
+	uint8_t pseudo_header[UDP_PSEUDO_HEADER_LEN] = { local_addr[0], local_addr[1], local_addr[2], local_addr[3],
+                                                        dest_addr[0], dest_addr[1], dest_addr[2], dest_addr[3],
+                                                        0x00, IP_UDP, udp_packet[4], udp_packet[5]
+                                                        };
+
+	uint16_t pseudo_sum = ~checksum(pseudo_header, sizeof(pseudo_header), UDP_PSEUDO_HEADER_LEN);
+	store_be16(&udp_packet[UDP_CHECKSUM], pseudo_sum);
+
+	RETURN_STATUS ret = send_ip4_datagram_segmented(dest_addr, udp_packet, udp_packet_len, IP_UDP, segment_len);
+
+	latency_record(LATENCY_TX, tx_start);
 
+	return ret;
 }
+#endif /* UDP_SEG_OFFLOAD */
@@ -24,6 +24,12 @@
  *
  *
  *  History
+ *	DB/19 Oct 2026	Added struct udp_header_view
+ *	DB/19 Oct 2026	Added udp_flow_connect and udp_flow_send
+ *	DB/19 Oct 2026	Added listen_udp_stream and udp_read
+ *	DB/19 Oct 2026	Added udp_stream_begin/write/end
+ *	DB/19 Oct 2026	Added set_udp_deliver
+ *	DB/19 Oct 2026	Added send_udp_segmented
  *	DB/06 Oct 2010	Started
  ****************************************************/
 #ifndef UDP_H_
@@ -32,18 +38,101 @@
 #include "global.h"
 
 
+/** UDP header laid over a datagram (only bytes, so any address will do) **/
+struct udp_header_view
+{
+	uint8_t src_port[2];
+	uint8_t dest_port[2];
+	uint8_t len[2];			/* Header and payload */
+	uint8_t checksum[2];
+};
+
+
 /** Initialise UDP comms */
 RETURN_STATUS init_udp(void);
 
 /** Send some data */
 RETURN_STATUS send_udp(const uint8_t* dest_addr, const uint16_t port, const uint8_t* buffer, const uint16_t buffer_len);
 
+#ifdef UDP_SEG_OFFLOAD
+/** Send data as a run of segment_len sized datagrams */
+RETURN_STATUS send_udp_segmented(const uint8_t* dest_addr, const uint16_t port, const uint8_t* buffer, const uint16_t buffer_len, const uint16_t segment_len);
+#endif
+
+#ifdef MAC_STREAM
+/** Start a datagram that is written straight into the MAC */
+RETURN_STATUS udp_stream_begin(const uint8_t* dest_addr, const uint16_t port, const uint16_t buffer_len);
+
+/** Write the next piece of it */
+RETURN_STATUS udp_stream_write(const uint8_t* buffer, const uint16_t buffer_len);
+
+/** Checksum and send it */
+RETURN_STATUS udp_stream_end(void);
+#endif
+
+/* Ethernet, IP and UDP headers */
+#define UDP_FLOW_HEADER_LEN		(14 + 20 + 8)
+
+/** A connected flow: everything about the headers that
+ * doesn't change from one datagram to the next **/
+struct udp_flow
+{
+	uint8_t header[UDP_FLOW_HEADER_LEN];	/* Lengths and checksums filled in per send */
+	uint8_t dest_addr[4];
+	uint16_t port;
+	uint32_t ip_sum;			/* IP header without its length (not folded) */
+	uint32_t pseudo_sum;		/* Pseudo-header without the length (not folded) */
+	uint32_t generation;		/* ARP table the header was built from */
+	bool valid;
+};
+
+/** Set up a flow to send to dest_addr:port, building its headers once */
+RETURN_STATUS udp_flow_connect(struct udp_flow *flow, const uint8_t* dest_addr, const uint16_t port);
+
+/** Send some data down a flow */
+RETURN_STATUS udp_flow_send(struct udp_flow *flow, const uint8_t* buffer, const uint16_t buffer_len);
+
 /** Start listening to a port */
 RETURN_STATUS listen_udp(const uint16_t port, void(*handler)(const uint8_t* buffer, const uint16_t buffer_len));
 
+#ifdef MAC_RX_STREAM
+/** A datagram still in the MAC, for a listen_udp_stream handler **/
+struct udp_reader
+{
+	const uint8_t *src_addr;	/* Sender's IP address */
+	uint16_t src_port;
+	uint16_t len;				/* Payload length */
+	uint16_t offset;			/* Next byte udp_read gets */
+	uint32_t sum;				/* Checksum so far (not folded) */
+	bool odd;
+	bool checked;				/* Checksum already known good */
+	bool summing;				/* Every byte read, in order */
+};
+
+/** Start listening to a port, reading datagrams straight from the MAC */
+RETURN_STATUS listen_udp_stream(const uint16_t port, void (*handler)(struct udp_reader *reader));
+
+/** Read the next part of the datagram, returning how much was read */
+uint16_t udp_read(struct udp_reader *reader, uint8_t *buffer, const uint16_t buffer_len);
+
+/** Step over part of it without reading it */
+uint16_t udp_skip(struct udp_reader *reader, const uint16_t len);
+
+/** Whether the datagram is good (once it has all been read) */
+bool udp_read_ok(const struct udp_reader *reader);
+
+/** Get notified when IP gets the start of a UDP packet */
+bool udp_header_arrival(const uint8_t *src_addr, const uint8_t* header, const uint16_t header_len, const uint16_t packet_len);
+#endif
+
 /** Stop listening to a port */
 RETURN_STATUS close_udp(const uint16_t port);
 
+/** Pass datagrams to deliver (eg a worker pool), rather than straight to their handler */
+RETURN_STATUS set_udp_deliver(void (*deliver)(void (*handler)(const uint8_t *buffer, const uint16_t buffer_len),
+								const uint8_t *src_addr, const uint16_t src_port, const uint16_t port,
+								const uint8_t *buffer, const uint16_t buffer_len));
+
 /** Get notified when IP gets a UDP packet */
 void udp_arrival_callback(const uint8_t *src_addr, const uint8_t* buffer, const uint16_t buffer_len);
 
@@ -9,16 +9,17 @@
 /** Initialise IC **/
 RETURN_STATUS init_uc()
 {
-	open_pcap();
-	return SUCCESS;
+	// Capture everything the stack sees, both ways.
+	if(open_pcap("capture.pcapng", 0, 1) != 0)
+		return FAILURE;
+
+	return set_ether_tap(&capture_tap);
 }
 
 /** Write to file & decide what response to give **/
 RETURN_STATUS send_frame(const uint8_t *buffer, const uint16_t buffer_len)
 {
 
-	write_pcap(buffer, buffer_len-ETH_CRCLEN);
-
 	if(buffer[12] == 0x08 && buffer[13] == 0x06)
 	{
 		// only respond to a request
@@ -64,6 +65,12 @@ RETURN_STATUS init_mac()
 	return SUCCESS;
 }
 
+/** No checksum offload, the stack does it all */
+uint8_t get_mac_offload()
+{
+	return MAC_OFFLOAD_NONE;
+}
+
 /** Callback to next layer when we have a whole packet */
 void (*cb_frame_complete)(uint8_t *buffer, const uint16_t buffer_len) = NULL;
 RETURN_STATUS set_frame_complete(void (*frame_complete_callback)(uint8_t *buffer, const uint16_t buffer_len))
@@ -72,3 +79,11 @@ RETURN_STATUS set_frame_complete(void (*frame_complete_callback)(uint8_t *buffer
 	return SUCCESS;
 }
 
+#ifdef MAC_RX_VECTOR
+/** No batches, every frame goes to frame_complete */
+RETURN_STATUS set_frames_complete(void (*frames_complete_callback)(struct mac_frame *frames, const uint16_t count))
+{
+	return FAILURE;
+}
+#endif
+
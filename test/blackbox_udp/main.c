@@ -67,10 +67,6 @@ int main(int argc, char *argv[])
 		192, 168, 1, 1
 		};
 
-
-	// write to debug file
-	write_pcap(buff, sizeof(buff));
-
         // send in original arp request
 	(cb_frame_complete)(buff, sizeof(buff));
 
@@ -95,7 +91,11 @@ int main(int argc, char *argv[])
 	printf("Send OK: %d\tSend Err: %d\n", send_ok, send_err);
 
 
-        close_pcap();
+	struct capture_stats stats;
+        close_pcap(&stats);
+
+	printf("Captured: %llu\tSampled out: %llu\tDropped: %llu\n",
+		(unsigned long long)stats.captured, (unsigned long long)stats.sampled_out, (unsigned long long)stats.dropped);
 
 	return 0;
 
@@ -1,73 +1,254 @@
-/* Copyright 2010 Dave Barnard (www.shoalresearch.com) */
+/* Copyright 2010, 2026 Dave Barnard (www.shoalresearch.com) */
+
+/*
+ * pcapng capture for the stack's frame tap.
+ *
+ * The tap (called from the stack's receive and transmit paths)
+ * only copies a complete Enhanced Packet Block into a
+ * single-producer/single-consumer byte ring.  A writer thread
+ * drains the ring to disk in large chunks, so the datapath never
+ * waits on the file system.  If the ring is full, frames are
+ * dropped (and counted) rather than stalling the stack.
+ */
 #include "pcap.h"
 
 #include <stdint.h>
 #include <stdio.h>
-FILE *m_fp;
-static uint32_t m_secs = 0;
-static uint32_t m_usecs = 0;
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/* Ring size (must be a power of 2) */
+#define CAPTURE_RING_SIZE	(1 << 22)
+
+/* Writer wakes this often, and flushes when this much is waiting */
+#define CAPTURE_POLL_NS		1000000
+#define CAPTURE_FLUSH_BYTES	(1 << 16)
+
+/* Block types & options, from the pcapng spec */
+#define PCAPNG_SHB			0x0A0D0D0A
+#define PCAPNG_IDB			0x00000001
+#define PCAPNG_EPB			0x00000006
+#define PCAPNG_BYTE_ORDER	0x1A2B3C4D
+#define PCAPNG_LINK_ETHER	1
+#define PCAPNG_IF_TSRESOL	9
+#define PCAPNG_EPB_FLAGS	2
+#define PCAPNG_INBOUND		0x01
+#define PCAPNG_OUTBOUND		0x02
 
+/* Fixed part of an EPB, flags option (8) and end of options (4) */
+#define EPB_FIXED_LEN		(28 + 12 + 4)
 
-// pcap header
-typedef struct pcap_hdr_s {
-        uint32_t magic_number;   /* magic number */
-        uint16_t version_major;  /* major version number */
-        uint16_t version_minor;  /* minor version number */
-        int32_t  thiszone;       /* GMT to local correction */
-        uint32_t sigfigs;        /* accuracy of timestamps */
-        uint32_t snaplen;        /* max length of captured packets, in octets */
-        uint32_t network;        /* data link type */
-} pcap_hdr_t;
+static FILE *m_fp = NULL;
+static uint32_t m_snaplen = 65535;
+static uint32_t m_sample_every = 1;
+static uint32_t m_sample_count = 0;
+static uint64_t m_clock_offset = 0;
 
+/* The ring.  head is only written by the tap, tail only by the writer */
+static uint8_t m_ring[CAPTURE_RING_SIZE];
+static uint64_t m_head = 0;
+static uint64_t m_tail = 0;
+static int m_running = 0;
+static pthread_t m_writer;
 
-//packet header
-typedef struct pcaprec_hdr_s {
-        uint32_t ts_sec;         /* timestamp seconds */
-        uint32_t ts_usec;        /* timestamp microseconds */
-        uint32_t incl_len;       /* number of octets of packet saved in file */
-        uint32_t orig_len;       /* actual length of packet */
-} pcaprec_hdr_t;
+static struct capture_stats m_stats;
 
 
-void open_pcap()
+/* CLOCK_MONOTONIC, moved to start at the wall clock time of open_pcap */
+static uint64_t capture_time_ns(void)
 {
-	// Create pcap file.
-	m_fp = fopen("capture.pcap", "w+");
-	if(m_fp)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec + m_clock_offset;
+}
+
+
+/* Copy into the ring at 'pos', wrapping round the end */
+static void ring_put(uint64_t pos, const void *data, uint32_t len)
+{
+	uint32_t start = (uint32_t)(pos & (CAPTURE_RING_SIZE - 1));
+	uint32_t first = CAPTURE_RING_SIZE - start;
+	if(first > len)
+		first = len;
+
+	memcpy(&m_ring[start], data, first);
+	memcpy(&m_ring[0], (const uint8_t*)data + first, len - first);
+}
+
+
+/* Write everything between tail and head to the file */
+static void ring_flush(void)
+{
+	uint64_t head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+	uint64_t tail = m_tail;
+
+	while(tail != head)
+	{
+		uint32_t start = (uint32_t)(tail & (CAPTURE_RING_SIZE - 1));
+		uint64_t len = head - tail;
+		if(len > CAPTURE_RING_SIZE - start)
+			len = CAPTURE_RING_SIZE - start;
+
+		fwrite(&m_ring[start], 1, len, m_fp);
+		tail += len;
+	}
+
+	__atomic_store_n(&m_tail, tail, __ATOMIC_RELEASE);
+}
+
+
+static void *capture_writer(void *arg)
+{
+	struct timespec nap = { 0, CAPTURE_POLL_NS };
+	unsigned int idle = 0;
+
+	while(__atomic_load_n(&m_running, __ATOMIC_ACQUIRE))
+	{
+		uint64_t waiting = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE) - m_tail;
+
+		/* Big writes when busy, but dont sit on a trickle forever */
+		if(waiting >= CAPTURE_FLUSH_BYTES || (waiting > 0 && ++idle >= 100))
+		{
+			ring_flush();
+			idle = 0;
+		}
+		else
+		{
+			nanosleep(&nap, NULL);
+		}
+	}
+
+	ring_flush();
+	return NULL;
+}
+
+
+int open_pcap(const char *filename, const uint32_t snaplen, const uint32_t sample_every)
+{
+	m_fp = fopen(filename, "wb");
+	if(!m_fp)
+		return -1;
+
+	m_snaplen = (snaplen == 0) ? 65535 : snaplen;
+	m_sample_every = (sample_every == 0) ? 1 : sample_every;
+	m_sample_count = 0;
+	m_head = m_tail = 0;
+	memset(&m_stats, 0, sizeof(m_stats));
+
+	/* Line the monotonic clock up with the wall clock, so
+	 * Wireshark shows sensible dates. */
+	struct timespec mono, real;
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	m_clock_offset = (((uint64_t)real.tv_sec * 1000000000ULL) + real.tv_nsec)
+					- (((uint64_t)mono.tv_sec * 1000000000ULL) + mono.tv_nsec);
+
+	// Section header
+	uint32_t shb[7];
+	shb[0] = PCAPNG_SHB;
+	shb[1] = sizeof(shb);
+	shb[2] = PCAPNG_BYTE_ORDER;
+	shb[3] = 1;				/* version 1.0 */
+	shb[4] = 0xFFFFFFFF;	/* section length unknown (64 bits) */
+	shb[5] = 0xFFFFFFFF;
+	shb[6] = sizeof(shb);
+	fwrite(shb, 1, sizeof(shb), m_fp);
+
+	// Interface, with ns timestamps
+	uint32_t idb[8];
+	idb[0] = PCAPNG_IDB;
+	idb[1] = sizeof(idb);
+	idb[2] = PCAPNG_LINK_ETHER;
+	idb[3] = m_snaplen;
+	idb[4] = PCAPNG_IF_TSRESOL | (1 << 16);
+	idb[5] = 9;				/* 10^-9 */
+	idb[6] = 0;				/* end of options */
+	idb[7] = sizeof(idb);
+	fwrite(idb, 1, sizeof(idb), m_fp);
+
+	m_running = 1;
+	if(pthread_create(&m_writer, NULL, &capture_writer, NULL) != 0)
 	{
-		// pcap header;
-		struct pcap_hdr_s pcap_h;
-		pcap_h.magic_number = 0xa1b2c3d4;
-		pcap_h.version_major = 2;
-		pcap_h.version_minor = 4;
-		pcap_h.thiszone = 0;
-		pcap_h.sigfigs = 0;
-		pcap_h.snaplen = 65535;
-		pcap_h.network = 1;
-
-		fwrite(&pcap_h, 1, sizeof(pcap_h), m_fp);
+		m_running = 0;
+		fclose(m_fp);
+		m_fp = NULL;
+		return -1;
 	}
+
+	return 0;
 }
 
 
-void write_pcap(const uint8_t *buffer, const uint16_t buffer_len)
+void capture_tap(const uint8_t *frame, const uint16_t frame_len, const bool outgoing)
 {
-	// packet header;
-	struct pcaprec_hdr_s pac_h;
-	pac_h.ts_sec = m_secs++;
-	pac_h.ts_usec = ++m_usecs;
-	pac_h.incl_len = buffer_len;
-	pac_h.orig_len = buffer_len;
+	if(!m_running)
+		return;
 
-	fwrite(&pac_h, 1, sizeof(pac_h), m_fp);
+	/* 1-in-N sampling */
+	if(++m_sample_count < m_sample_every)
+	{
+		m_stats.sampled_out++;
+		return;
+	}
+	m_sample_count = 0;
 
-	
-	// packet
-	fwrite(&buffer[0], 1, buffer_len, m_fp);
+	uint32_t cap_len = (frame_len > m_snaplen) ? m_snaplen : frame_len;
+	uint32_t padded = (cap_len + 3) & ~3;
+	uint32_t block_len = EPB_FIXED_LEN + padded;
 
+	/* Drop rather than wait for the writer */
+	uint64_t head = m_head;
+	uint64_t tail = __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE);
+	if(CAPTURE_RING_SIZE - (head - tail) < block_len)
+	{
+		m_stats.dropped++;
+		return;
+	}
+
+	uint64_t ts = capture_time_ns();
+	uint32_t epb[7];
+	epb[0] = PCAPNG_EPB;
+	epb[1] = block_len;
+	epb[2] = 0;				/* interface */
+	epb[3] = (uint32_t)(ts >> 32);
+	epb[4] = (uint32_t)ts;
+	epb[5] = cap_len;
+	epb[6] = frame_len;
+	ring_put(head, epb, sizeof(epb));
+	head += sizeof(epb);
+
+	ring_put(head, frame, cap_len);
+	head += cap_len;
+
+	uint32_t trailer[5] = { 0, 0, 0, 0, 0 };
+	uint32_t pad = padded - cap_len;
+	trailer[1] = PCAPNG_EPB_FLAGS | (4 << 16);
+	trailer[2] = outgoing ? PCAPNG_OUTBOUND : PCAPNG_INBOUND;
+	trailer[3] = 0;			/* end of options */
+	trailer[4] = block_len;
+	ring_put(head, (uint8_t*)trailer + (4 - pad), pad + 16);
+	head += pad + 16;
+
+	__atomic_store_n(&m_head, head, __ATOMIC_RELEASE);
+	m_stats.captured++;
 }
 
-void close_pcap()
+
+void close_pcap(struct capture_stats *stats)
 {
-	fclose(m_fp);
+	if(m_running)
+	{
+		__atomic_store_n(&m_running, 0, __ATOMIC_RELEASE);
+		pthread_join(m_writer, NULL);
+	}
+
+	if(m_fp)
+	{
+		fclose(m_fp);
+		m_fp = NULL;
+	}
+
+	if(stats)
+		*stats = m_stats;
 }
@@ -3,11 +3,22 @@
 #define INC_PCAP_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
-void open_pcap();
+struct capture_stats
+{
+	uint64_t captured;		/* written to the file */
+	uint64_t sampled_out;	/* skipped by 1-in-N sampling */
+	uint64_t dropped;		/* ring was full */
+};
 
-void write_pcap(const uint8_t *buffer, const uint16_t buffer_len);
+/* Start capturing (snaplen 0 = whole frames, sample_every 1 = all frames) */
+int open_pcap(const char *filename, const uint32_t snaplen, const uint32_t sample_every);
 
-void close_pcap();
+/* Frame tap, give to set_ether_tap() */
+void capture_tap(const uint8_t *frame, const uint16_t frame_len, const bool outgoing);
+
+/* Flush everything to disk and stop */
+void close_pcap(struct capture_stats *stats);
 
 #endif
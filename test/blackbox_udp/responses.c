@@ -3,7 +3,6 @@
 #include "../../src/link_uc_mac.h"
 
 #include "responses.h"
-#include "pcap.h"
 #include <stdint.h>
 
 extern void (*cb_frame_complete)(uint8_t *buffer, const uint16_t buffer_len);
@@ -27,10 +26,6 @@ void arp_response( )
 		192, 168, 1, 1 };		//youare
 	uint16_t buff_len = 42;
 
-
-	// write to debug file
-	write_pcap(buff, buff_len);
-
 	// send data back
 	(cb_frame_complete)(buff, buff_len);
 
@@ -61,9 +56,6 @@ void ip_response()
 		'h', 'e', 'l', 'l', 'o', '-', 'm', 'e'
 		};
 
-	// write to debug file
-	write_pcap(buff, sizeof(buff));
-
 	(cb_frame_complete)(buff, sizeof(buff));
 
    
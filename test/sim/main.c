@@ -0,0 +1,201 @@
+/* Copyright 2026 Dave Barnard (www.shoalresearch.com) */
+
+/*
+ * Scale tests on the simulator.  See README.
+ *
+ *   ./sim.out [storm|flood|table|all] [nodes]
+ */
+#include "sim.h"
+#include "arp.h"
+#include "udp.h"
+#include "ethernet.h"
+#include "functions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SIM_PORT			7000
+#define FLOOD_FRAMES		10
+#define RUN_US				10000000ULL		/* 10 s */
+
+static int m_failed = 0;
+
+
+static void on_udp(const uint8_t *buffer, const uint16_t buffer_len)
+{
+	sim_current()->udp_received++;
+}
+
+
+/* Send a datagram to the node given as arg (ARPing for it first) */
+static void app_send(struct sim_node *node, void *arg)
+{
+	struct sim_node *to = (struct sim_node *)arg;
+	const char *data = "hello";
+
+	send_udp(to->ip_addr, SIM_PORT, (const uint8_t *)data, 5);
+}
+
+
+/* Broadcast an ARP request for an address nobody has */
+static void app_flood(struct sim_node *node, void *arg)
+{
+	uint8_t bcast[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+	uint8_t request[ARP_LEN] = {
+		0x00, 0x01, 0x08, 0x00, ARP_HLN, ARP_PRO, 0x00, ARP_REQUEST,
+		0, 0, 0, 0, 0, 0,	0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0,	10, 255, 255, 254
+	};
+
+	sr_memcpy(&request[8], node->hw_addr, 6);
+	sr_memcpy(&request[14], node->ip_addr, 4);
+
+	send_ether_packet(bcast, request, ARP_LEN, ARP);
+}
+
+
+static int start(const uint16_t nodes)
+{
+	struct sim_config config;
+	config.latency_us = 50;
+	config.loss_ppm = 0;
+	config.bandwidth_kbps = 100000;
+	config.queue_us = 10000;
+	config.mtu = 1500;
+	config.seed = 1;
+
+	if(sim_init(nodes, &config) != 0)
+	{
+		printf("Cant make %u nodes\n", nodes);
+		return -1;
+	}
+
+	uint16_t i = 0;
+	for(i = 0; i < nodes; i++)
+	{
+		sip_ctx_use(&sim_node(i)->ctx);
+		listen_udp(SIM_PORT, &on_udp);
+	}
+	sip_ctx_use(NULL);
+
+	return 0;
+}
+
+
+static void finish(const char *name, const clock_t began)
+{
+	const struct sim_stats *stats = sim_get_stats();
+	double wall_ms = (double)(clock() - began) * 1000 / CLOCKS_PER_SEC;
+
+	printf("%s: %u nodes, %.0f virtual ms in %.0f wall ms\n", name, sim_node_count(), sim_now() / 1000.0, wall_ms);
+	printf("\tSent: %llu\tDelivered: %llu\tFlooded: %llu\n",
+			(unsigned long long)stats->sent, (unsigned long long)stats->delivered, (unsigned long long)stats->flooded);
+	printf("\tLost: %llu\tToo big: %llu\tQueue full: %llu\tWait depth: %u\n",
+			(unsigned long long)stats->lost, (unsigned long long)stats->too_big,
+			(unsigned long long)stats->queue_full, stats->max_depth);
+
+	sim_free();
+}
+
+
+static void check(const char *what, const uint32_t got, const uint32_t want)
+{
+	printf("\t%s: %u/%u %s\n", what, got, want, (got == want) ? "OK" : "FAIL");
+	if(got != want)
+		m_failed++;
+}
+
+
+/* Everyone ARPs for node 0 at once, then sends it a datagram */
+static void storm(const uint16_t nodes)
+{
+	clock_t began = clock();
+	if(start(nodes) != 0)
+		return;
+
+	uint16_t i = 0;
+	for(i = 1; i < nodes; i++)
+		sim_at(1000, sim_node(i), &app_send, sim_node(0));
+
+	sim_run(RUN_US);
+
+	check("Node 0 received", sim_node(0)->udp_received, nodes - 1);
+	finish("ARP storm", began);
+}
+
+
+/* Everyone broadcasts, spread over 100ms */
+static void flood(const uint16_t nodes)
+{
+	clock_t began = clock();
+	if(start(nodes) != 0)
+		return;
+
+	uint16_t i = 0;
+	for(i = 0; i < nodes; i++)
+	{
+		int n = 0;
+		for(n = 0; n < FLOOD_FRAMES; n++)
+			sim_at(1000 + (rand() % 100000), sim_node(i), &app_flood, NULL);
+	}
+
+	sim_run(RUN_US);
+
+	const struct sim_stats *stats = sim_get_stats();
+	check("Frames delivered", (uint32_t)(stats->delivered + stats->queue_full),
+			(uint32_t)nodes * FLOOD_FRAMES * (nodes - 1));
+	finish("Broadcast flood", began);
+}
+
+
+/* Node 0 talks to everyone, so has an ARP entry for everyone */
+static void table(const uint16_t nodes)
+{
+	clock_t began = clock();
+	if(start(nodes) != 0)
+		return;
+
+	uint16_t i = 0;
+	for(i = 1; i < nodes; i++)
+		sim_at(1000 + (i * 100), sim_node(0), &app_send, sim_node(i));
+
+	sim_run(RUN_US);
+
+	uint32_t entries = 0, received = 0;
+	for(i = 0; i < ARP_TABLE_SIZE; i++)
+	{
+		if(sim_node(0)->ctx.arp.table[i].valid)
+			entries++;
+	}
+	for(i = 1; i < nodes; i++)
+		received += sim_node(i)->udp_received;
+
+	check("Node 0 ARP entries", entries, nodes - 1);
+	check("Peers received", received, nodes - 1);
+	finish("ARP table", began);
+}
+
+
+int main(int argc, char *argv[])
+{
+	const char *test = (argc > 1) ? argv[1] : "all";
+	uint16_t nodes = (argc > 2) ? (uint16_t)atoi(argv[2]) : 1000;
+
+	if(nodes < 2 || nodes > SIM_MAX_NODES || nodes > ARP_TABLE_SIZE)
+	{
+		printf("Nodes must be 2 to %u (and fit in ARP_TABLE_SIZE)\n", SIM_MAX_NODES);
+		return 1;
+	}
+
+	if(!strcmp(test, "storm") || !strcmp(test, "all"))
+		storm(nodes);
+	if(!strcmp(test, "flood") || !strcmp(test, "all"))
+		flood(nodes);
+	if(!strcmp(test, "table") || !strcmp(test, "all"))
+		table(nodes);
+
+	printf("%s\n", m_failed ? "FAILED" : "PASSED");
+	return m_failed ? 1 : 0;
+}
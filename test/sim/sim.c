@@ -0,0 +1,441 @@
+/* Copyright 2026 Dave Barnard (www.shoalresearch.com) */
+
+/*
+ * Many sIP stacks on one virtual switch, in virtual time.
+ *
+ * Every node is a struct sip_ctx (plus a little driver state), so
+ * they all run in this one thread.  Nothing sleeps: the clock jumps
+ * straight to the next frame, and every virtual ms each node's
+ * timer_tick_callback is called, so a long run takes as long as the
+ * work in it, not as long as it pretends to.
+ *
+ * The stack busy-waits in places (ARP replies, pings).  Each node's
+ * timer idle hook runs the simulation on from inside the wait, so
+ * other nodes (and the reply) can happen.  Waits can nest, as one
+ * waiting node's app may start another node waiting.
+ *
+ * The switch learns source addresses and floods broadcasts and
+ * unknown destinations, like a real one.  Each link has a latency,
+ * bandwidth (frames queue behind each other) and loss.
+ */
+#include "sim.h"
+#include "ethernet.h"
+#include "ip.h"
+#include "arp.h"
+#include "udp.h"
+#include "timer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Waits nested deeper than this dont start any more apps */
+#define SIM_MAX_DEPTH		1024
+
+/* Switch address table (power of 2, at least twice SIM_MAX_NODES) */
+#define SIM_MAC_TABLE		8192
+
+#define SIM_TICK_US			1000
+
+enum sim_event_kind
+{
+	SIM_FRAME,
+	SIM_APP
+};
+
+struct sim_event
+{
+	uint64_t at;
+	uint64_t seq;				/* same time, first come first served */
+	enum sim_event_kind kind;
+	struct sim_node *node;
+	uint8_t *frame;
+	uint16_t frame_len;
+	sim_app_fn fn;
+	void *arg;
+};
+
+struct sim_mac_entry
+{
+	uint8_t hw_addr[6];
+	uint16_t port;				/* node index + 1, 0 = empty */
+};
+
+static struct sim_config m_config;
+static struct sim_stats m_stats;
+
+static struct sim_node *m_nodes = NULL;
+static uint16_t m_count = 0;
+
+static uint64_t m_now = 0;
+static uint64_t m_seq = 0;
+static uint32_t m_depth = 0;
+static uint32_t m_random = 1;
+
+/* Events, as a binary heap on (at, seq) */
+static struct sim_event *m_heap = NULL;
+static uint32_t m_heap_len = 0;
+static uint32_t m_heap_size = 0;
+
+static struct sim_mac_entry m_mac_table[SIM_MAC_TABLE];
+
+
+static bool event_before(const struct sim_event *a, const struct sim_event *b)
+{
+	return (a->at < b->at) || (a->at == b->at && a->seq < b->seq);
+}
+
+
+static int heap_push(struct sim_event *ev)
+{
+	if(m_heap_len == m_heap_size)
+	{
+		uint32_t size = m_heap_size ? m_heap_size * 2 : 1024;
+		struct sim_event *heap = realloc(m_heap, size * sizeof(struct sim_event));
+		if(!heap)
+			return -1;
+		m_heap = heap;
+		m_heap_size = size;
+	}
+
+	ev->seq = m_seq++;
+
+	uint32_t i = m_heap_len++;
+	while(i > 0)
+	{
+		uint32_t parent = (i - 1) / 2;
+		if(!event_before(ev, &m_heap[parent]))
+			break;
+		m_heap[i] = m_heap[parent];
+		i = parent;
+	}
+	m_heap[i] = *ev;
+	return 0;
+}
+
+
+static void heap_pop(struct sim_event *ev)
+{
+	*ev = m_heap[0];
+
+	struct sim_event last = m_heap[--m_heap_len];
+	uint32_t i = 0;
+	while(1)
+	{
+		uint32_t child = (i * 2) + 1;
+		if(child >= m_heap_len)
+			break;
+		if(child + 1 < m_heap_len && event_before(&m_heap[child + 1], &m_heap[child]))
+			child++;
+		if(!event_before(&m_heap[child], &last))
+			break;
+		m_heap[i] = m_heap[child];
+		i = child;
+	}
+	m_heap[i] = last;
+}
+
+
+/* xorshift32, so runs repeat exactly */
+static uint32_t sim_random(void)
+{
+	m_random ^= m_random << 13;
+	m_random ^= m_random >> 17;
+	m_random ^= m_random << 5;
+	return m_random;
+}
+
+
+/* Time to clock len bytes onto a link */
+static uint64_t wire_time(const uint16_t len)
+{
+	if(m_config.bandwidth_kbps == 0)
+		return 0;
+
+	/* Preamble, FCS and gap as well */
+	return (((uint64_t)len + 24) * 8 * 1000) / m_config.bandwidth_kbps;
+}
+
+
+static struct sim_mac_entry *mac_lookup(const uint8_t *hw_addr)
+{
+	uint32_t hash = 2166136261u;
+	int i = 0;
+	for(i = 0; i < 6; i++)
+		hash = (hash ^ hw_addr[i]) * 16777619u;
+
+	uint32_t slot = hash & (SIM_MAC_TABLE - 1);
+	while(m_mac_table[slot].port != 0 && memcmp(m_mac_table[slot].hw_addr, hw_addr, 6) != 0)
+		slot = (slot + 1) & (SIM_MAC_TABLE - 1);
+
+	return &m_mac_table[slot];
+}
+
+
+/* Switch to node, over its link */
+static void forward(struct sim_node *to, const uint8_t *frame, const uint16_t frame_len, const uint64_t at_switch)
+{
+	if(m_config.loss_ppm && (sim_random() % 1000000) < m_config.loss_ppm)
+	{
+		m_stats.lost++;
+		return;
+	}
+
+	uint64_t start = (to->downlink_free > at_switch) ? to->downlink_free : at_switch;
+	if(start - at_switch > m_config.queue_us)
+	{
+		m_stats.queue_full++;
+		return;
+	}
+	to->downlink_free = start + wire_time(frame_len);
+
+	struct sim_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.at = to->downlink_free + (m_config.latency_us - (m_config.latency_us / 2));
+	ev.kind = SIM_FRAME;
+	ev.node = to;
+	ev.frame = malloc(frame_len);
+	ev.frame_len = frame_len;
+	if(!ev.frame)
+		return;
+	memcpy(ev.frame, frame, frame_len);
+
+	heap_push(&ev);
+}
+
+
+void sim_send(struct sim_node *from, const uint8_t *frame, const uint16_t frame_len)
+{
+	m_stats.sent++;
+
+	if(frame_len < ETH_HEADERLEN)
+		return;
+
+	if(frame_len - ETH_HEADERLEN > m_config.mtu)
+	{
+		m_stats.too_big++;
+		return;
+	}
+
+	/* Node to switch */
+	uint64_t start = (from->uplink_free > m_now) ? from->uplink_free : m_now;
+	if(start - m_now > m_config.queue_us)
+	{
+		m_stats.queue_full++;
+		return;
+	}
+	from->uplink_free = start + wire_time(frame_len);
+	uint64_t at_switch = from->uplink_free + (m_config.latency_us / 2);
+
+	/* Learn where the sender is */
+	struct sim_mac_entry *src = mac_lookup(&frame[6]);
+	memcpy(src->hw_addr, &frame[6], 6);
+	src->port = from->index + 1;
+
+	/* Then send it on, to everyone if need be */
+	struct sim_mac_entry *dest = mac_lookup(&frame[0]);
+	if((frame[0] & 0x01) || dest->port == 0)
+	{
+		m_stats.flooded++;
+
+		uint16_t i = 0;
+		for(i = 0; i < m_count; i++)
+		{
+			if(&m_nodes[i] != from)
+				forward(&m_nodes[i], frame, frame_len, at_switch);
+		}
+	}
+	else if(dest->port != from->index + 1)
+	{
+		forward(&m_nodes[dest->port - 1], frame, frame_len, at_switch);
+	}
+}
+
+
+/* Run everything up to the next tick, then tick every node */
+static void sim_step(void)
+{
+	uint64_t next_tick = ((m_now / SIM_TICK_US) + 1) * SIM_TICK_US;
+	struct sip_ctx *ctx = sip_ctx_get();
+
+	while(m_heap_len > 0 && m_heap[0].at < next_tick)
+	{
+		struct sim_event ev;
+		heap_pop(&ev);
+
+		/* Too deep to start anything else waiting, so leave it till later */
+		if(ev.kind == SIM_APP && m_depth > SIM_MAX_DEPTH)
+		{
+			ev.at = next_tick;
+			heap_push(&ev);
+			continue;
+		}
+
+		/* Waits inside the last event may have moved time on already */
+		if(ev.at > m_now)
+			m_now = ev.at;
+		sip_ctx_use(&ev.node->ctx);
+
+		if(ev.kind == SIM_FRAME)
+		{
+			m_stats.delivered++;
+			if(ev.node->frame_complete)
+				ev.node->frame_complete(ev.frame, ev.frame_len);
+			free(ev.frame);
+		}
+		else
+		{
+			ev.fn(ev.node, ev.arg);
+		}
+	}
+
+	/* Unless a wait inside has already done this tick */
+	if(m_now < next_tick)
+	{
+		m_now = next_tick;
+
+		uint16_t i = 0;
+		for(i = 0; i < m_count; i++)
+		{
+			sip_ctx_use(&m_nodes[i].ctx);
+			timer_tick_callback();
+		}
+	}
+
+	sip_ctx_use(ctx);
+}
+
+
+/* Timer idle hook: a node is waiting, so move the world on */
+static void sim_idle(void)
+{
+	m_depth++;
+	if(m_depth > m_stats.max_depth)
+		m_stats.max_depth = m_depth;
+
+	sim_step();
+
+	m_depth--;
+}
+
+
+int sim_init(const uint16_t count, const struct sim_config *config)
+{
+	if(count == 0 || count > SIM_MAX_NODES)
+		return -1;
+
+	m_nodes = calloc(count, sizeof(struct sim_node));
+	if(!m_nodes)
+		return -1;
+
+	m_count = count;
+	m_config = *config;
+	m_random = config->seed ? config->seed : 1;
+	m_now = 0;
+	memset(&m_stats, 0, sizeof(m_stats));
+	memset(m_mac_table, 0, sizeof(m_mac_table));
+
+	struct sip_ctx *ctx = sip_ctx_get();
+
+	uint16_t i = 0;
+	for(i = 0; i < count; i++)
+	{
+		struct sim_node *node = &m_nodes[i];
+		uint32_t id = i + 1;
+
+		node->index = i;
+		node->hw_addr[0] = 0x02;
+		node->hw_addr[3] = (uint8_t)(id >> 16);
+		node->hw_addr[4] = (uint8_t)(id >> 8);
+		node->hw_addr[5] = (uint8_t)id;
+		node->ip_addr[0] = 10;
+		node->ip_addr[1] = (uint8_t)(id >> 16);
+		node->ip_addr[2] = (uint8_t)(id >> 8);
+		node->ip_addr[3] = (uint8_t)id;
+
+		sip_ctx_init(&node->ctx);
+		sip_ctx_use(&node->ctx);
+
+		init_ethernet();
+		set_ether_addr(node->hw_addr);
+		init_ip();
+		set_ipv4_addr(node->ip_addr);
+		init_arp();
+		init_udp();
+		init_timer();
+		set_timer_idle(&sim_idle);
+	}
+
+	sip_ctx_use(ctx);
+	return 0;
+}
+
+
+void sim_free(void)
+{
+	while(m_heap_len > 0)
+	{
+		struct sim_event ev;
+		heap_pop(&ev);
+		free(ev.frame);
+	}
+
+	free(m_heap);
+	m_heap = NULL;
+	m_heap_size = 0;
+
+	free(m_nodes);
+	m_nodes = NULL;
+	m_count = 0;
+}
+
+
+struct sim_node *sim_node(const uint16_t index)
+{
+	return (index < m_count) ? &m_nodes[index] : NULL;
+}
+
+
+uint16_t sim_node_count(void)
+{
+	return m_count;
+}
+
+
+struct sim_node *sim_current(void)
+{
+	/* Only true while one of our nodes is running */
+	return (struct sim_node *)sip_ctx_get();
+}
+
+
+int sim_at(const uint64_t at_us, struct sim_node *node, sim_app_fn fn, void *arg)
+{
+	struct sim_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.at = (at_us > m_now) ? at_us : m_now;
+	ev.kind = SIM_APP;
+	ev.node = node;
+	ev.fn = fn;
+	ev.arg = arg;
+
+	return heap_push(&ev);
+}
+
+
+void sim_run(const uint64_t until_us)
+{
+	while(m_now < until_us)
+		sim_step();
+}
+
+
+uint64_t sim_now(void)
+{
+	return m_now;
+}
+
+
+const struct sim_stats *sim_get_stats(void)
+{
+	return &m_stats;
+}
@@ -0,0 +1,81 @@
+/* Copyright 2026 Dave Barnard (www.shoalresearch.com) */
+#ifndef INC_SIM_H
+#define INC_SIM_H
+
+#include "global.h"
+#include "sip_ctx.h"
+
+/* Most nodes on the switch */
+#define SIM_MAX_NODES		4096
+
+/* Links between every node and the switch */
+struct sim_config
+{
+	uint32_t latency_us;		/* one way, node to node */
+	uint32_t loss_ppm;			/* frames lost per million */
+	uint32_t bandwidth_kbps;	/* of each link, 0 = infinite */
+	uint32_t queue_us;			/* most a frame waits for a link, else dropped */
+	uint16_t mtu;				/* biggest Ethernet payload */
+	uint32_t seed;				/* for loss */
+};
+
+struct sim_stats
+{
+	uint64_t sent;				/* frames from nodes */
+	uint64_t delivered;			/* frames to nodes */
+	uint64_t flooded;			/* broadcast or unknown destination */
+	uint64_t lost;				/* loss_ppm */
+	uint64_t too_big;			/* over the MTU */
+	uint64_t queue_full;		/* waited more than queue_us */
+	uint32_t max_depth;			/* deepest nesting of waiting stacks */
+};
+
+/* One sIP instance.  The context must come first (see sim_current) */
+struct sim_node
+{
+	struct sip_ctx ctx;
+	uint16_t index;
+	uint8_t hw_addr[6];
+	uint8_t ip_addr[4];
+
+	/* Set by the stack through link_uc_mac.h */
+	void (*frame_complete)(uint8_t *buffer, const uint16_t buffer_len);
+
+	/* When each direction of our link is next free (virtual us) */
+	uint64_t uplink_free;
+	uint64_t downlink_free;
+
+	/* For the application to count things */
+	uint32_t udp_received;
+};
+
+/* Something for a node to do at a given time */
+typedef void (*sim_app_fn)(struct sim_node *node, void *arg);
+
+/* Build count nodes (10.x.y.z, 02:00:00:x:y:z), all running ARP/IP/UDP */
+int sim_init(const uint16_t count, const struct sim_config *config);
+
+/* Free everything */
+void sim_free(void);
+
+struct sim_node *sim_node(const uint16_t index);
+uint16_t sim_node_count(void);
+
+/* The node whose stack is running now */
+struct sim_node *sim_current(void);
+
+/* Run fn in node's stack at virtual time at_us */
+int sim_at(const uint64_t at_us, struct sim_node *node, sim_app_fn fn, void *arg);
+
+/* Run until the virtual clock reaches until_us */
+void sim_run(const uint64_t until_us);
+
+/* Virtual time (us) */
+uint64_t sim_now(void);
+
+const struct sim_stats *sim_get_stats(void);
+
+/* Called by the driver, for the switch */
+void sim_send(struct sim_node *from, const uint8_t *frame, const uint16_t frame_len);
+
+#endif
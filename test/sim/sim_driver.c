@@ -0,0 +1,60 @@
+/* Copyright 2026 Dave Barnard (www.shoalresearch.com) */
+
+/*
+ * MAC driver for the simulator.  There is one copy of the driver
+ * but many stacks, so everything is kept in the node of whichever
+ * stack is calling (sim_current).
+ */
+#include "../../src/link_uc_mac.h"
+
+#include "ethernet.h"
+#include "sim.h"
+
+RETURN_STATUS init_uc()
+{
+	return SUCCESS;
+}
+
+RETURN_STATUS init_mac()
+{
+	return SUCCESS;
+}
+
+/** No checksum offload, the stack does it all */
+uint8_t get_mac_offload()
+{
+	return MAC_OFFLOAD_NONE;
+}
+
+RETURN_STATUS set_frame_complete(void (*frame_complete_callback)(uint8_t *buffer, const uint16_t buffer_len))
+{
+	sim_current()->frame_complete = frame_complete_callback;
+	return SUCCESS;
+}
+
+#ifdef MAC_RX_VECTOR
+/** No batches, every frame goes to frame_complete */
+RETURN_STATUS set_frames_complete(void (*frames_complete_callback)(struct mac_frame *frames, const uint16_t count))
+{
+	return FAILURE;
+}
+#endif
+
+/** Onto the switch, without the CRC */
+RETURN_STATUS send_frame(const uint8_t *buffer, const uint16_t buffer_len)
+{
+	sim_send(sim_current(), buffer, buffer_len - ETH_CRCLEN);
+	return SUCCESS;
+}
+
+/** Frames only arrive through the frame complete callback */
+RETURN_STATUS read_buffer(uint8_t *buffer, const unsigned int buffer_len, unsigned int *actual_len, const unsigned int timeout_ms)
+{
+	return NOT_AVAILABLE;
+}
+
+/** The simulator ticks every node itself, on virtual time */
+RETURN_STATUS register_ms_callback(void(*handler)())
+{
+	return SUCCESS;
+}
@@ -29,30 +29,30 @@ TEST_GROUP(arp)
 		if(!bRunOnce)
 		{	
 			bRunOnce = true;
-			arp_table[0].valid = true;
+			SIP->arp.table[0].valid = true;
 		}
 
 		RETURN_STATUS ret = init_arp();
 		CHECK_EQUAL(SUCCESS, ret);
 
 		// Check enough to know it wasnt just luck
-		CHECK(!arp_table[0].valid);
-		CHECK(!arp_table[1].valid);
-		CHECK(!arp_table[2].valid);
-		CHECK(!arp_table[3].valid);
-		CHECK(!arp_table[4].valid);
-		CHECK(!arp_table[5].valid);
+		CHECK(!SIP->arp.table[0].valid);
+		CHECK(!SIP->arp.table[1].valid);
+		CHECK(!SIP->arp.table[2].valid);
+		CHECK(!SIP->arp.table[3].valid);
+		CHECK(!SIP->arp.table[4].valid);
+		CHECK(!SIP->arp.table[5].valid);
 	}
 
 	void teardown()
 	{
 		// Enough to know it isnt luck
-		CHECK(!arp_table[0].valid);
-		CHECK(!arp_table[1].valid);
-		CHECK(!arp_table[2].valid);
-		CHECK(!arp_table[3].valid);
-		CHECK(!arp_table[4].valid);
-		CHECK(!arp_table[5].valid);
+		CHECK(!SIP->arp.table[0].valid);
+		CHECK(!SIP->arp.table[1].valid);
+		CHECK(!SIP->arp.table[2].valid);
+		CHECK(!SIP->arp.table[3].valid);
+		CHECK(!SIP->arp.table[4].valid);
+		CHECK(!SIP->arp.table[5].valid);
 	}
 };
 
@@ -63,33 +63,33 @@ TEST(arp, add_arp_entry)
 	// tested in add_remove_arp_entry.
 
 	// Record time info:
-	int iOldTime = arp_table[0].timeout_id;
+	int iOldTime = SIP->arp.table[0].timeout_id;
 
         const uint8_t hw_addr[6] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
         const uint8_t ip_addr[4] = {0x77, 0x88, 0x99, 0xAA };
         RETURN_STATUS ret = add_arp_entry(ip_addr, hw_addr, 100, true);
 	CHECK_EQUAL(SUCCESS, ret);
 
-	CHECK(arp_table[0].valid);
-	CHECK(!arp_table[1].valid);
+	CHECK(SIP->arp.table[0].valid);
+	CHECK(!SIP->arp.table[1].valid);
 
 	// Make sure time ID is roughly right
-	CHECK(0 != arp_table[0].timeout_id);
-	CHECK(iOldTime != arp_table[0].timeout_id);
+	CHECK(0 != SIP->arp.table[0].timeout_id);
+	CHECK(iOldTime != SIP->arp.table[0].timeout_id);
 
 	// MAC addr
-	CHECK_EQUAL(0x11, arp_table[0].hw_addr[0]);
-	CHECK_EQUAL(0x22, arp_table[0].hw_addr[1]);
-	CHECK_EQUAL(0x33, arp_table[0].hw_addr[2]);
-	CHECK_EQUAL(0x44, arp_table[0].hw_addr[3]);
-	CHECK_EQUAL(0x55, arp_table[0].hw_addr[4]);
-	CHECK_EQUAL(0x66, arp_table[0].hw_addr[5]);
+	CHECK_EQUAL(0x11, SIP->arp.table[0].hw_addr[0]);
+	CHECK_EQUAL(0x22, SIP->arp.table[0].hw_addr[1]);
+	CHECK_EQUAL(0x33, SIP->arp.table[0].hw_addr[2]);
+	CHECK_EQUAL(0x44, SIP->arp.table[0].hw_addr[3]);
+	CHECK_EQUAL(0x55, SIP->arp.table[0].hw_addr[4]);
+	CHECK_EQUAL(0x66, SIP->arp.table[0].hw_addr[5]);
 
 	// IP addr
-	CHECK_EQUAL(0x77, arp_table[0].ip_addr[0]);
-	CHECK_EQUAL(0x88, arp_table[0].ip_addr[1]);
-	CHECK_EQUAL(0x99, arp_table[0].ip_addr[2]);
-	CHECK_EQUAL(0xAA, arp_table[0].ip_addr[3]);
+	CHECK_EQUAL(0x77, SIP->arp.table[0].ip_addr[0]);
+	CHECK_EQUAL(0x88, SIP->arp.table[0].ip_addr[1]);
+	CHECK_EQUAL(0x99, SIP->arp.table[0].ip_addr[2]);
+	CHECK_EQUAL(0xAA, SIP->arp.table[0].ip_addr[3]);
 
 
 	// Assume the above will fill entry 0 & no further
@@ -104,17 +104,17 @@ TEST(arp, add_remove_arp_entry)
 	CHECK_EQUAL(SUCCESS, ret);
 
 	// Assume the above will fill entry 0 & no further
-	CHECK(arp_table[0].valid);
-	CHECK(!arp_table[1].valid);
-	CHECK(!arp_table[2].valid);
+	CHECK(SIP->arp.table[0].valid);
+	CHECK(!SIP->arp.table[1].valid);
+	CHECK(!SIP->arp.table[2].valid);
 
         ret = add_arp_entry(ip_addr, hw_addr, 100, true);
 	CHECK_EQUAL(SUCCESS, ret);
 
 	// Nothing should have changed.
-	CHECK(arp_table[0].valid);
-	CHECK(!arp_table[1].valid);
-	CHECK(!arp_table[2].valid);
+	CHECK(SIP->arp.table[0].valid);
+	CHECK(!SIP->arp.table[1].valid);
+	CHECK(!SIP->arp.table[2].valid);
 
 	// Different entry;
 	uint8_t hw_addr2[6] = {0x10, 0x10, 0x20, 0x20, 0x30, 0x30 };
@@ -122,9 +122,9 @@ TEST(arp, add_remove_arp_entry)
         ret = add_arp_entry(ip_addr2, hw_addr2, 100, true);
 	CHECK_EQUAL(SUCCESS, ret);
 
-	CHECK(arp_table[0].valid);
-	CHECK(arp_table[1].valid);
-	CHECK(!arp_table[2].valid);
+	CHECK(SIP->arp.table[0].valid);
+	CHECK(SIP->arp.table[1].valid);
+	CHECK(!SIP->arp.table[2].valid);
 
 
 	// Leave it how we found it;
@@ -135,7 +135,7 @@ TEST(arp, add_remove_arp_entry)
 TEST(arp, resolve_ether_addr_existing)
 {
 	// Record time info:
-//	int iOldTime = arp_table[0].timeout_id;
+//	int iOldTime = SIP->arp.table[0].timeout_id;
 
         const uint8_t hw_addr[6] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
         const uint8_t ip_addr[4] = {0x77, 0x88, 0x99, 0xAA };
@@ -216,25 +216,79 @@ TEST(arp, incomming_arp_arrival_callback)
 	uint16_t buff_len = 28;
 
 	// Record time info:
-	int iOldTime = arp_table[0].timeout_id;
+	int iOldTime = SIP->arp.table[0].timeout_id;
 
 	// The main event
 	arp_arrival_callback(buff, buff_len);
 
-	CHECK(arp_table[0].valid);
+	CHECK(SIP->arp.table[0].valid);
 
 	// Make sure time ID is roughly right
-	CHECK(0 != arp_table[0].timeout_id);
-	CHECK(iOldTime != arp_table[0].timeout_id);
+	CHECK(0 != SIP->arp.table[0].timeout_id);
+	CHECK(iOldTime != SIP->arp.table[0].timeout_id);
 
 	// MAC addr
-	CHECK(sr_memcmp(them_hw, arp_table[0].hw_addr, 6));
+	CHECK(sr_memcmp(them_hw, SIP->arp.table[0].hw_addr, 6));
 	// IP addr
-	CHECK(sr_memcmp(them_ip, arp_table[0].ip_addr, 4));
+	CHECK(sr_memcmp(them_ip, SIP->arp.table[0].ip_addr, 4));
 
 	remove_arp_entry(them_hw, them_ip);
 }
 
+static uint8_t learnt_ip[4];
+static uint8_t learnt_hw[6];
+static int learnt_count = 0;
+
+static void arp_learnt(const uint8_t *ip4_addr, const uint8_t *hw_addr)
+{
+	sr_memcpy(learnt_ip, ip4_addr, 4);
+	sr_memcpy(learnt_hw, hw_addr, 6);
+	learnt_count++;
+}
+
+TEST(arp, arp_learn_callback)
+{
+	uint8_t ip_addr[4] = { 0x12, 0x34, 0x56, 0x78 };
+	set_ipv4_addr(ip_addr);
+
+	const uint8_t them_hw[6] = { 0xDA, 0xDA, 0xDA, 0xDA, 0xDA, 0xDB };
+	const uint8_t them_ip[4] = { 0xAB, 0xAC, 0xAD, 0xAF };
+
+	uint8_t buff[] = {
+	0x00, 0x01,					//ether
+	0x08, 0x00,					//arp (for IPv4)
+	0x06,						//hw len
+	0x04,						//ip len
+	0x00, 0x02,					//response
+	them_hw[0], them_hw[1], them_hw[2], them_hw[3], them_hw[4], them_hw[5],	//whoami
+	them_ip[0], them_ip[1], them_ip[2], them_ip[3],				//whoami
+	0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF,					//youare (dont care)
+	ip_addr[0], ip_addr[1], ip_addr[2], ip_addr[3]				//youare
+	};
+
+	learnt_count = 0;
+	set_arp_learn_callback(&arp_learnt);
+
+	// Entries we add ourselves arent passed on
+	const uint8_t hw_addr[6] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
+	const uint8_t other_ip[4] = {0x77, 0x88, 0x99, 0xAA };
+	add_arp_entry(other_ip, hw_addr, 100, true);
+	CHECK_EQUAL(0, learnt_count);
+
+	// Replies are
+	arp_arrival_callback(buff, sizeof(buff));
+	CHECK_EQUAL(1, learnt_count);
+	CHECK(sr_memcmp(them_hw, learnt_hw, 6));
+	CHECK(sr_memcmp(them_ip, learnt_ip, 4));
+
+	set_arp_learn_callback(NULL);
+	arp_arrival_callback(buff, sizeof(buff));
+	CHECK_EQUAL(1, learnt_count);
+
+	remove_arp_entry(hw_addr, other_ip);
+	remove_arp_entry(them_hw, them_ip);
+}
+
 TEST(arp, arp_timeout_callback)
 {
 //	ARP timeout callback
@@ -248,11 +302,33 @@ TEST(arp, arp_timeout_callback)
     for(uint8_t i = 0; i < 9; i++)
         timer_tick_callback();
 
-    CHECK(arp_table[0].valid);
+    CHECK(SIP->arp.table[0].valid);
 
     timer_tick_callback();
 
-    CHECK(!arp_table[0].valid);
+    CHECK(!SIP->arp.table[0].valid);
+}
+
+TEST(arp, arp_generation)
+{
+	const uint8_t hw_addr[6] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
+	const uint8_t hw_addr2[6] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x77 };
+	const uint8_t ip_addr[4] = {0x77, 0x88, 0x99, 0xAA };
+	CHECK_EQUAL(SUCCESS, add_arp_entry(ip_addr, hw_addr, 100, true));
+
+	// A refresh changes nothing
+	uint32_t generation = get_arp_generation();
+	CHECK_EQUAL(SUCCESS, add_arp_entry(ip_addr, hw_addr, 100, true));
+	CHECK(generation == get_arp_generation());
+
+	// A new address does
+	CHECK_EQUAL(SUCCESS, add_arp_entry(ip_addr, hw_addr2, 100, true));
+	CHECK(generation != get_arp_generation());
+
+	// So does it going
+	generation = get_arp_generation();
+	remove_arp_entry(hw_addr2, ip_addr);
+	CHECK(generation != get_arp_generation());
 }
 
 
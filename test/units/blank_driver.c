@@ -3,6 +3,7 @@
 #include "CppUTest/TestHarness.h"
 
 #include "link_uc_mac.h"
+#include "stack_defines.h"
 #include "functions.h"
 #include <malloc.h>
 
@@ -17,6 +18,12 @@ RETURN_STATUS init_mac()
 	return SUCCESS;
 }
 
+/** No checksum offload, the stack does it all */
+uint8_t get_mac_offload()
+{
+	return MAC_OFFLOAD_NONE;
+}
+
 /** Callback to next layer when we have a whole packet */
 void (*cb_frame_complete)(uint8_t *buffer, const uint16_t buffer_len) = NULL;
 RETURN_STATUS set_frame_complete(void (*frame_complete_callback)(uint8_t *buffer, const uint16_t buffer_len))
@@ -25,6 +32,13 @@ RETURN_STATUS set_frame_complete(void (*frame_complete_callback)(uint8_t *buffer
 	return SUCCESS;
 }
 
+/** IPv4 frames are kept here, rather than refused, while set */
+#define DRIVER_CAPTURE_MAX	8
+bool driverCaptureIPv4 = false;
+uint8_t driverCaptured[DRIVER_CAPTURE_MAX][ETH_HEADERLEN + ETH_MAXDATA + ETH_CRCLEN];
+uint16_t driverCapturedLen[DRIVER_CAPTURE_MAX];
+uint8_t driverCapturedCount = 0;
+
 /** Write to file & decide what response to give **/
 uint8_t* driverLastPacketSent = NULL;
 uint16_t driverLastPacketLen = 0;
@@ -76,6 +90,16 @@ RETURN_STATUS send_frame(const uint8_t *buffer, const uint16_t buffer_len)
 	// sufficiently tested by ARP.
 	if(buffer[12] == 0x08 && buffer[13] == 0x00)
 	{
+		if(driverCaptureIPv4)
+		{
+			CHECK(driverCapturedCount < DRIVER_CAPTURE_MAX);
+			CHECK(buffer_len <= sizeof(driverCaptured[0]));
+			sr_memcpy(driverCaptured[driverCapturedCount], buffer, buffer_len);
+			driverCapturedLen[driverCapturedCount] = buffer_len;
+			driverCapturedCount++;
+			return SUCCESS;
+		}
+
 		return NOT_AVAILABLE;
 	}
 
@@ -98,3 +122,155 @@ return SUCCESS;
 }
 
 
+
+#ifdef MAC_POLL
+/** Frames 'waiting' in the MAC, and whether its receive interrupt is on */
+uint16_t driverFramesWaiting = 0;
+bool driverRxIrq = false;
+
+uint16_t poll_mac(const uint16_t budget)
+{
+	// Small frame of a type nobody wants (local experimental)
+	uint8_t frame[60] = { 0 };
+	frame[12] = 0x88;
+	frame[13] = 0xB5;
+
+	uint16_t done = 0;
+	while(done < budget && driverFramesWaiting > 0)
+	{
+		driverFramesWaiting--;
+		(cb_frame_complete)(frame, sizeof(frame));
+		done++;
+	}
+
+	return done;
+}
+
+void mac_rx_irq(const bool enable)
+{
+	driverRxIrq = enable;
+}
+#endif
+
+
+#ifdef MAC_GATHER
+/** Set when a frame comes through send_frame_gather */
+bool driverGathered = false;
+
+RETURN_STATUS send_frame_gather(const uint8_t *header, const uint16_t header_len, const uint8_t *payload, const uint16_t payload_len)
+{
+	driverGathered = true;
+
+	// Then as if it came in one piece
+	uint8_t frame[ETH_HEADERLEN + ETH_MAXDATA + ETH_CRCLEN] = { 0 };
+	sr_memcpy(frame, header, header_len);
+	sr_memcpy(&frame[header_len], payload, payload_len);
+
+	return send_frame(frame, header_len + payload_len + ETH_CRCLEN);
+}
+#endif
+
+
+#ifdef MAC_STREAM
+/** Frame being built by mac_tx_write, 0 length when there isn't one */
+static uint8_t driverStreamFrame[ETH_HEADERLEN + ETH_STREAM_MAXDATA + ETH_CRCLEN];
+static uint16_t driverStreamLen = 0;
+
+RETURN_STATUS mac_tx_begin(const uint16_t frame_len)
+{
+	if(driverStreamLen != 0 || frame_len > ETH_HEADERLEN + ETH_STREAM_MAXDATA)
+	{
+		return FAILURE;
+	}
+
+	sr_memset(driverStreamFrame, 0, sizeof(driverStreamFrame));
+	driverStreamLen = frame_len;
+	return SUCCESS;
+}
+
+RETURN_STATUS mac_tx_write(const uint16_t offset, const uint8_t *buffer, const uint16_t buffer_len)
+{
+	if(driverStreamLen == 0 || offset + buffer_len > driverStreamLen)
+	{
+		return FAILURE;
+	}
+
+	sr_memcpy(&driverStreamFrame[offset], buffer, buffer_len);
+	return SUCCESS;
+}
+
+RETURN_STATUS mac_tx_end(const bool send)
+{
+	if(driverStreamLen == 0)
+	{
+		return FAILURE;
+	}
+
+	const uint16_t frame_len = driverStreamLen;
+	driverStreamLen = 0;
+
+	// Then as if it came in one piece
+	return send ? send_frame(driverStreamFrame, frame_len + ETH_CRCLEN) : SUCCESS;
+}
+#endif
+
+
+#ifdef MAC_RX_STREAM
+/** The frame 'in the MAC' for mac_rx_read, and how much has been read */
+const uint8_t *driverRxFrame = NULL;
+uint16_t driverRxFrameLen = 0;
+uint16_t driverRxBytesRead = 0;
+
+bool (*cb_frame_header)(const uint8_t *header, const uint16_t header_len, const uint16_t frame_len) = NULL;
+RETURN_STATUS set_frame_header(bool (*frame_header_callback)(const uint8_t *header, const uint16_t header_len, const uint16_t frame_len))
+{
+	cb_frame_header = frame_header_callback;
+	return SUCCESS;
+}
+
+RETURN_STATUS mac_rx_read(const uint16_t offset, uint8_t *buffer, const uint16_t buffer_len)
+{
+	if(driverRxFrame == NULL || offset + buffer_len > driverRxFrameLen)
+	{
+		return FAILURE;
+	}
+
+	sr_memcpy(buffer, &driverRxFrame[offset], buffer_len);
+	driverRxBytesRead += buffer_len;
+	return SUCCESS;
+}
+#endif
+
+
+#ifdef MAC_RX_VECTOR
+/** Callback for a batch of frames */
+void (*cb_frames_complete)(struct mac_frame *frames, const uint16_t count) = NULL;
+RETURN_STATUS set_frames_complete(void (*frames_complete_callback)(struct mac_frame *frames, const uint16_t count))
+{
+	cb_frames_complete = frames_complete_callback;
+	return SUCCESS;
+}
+#endif
+
+
+#ifdef UDP_SEG_OFFLOAD
+/** The last frame given to send_frame_segmented (NULL if none) */
+uint8_t *driverSegmentedFrame = NULL;
+uint16_t driverSegmentedLen = 0;
+uint16_t driverSegmentLen = 0;
+
+RETURN_STATUS send_frame_segmented(const uint8_t *buffer, const uint16_t buffer_len, const uint16_t segment_len)
+{
+	if(driverSegmentedFrame != NULL)
+	{
+		free(driverSegmentedFrame);
+	}
+
+	driverSegmentedFrame = (uint8_t*)malloc(buffer_len);
+	sr_memcpy(driverSegmentedFrame, buffer, buffer_len);
+	driverSegmentedLen = buffer_len;
+	driverSegmentLen = segment_len;
+
+	return SUCCESS;
+}
+#endif
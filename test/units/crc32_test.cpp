@@ -0,0 +1,94 @@
+#include "crc32_test.h"
+#include "CppUTest/TestHarness.h"
+
+// The file we are testing (with the tables, so
+// both software engines can be checked):
+extern "C"
+{
+#define CRC32_SLICE_BY_8
+#include "crc32.c"
+}
+
+TEST_GROUP(crc32)
+{
+	uint8_t data[1500];
+
+	void setup()
+	{
+		init_crc32();
+
+		uint16_t i = 0;
+		for(i = 0; i < sizeof(data); i++)
+		{
+			data[i] = (uint8_t)((i * 7) + (i >> 8));
+		}
+	}
+
+	void teardown()
+	{
+	}
+};
+
+TEST(crc32, check_value)
+{
+	// Standard CRC-32 check value
+	const uint8_t check[] = "123456789";
+
+	CHECK_EQUAL((uint32_t)0xCBF43926, (uint32_t)~crc32_bitwise(CRC32_INIT, check, 9));
+	CHECK_EQUAL((uint32_t)0xCBF43926, (uint32_t)~crc32_slice8(CRC32_INIT, check, 9));
+	CHECK_EQUAL((uint32_t)0xCBF43926, (uint32_t)ether_crc32(check, 9));
+}
+
+TEST(crc32, engines_agree)
+{
+	// Every length, so all the odd byte and tail paths are hit
+	uint16_t len = 0;
+	for(len = 0; len <= sizeof(data); len++)
+	{
+		uint32_t expected = crc32_bitwise(CRC32_INIT, data, len);
+
+		CHECK_EQUAL(expected, crc32_slice8(CRC32_INIT, data, len));
+		CHECK_EQUAL(expected, crc32_update(CRC32_INIT, data, len));
+	}
+}
+
+TEST(crc32, running_value)
+{
+	// Doing it in pieces should give the same answer
+	uint32_t crc = crc32_update(CRC32_INIT, data, 13);
+	crc = crc32_update(crc, &data[13], 100);
+	crc = crc32_update(crc, &data[113], sizeof(data) - 113);
+
+	CHECK_EQUAL(ether_crc32(data, sizeof(data)), ~crc);
+}
+
+TEST(crc32, residue)
+{
+	// A frame with its FCS on the end (LSB first) always
+	// leaves the same value behind
+	uint32_t fcs = ether_crc32(data, 60);
+	data[60] = (uint8_t)fcs;
+	data[61] = (uint8_t)(fcs >> 8);
+	data[62] = (uint8_t)(fcs >> 16);
+	data[63] = (uint8_t)(fcs >> 24);
+
+	CHECK_EQUAL((uint32_t)0xDEBB20E3, crc32_update(CRC32_INIT, data, 64));
+}
+
+#if defined(__PCLMUL__) && defined(CRC32_CLMUL)
+TEST(crc32, clmul_matches_slice8)
+{
+	// Short lengths go through the tables and 64 is the first
+	// fold, so try each from every alignment in a 16 byte lane
+	uint8_t offset = 0;
+	for(offset = 0; offset < 16; offset++)
+	{
+		uint16_t len = 0;
+		for(len = 0; len <= 64 + 16 * 4; len++)
+		{
+			CHECK_EQUAL(crc32_slice8(CRC32_INIT, &data[offset], len), crc32_clmul(CRC32_INIT, &data[offset], len));
+			CHECK_EQUAL(crc32_slice8(0x12345678, &data[offset], len), crc32_clmul(0x12345678, &data[offset], len));
+		}
+	}
+}
+#endif
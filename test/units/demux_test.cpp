@@ -0,0 +1,237 @@
+#include "demux_test.h"
+#include "CppUTest/TestHarness.h"
+
+// The file we are testing:
+extern "C"
+{
+#include "functions.h"
+#include "sip_ctx.h"
+#include "demux.c"
+}
+
+static struct sip_ctx demux_ctx;
+
+/** What the handlers saw **/
+static uint8_t demux_calls = 0;
+static uint8_t demux_other_calls = 0;
+static uint16_t demux_len = 0;
+static uint8_t demux_first = 0;
+
+static void demux_test_handler(const uint8_t *buffer, const uint16_t buffer_len)
+{
+	demux_calls++;
+	demux_len = buffer_len;
+	demux_first = buffer[0];
+}
+
+static void demux_test_other(const uint8_t *buffer, const uint16_t buffer_len)
+{
+	demux_other_calls++;
+}
+
+static const uint8_t demux_sender[4] = { 192, 168, 0, 7 };
+
+/** Ethernet, IP and UDP headers plus 4 bytes, checksums and all **/
+static void demux_test_frame(uint8_t *frame, const uint16_t src_port, const uint16_t dest_port)
+{
+	uint8_t i = 0;
+	for(i = 0; i < 12; i++)
+	{
+		frame[i] = i;
+	}
+	store_be16(&frame[12], IPv4);
+
+	uint8_t *ip = &frame[14];
+	ip[0] = 0x45;
+	ip[1] = 0;
+	store_be16(&ip[2], 20 + 8 + 4);
+	store_be16(&ip[4], 0);
+	store_be16(&ip[6], 0);
+	ip[8] = 64;
+	ip[9] = IP_UDP;
+	store_be16(&ip[10], 0);
+	sr_memcpy(&ip[12], demux_sender, 4);
+	ip[16] = 192; ip[17] = 168; ip[18] = 0; ip[19] = 2;
+	store_be16(&ip[10], checksum(ip, 20, 10));
+
+	uint8_t *udp = &ip[20];
+	store_be16(&udp[0], src_port);
+	store_be16(&udp[2], dest_port);
+	store_be16(&udp[4], 8 + 4);
+	store_be16(&udp[6], 0);
+	udp[8] = 0xA5; udp[9] = 1; udp[10] = 2; udp[11] = 3;
+
+	uint8_t pseudo[12] = { ip[12], ip[13], ip[14], ip[15], ip[16], ip[17], ip[18], ip[19], 0, IP_UDP, udp[4], udp[5] };
+	store_be16(&udp[6], checksum_fragmented(pseudo, sizeof(pseudo), udp, 12, 12 + 6));
+}
+
+static void demux_test_key(struct demux_key *key, const uint16_t port)
+{
+	sr_memset((uint8_t *)key, 0, sizeof(struct demux_key));
+	key->ether_type = IPv4;
+	key->protocol = IP_UDP;
+	key->dest_port = port;
+}
+
+TEST_GROUP(demux)
+{
+	void setup()
+	{
+		sip_ctx_init(&demux_ctx);
+		sip_ctx_use(&demux_ctx);
+		init_demux();
+
+		demux_calls = 0;
+		demux_other_calls = 0;
+		demux_len = 0;
+		demux_first = 0;
+	}
+
+	void teardown()
+	{
+		sip_ctx_use(NULL);
+	}
+};
+
+TEST(demux, delivers_payload)
+{
+	struct demux_key key;
+	demux_test_key(&key, 5000);
+	CHECK_EQUAL(SUCCESS, add_demux_entry(&key, &demux_test_handler));
+
+	uint8_t frame[14 + 20 + 8 + 4];
+	demux_test_frame(frame, 1234, 5000);
+
+	CHECK(demux_frame(frame, sizeof(frame)));
+	CHECK_EQUAL(1, demux_calls);
+	CHECK_EQUAL(4, demux_len);
+	CHECK_EQUAL(0xA5, demux_first);
+
+	// Ethernet padding isn't payload
+	uint8_t padded[60] = {0};
+	demux_test_frame(padded, 1234, 5000);
+	CHECK(demux_frame(padded, sizeof(padded)));
+	CHECK_EQUAL(2, demux_calls);
+	CHECK_EQUAL(4, demux_len);
+
+	uint32_t delivered = 0;
+	uint32_t dropped = 0;
+	get_demux_stats(&delivered, &dropped);
+	CHECK(delivered == 2 && dropped == 0);
+}
+
+TEST(demux, drops_unwanted_and_bad)
+{
+	struct demux_key key;
+	demux_test_key(&key, 5000);
+	add_demux_entry(&key, &demux_test_handler);
+
+	uint8_t frame[14 + 20 + 8 + 4];
+
+	// Nobody on the port
+	demux_test_frame(frame, 1234, 5001);
+	CHECK(demux_frame(frame, sizeof(frame)));
+
+	// Bad UDP checksum
+	demux_test_frame(frame, 1234, 5000);
+	frame[sizeof(frame) - 1] ^= 0x10;
+	CHECK(demux_frame(frame, sizeof(frame)));
+
+	// Bad IP checksum
+	demux_test_frame(frame, 1234, 5000);
+	frame[14 + 8] ^= 0x01;
+	CHECK(demux_frame(frame, sizeof(frame)));
+
+	CHECK_EQUAL(0, demux_calls);
+
+	uint32_t dropped = 0;
+	get_demux_stats(NULL, &dropped);
+	CHECK(dropped == 3);
+}
+
+TEST(demux, leaves_the_rest)
+{
+	uint8_t frame[14 + 20 + 8 + 4];
+
+	// ARP
+	demux_test_frame(frame, 1234, 5000);
+	store_be16(&frame[12], ARP);
+	CHECK(!demux_frame(frame, sizeof(frame)));
+
+	// ICMP
+	demux_test_frame(frame, 1234, 5000);
+	frame[14 + 9] = IP_ICMP;
+	CHECK(!demux_frame(frame, sizeof(frame)));
+
+	// A fragment
+	demux_test_frame(frame, 1234, 5000);
+	store_be16(&frame[14 + 6], 0x2000);
+	CHECK(!demux_frame(frame, sizeof(frame)));
+}
+
+TEST(demux, sender_first)
+{
+	struct demux_key key;
+	demux_test_key(&key, 5000);
+	add_demux_entry(&key, &demux_test_handler);
+
+	sr_memcpy(key.src_addr, demux_sender, 4);
+	key.src_port = 1234;
+	CHECK_EQUAL(SUCCESS, add_demux_entry(&key, &demux_test_other));
+
+	uint8_t frame[14 + 20 + 8 + 4];
+	demux_test_frame(frame, 1234, 5000);
+	demux_frame(frame, sizeof(frame));
+	CHECK_EQUAL(0, demux_calls);
+	CHECK_EQUAL(1, demux_other_calls);
+
+	// Anyone else gets the general one
+	demux_test_frame(frame, 1235, 5000);
+	demux_frame(frame, sizeof(frame));
+	CHECK_EQUAL(1, demux_calls);
+	CHECK_EQUAL(1, demux_other_calls);
+
+	CHECK_EQUAL(SUCCESS, remove_demux_entry(&key));
+	CHECK_EQUAL(FAILURE, remove_demux_entry(&key));
+
+	demux_test_frame(frame, 1234, 5000);
+	demux_frame(frame, sizeof(frame));
+	CHECK_EQUAL(2, demux_calls);
+	CHECK_EQUAL(1, demux_other_calls);
+}
+
+TEST(demux, bad_keys_and_full)
+{
+	struct demux_key key;
+
+	// Address without a port
+	demux_test_key(&key, 5000);
+	sr_memcpy(key.src_addr, demux_sender, 4);
+	CHECK_EQUAL(FAILURE, add_demux_entry(&key, &demux_test_handler));
+
+	demux_test_key(&key, 0);
+	CHECK_EQUAL(FAILURE, add_demux_entry(&key, &demux_test_handler));
+
+	demux_test_key(&key, 5000);
+	key.protocol = IP_ICMP;
+	CHECK_EQUAL(FAILURE, add_demux_entry(&key, &demux_test_handler));
+
+	uint8_t i = 0;
+	for(i = 0; i < DEMUX_TABLE_SIZE; i++)
+	{
+		demux_test_key(&key, 6000 + i);
+		CHECK_EQUAL(SUCCESS, add_demux_entry(&key, &demux_test_handler));
+	}
+
+	demux_test_key(&key, 7000);
+	CHECK_EQUAL(FAILURE, add_demux_entry(&key, &demux_test_handler));
+
+	// Every one can still be found
+	uint8_t frame[14 + 20 + 8 + 4];
+	for(i = 0; i < DEMUX_TABLE_SIZE; i++)
+	{
+		demux_test_frame(frame, 1234, 6000 + i);
+		demux_frame(frame, sizeof(frame));
+	}
+	CHECK_EQUAL(DEMUX_TABLE_SIZE, demux_calls);
+}
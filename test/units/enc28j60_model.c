@@ -0,0 +1,327 @@
+/* Copyright 2026 Dave Barnard */
+
+/*
+ * A model of the ENC28J60 behind the avr_spi.h calls, so the
+ * driver can be run on the PC.  Registers, the 8K buffer memory
+ * with its read/write pointers, EPKTCNT, the DMA checksum and the
+ * transmit logic are modelled.  Frames 'arrive' by being put in
+ * the memory with model_rx_frame.
+ *
+ * Included by enc28j60_test.cpp, after CppUTest.
+ */
+
+#include "mac/enc28j60.h"
+#include "avr_spi.h"
+#include "ethernet.h"
+#include "stack_defines.h"
+#include "functions.h"
+
+#define MODEL_MEMORY	0x2000
+
+uint8_t modelMemory[MODEL_MEMORY];
+uint8_t modelRegs[4][0x20];
+
+/** MAC INT pin interrupt allowed, and whether we are 'in' it */
+bool modelIntEnabled = true;
+bool modelInIsr = false;
+
+/** Things the driver shouldn't do, and things it should */
+uint16_t modelUnmaskedSpi = 0;		/* SPI from the main loop with INT allowed */
+uint16_t modelIsrUnmasked = 0;		/* INT allowed again from inside the ISR */
+uint16_t modelDmaRuns = 0;
+uint16_t modelDmaWithRx = 0;		/* DMA checksum started with RXEN on */
+uint16_t modelRxResets = 0;
+uint16_t modelTxResets = 0;
+uint16_t modelTxStarted = 0;
+
+/** Transmit status byte 2 the 'wire' reports, and the last frame sent */
+uint8_t modelTsvStatus = TSV_DONE;
+uint8_t modelTxFrame[FRAMELEN_MAX + TX_CONTROL_LEN];
+uint16_t modelTxFrameLen = 0;
+
+/** The SPI command in progress (0xFF for none) */
+static uint8_t model_command = 0xFF;
+static bool model_selected = false;
+
+
+static uint8_t *model_reg(const uint8_t address)
+{
+	/* EIE, EIR, ESTAT, ECON2, ECON1 are in every bank */
+	if(address >= EIE)
+	{
+		return &modelRegs[0][address];
+	}
+
+	return &modelRegs[modelRegs[0][ECON1] & (ECON1_BSEL0 | ECON1_BSEL1)][address];
+}
+
+static uint16_t model_reg16(const uint8_t address)
+{
+	return ((uint16_t)modelRegs[0][address + 1] << 8) | modelRegs[0][address];
+}
+
+static void model_set_reg16(const uint8_t address, const uint16_t value)
+{
+	modelRegs[0][address] = (uint8_t)value;
+	modelRegs[0][address + 1] = (uint8_t)(value >> 8);
+}
+
+/** Next address on from address, wrapping round the receive buffer as AUTOINC does */
+static uint16_t model_next(const uint16_t address)
+{
+	if(address == model_reg16(ERXNDL))
+	{
+		return model_reg16(ERXSTL);
+	}
+
+	return (address + 1) & (MODEL_MEMORY - 1);
+}
+
+/** The DMA checksum, EDMAST to EDMAND */
+static void model_dma(void)
+{
+	modelDmaRuns++;
+	if(modelRegs[0][ECON1] & ECON1_RXEN)
+	{
+		modelDmaWithRx++;
+	}
+
+	uint16_t address = model_reg16(EDMASTL);
+	const uint16_t end = model_reg16(EDMANDL);
+	uint32_t sum = 0;
+	bool high = true;
+
+	while(true)
+	{
+		sum += high ? ((uint16_t)modelMemory[address] << 8) : modelMemory[address];
+		high = !high;
+
+		if(address == end)
+		{
+			break;
+		}
+		address = model_next(address);
+	}
+
+	while(sum >> 16)
+	{
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	}
+
+	modelRegs[0][EDMACSL] = (uint8_t)~sum;
+	modelRegs[0][EDMACSH] = (uint8_t)(~sum >> 8);
+	modelRegs[0][ECON1] &= ~ECON1_DMAST;
+}
+
+/** The frame in ETXST..ETXND goes, if the wire is set to let it */
+void model_tx_done(void)
+{
+	const uint16_t start = model_reg16(ETXSTL);
+	const uint16_t end = model_reg16(ETXNDL);
+
+	modelTxFrameLen = end - start + 1;
+	sr_memcpy(modelTxFrame, &modelMemory[start], modelTxFrameLen);
+
+	/* Status vector after the frame */
+	uint8_t status[TX_STATUS_LEN] = { (uint8_t)(modelTxFrameLen - TX_CONTROL_LEN), (uint8_t)((modelTxFrameLen - TX_CONTROL_LEN) >> 8), modelTsvStatus, 0, 0, 0, 0 };
+	sr_memcpy(&modelMemory[end + 1], status, TX_STATUS_LEN);
+
+	modelRegs[0][ECON1] &= ~ECON1_TXRTS;
+	modelRegs[0][EIR] |= EIR_TXIF;
+}
+
+/** Act on bits the driver has just set */
+static void model_bits_set(const uint8_t address, const uint8_t before)
+{
+	if(address == ECON2 && (modelRegs[0][ECON2] & ECON2_PKTDEC))
+	{
+		modelRegs[0][ECON2] &= ~ECON2_PKTDEC;
+		if(modelRegs[1][EPKTCNT] > 0)
+		{
+			modelRegs[1][EPKTCNT]--;
+		}
+	}
+
+	if(address != ECON1)
+	{
+		return;
+	}
+
+	const uint8_t set = modelRegs[0][ECON1] & ~before;
+
+	if(set & ECON1_RXRST)
+	{
+		modelRxResets++;
+	}
+	if(set & ECON1_TXRST)
+	{
+		modelTxResets++;
+	}
+	if(set & ECON1_TXRTS)
+	{
+		modelTxStarted++;
+	}
+	if(set & ECON1_DMAST)
+	{
+		model_dma();
+	}
+}
+
+/** Empty chip, INT allowed */
+void model_reset(void)
+{
+	sr_memset(modelMemory, 0, sizeof(modelMemory));
+	sr_memset(&modelRegs[0][0], 0, sizeof(modelRegs));
+
+	modelIntEnabled = true;
+	modelInIsr = false;
+	modelUnmaskedSpi = 0;
+	modelIsrUnmasked = 0;
+	modelDmaRuns = 0;
+	modelDmaWithRx = 0;
+	modelRxResets = 0;
+	modelTxResets = 0;
+	modelTxStarted = 0;
+	modelTsvStatus = TSV_DONE;
+	modelTxFrameLen = 0;
+	model_command = 0xFF;
+	model_selected = false;
+}
+
+/** A frame arrives at address (the receive status vector goes first) */
+uint16_t model_rx_frame(const uint16_t address, const uint8_t *frame, const uint16_t frame_len)
+{
+	/* Next frame starts on an even address */
+	const uint16_t byte_count = frame_len + ETH_CRCLEN;
+	uint16_t following = address + RX_HEADER_LEN + byte_count;
+	following = (following + 1) & ~1;
+	if(following > RX_END)
+	{
+		following -= (RX_END - RX_START + 1);
+	}
+
+	const uint8_t header[RX_HEADER_LEN] = { (uint8_t)following, (uint8_t)(following >> 8),
+											(uint8_t)byte_count, (uint8_t)(byte_count >> 8), RSV_RX_OK, 0 };
+
+	uint16_t at = address;
+	uint16_t i = 0;
+	for(i = 0; i < RX_HEADER_LEN + byte_count; i++)
+	{
+		modelMemory[at] = (i < RX_HEADER_LEN) ? header[i] : (i < RX_HEADER_LEN + frame_len) ? frame[i - RX_HEADER_LEN] : 0xEE;
+		at = (at == RX_END) ? RX_START : at + 1;
+	}
+
+	modelRegs[1][EPKTCNT]++;
+	return following;
+}
+
+
+/*
+ * What avr_spi.c does on the AVR
+ */
+
+RETURN_STATUS init_link(void)
+{
+	return SUCCESS;
+}
+
+RETURN_STATUS set_mac_int_callback(void (*fn_callback)(void))
+{
+	return SUCCESS;
+}
+
+RETURN_STATUS mac_int_enable(const bool enable)
+{
+	if(enable && modelInIsr)
+	{
+		modelIsrUnmasked++;
+	}
+
+	modelIntEnabled = enable;
+	return SUCCESS;
+}
+
+RETURN_STATUS mac_cs(const bool chip_enable)
+{
+	if(chip_enable && modelIntEnabled && !modelInIsr)
+	{
+		modelUnmaskedSpi++;
+	}
+
+	model_selected = chip_enable;
+	model_command = 0xFF;
+	return SUCCESS;
+}
+
+RETURN_STATUS write_buffer(const uint8_t *buffer, const unsigned int buffer_len)
+{
+	CHECK(model_selected);
+
+	unsigned int i = 0;
+	if(model_command == 0xFF && buffer_len > 0)
+	{
+		model_command = buffer[0];
+		i = 1;
+	}
+
+	const uint8_t opcode = model_command & 0xE0;
+	const uint8_t address = model_command & 0x1F;
+
+	for(; i < buffer_len; i++)
+	{
+		uint8_t *reg = model_reg(address);
+		const uint8_t before = *reg;
+
+		if(opcode == WCR)
+		{
+			*reg = buffer[i];
+		}
+		else if(opcode == BFS)
+		{
+			*reg |= buffer[i];
+		}
+		else if(opcode == BFC)
+		{
+			*reg &= ~buffer[i];
+		}
+		else if(opcode == WBM)
+		{
+			const uint16_t write_at = model_reg16(EWRPTL);
+			modelMemory[write_at] = buffer[i];
+			model_set_reg16(EWRPTL, (write_at + 1) & (MODEL_MEMORY - 1));
+			continue;
+		}
+
+		if(opcode != WBM)
+		{
+			model_bits_set(address, before);
+		}
+	}
+
+	return SUCCESS;
+}
+
+RETURN_STATUS read_buffer(uint8_t *buffer, const unsigned int buffer_len, unsigned int *actual_len, const unsigned int timeout_ms)
+{
+	CHECK(model_selected);
+
+	const uint8_t opcode = model_command & 0xE0;
+	unsigned int i = 0;
+
+	for(i = 0; i < buffer_len; i++)
+	{
+		if(opcode == RBM)
+		{
+			const uint16_t read_at = model_reg16(ERDPTL);
+			buffer[i] = modelMemory[read_at];
+			model_set_reg16(ERDPTL, model_next(read_at));
+		}
+		else
+		{
+			buffer[i] = *model_reg(model_command & 0x1F);
+		}
+	}
+
+	*actual_len = buffer_len;
+	return SUCCESS;
+}
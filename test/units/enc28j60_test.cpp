@@ -0,0 +1,401 @@
+#include "enc28j60_test.h"
+#include "CppUTest/TestHarness.h"
+
+// The file we are testing, against a model of the chip
+// (enc28j60_model.c).  It is a whole MAC layer, so this
+// builds into its own executable (see the Makefile).
+extern "C"
+{
+#include "functions.c"
+#include "enc28j60_model.c"
+#include "mac/enc28j60.c"
+}
+
+extern "C"
+{
+/* What the driver needs from the rest of the stack */
+static const uint8_t enc_addr[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static uint8_t enc_offload = MAC_OFFLOAD_NONE;
+static uint16_t enc_scheduled = 0;
+
+const uint8_t * get_ether_addr(void)
+{
+	return enc_addr;
+}
+
+uint8_t get_ether_offload(void)
+{
+	return enc_offload;
+}
+
+uint16_t add_timer(uint32_t ms, void(*handler)(uint16_t))
+{
+	return 0;
+}
+
+bool is_running(uint16_t id)
+{
+	return false;
+}
+
+void ether_rx_schedule(void)
+{
+	enc_scheduled++;
+	mac_rx_irq(false);
+}
+}
+
+/** What frame_complete saw **/
+static uint8_t enc_frames = 0;
+static uint8_t enc_frame[FRAMELEN_MAX + ETH_CRCLEN];
+static uint16_t enc_frame_len = 0;
+
+static void enc_frame_complete(uint8_t *buffer, const uint16_t buffer_len)
+{
+	enc_frames++;
+	enc_frame_len = buffer_len;
+	sr_memcpy(enc_frame, buffer, buffer_len);
+}
+
+#ifdef MAC_RX_STREAM
+/** What frame_header saw, and read with mac_rx_read **/
+static bool enc_header_wants = false;
+static uint16_t enc_header_calls = 0;
+static uint16_t enc_header_frame_len = 0;
+static uint8_t enc_header_read[FRAMELEN_MAX];
+
+static bool enc_frame_header(const uint8_t *header, const uint16_t header_len, const uint16_t frame_len)
+{
+	enc_header_calls++;
+	enc_header_frame_len = frame_len;
+	CHECK_EQUAL(SUCCESS, mac_rx_read(0, enc_header_read, frame_len - ETH_CRCLEN));
+	CHECK_EQUAL(FAILURE, mac_rx_read(1, enc_header_read, frame_len - ETH_CRCLEN));
+
+	return enc_header_wants;
+}
+#endif
+
+/** A frame of a type nobody minds, its payload counting up from seed **/
+static void enc_test_frame(uint8_t *frame, const uint16_t frame_len, const uint8_t seed)
+{
+	uint16_t i = 0;
+	for(i = 0; i < frame_len; i++)
+	{
+		frame[i] = (uint8_t)(seed + i);
+	}
+	sr_memcpy(frame, enc_addr, 6);
+	frame[ETH_PROTOCOL] = 0x88;
+	frame[ETH_PROTOCOL + 1] = 0xB5;
+}
+
+#define ENC_UDP_LEN	(ETH_HEADERLEN + 20 + 8 + 4)
+
+/** To us over UDP, checksums and all **/
+static void enc_udp_frame(uint8_t *frame)
+{
+	enc_test_frame(frame, ENC_UDP_LEN, 0);
+	store_be16(&frame[ETH_PROTOCOL], IPv4);
+
+	uint8_t *ip = &frame[ETH_HEADERLEN];
+	sr_memset(ip, 0, 20);
+	ip[0] = 0x45;
+	store_be16(&ip[2], 20 + 8 + 4);
+	ip[8] = 64;
+	ip[9] = IP_UDP;
+	ip[12] = 192; ip[13] = 168; ip[14] = 0; ip[15] = 7;
+	ip[16] = 192; ip[17] = 168; ip[18] = 0; ip[19] = 2;
+	store_be16(&ip[10], checksum(ip, 20, 10));
+
+	uint8_t *udp = &ip[20];
+	store_be16(&udp[0], 1234);
+	store_be16(&udp[2], 5000);
+	store_be16(&udp[4], 8 + 4);
+	store_be16(&udp[6], 0);
+	udp[8] = 0xA5; udp[9] = 1; udp[10] = 2; udp[11] = 3;
+
+	uint8_t pseudo[12] = { ip[12], ip[13], ip[14], ip[15], ip[16], ip[17], ip[18], ip[19], 0, IP_UDP, udp[4], udp[5] };
+	store_be16(&udp[6], checksum_fragmented(pseudo, sizeof(pseudo), udp, 12, 12 + 6));
+}
+
+/** Call the INT pin interrupt **/
+static void enc_interrupt(void)
+{
+	modelInIsr = true;
+	modelIntEnabled = false;
+	enc28j60_int();
+	modelIntEnabled = true;
+	modelInIsr = false;
+}
+
+TEST_GROUP(enc28j60)
+{
+	void setup()
+	{
+		model_reset();
+
+		modelIntEnabled = false;
+		CHECK_EQUAL(SUCCESS, init_mac());
+		modelIntEnabled = true;
+
+		set_frame_complete(&enc_frame_complete);
+#ifdef MAC_RX_STREAM
+		set_frame_header(NULL);
+#endif
+
+		enc_offload = MAC_OFFLOAD_NONE;
+		enc_scheduled = 0;
+		enc_frames = 0;
+		enc_frame_len = 0;
+	}
+
+	void teardown()
+	{
+		// Main loop SPI never races the interrupt
+		CHECK_EQUAL(0, modelUnmaskedSpi);
+		CHECK_EQUAL(0, modelIsrUnmasked);
+	}
+};
+
+TEST(enc28j60, tsv_sent)
+{
+	// 60 byte frame, done, no collisions or errors
+	const uint8_t good[TX_STATUS_LEN] = { 0x3C, 0x00, 0x80, 0x00, 0x00, 0x00, 0x00 };
+	CHECK(TSV_SENT(good));
+
+	// Went after a few collisions
+	const uint8_t retried[TX_STATUS_LEN] = { 0x3C, 0x00, 0x83, 0x00, 0x00, 0x00, 0x00 };
+	CHECK(TSV_SENT(retried));
+
+	// Collision count alone isn't done (bit 19)
+	const uint8_t collided[TX_STATUS_LEN] = { 0x3C, 0x00, 0x0F, 0x00, 0x00, 0x00, 0x00 };
+	CHECK(!TSV_SENT(collided));
+
+	const uint8_t nothing[TX_STATUS_LEN] = { 0 };
+	CHECK(!TSV_SENT(nothing));
+}
+
+TEST(enc28j60, rx_frames_in_order)
+{
+	uint8_t frame[100];
+	enc_test_frame(frame, sizeof(frame), 1);
+	uint16_t following = model_rx_frame(RX_START, frame, sizeof(frame));
+
+	uint8_t second[60];
+	enc_test_frame(second, sizeof(second), 2);
+	following = model_rx_frame(following, second, sizeof(second));
+
+	// The interrupt leaves the reading to the main loop
+	enc_interrupt();
+	CHECK_EQUAL(1, enc_scheduled);
+	CHECK(!(modelRegs[0][EIE] & EIE_PKTIE));
+
+	CHECK_EQUAL(2, poll_mac(8));
+	CHECK_EQUAL(2, enc_frames);
+	CHECK_EQUAL((uint16_t)(sizeof(second) + ETH_CRCLEN), enc_frame_len);
+	CHECK(sr_memcmp(enc_frame, second, sizeof(second)));
+
+	// Space given back, one short of the next frame
+	CHECK_EQUAL(0, modelRegs[1][EPKTCNT]);
+	CHECK_EQUAL(following, next_packet);
+	CHECK_EQUAL(following - 1, model_reg16(ERXRDPTL));
+	CHECK_EQUAL(0, poll_mac(8));
+}
+
+TEST(enc28j60, rx_irq_masked)
+{
+	uint8_t frame[60];
+	enc_test_frame(frame, sizeof(frame), 5);
+	model_rx_frame(RX_START, frame, sizeof(frame));
+
+	// From the interrupt, which leaves INT off (see teardown)
+	enc_interrupt();
+	CHECK_EQUAL(1, enc_scheduled);
+	CHECK(!(modelRegs[0][EIE] & EIE_PKTIE));
+
+	// From the main loop, with INT off round the SPI
+	mac_rx_irq(true);
+	CHECK(modelRegs[0][EIE] & EIE_PKTIE);
+	CHECK(modelIntEnabled);
+	mac_rx_irq(false);
+	CHECK(!(modelRegs[0][EIE] & EIE_PKTIE));
+	CHECK(modelIntEnabled);
+}
+
+TEST(enc28j60, rx_ring_wrap)
+{
+	// Header and frame both run off the end of the ring
+	uint8_t frame[200];
+	enc_test_frame(frame, sizeof(frame), 3);
+
+	next_packet = RX_END - 3;
+	const uint16_t following = model_rx_frame(next_packet, frame, sizeof(frame));
+	CHECK(following < next_packet);
+
+	CHECK_EQUAL(1, poll_mac(8));
+	CHECK_EQUAL(1, enc_frames);
+	CHECK_EQUAL((uint16_t)(sizeof(frame) + ETH_CRCLEN), enc_frame_len);
+	CHECK(sr_memcmp(enc_frame, frame, sizeof(frame)));
+	CHECK_EQUAL(following, next_packet);
+	CHECK_EQUAL(following - 1, model_reg16(ERXRDPTL));
+
+	// Just before the top, ERXRDPT goes back to RX_END
+	next_packet = RX_END + 1 - RX_HEADER_LEN - (60 + ETH_CRCLEN);
+	CHECK_EQUAL(RX_START, model_rx_frame(next_packet, frame, 60));
+	CHECK_EQUAL(1, poll_mac(8));
+	CHECK_EQUAL(RX_END, model_reg16(ERXRDPTL));
+}
+
+TEST(enc28j60, rx_longer_than_rx_frame)
+{
+	static uint8_t frame[sizeof(rx_frame) + 100];
+	enc_test_frame(frame, sizeof(frame), 6);
+
+	// Read whole, so it doesn't fit
+	model_rx_frame(RX_START, frame, sizeof(frame));
+	CHECK_EQUAL(1, poll_mac(8));
+	CHECK_EQUAL(0, enc_frames);
+	CHECK_EQUAL(0, modelRegs[1][EPKTCNT]);
+}
+
+#ifdef MAC_RX_STREAM
+TEST(enc28j60, rx_stream_longer_than_rx_frame)
+{
+	static uint8_t frame[sizeof(rx_frame) + 100];
+	enc_test_frame(frame, sizeof(frame), 7);
+	set_frame_header(&enc_frame_header);
+	enc_header_calls = 0;
+
+	// frame_header sees all of it from the MAC
+	enc_header_wants = false;
+	uint16_t following = model_rx_frame(RX_START, frame, sizeof(frame));
+	CHECK_EQUAL(1, poll_mac(8));
+	CHECK_EQUAL(1, enc_header_calls);
+	CHECK_EQUAL((uint16_t)(sizeof(frame) + ETH_CRCLEN), enc_header_frame_len);
+	CHECK(sr_memcmp(enc_header_read, frame, sizeof(frame)));
+	CHECK_EQUAL(0, enc_frames);
+
+	// Wanted, but too long to read in
+	enc_header_wants = true;
+	model_rx_frame(following, frame, sizeof(frame));
+	CHECK_EQUAL(1, poll_mac(8));
+	CHECK_EQUAL(2, enc_header_calls);
+	CHECK_EQUAL(0, enc_frames);
+
+	// Short enough is read in
+	following = next_packet;
+	model_rx_frame(following, frame, 100);
+	CHECK_EQUAL(1, poll_mac(8));
+	CHECK_EQUAL(1, enc_frames);
+	CHECK(sr_memcmp(enc_frame, frame, 100));
+}
+#endif
+
+TEST(enc28j60, rx_checksums_receive_off)
+{
+	enc_offload = MAC_OFFLOAD_RX_CSUM;
+
+	uint8_t frame[ENC_UDP_LEN];
+	enc_udp_frame(frame);
+	uint16_t following = model_rx_frame(RX_START, frame, sizeof(frame));
+
+	CHECK_EQUAL(1, poll_mac(8));
+	CHECK_EQUAL(1, enc_frames);
+
+	// No DMA while a frame could come in (errata), and back on after
+	CHECK(modelDmaRuns > 0);
+	CHECK_EQUAL(0, modelDmaWithRx);
+	CHECK(modelRegs[0][ECON1] & ECON1_RXEN);
+
+	// Bad UDP checksum
+	frame[ENC_UDP_LEN - 1] ^= 0x10;
+	model_rx_frame(following, frame, sizeof(frame));
+
+	CHECK_EQUAL(1, poll_mac(8));
+	CHECK_EQUAL(1, enc_frames);
+	CHECK_EQUAL(0, modelDmaWithRx);
+	CHECK(modelRegs[0][ECON1] & ECON1_RXEN);
+}
+
+TEST(enc28j60, rx_bad_following)
+{
+	uint8_t frame[60];
+	enc_test_frame(frame, sizeof(frame), 4);
+
+	// Odd
+	next_packet = 0x0100;
+	model_rx_frame(next_packet, frame, sizeof(frame));
+	modelMemory[0x0100 + RSV_NEXT] |= 0x01;
+
+	CHECK_EQUAL(0, poll_mac(8));
+	CHECK_EQUAL(0, enc_frames);
+	CHECK_EQUAL(1, modelRxResets);
+	CHECK_EQUAL(RX_START, next_packet);
+	CHECK(modelRegs[0][ECON1] & ECON1_RXEN);
+
+	// Past the end of the ring
+	model_reset();
+	modelIntEnabled = false;
+	init_mac();
+	modelIntEnabled = true;
+
+	model_rx_frame(RX_START, frame, sizeof(frame));
+	modelMemory[RX_START + RSV_NEXT + 1] = (RX_END + 1) >> 8;
+
+	CHECK_EQUAL(0, poll_mac(8));
+	CHECK_EQUAL(0, enc_frames);
+	CHECK_EQUAL(1, modelRxResets);
+}
+
+TEST(enc28j60, tx_queue_full)
+{
+	uint8_t frame[100 + ETH_CRCLEN];
+	uint8_t i = 0;
+
+	// The first goes straight out, the rest wait behind it
+	for(i = 0; i < TX_QUEUE_LEN; i++)
+	{
+		enc_test_frame(frame, sizeof(frame), 10 + i);
+		CHECK_EQUAL(SUCCESS, send_frame(frame, sizeof(frame)));
+	}
+	CHECK_EQUAL(1, modelTxStarted);
+	CHECK_EQUAL(TX_QUEUE_LEN, tx_count);
+
+	uint16_t start = 0;
+	CHECK(!tx_space(TX_CONTROL_LEN + 100 + TX_STATUS_LEN, &start));
+
+	// Each one done frees a slot and starts the next
+	for(i = 0; i < TX_QUEUE_LEN; i++)
+	{
+		model_tx_done();
+		enc_test_frame(frame, sizeof(frame), 10 + i);
+		CHECK_EQUAL(100 + TX_CONTROL_LEN, modelTxFrameLen);
+		CHECK(sr_memcmp(&modelTxFrame[TX_CONTROL_LEN], frame, 100));
+
+		enc_interrupt();
+		CHECK_EQUAL(TX_QUEUE_LEN - 1 - i, tx_count);
+	}
+
+	CHECK_EQUAL(TX_QUEUE_LEN, modelTxStarted);
+	CHECK_EQUAL(0, modelTxResets);
+	CHECK(!tx_busy);
+
+	// Nothing left, so nothing to keep INT low
+	CHECK(!(modelRegs[0][EIR] & (EIR_TXIF | EIR_TXERIF)));
+	CHECK(tx_space(TX_CONTROL_LEN + 100 + TX_STATUS_LEN, &start));
+}
+
+TEST(enc28j60, tx_failed_resets)
+{
+	uint8_t frame[60 + ETH_CRCLEN];
+	enc_test_frame(frame, sizeof(frame), 20);
+	send_frame(frame, sizeof(frame));
+
+	// Gave up (no done bit), so the transmit logic is reset
+	modelTsvStatus = 0x0F;
+	model_tx_done();
+	enc_interrupt();
+
+	CHECK_EQUAL(1, modelTxResets);
+	CHECK_EQUAL(0, tx_count);
+	CHECK(!(modelRegs[0][ECON1] & ECON1_TXRTS));
+}
@@ -27,7 +27,7 @@ TEST_GROUP(ethernet)
 		static bool bRunOnce = false;
 		if(!bRunOnce)
 		{	
-			ether_packet_callbacks[0].required_type = ARP;
+			SIP->ether.callbacks[0].required_type = ARP;
 		}
 
 		//Should always be SUCCESS.
@@ -38,22 +38,22 @@ TEST_GROUP(ethernet)
 		if(!bRunOnce)
 		{
 			// Check it initialised to INVALID
-			CHECK_EQUAL(INVALID, ether_packet_callbacks[0].required_type);
+			CHECK_EQUAL(INVALID, SIP->ether.callbacks[0].required_type);
 			bRunOnce = true;
 		}
 
 		// Clean up anything from other tests (which might cause this test to be skipped)
-		ether_packet_callbacks[0].required_type = INVALID;
+		SIP->ether.callbacks[0].required_type = INVALID;
 
 	}
 
 	void teardown()
 	{
 		// Last test cleaned up ok
-		CHECK_EQUAL(INVALID, ether_packet_callbacks[0].required_type);
-		CHECK_EQUAL(INVALID, ether_packet_callbacks[1].required_type);
-		CHECK_EQUAL(INVALID, ether_packet_callbacks[2].required_type);
-		CHECK_EQUAL(INVALID, ether_packet_callbacks[3].required_type);
+		CHECK_EQUAL(INVALID, SIP->ether.callbacks[0].required_type);
+		CHECK_EQUAL(INVALID, SIP->ether.callbacks[1].required_type);
+		CHECK_EQUAL(INVALID, SIP->ether.callbacks[2].required_type);
+		CHECK_EQUAL(INVALID, SIP->ether.callbacks[3].required_type);
 	}
 };
 
@@ -63,12 +63,12 @@ TEST(ethernet, set_ether_addr)
 	const uint8_t addr[] = {0xFE, 0xDC, 0xBA, 0xAB, 0xCD, 0xEF};
 	set_ether_addr(addr);
 	
-	BYTES_EQUAL(addr[0], ethernet_addr[0]);
-	BYTES_EQUAL(addr[1], ethernet_addr[1]);
-	BYTES_EQUAL(addr[2], ethernet_addr[2]);
-	BYTES_EQUAL(addr[3], ethernet_addr[3]);
-	BYTES_EQUAL(addr[4], ethernet_addr[4]);
-	BYTES_EQUAL(addr[5], ethernet_addr[5]);
+	BYTES_EQUAL(addr[0], SIP->ether.addr[0]);
+	BYTES_EQUAL(addr[1], SIP->ether.addr[1]);
+	BYTES_EQUAL(addr[2], SIP->ether.addr[2]);
+	BYTES_EQUAL(addr[3], SIP->ether.addr[3]);
+	BYTES_EQUAL(addr[4], SIP->ether.addr[4]);
+	BYTES_EQUAL(addr[5], SIP->ether.addr[5]);
 }
 
 TEST(ethernet, get_ether_addr)
@@ -96,8 +96,8 @@ TEST(ethernet, add_ether_packet_callback)
 
 	add_ether_packet_callback(ARP, (void(*)(const uint8_t*,const uint16_t))7);
 	
-	CHECK_EQUAL(ARP, ether_packet_callbacks[0].required_type);
-	POINTERS_EQUAL((const void*)(void(*)(const uint8_t*,const uint16_t))7, (const void*)ether_packet_callbacks[0].fn_callback);
+	CHECK_EQUAL(ARP, SIP->ether.callbacks[0].required_type);
+	POINTERS_EQUAL((const void*)(void(*)(const uint8_t*,const uint16_t))7, (const void*)SIP->ether.callbacks[0].fn_callback);
 
 	remove_ether_packet_callback(ARP, (void(*)(const uint8_t*,const uint16_t))7);
 }
@@ -110,8 +110,8 @@ TEST(ethernet, remove_ether_packet_callback)
 
 	remove_ether_packet_callback(ARP, (void(*)(const uint8_t*,const uint16_t))7);
 	
-	CHECK_EQUAL(INVALID, ether_packet_callbacks[0].required_type);
-	CHECK_EQUAL(IPv4, ether_packet_callbacks[1].required_type);
+	CHECK_EQUAL(INVALID, SIP->ether.callbacks[0].required_type);
+	CHECK_EQUAL(IPv4, SIP->ether.callbacks[1].required_type);
 
 	remove_ether_packet_callback(IPv4, (void(*)(const uint8_t*,const uint16_t))7);
 }
@@ -154,3 +154,283 @@ TEST(ethernet, send_ether_packet)
 
 
 }
+
+#ifdef MAC_POLL
+// In blank_driver.c
+extern "C" uint16_t driverFramesWaiting;
+extern "C" bool driverRxIrq;
+
+TEST_GROUP(ether_poll)
+{
+	void setup()
+	{
+		init_ethernet();
+		set_ether_busy_poll(false);
+		while(ether_poll(100));
+	}
+};
+
+TEST(ether_poll, interrupt_off_until_dry)
+{
+	CHECK(driverRxIrq);
+
+	// Nothing happens until the interrupt goes off
+	driverFramesWaiting = 20;
+	CHECK(!ether_poll(8));
+	CHECK_EQUAL(20, driverFramesWaiting);
+
+	ether_rx_schedule();
+	CHECK(!driverRxIrq);
+
+	// A budget at a time
+	CHECK(ether_poll(8));
+	CHECK_EQUAL(12, driverFramesWaiting);
+	CHECK(ether_poll(8));
+	CHECK_EQUAL(4, driverFramesWaiting);
+	CHECK(!driverRxIrq);
+
+	// Then the interrupt comes back
+	CHECK(!ether_poll(8));
+	CHECK_EQUAL(0, driverFramesWaiting);
+	CHECK(driverRxIrq);
+}
+
+TEST(ether_poll, busy_poll)
+{
+	set_ether_busy_poll(true);
+	CHECK(!driverRxIrq);
+
+	// No interrupt needed, and it stays off
+	driverFramesWaiting = 3;
+	CHECK(!ether_poll(8));
+	CHECK_EQUAL(0, driverFramesWaiting);
+	CHECK(!driverRxIrq);
+
+	set_ether_busy_poll(false);
+	CHECK(!ether_poll(8));
+	CHECK(driverRxIrq);
+}
+#endif
+
+
+#ifdef MAC_GATHER
+extern "C" bool driverGathered;
+extern "C" uint8_t* driverLastPacketSent;
+extern "C" uint16_t driverLastPacketLen;
+
+TEST_GROUP(ether_gather)
+{
+	void setup()
+	{
+		init_ethernet();
+		driverGathered = false;
+	}
+};
+
+TEST(ether_gather, only_without_padding)
+{
+	uint8_t dest[6] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 };
+	uint8_t payload[ETH_MINDATA] = { 0 };
+
+	// Short ones need padding, so are copied
+	send_ether_packet(dest, payload, ETH_MINDATA - 1, ARP);
+	CHECK(!driverGathered);
+
+	send_ether_packet(dest, payload, ETH_MINDATA, ARP);
+	CHECK(driverGathered);
+	CHECK_EQUAL(ETH_HEADERLEN + ETH_MINDATA + ETH_CRCLEN, driverLastPacketLen);
+	CHECK(sr_memcmp(driverLastPacketSent, dest, 6));
+}
+#endif
+
+
+#ifdef MAC_STREAM
+TEST_GROUP(ether_stream)
+{
+	void setup()
+	{
+		init_ethernet();
+		driverLastPacketLen = 0;
+	}
+};
+
+TEST(ether_stream, built_in_pieces)
+{
+	uint8_t dest[6] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 };
+	uint8_t payload[50];
+
+	uint8_t i = 0;
+	for(i = 0; i < sizeof(payload); i++)
+	{
+		payload[i] = i;
+	}
+
+	CHECK_EQUAL(SUCCESS, ether_stream_begin(dest, sizeof(payload), ARP));
+
+	// Any order, but not off the end
+	CHECK_EQUAL(SUCCESS, ether_stream_write(20, &payload[20], 30));
+	CHECK_EQUAL(SUCCESS, ether_stream_write(0, payload, 20));
+	CHECK_EQUAL(FAILURE, ether_stream_write(49, payload, 2));
+
+	// Only one at a time
+	CHECK_EQUAL(FAILURE, ether_stream_begin(dest, 10, ARP));
+
+	CHECK_EQUAL(SUCCESS, ether_stream_end(true));
+	CHECK_EQUAL(ETH_HEADERLEN + 50 + ETH_CRCLEN, driverLastPacketLen);
+	CHECK(sr_memcmp(driverLastPacketSent, dest, 6));
+	CHECK_EQUAL(0x08, driverLastPacketSent[ETH_PROTOCOL]);
+	CHECK_EQUAL(0x06, driverLastPacketSent[ETH_PROTOCOL + 1]);
+	CHECK(sr_memcmp(&driverLastPacketSent[ETH_HEADERLEN], payload, sizeof(payload)));
+}
+
+TEST(ether_stream, thrown_away)
+{
+	uint8_t dest[6] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 };
+
+	CHECK_EQUAL(SUCCESS, ether_stream_begin(dest, 40, ARP));
+	CHECK_EQUAL(SUCCESS, ether_stream_end(false));
+	CHECK_EQUAL(0, driverLastPacketLen);
+
+	// Nothing left open
+	CHECK_EQUAL(FAILURE, ether_stream_end(true));
+	CHECK_EQUAL(FAILURE, ether_stream_begin(dest, ETH_STREAM_MAXDATA + 1, ARP));
+}
+#endif
+
+
+#ifdef MAC_RX_STREAM
+// In blank_driver.c
+extern "C" bool (*cb_frame_header)(const uint8_t *header, const uint16_t header_len, const uint16_t frame_len);
+extern "C" const uint8_t *driverRxFrame;
+extern "C" uint16_t driverRxFrameLen;
+extern "C" uint16_t driverRxBytesRead;
+
+/** Local experimental, so nothing else has a handler for it */
+#define RX_STREAM_TYPE	((ETHERNET_TYPE)0x88B5)
+
+/** What ether_rx_stream_header saw and read */
+static uint8_t rx_stream_read[10];
+static uint16_t rx_stream_packet_len = 0;
+static bool rx_stream_want = false;
+
+static bool ether_rx_stream_header(const uint8_t *header, const uint16_t header_len, const uint16_t packet_len)
+{
+	rx_stream_packet_len = packet_len;
+
+	// Some of the payload past what we were given, but not off the end
+	CHECK_EQUAL(SUCCESS, ether_rx_read(40, rx_stream_read, 10));
+	CHECK_EQUAL(FAILURE, ether_rx_read(packet_len - 2, rx_stream_read, 4));
+
+	return rx_stream_want;
+}
+
+TEST_GROUP(ether_rx_stream)
+{
+	uint8_t frame[100];
+
+	void setup()
+	{
+		init_ethernet();
+
+		uint8_t i = 0;
+		for(i = 0; i < 100; i++)
+		{
+			frame[i] = i;
+		}
+		frame[ETH_PROTOCOL] = 0x88;
+		frame[ETH_PROTOCOL + 1] = 0xB5;
+
+		driverRxFrame = frame;
+		driverRxFrameLen = 100 - ETH_CRCLEN;
+		driverRxBytesRead = 0;
+		ether_count_mock_calls = 0;
+		rx_stream_packet_len = 0;
+		rx_stream_want = false;
+	}
+
+	void teardown()
+	{
+		driverRxFrame = NULL;
+
+		// Tests clean up after themselves
+		uint8_t i = 0;
+		for(i = 0; i < ETHER_CALLBACK_SIZE; i++)
+		{
+			CHECK(SIP->ether.callbacks[i].required_type != RX_STREAM_TYPE);
+		}
+	}
+};
+
+TEST(ether_rx_stream, registered_with_the_mac)
+{
+	CHECK(cb_frame_header == &ether_frame_header);
+}
+
+TEST(ether_rx_stream, nobody_wants_it)
+{
+	CHECK(!ether_frame_header(frame, ETH_RX_PEEKLEN, 100));
+	CHECK_EQUAL(0, driverRxBytesRead);
+}
+
+TEST(ether_rx_stream, whole_frame_handler)
+{
+	add_ether_packet_callback(RX_STREAM_TYPE, &ethernet_test_mock);
+
+	CHECK(ether_frame_header(frame, ETH_RX_PEEKLEN, 100));
+	CHECK_EQUAL(0, driverRxBytesRead);
+
+	remove_ether_packet_callback(RX_STREAM_TYPE, &ethernet_test_mock);
+}
+
+TEST(ether_rx_stream, header_handler_reads_some)
+{
+	add_ether_header_callback(RX_STREAM_TYPE, &ether_rx_stream_header);
+	add_ether_packet_callback(RX_STREAM_TYPE, &ethernet_test_mock);
+
+	// It decides for the whole frame handler too
+	CHECK(!ether_frame_header(frame, ETH_RX_PEEKLEN, 100));
+	CHECK_EQUAL(100 - ETH_HEADERLEN - ETH_CRCLEN, rx_stream_packet_len);
+	CHECK_EQUAL(10, driverRxBytesRead);
+	CHECK(sr_memcmp(rx_stream_read, &frame[ETH_HEADERLEN + 40], 10));
+
+	rx_stream_want = true;
+	CHECK(ether_frame_header(frame, ETH_RX_PEEKLEN, 100));
+
+	// Nothing goes to the header handler here
+	ether_frame_available(frame, 100);
+	CHECK_EQUAL(1, ether_count_mock_calls);
+
+	CHECK_EQUAL(SUCCESS, remove_ether_header_callback(RX_STREAM_TYPE, &ether_rx_stream_header));
+	CHECK_EQUAL(FAILURE, remove_ether_header_callback(RX_STREAM_TYPE, &ether_rx_stream_header));
+	remove_ether_packet_callback(RX_STREAM_TYPE, &ethernet_test_mock);
+}
+
+static uint16_t rx_stream_tap_len = 0;
+static bool rx_stream_tap_outgoing = false;
+
+static void ether_rx_stream_tap(const uint8_t *frame, const uint16_t frame_len, const bool outgoing)
+{
+	rx_stream_tap_len = frame_len;
+	rx_stream_tap_outgoing = outgoing;
+}
+
+TEST(ether_rx_stream, tap_sees_everything)
+{
+	set_ether_tap(&ether_rx_stream_tap);
+	CHECK(ether_frame_header(frame, ETH_RX_PEEKLEN, 100));
+	set_ether_tap(NULL);
+}
+
+TEST(ether_rx_stream, tap_without_fcs)
+{
+	set_ether_tap(&ether_rx_stream_tap);
+
+	// As for frames sent, the tap doesn't get the FCS
+	rx_stream_tap_outgoing = true;
+	ether_frame_available(frame, 100);
+	set_ether_tap(NULL);
+
+	CHECK_EQUAL(100 - ETH_CRCLEN, rx_stream_tap_len);
+	CHECK(!rx_stream_tap_outgoing);
+}
+#endif
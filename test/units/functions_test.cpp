@@ -108,6 +108,18 @@ TEST(functions, checksum_blank)
 	CHECK_EQUAL(0xFFFF, cs);
 }
 
+TEST(functions, checksum_odd_length)
+{
+	// Whatever is after the last byte must not count
+	uint8_t buff[] = { 0x00, 0x01, 0x02, 0xAA };
+
+	uint16_t cs = checksum(buff, 3, 10);
+	CHECK_EQUAL(0xFDFE, cs);
+
+	cs = checksum_fragmented(buff, 2, &buff[2], 1, 10);
+	CHECK_EQUAL(0xFDFE, cs);
+}
+
 TEST(functions, checksum_short_ip)
 {
 	uint8_t buff[] = {
@@ -181,3 +193,162 @@ TEST(functions, checksum_fragmented_udp)
 	uint16_t cs = checksum_fragmented(buff1, 12, buff2, 16, 18);
 	CHECK_EQUAL(0xc81e, cs);
 }
+
+TEST(functions, checksum_long)
+{
+	// More than 255 bytes (the index used to wrap)
+	uint8_t buff[600];
+	sr_memset(buff, 0x01, sizeof(buff));
+
+	// 300 words of 0x0101
+	uint16_t cs = checksum(buff, 600, 0xFF);
+	CHECK_EQUAL((uint16_t)~(0x0101 * 300 % 0xFFFF), cs);
+
+	cs = checksum_fragmented(buff, 300, &buff[300], 300, 0xFF);
+	CHECK_EQUAL((uint16_t)~(0x0101 * 300 % 0xFFFF), cs);
+}
+
+TEST(functions, checksum_partial)
+{
+	uint8_t buff[] = {
+		0x45, 0x00, 0x00, 0x24, 0x00, 0x00, 0x00, 0x00, 0xc8, 0x11, 0x00, 0x00, 0xc0, 0xa8, 0x01, 0x01, 0xc0, 0xa8, 0x01, 0x02
+	};
+
+	// In pieces, as long as each starts on a word
+	uint32_t sum = checksum_partial(buff, 6, 0);
+	sum = checksum_partial(&buff[6], 12, sum);
+	sum = checksum_partial(&buff[18], 2, sum);
+	CHECK_EQUAL(0x6F75, checksum_finish(sum));
+
+	// Same as all at once
+	CHECK_EQUAL(checksum(buff, 20, 10), checksum_finish(checksum_partial(buff, 20, 0)));
+}
+
+TEST(functions, checksum_copy)
+{
+	uint8_t src[301];
+	uint8_t dest[304] = {0};
+	uint16_t i = 0;
+	for(i = 0; i < sizeof(src); i++)
+	{
+		src[i] = (uint8_t)(i * 7 + 3);
+	}
+
+	// Odd lengths and unaligned buffers too
+	uint16_t len = 0;
+	for(len = 0; len <= sizeof(src) - 1; len += 37)
+	{
+		sr_memset(dest, 0, sizeof(dest));
+		uint32_t sum = checksum_copy(&dest[1], &src[1], len, 0);
+
+		CHECK(sr_memcmp(&dest[1], &src[1], len));
+		CHECK_EQUAL(0, dest[len + 1]);
+		CHECK_EQUAL(checksum(&src[1], len, 0xFF), checksum_finish(sum));
+	}
+}
+
+/* Plain C versions, for checking the processor specific
+ * loops (SR_MEM_ASM) against on the target */
+static uint16_t reference_checksum(const uint8_t *buffer, uint16_t len)
+{
+	uint32_t sum = 0;
+	uint16_t i = 0;
+	for(i = 0; i < len; i += 2)
+	{
+		sum += (buffer[i] << 8) | ((i + 1 < len) ? buffer[i + 1] : 0);
+	}
+
+	while(sum >> 16)
+	{
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	}
+
+	sum = ~sum & 0xFFFF;
+	return (sum == 0) ? 0xFFFF : (uint16_t)sum;
+}
+
+static bool reference_equal(const uint8_t *a, const uint8_t *b, uint16_t len)
+{
+	uint16_t i = 0;
+	for(i = 0; i < len; i++)
+	{
+		if(a[i] != b[i])
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+TEST(functions, kernels_match_reference)
+{
+	uint8_t src[80];
+	uint8_t dest[84];
+	uint16_t i = 0;
+	for(i = 0; i < sizeof(src); i++)
+	{
+		src[i] = (uint8_t)(0xF0 + i * 13);
+	}
+
+	// Every alignment, and lengths either side of whole blocks
+	uint8_t from = 0;
+	uint8_t to = 0;
+	uint16_t len = 0;
+	for(from = 0; from < 4; from++)
+	{
+		for(to = 0; to < 4; to++)
+		{
+			for(len = 0; len + from <= sizeof(src) && len + to < sizeof(dest); len++)
+			{
+				uint8_t expected = (uint8_t)(len + 0x5A);
+
+				sr_memset(dest, expected, sizeof(dest));
+				sr_memcpy(&dest[to], &src[from], len);
+				CHECK(reference_equal(&dest[to], &src[from], len));
+				CHECK_EQUAL(expected, dest[to + len]);
+				CHECK(sr_memcmp(&dest[to], &src[from], len));
+
+				if(len > 0)
+				{
+					dest[to + len - 1] ^= 0x01;
+					CHECK(!sr_memcmp(&dest[to], &src[from], len));
+				}
+
+				sr_memset(dest, expected, sizeof(dest));
+				uint32_t sum = checksum_copy(&dest[to], &src[from], len, 0);
+				CHECK(reference_equal(&dest[to], &src[from], len));
+				CHECK_EQUAL(expected, dest[to + len]);
+				CHECK_EQUAL(reference_checksum(&src[from], len), checksum_finish(sum));
+				CHECK_EQUAL(reference_checksum(&src[from], len), checksum_finish(checksum_partial(&src[from], len, 0)));
+			}
+		}
+	}
+}
+
+TEST(functions, byteorder_any_alignment)
+{
+	uint8_t buffer[8] = {0};
+
+	uint8_t offset = 0;
+	for(offset = 0; offset < 4; offset++)
+	{
+		sr_memset(buffer, 0, sizeof(buffer));
+
+		store_be16(&buffer[offset], 0x1234);
+		CHECK_EQUAL(0x12, buffer[offset]);
+		CHECK_EQUAL(0x34, buffer[offset + 1]);
+		CHECK_EQUAL(0x1234, load_be16(&buffer[offset]));
+
+		store_be32(&buffer[offset], 0x89ABCDEFUL);
+		CHECK_EQUAL(0x89, buffer[offset]);
+		CHECK_EQUAL(0xAB, buffer[offset + 1]);
+		CHECK_EQUAL(0xCD, buffer[offset + 2]);
+		CHECK_EQUAL(0xEF, buffer[offset + 3]);
+		CHECK(load_be32(&buffer[offset]) == 0x89ABCDEFUL);
+	}
+
+	uint16_t nbo = uint16_to_nbo(0x0102);
+	CHECK_EQUAL(0x01, ((uint8_t *)&nbo)[0]);
+	CHECK_EQUAL(0x0102, uint16_from_nbo(nbo));
+}
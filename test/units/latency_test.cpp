@@ -0,0 +1,101 @@
+#include "latency_test.h"
+#include "CppUTest/TestHarness.h"
+
+// The file we are testing:
+extern "C"
+{
+#include "latency.c"
+}
+
+TEST_GROUP(latency)
+{
+	/* Histograms are global, so start
+	 * and finish with them empty. */
+	void setup()
+	{
+		reset_latency(LATENCY_RX);
+		reset_latency(LATENCY_TX);
+	}
+
+	void teardown()
+	{
+		reset_latency(LATENCY_RX);
+		reset_latency(LATENCY_TX);
+	}
+};
+
+TEST(latency, buckets_are_continuous)
+{
+	// Every value should land in the same or the next bucket as the one before
+	uint8_t last = 0;
+	uint32_t value = 0;
+	for(value = 0; value < (1UL << LATENCY_MAX_BITS); value++)
+	{
+		uint8_t bucket = latency_bucket(value);
+		CHECK(bucket == last || bucket == last + 1);
+		CHECK(value <= latency_bucket_top(bucket));
+		last = bucket;
+	}
+
+	CHECK_EQUAL(LATENCY_BUCKETS - 1, last);
+}
+
+TEST(latency, small_values_exact)
+{
+	CHECK_EQUAL(0, latency_bucket(0));
+	CHECK_EQUAL(1, latency_bucket(1));
+	CHECK_EQUAL(3, latency_bucket(3));
+	CHECK_EQUAL(3, latency_bucket_top(3));
+}
+
+TEST(latency, large_values_clamped)
+{
+	CHECK_EQUAL(LATENCY_BUCKETS - 1, latency_bucket(0xFFFFFFFF));
+	CHECK_EQUAL(LATENCY_BUCKETS - 1, latency_bucket(1UL << LATENCY_MAX_BITS));
+
+	latency_add(LATENCY_RX, 0xFFFFFFFF);
+	CHECK_EQUAL(0xFFFFFFFF, get_latency_max(LATENCY_RX));
+	CHECK_EQUAL(0xFFFFFFFF, get_latency_percentile(LATENCY_RX, 500));
+}
+
+TEST(latency, empty)
+{
+	CHECK_EQUAL(0, get_latency_count(LATENCY_TX));
+	CHECK_EQUAL(0, get_latency_percentile(LATENCY_TX, 999));
+}
+
+TEST(latency, percentiles)
+{
+	// 999 quick ones and a single ARP stall
+	int i = 0;
+	for(i = 0; i < 999; i++)
+	{
+		latency_add(LATENCY_TX, 2);
+	}
+	latency_add(LATENCY_TX, 15000);
+
+	CHECK_EQUAL(1000, get_latency_count(LATENCY_TX));
+	CHECK_EQUAL(2, get_latency_percentile(LATENCY_TX, 500));
+	CHECK_EQUAL(2, get_latency_percentile(LATENCY_TX, 990));
+	CHECK_EQUAL(2, get_latency_percentile(LATENCY_TX, 999));
+	CHECK_EQUAL(15000, get_latency_percentile(LATENCY_TX, 1000));
+
+	// One more stall pushes it into p99.9
+	latency_add(LATENCY_TX, 15000);
+	CHECK_EQUAL(15000, get_latency_percentile(LATENCY_TX, 999));
+
+	// Other path untouched
+	CHECK_EQUAL(0, get_latency_count(LATENCY_RX));
+}
+
+TEST(latency, percentile_within_bucket)
+{
+	latency_add(LATENCY_RX, 1000);
+	latency_add(LATENCY_RX, 1100);
+
+	// 1000 shares a bucket with values up to 1023
+	uint32_t p50 = get_latency_percentile(LATENCY_RX, 500);
+	CHECK(p50 >= 1000);
+	CHECK(p50 < 1000 + (1000 >> LATENCY_SUB_BITS));
+	CHECK_EQUAL(1100, get_latency_percentile(LATENCY_RX, 1000));
+}
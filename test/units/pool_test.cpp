@@ -0,0 +1,176 @@
+#include "pool_test.h"
+#include "CppUTest/TestHarness.h"
+
+// The file we are testing:
+extern "C"
+{
+#include "functions.h"
+#include "pool.c"
+}
+
+/** One spare byte, so the arena can be made to start unaligned */
+static uint8_t pool_arena[POOL_ARENA_SIZE + 1];
+
+/** What the watermark callback saw */
+static uint8_t pool_low_calls = 0;
+static uint16_t pool_low_free = 0;
+
+static void pool_test_low(const POOL_CLASS cls, const uint16_t free)
+{
+	CHECK_EQUAL(POOL_MTU, cls);
+	pool_low_calls++;
+	pool_low_free = free;
+}
+
+TEST_GROUP(pool)
+{
+	void setup()
+	{
+		CHECK_EQUAL(SUCCESS, init_pool(pool_arena, POOL_ARENA_SIZE));
+		pool_low_calls = 0;
+		pool_low_free = 0;
+	}
+};
+
+TEST(pool, arena_too_small)
+{
+	CHECK_EQUAL(FAILURE, init_pool(pool_arena, POOL_ARENA_SIZE - 1));
+	CHECK_EQUAL(FAILURE, init_pool(NULL, POOL_ARENA_SIZE));
+}
+
+TEST(pool, smallest_that_fits)
+{
+	struct pool_stats stats;
+
+	uint8_t *header = pool_alloc(10);
+	uint8_t *small = pool_alloc(POOL_HEADER_SIZE + 1);
+	uint8_t *mtu = pool_alloc(POOL_MTU_SIZE);
+
+	CHECK(header != NULL && small != NULL && mtu != NULL);
+	CHECK(pool_alloc(POOL_MTU_SIZE + 1) == NULL);
+
+	get_pool_stats(POOL_HEADER, &stats);
+	CHECK_EQUAL(POOL_HEADER_COUNT - 1, stats.free);
+	get_pool_stats(POOL_SMALL, &stats);
+	CHECK_EQUAL(POOL_SMALL_COUNT - 1, stats.free);
+	get_pool_stats(POOL_MTU, &stats);
+	CHECK_EQUAL(POOL_MTU_COUNT - 1, stats.free);
+	CHECK_EQUAL(1, stats.allocs);
+
+	// Aligned, and the whole size can be written
+	CHECK(((uintptr_t)header & 7) == 0);
+	sr_memset(mtu, 0xAA, POOL_MTU_SIZE);
+
+	pool_free(header);
+	pool_free(small);
+	pool_free(mtu);
+	pool_free(NULL);
+
+	get_pool_stats(POOL_MTU, &stats);
+	CHECK_EQUAL(POOL_MTU_COUNT, stats.free);
+	CHECK_EQUAL(POOL_MTU_COUNT - 1, stats.low);
+}
+
+TEST(pool, runs_out)
+{
+	uint8_t *buffers[POOL_MTU_COUNT];
+	struct pool_stats stats;
+
+	uint8_t i = 0;
+	for(i = 0; i < POOL_MTU_COUNT; i++)
+	{
+		buffers[i] = pool_alloc(POOL_MTU_SIZE);
+		CHECK(buffers[i] != NULL);
+	}
+
+	CHECK(pool_alloc(POOL_MTU_SIZE) == NULL);
+	get_pool_stats(POOL_MTU, &stats);
+	CHECK_EQUAL(0, stats.free);
+	CHECK_EQUAL(1, stats.fails);
+
+	// What comes back goes out again
+	pool_free(buffers[0]);
+	POINTERS_EQUAL(buffers[0], pool_alloc(POOL_MTU_SIZE));
+
+	for(i = 0; i < POOL_MTU_COUNT; i++)
+	{
+		pool_free(buffers[i]);
+	}
+}
+
+TEST(pool, next_size_up)
+{
+	uint8_t *buffers[POOL_HEADER_COUNT];
+
+	uint8_t i = 0;
+	for(i = 0; i < POOL_HEADER_COUNT; i++)
+	{
+		buffers[i] = pool_alloc(1);
+	}
+
+	uint8_t *spill = pool_alloc(1);
+	CHECK(spill != NULL);
+
+	struct pool_stats stats;
+	get_pool_stats(POOL_SMALL, &stats);
+	CHECK_EQUAL(POOL_SMALL_COUNT - 1, stats.free);
+
+	// And back where it came from
+	pool_free(spill);
+	get_pool_stats(POOL_SMALL, &stats);
+	CHECK_EQUAL(POOL_SMALL_COUNT, stats.free);
+
+	for(i = 0; i < POOL_HEADER_COUNT; i++)
+	{
+		pool_free(buffers[i]);
+	}
+}
+
+TEST(pool, watermark_on_the_way_down)
+{
+	uint8_t *buffers[POOL_MTU_COUNT];
+
+	CHECK_EQUAL(SUCCESS, set_pool_watermark(POOL_MTU, POOL_MTU_COUNT - 1, &pool_test_low));
+	CHECK_EQUAL(FAILURE, set_pool_watermark(POOL_CLASSES, 0, &pool_test_low));
+
+	buffers[0] = pool_alloc(POOL_MTU_SIZE);
+	CHECK_EQUAL(1, pool_low_calls);
+	CHECK_EQUAL(POOL_MTU_COUNT - 1, pool_low_free);
+
+	// Not again while below it
+	buffers[1] = pool_alloc(POOL_MTU_SIZE);
+	CHECK_EQUAL(1, pool_low_calls);
+
+	pool_free(buffers[1]);
+	pool_free(buffers[0]);
+}
+
+TEST(pool, unaligned_arena)
+{
+	CHECK_EQUAL(SUCCESS, init_pool(&pool_arena[1], POOL_ARENA_SIZE));
+
+	uint8_t *buffer = pool_alloc(POOL_MTU_SIZE);
+	CHECK(buffer != NULL);
+	CHECK(((uintptr_t)buffer & 7) == 0);
+	CHECK(buffer + POOL_MTU_SIZE <= &pool_arena[POOL_ARENA_SIZE + 1]);
+
+	pool_free(buffer);
+}
+
+TEST(pool, freed_from_another_context)
+{
+	static struct sip_ctx other;
+	sip_ctx_init(&other);
+
+	uint8_t *buffer = pool_alloc(1);
+
+	// Goes back to the pool it came from, not the current one
+	sip_ctx_use(&other);
+	pool_free(buffer);
+	sip_ctx_use(NULL);
+
+	struct pool_stats stats;
+	get_pool_stats(POOL_HEADER, &stats);
+	CHECK_EQUAL(POOL_HEADER_COUNT, stats.free);
+	CHECK_EQUAL(0, other.pool.classes[POOL_HEADER].free);
+}
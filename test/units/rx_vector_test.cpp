@@ -0,0 +1,144 @@
+#include "rx_vector_test.h"
+#include "CppUTest/TestHarness.h"
+
+// The file we are testing:
+extern "C"
+{
+#include "functions.h"
+#include "sip_ctx.h"
+#include "ethernet.h"
+#include "demux.h"
+#include "rx_vector.c"
+}
+
+static struct sip_ctx rx_vector_ctx;
+
+/** What the handlers saw **/
+static uint16_t rx_vector_udp_calls = 0;
+static uint16_t rx_vector_arp_calls = 0;
+
+static void rx_vector_udp_handler(const uint8_t *buffer, const uint16_t buffer_len)
+{
+	rx_vector_udp_calls++;
+}
+
+static void rx_vector_arp_handler(const uint8_t *buffer, const uint16_t buffer_len)
+{
+	rx_vector_arp_calls++;
+}
+
+#define RX_VECTOR_TEST_LEN	(14 + 20 + 8 + 4 + ETH_CRCLEN)
+
+/** Ethernet, IP and UDP headers plus 4 bytes, checksums and all, then an FCS **/
+static void rx_vector_test_frame(uint8_t *frame, const uint16_t dest_port)
+{
+	sr_memset(frame, 0, RX_VECTOR_TEST_LEN);
+	store_be16(&frame[12], IPv4);
+
+	uint8_t *ip = &frame[14];
+	ip[0] = 0x45;
+	store_be16(&ip[2], 20 + 8 + 4);
+	ip[8] = 64;
+	ip[9] = IP_UDP;
+	ip[12] = 192; ip[13] = 168; ip[14] = 0; ip[15] = 7;
+	ip[16] = 192; ip[17] = 168; ip[18] = 0; ip[19] = 2;
+	store_be16(&ip[10], checksum(ip, 20, 10));
+
+	uint8_t *udp = &ip[20];
+	store_be16(&udp[0], 1234);
+	store_be16(&udp[2], dest_port);
+	store_be16(&udp[4], 8 + 4);
+	udp[8] = 0xA5; udp[9] = 1; udp[10] = 2; udp[11] = 3;
+
+	uint8_t pseudo[12] = { ip[12], ip[13], ip[14], ip[15], ip[16], ip[17], ip[18], ip[19], 0, IP_UDP, udp[4], udp[5] };
+	store_be16(&udp[6], checksum_fragmented(pseudo, sizeof(pseudo), udp, 12, 12 + 6));
+}
+
+TEST_GROUP(rx_vector)
+{
+	void setup()
+	{
+		sip_ctx_init(&rx_vector_ctx);
+		sip_ctx_use(&rx_vector_ctx);
+		init_ethernet();
+		init_demux();
+
+		struct demux_key key;
+		sr_memset((uint8_t *)&key, 0, sizeof(key));
+		key.ether_type = IPv4;
+		key.protocol = IP_UDP;
+		key.dest_port = 5000;
+		CHECK_EQUAL(SUCCESS, add_demux_entry(&key, &rx_vector_udp_handler));
+		CHECK_EQUAL(SUCCESS, add_ether_packet_callback(ARP, &rx_vector_arp_handler));
+
+		rx_vector_udp_calls = 0;
+		rx_vector_arp_calls = 0;
+	}
+
+	void teardown()
+	{
+		sip_ctx_use(NULL);
+	}
+};
+
+TEST(rx_vector, mixed_vector)
+{
+	uint8_t frames[4][RX_VECTOR_TEST_LEN];
+	rx_vector_test_frame(frames[0], 5000);
+	rx_vector_test_frame(frames[1], 5001);		// Nobody on the port
+	rx_vector_test_frame(frames[2], 5000);
+	frames[2][14 + 20 + 8 + 3] ^= 0x10;			// Bad UDP checksum
+	rx_vector_test_frame(frames[3], 5000);
+	store_be16(&frames[3][12], ARP);			// Not for the stages
+
+	struct mac_frame batch[4];
+	uint8_t i = 0;
+	for(i = 0; i < 4; i++)
+	{
+		batch[i].buffer = frames[i];
+		batch[i].len = RX_VECTOR_TEST_LEN;
+	}
+
+	ether_frames_available(batch, 4);
+	CHECK_EQUAL(1, rx_vector_udp_calls);
+	CHECK_EQUAL(1, rx_vector_arp_calls);
+
+	struct rx_stage_stats stats;
+	CHECK_EQUAL(SUCCESS, get_rx_stage_stats(RX_STAGE_ETHER, &stats));
+	CHECK(stats.vectors == 1 && stats.frames == 4 && stats.punted == 1 && stats.dropped == 0);
+	get_rx_stage_stats(RX_STAGE_UDP, &stats);
+	CHECK(stats.frames == 3 && stats.dropped == 2);
+	get_rx_stage_stats(RX_STAGE_DELIVER, &stats);
+	CHECK(stats.frames == 1);
+
+	// Counted as demux_frame would have
+	uint32_t delivered = 0;
+	uint32_t dropped = 0;
+	get_demux_stats(&delivered, &dropped);
+	CHECK_EQUAL(1, delivered);
+	CHECK_EQUAL(2, dropped);
+
+	CHECK_EQUAL(FAILURE, get_rx_stage_stats(RX_STAGES, &stats));
+}
+
+TEST(rx_vector, long_batch)
+{
+	static uint8_t frames[RX_VECTOR_SIZE + 1][RX_VECTOR_TEST_LEN];
+	static struct mac_frame batch[RX_VECTOR_SIZE + 1];
+
+	uint16_t i = 0;
+	for(i = 0; i < RX_VECTOR_SIZE + 1; i++)
+	{
+		rx_vector_test_frame(frames[i], 5000);
+		batch[i].buffer = frames[i];
+		batch[i].len = RX_VECTOR_TEST_LEN;
+	}
+
+	// Cut into two vectors, every frame delivered
+	ether_frames_available(batch, RX_VECTOR_SIZE + 1);
+	CHECK_EQUAL(RX_VECTOR_SIZE + 1, rx_vector_udp_calls);
+
+	struct rx_stage_stats stats;
+	get_rx_stage_stats(RX_STAGE_DELIVER, &stats);
+	CHECK(stats.vectors == 2 && stats.frames == RX_VECTOR_SIZE + 1);
+}
@@ -0,0 +1,91 @@
+#include "sip_ctx_test.h"
+#include "CppUTest/TestHarness.h"
+
+// The file we are testing:
+extern "C"
+{
+#include "ip.h"
+#include "arp.h"
+#include "sip_ctx.c"
+}
+
+static struct sip_ctx ctx_a;
+static struct sip_ctx ctx_b;
+
+TEST_GROUP(sip_ctx)
+{
+	/* Every other test uses the default
+	 * context, so always go back to it. */
+	void setup()
+	{
+		CHECK_EQUAL(SUCCESS, sip_ctx_init(&ctx_a));
+		CHECK_EQUAL(SUCCESS, sip_ctx_init(&ctx_b));
+	}
+
+	void teardown()
+	{
+		sip_ctx_use(NULL);
+		POINTERS_EQUAL(&sip_default_ctx, sip_ctx_get());
+	}
+};
+
+TEST(sip_ctx, init_null)
+{
+	CHECK_EQUAL(FAILURE, sip_ctx_init(NULL));
+}
+
+TEST(sip_ctx, use_returns_old)
+{
+	struct sip_ctx *old = sip_ctx_use(&ctx_a);
+	POINTERS_EQUAL(&sip_default_ctx, old);
+	POINTERS_EQUAL(&ctx_a, sip_ctx_get());
+
+	old = sip_ctx_use(&ctx_b);
+	POINTERS_EQUAL(&ctx_a, old);
+	POINTERS_EQUAL(&ctx_b, SIP);
+}
+
+TEST(sip_ctx, starts_broadcast)
+{
+	sip_ctx_use(&ctx_a);
+
+	const uint8_t *addr = get_ipv4_addr();
+	BYTES_EQUAL(0xFF, addr[0]);
+	BYTES_EQUAL(0xFF, addr[1]);
+	BYTES_EQUAL(0xFF, addr[2]);
+	BYTES_EQUAL(0xFF, addr[3]);
+}
+
+TEST(sip_ctx, contexts_are_independent)
+{
+	uint8_t ip_a[4] = { 10, 0, 0, 1 };
+	uint8_t ip_b[4] = { 10, 0, 0, 2 };
+	const uint8_t them_hw[6] = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66 };
+	const uint8_t them_ip[4] = { 10, 0, 0, 3 };
+
+	sip_ctx_use(&ctx_a);
+	set_ipv4_addr(ip_a);
+	CHECK_EQUAL(SUCCESS, add_arp_entry(them_ip, them_hw, 100, true));
+
+	sip_ctx_use(&ctx_b);
+	set_ipv4_addr(ip_b);
+
+	// B has its own address and an empty ARP table
+	BYTES_EQUAL(2, get_ipv4_addr()[3]);
+	CHECK(!ctx_b.arp.table[0].valid);
+	CHECK(ctx_b.timer.store[0].status == TIMER_EMPTY);
+
+	// A is as we left it
+	sip_ctx_use(&ctx_a);
+	BYTES_EQUAL(1, get_ipv4_addr()[3]);
+	CHECK(ctx_a.arp.table[0].valid);
+	CHECK(ctx_a.timer.store[0].status == TIMER_RUNNING);
+
+	remove_arp_entry(them_hw, them_ip);
+	CHECK(!ctx_a.arp.table[0].valid);
+
+	// And the default never saw any of it
+	sip_ctx_use(NULL);
+	CHECK(get_ipv4_addr()[3] != 1);
+	CHECK(get_ipv4_addr()[3] != 2);
+}
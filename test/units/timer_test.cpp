@@ -24,7 +24,7 @@ TEST_GROUP(timer)
 		static bool bRunOnce = false;
 		if(!bRunOnce)
 		{	
-			timer_store[0].status = TIMER_RUNNING;
+			SIP->timer.store[0].status = TIMER_RUNNING;
 		}
 
 		//Should always be SUCCESS.
@@ -35,7 +35,7 @@ TEST_GROUP(timer)
 		if(!bRunOnce)
 		{
 			// Check it initialised to INVALID
-			CHECK_EQUAL(TIMER_EMPTY, timer_store[0].status);
+			CHECK_EQUAL(TIMER_EMPTY, SIP->timer.store[0].status);
 			bRunOnce = true;
 		}
 
@@ -44,11 +44,11 @@ TEST_GROUP(timer)
 	void teardown()
 	{
 		// Last test cleaned up ok
-		CHECK_EQUAL(TIMER_EMPTY, timer_store[0].status);
-		CHECK_EQUAL(TIMER_EMPTY, timer_store[1].status);
-		CHECK_EQUAL(TIMER_EMPTY, timer_store[2].status);
-		CHECK_EQUAL(TIMER_EMPTY, timer_store[3].status);
-		CHECK_EQUAL(TIMER_EMPTY, timer_store[4].status);
+		CHECK_EQUAL(TIMER_EMPTY, SIP->timer.store[0].status);
+		CHECK_EQUAL(TIMER_EMPTY, SIP->timer.store[1].status);
+		CHECK_EQUAL(TIMER_EMPTY, SIP->timer.store[2].status);
+		CHECK_EQUAL(TIMER_EMPTY, SIP->timer.store[3].status);
+		CHECK_EQUAL(TIMER_EMPTY, SIP->timer.store[4].status);
 	}
 };
 
@@ -56,8 +56,8 @@ TEST(timer, add_timer)
 {
 	uint16_t id = add_timer(100, NULL);
 
-	CHECK_EQUAL(TIMER_RUNNING, timer_store[0].status);
-	CHECK_EQUAL(TIMER_EMPTY, timer_store[1].status);
+	CHECK_EQUAL(TIMER_RUNNING, SIP->timer.store[0].status);
+	CHECK_EQUAL(TIMER_EMPTY, SIP->timer.store[1].status);
 
 	kill_timer(id, false);
 }
@@ -69,8 +69,8 @@ TEST(timer, kill_timer)
 	kill_timer(id, false);
 	kill_timer(id, false);
 
-	CHECK_EQUAL(TIMER_EMPTY, timer_store[0].status);
-	CHECK_EQUAL(TIMER_EMPTY, timer_store[1].status);
+	CHECK_EQUAL(TIMER_EMPTY, SIP->timer.store[0].status);
+	CHECK_EQUAL(TIMER_EMPTY, SIP->timer.store[1].status);
 
 }
 
@@ -126,3 +126,45 @@ TEST(timer, kill_timer_cb)
 	CHECK_EQUAL(1, timer_test_cb_count);
 }
 
+
+TEST(timer, only_used_slots_scanned)
+{
+	uint16_t id1 = add_timer(5, NULL);
+	uint16_t id2 = add_timer(10, NULL);
+	CHECK_EQUAL(2, SIP->timer.top);
+
+	// Emptying the last slot lets the scan stop sooner
+	kill_timer(id2, false);
+	timer_tick_callback();
+	CHECK_EQUAL(1, SIP->timer.top);
+
+	int i = 0;
+	for(i = 0; i < 4; i++)
+	{
+		timer_tick_callback();
+	}
+	CHECK(!is_running(id1));
+	CHECK_EQUAL(0, SIP->timer.top);
+}
+
+static int timer_test_idle_count = 0;
+static void timer_test_idle(void)
+{
+	timer_test_idle_count++;
+	timer_tick_callback();
+}
+
+TEST(timer, idle_while_waiting)
+{
+	timer_test_idle_count = 0;
+	set_timer_idle(&timer_test_idle);
+
+	// Nothing else moves time on, so this only ends because of idle
+	uint16_t id = add_timer(10, NULL);
+	while(is_running(id))
+		;
+
+	CHECK_EQUAL(10, timer_test_idle_count);
+
+	set_timer_idle(NULL);
+}
@@ -0,0 +1,311 @@
+#include "udp_test.h"
+#include "CppUTest/TestHarness.h"
+
+// The file we are testing:
+extern "C"
+{
+#include "functions.h"
+#include "sip_ctx.h"
+#include "ethernet.h"
+#include "ip.h"
+#include "arp.h"
+#include "udp.c"
+}
+
+extern "C" bool driverCaptureIPv4;
+extern "C" uint8_t driverCaptured[][ETH_HEADERLEN + ETH_MAXDATA + ETH_CRCLEN];
+extern "C" uint16_t driverCapturedLen[];
+extern "C" uint8_t driverCapturedCount;
+
+extern "C" uint8_t *driverSegmentedFrame;
+extern "C" uint16_t driverSegmentedLen;
+extern "C" uint16_t driverSegmentLen;
+
+static struct sip_ctx udp_ctx;
+
+static uint8_t udp_local[4] = { 192, 168, 0, 2 };
+static const uint8_t udp_remote[4] = { 192, 168, 0, 9 };
+static const uint8_t udp_remote_hw[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x09 };
+
+static uint8_t udp_data[UDP_SEG_MAX_PACKET];
+
+/** Check one captured frame is a good datagram holding data[offset..offset+len) **/
+static void udp_test_datagram(const uint8_t *frame, const uint16_t frame_len, const uint16_t offset, const uint16_t len)
+{
+	CHECK(frame_len >= ETH_HEADERLEN + IP_HEADERLEN + UDP_HEADER_LEN + len);
+	CHECK(sr_memcmp(frame, udp_remote_hw, 6));
+	CHECK_EQUAL(IPv4, load_be16(&frame[ETH_PROTOCOL]));
+
+	const uint8_t *ip = &frame[ETH_HEADERLEN];
+	CHECK_EQUAL(IP_HEADERLEN + UDP_HEADER_LEN + len, load_be16(&ip[2]));
+	CHECK_EQUAL(IP_UDP, ip[9]);
+	CHECK(sr_memcmp(&ip[16], udp_remote, 4));
+
+	const uint8_t *udp = &ip[IP_HEADERLEN];
+	CHECK_EQUAL(4000, load_be16(&udp[0]));
+	CHECK_EQUAL(4000, load_be16(&udp[2]));
+	CHECK_EQUAL(UDP_HEADER_LEN + len, load_be16(&udp[4]));
+	CHECK(sr_memcmp(&udp[UDP_HEADER_LEN], &udp_data[offset], len));
+
+	uint8_t copy[UDP_MAX_PACKET];
+	sr_memcpy(copy, udp, UDP_HEADER_LEN + len);
+	store_be16(&copy[UDP_CHECKSUM], 0);
+
+	uint8_t pseudo[12] = { ip[12], ip[13], ip[14], ip[15], ip[16], ip[17], ip[18], ip[19], 0, IP_UDP, udp[4], udp[5] };
+	CHECK_EQUAL(checksum_fragmented(pseudo, sizeof(pseudo), copy, UDP_HEADER_LEN + len, sizeof(pseudo) + UDP_CHECKSUM),
+				load_be16(&udp[UDP_CHECKSUM]));
+}
+
+TEST_GROUP(udp)
+{
+	void setup()
+	{
+		sip_ctx_init(&udp_ctx);
+		sip_ctx_use(&udp_ctx);
+
+		init_ethernet();
+		init_ip();
+		set_ipv4_addr(udp_local);
+		init_arp();
+		init_udp();
+		CHECK_EQUAL(SUCCESS, add_arp_entry(udp_remote, udp_remote_hw, 0, true));
+
+		uint32_t i = 0;
+		for(i = 0; i < sizeof(udp_data); i++)
+		{
+			udp_data[i] = (uint8_t)(i * 13 + (i >> 8));
+		}
+
+		driverCaptureIPv4 = true;
+		driverCapturedCount = 0;
+	}
+
+	void teardown()
+	{
+		driverCaptureIPv4 = false;
+		sip_ctx_use(NULL);
+	}
+};
+
+TEST(udp, segmented_fallback)
+{
+	// No MAC segmentation, so one send_udp per segment
+	CHECK(!(get_ether_offload() & MAC_OFFLOAD_UDP_SEG));
+	CHECK_EQUAL(SUCCESS, send_udp_segmented(udp_remote, 4000, udp_data, 500, 200));
+
+	CHECK_EQUAL(3, driverCapturedCount);
+	udp_test_datagram(driverCaptured[0], driverCapturedLen[0], 0, 200);
+	udp_test_datagram(driverCaptured[1], driverCapturedLen[1], 200, 200);
+	udp_test_datagram(driverCaptured[2], driverCapturedLen[2], 400, 100);
+
+	// Exactly one segment's worth
+	driverCapturedCount = 0;
+	CHECK_EQUAL(SUCCESS, send_udp_segmented(udp_remote, 4000, udp_data, 200, 200));
+	CHECK_EQUAL(1, driverCapturedCount);
+	udp_test_datagram(driverCaptured[0], driverCapturedLen[0], 0, 200);
+
+	driverCapturedCount = 0;
+	CHECK_EQUAL(FAILURE, send_udp_segmented(udp_remote, 4000, udp_data, 500, 0));
+	CHECK_EQUAL(0, driverCapturedCount);
+}
+
+TEST(udp, segmented_offload)
+{
+	SIP->ether.offload |= MAC_OFFLOAD_UDP_SEG | MAC_OFFLOAD_TX_CSUM;
+
+	CHECK_EQUAL(SUCCESS, send_udp_segmented(udp_remote, 4000, udp_data, 3000, 1000));
+	CHECK_EQUAL(0, driverCapturedCount);
+
+	// One frame with one set of headers for the lot
+	CHECK(driverSegmentedFrame != NULL);
+	CHECK_EQUAL(1000, driverSegmentLen);
+	CHECK_EQUAL(ETH_HEADERLEN + IP_HEADERLEN + UDP_HEADER_LEN + 3000, driverSegmentedLen);
+	CHECK(sr_memcmp(driverSegmentedFrame, udp_remote_hw, 6));
+
+	const uint8_t *ip = &driverSegmentedFrame[ETH_HEADERLEN];
+	CHECK_EQUAL(IP_HEADERLEN + UDP_HEADER_LEN + 3000, load_be16(&ip[2]));
+
+	const uint8_t *udp = &ip[IP_HEADERLEN];
+	CHECK_EQUAL(UDP_HEADER_LEN + 3000, load_be16(&udp[4]));
+	CHECK(sr_memcmp(&udp[UDP_HEADER_LEN], udp_data, 3000));
+
+	// Seeded with the pseudo-header only, for the MAC to finish
+	uint8_t pseudo[12] = { ip[12], ip[13], ip[14], ip[15], ip[16], ip[17], ip[18], ip[19], 0, IP_UDP, udp[4], udp[5] };
+	CHECK_EQUAL((uint16_t)~checksum(pseudo, sizeof(pseudo), sizeof(pseudo)), load_be16(&udp[UDP_CHECKSUM]));
+}
+
+TEST(udp, segmented_too_big)
+{
+	SIP->ether.offload |= MAC_OFFLOAD_UDP_SEG | MAC_OFFLOAD_TX_CSUM;
+	driverSegmentLen = 0;
+
+	const uint16_t too_big = UDP_SEG_MAX_PACKET - IP_HEADERLEN - UDP_HEADER_LEN + 1;
+	CHECK_EQUAL(FAILURE, send_udp_segmented(udp_remote, 4000, udp_data, too_big, 1000));
+	CHECK_EQUAL(SUCCESS, send_udp_segmented(udp_remote, 4000, udp_data, too_big - 1, 1000));
+	CHECK_EQUAL(1000, driverSegmentLen);
+
+	// And the layers below refuse it too
+	CHECK_EQUAL(FAILURE, send_ip4_datagram_segmented(udp_remote, udp_data, UDP_SEG_MAX_PACKET - IP_HEADERLEN + 1, IP_UDP, 1000));
+	CHECK_EQUAL(FAILURE, send_ether_packet_segmented(udp_remote_hw, udp_data, UDP_SEG_MAX_PACKET + 1, IPv4, 1000));
+
+	// Without the offload, the MAC isn't asked
+	SIP->ether.offload &= ~MAC_OFFLOAD_UDP_SEG;
+	CHECK_EQUAL(FAILURE, send_ether_packet_segmented(udp_remote_hw, udp_data, 100, IPv4, 1000));
+}
+
+/** One frame from send_udp and one from udp_flow_send, same payload **/
+static void udp_test_flow_matches(struct udp_flow *flow, const uint16_t len)
+{
+	driverCapturedCount = 0;
+	CHECK_EQUAL(SUCCESS, send_udp(udp_remote, 4000, udp_data, len));
+	CHECK_EQUAL(SUCCESS, udp_flow_send(flow, udp_data, len));
+	CHECK_EQUAL(2, driverCapturedCount);
+
+	// Byte for byte, checksums and all
+	CHECK_EQUAL(driverCapturedLen[0], driverCapturedLen[1]);
+	CHECK(sr_memcmp(driverCaptured[0], driverCaptured[1], driverCapturedLen[0]));
+	udp_test_datagram(driverCaptured[1], driverCapturedLen[1], 0, len);
+}
+
+TEST(udp, flow_matches_send_udp)
+{
+	struct udp_flow flow;
+	CHECK_EQUAL(SUCCESS, udp_flow_connect(&flow, udp_remote, 4000));
+
+	// Empty, odd and even lengths
+	const uint16_t lens[] = { 0, 1, 13, 200, UDP_MAX_PACKET - UDP_HEADER_LEN };
+	uint8_t i = 0;
+	for(i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+	{
+		udp_test_flow_matches(&flow, lens[i]);
+	}
+
+	// Left for the MAC to finish, the same way
+	SIP->ether.offload |= MAC_OFFLOAD_TX_CSUM;
+	driverCapturedCount = 0;
+	CHECK_EQUAL(SUCCESS, send_udp(udp_remote, 4000, udp_data, 13));
+	CHECK_EQUAL(SUCCESS, udp_flow_send(&flow, udp_data, 13));
+	CHECK_EQUAL(2, driverCapturedCount);
+	CHECK_EQUAL(driverCapturedLen[0], driverCapturedLen[1]);
+	CHECK(sr_memcmp(driverCaptured[0], driverCaptured[1], driverCapturedLen[0]));
+}
+
+TEST(udp, flow_rebuilt_on_arp_change)
+{
+	struct udp_flow flow;
+	CHECK_EQUAL(SUCCESS, udp_flow_connect(&flow, udp_remote, 4000));
+	udp_test_flow_matches(&flow, 50);
+
+	// A refresh with the same address keeps the cached header
+	const uint32_t generation = get_arp_generation();
+	CHECK_EQUAL(SUCCESS, add_arp_entry(udp_remote, udp_remote_hw, 0, true));
+	CHECK_EQUAL(generation, get_arp_generation());
+
+	// The remote moves to another MAC address
+	const uint8_t moved_hw[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x19 };
+	CHECK_EQUAL(SUCCESS, add_arp_entry(udp_remote, moved_hw, 0, true));
+	CHECK(get_arp_generation() != generation);
+	CHECK(sr_memcmp(flow.header, udp_remote_hw, 6));
+
+	driverCapturedCount = 0;
+	CHECK_EQUAL(SUCCESS, udp_flow_send(&flow, udp_data, 50));
+	CHECK_EQUAL(SUCCESS, send_udp(udp_remote, 4000, udp_data, 50));
+	CHECK_EQUAL(2, driverCapturedCount);
+
+	CHECK(sr_memcmp(driverCaptured[0], moved_hw, 6));
+	CHECK(sr_memcmp(flow.header, moved_hw, 6));
+	CHECK_EQUAL(get_arp_generation(), flow.generation);
+	CHECK_EQUAL(driverCapturedLen[1], driverCapturedLen[0]);
+	CHECK(sr_memcmp(driverCaptured[1], driverCaptured[0], driverCapturedLen[0]));
+}
+
+/** What a listen_udp handler was given **/
+static uint16_t udp_rx_calls = 0;
+static uint16_t udp_rx_len = 0;
+static uint8_t udp_rx_data[UDP_MAX_PACKET];
+
+static void udp_test_handler(const uint8_t *buffer, const uint16_t buffer_len)
+{
+	udp_rx_calls++;
+	udp_rx_len = buffer_len;
+	sr_memcpy(udp_rx_data, buffer, buffer_len);
+}
+
+/** From the remote to us on port 4000, FCS space and all, as a MAC hands it up **/
+static uint16_t udp_test_rx_frame(uint8_t *frame, const uint16_t len)
+{
+	sr_memcpy(frame, get_ether_addr(), 6);
+	sr_memcpy(&frame[6], udp_remote_hw, 6);
+	store_be16(&frame[ETH_PROTOCOL], IPv4);
+
+	uint8_t *ip = &frame[ETH_HEADERLEN];
+	sr_memset(ip, 0, IP_HEADERLEN);
+	ip[0] = 0x45;
+	store_be16(&ip[2], IP_HEADERLEN + UDP_HEADER_LEN + len);
+	ip[8] = 64;
+	ip[9] = IP_UDP;
+	sr_memcpy(&ip[12], udp_remote, 4);
+	sr_memcpy(&ip[16], udp_local, 4);
+	store_be16(&ip[10], checksum(ip, IP_HEADERLEN, 10));
+
+	uint8_t *udp = &ip[IP_HEADERLEN];
+	store_be16(&udp[0], 4000);
+	store_be16(&udp[2], 4000);
+	store_be16(&udp[4], UDP_HEADER_LEN + len);
+	store_be16(&udp[UDP_CHECKSUM], 0);
+	sr_memcpy(&udp[UDP_HEADER_LEN], udp_data, len);
+
+	uint8_t pseudo[12] = { ip[12], ip[13], ip[14], ip[15], ip[16], ip[17], ip[18], ip[19], 0, IP_UDP, udp[4], udp[5] };
+	store_be16(&udp[UDP_CHECKSUM], checksum_fragmented(pseudo, sizeof(pseudo), udp, UDP_HEADER_LEN + len,
+														sizeof(pseudo) + UDP_CHECKSUM));
+
+	uint16_t frame_len = ETH_HEADERLEN + IP_HEADERLEN + UDP_HEADER_LEN + len;
+	if(frame_len < ETH_MINDATA)
+	{
+		sr_memset(&frame[frame_len], 0, ETH_MINDATA - frame_len);
+		frame_len = ETH_MINDATA;
+	}
+
+	return frame_len + ETH_CRCLEN;
+}
+
+// Through the early demux table, or udp_arrival_callback without
+// ETH_EARLY_DEMUX (udp_nodemux_test.out)
+TEST(udp, arrival)
+{
+	CHECK_EQUAL(SUCCESS, listen_udp(4000, &udp_test_handler));
+	udp_rx_calls = 0;
+
+	uint8_t frame[ETH_HEADERLEN + ETH_MAXDATA + ETH_CRCLEN];
+	uint16_t frame_len = udp_test_rx_frame(frame, 101);
+	ether_frame_available(frame, frame_len);
+
+	CHECK_EQUAL(1, udp_rx_calls);
+	CHECK_EQUAL(101, udp_rx_len);
+	CHECK(sr_memcmp(udp_rx_data, udp_data, 101));
+
+	// Bad checksum
+	frame_len = udp_test_rx_frame(frame, 10);
+	frame[ETH_HEADERLEN + IP_HEADERLEN + UDP_HEADER_LEN] ^= 0x01;
+	ether_frame_available(frame, frame_len);
+	CHECK_EQUAL(1, udp_rx_calls);
+
+	// Nobody on the port
+	CHECK_EQUAL(SUCCESS, close_udp(4000));
+	frame_len = udp_test_rx_frame(frame, 10);
+	ether_frame_available(frame, frame_len);
+	CHECK_EQUAL(1, udp_rx_calls);
+
+	// Straight to the callback, as IP hands it over
+	CHECK_EQUAL(SUCCESS, listen_udp(4000, &udp_test_handler));
+	frame_len = udp_test_rx_frame(frame, 20);
+	udp_arrival_callback(udp_remote, &frame[ETH_HEADERLEN + IP_HEADERLEN], UDP_HEADER_LEN + 20);
+	CHECK_EQUAL(2, udp_rx_calls);
+	CHECK_EQUAL(20, udp_rx_len);
+
+	frame[ETH_HEADERLEN + IP_HEADERLEN + UDP_CHECKSUM] ^= 0x01;
+	udp_arrival_callback(udp_remote, &frame[ETH_HEADERLEN + IP_HEADERLEN], UDP_HEADER_LEN + 20);
+	CHECK_EQUAL(2, udp_rx_calls);
+
+	close_udp(4000);
+}